@@ -4,6 +4,7 @@
  * Copyright (C) 2023, Charles Chiou
  */
 
+#include <errno.h>
 #include <sys/time.h>
 #include <bsd/sys/time.h>
 #include <pigpio.h>
@@ -16,14 +17,67 @@
  */
 #define ADC_I2C_BUS    1
 #define ADC_I2C_ADDR   0x48
+#define ADC_RDY_GPIO   22
+
+/*
+ * The data rate is the lowest that covers the sum of the channel rates by
+ * ADC_SPS_MARGIN, which leaves room for the conversions lost to aligning
+ * with the schedule. Without RDY, a conversion is read after
+ * ADC_POLL_PERIODS conversion times, allowing for the +/-10% oscillator.
+ */
+#define ADC_DEFAULT_HZ     10
+#define ADC_MAX_HZ        860
+#define ADC_SPS_MARGIN    1.5
+#define ADC_POLL_PERIODS  1.5
+#define ADC_IDLE_MS       100
+
+static const struct {
+    unsigned int sps;
+    uint16_t dr;
+} data_rates[] = {
+    {   8, DR_8_SPS,   },
+    {  16, DR_16_SPS,  },
+    {  32, DR_32_SPS,  },
+    {  64, DR_64_SPS,  },
+    { 128, DR_128_SPS, },
+    { 250, DR_250_SPS, },
+    { 475, DR_475_SPS, },
+    { 860, DR_860_SPS, },
+};
+
+static const uint16_t muxes[ADC_CHANNELS] = {
+    MUX_AIN0_GND,
+    MUX_AIN1_GND,
+    MUX_AIN2_GND,
+    MUX_AIN3_GND,
+};
 
 static unsigned int instance = 0;
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t) ts.tv_sec * 1000000ULL) + (ts.tv_nsec / 1000);
+}
+
 ADC::ADC()
     : _handle(-1),
       _config(0),
+      _dr(DR_860_SPS),
+      _sps(860),
+      _mux(-1),
+      _reschedule(true),
+      _rdy(0),
+      _rdySeen(0),
+      _selectTick(0),
+      _rdyPaced(false),
       _running(false)
 {
     unsigned int i;
+    char name[SAMPLE_NAME_SIZE];
 
     if (instance != 0) {
         fprintf(stderr, "ADC can be instantiated only once!\n");
@@ -32,23 +86,33 @@ ADC::ADC()
         instance++;
     }
 
+    /* ALERT/RDY pulses low at the end of each conversion */
     _config =
-        MUX_AIN0_GND |
         PGA_FSR_6_144V |
-        MODE_SING |
-        DR_860_SPS |
+        MODE_CONT |
         COMP_MODE_TRAD |
         COMP_POL_LO |
         COMP_LAT_NO |
-        COMP_QUE_DIS;
+        COMP_QUE_ONE;
 
     for (i = 0; i < ADC_CHANNELS; i++) {
-        _hist[i] = new MedianFilter<float>(50);
+        snprintf(name, sizeof(name) - 1, "adc/%u", i);
+        _topic[i] = new SampleTopic<float>(name);
+        _chan[i].hz = ADC_DEFAULT_HZ;
+        _chan[i].due_us = 0;
+        _chan[i].head = 0;
+        _chan[i].count = 0;
+        _chan[i].samples = 0;
     }
 
     _running = true;
     pthread_mutex_init(&_mutex, NULL);
     pthread_cond_init(&_cond, NULL);
+
+    gpioSetMode(ADC_RDY_GPIO, PI_INPUT);
+    gpioSetPullUpDown(ADC_RDY_GPIO, PI_PUD_UP);
+    gpioSetAlertFuncEx(ADC_RDY_GPIO, ADC::rdy_alert, this);
+
     pthread_create(&_thread, NULL, ADC::thread_func, this);
     pthread_setname_np(_thread, "R'ADC");
 
@@ -59,6 +123,8 @@ ADC::~ADC()
 {
     unsigned int i;
 
+    gpioSetAlertFuncEx(ADC_RDY_GPIO, NULL, NULL);
+
     _running = false;
     pthread_cond_broadcast(&_cond);
     pthread_join(_thread, NULL);
@@ -66,13 +132,13 @@ ADC::~ADC()
     pthread_cond_destroy(&_cond);
 
     if (_handle >= 0) {
+        writeReg(CONFIG_REG, _config | MODE_SING);
         i2cClose(_handle);
         _handle = -1;
     }
 
     for (i = 0; i < ADC_CHANNELS; i++) {
-        delete _hist[i];
-        _hist[i] = NULL;
+        delete _topic[i];
     }
 
     instance--;
@@ -94,9 +160,11 @@ void ADC::probeOpenDevice(void)
             return;
         }
 
-        writeReg(CONFIG_REG, _config);
-        writeReg(LO_THRESH_REG, 0x8000);
-        writeReg(HI_THRESH_REG, 0x7fff);
+        /* Hi_thresh MSB set and Lo_thresh MSB clear turn ALERT into RDY */
+        writeReg(LO_THRESH_REG, 0x0000);
+        writeReg(HI_THRESH_REG, 0x8000);
+        _mux = -1;
+        _reschedule = true;
     }
 }
 
@@ -151,89 +219,192 @@ void *ADC::thread_func(void *args)
     return NULL;
 }
 
+/*
+ * Runs on the pigpio thread: only counts the pulse and wakes up run().
+ * Pulses older than the last mux switch belong to the previous channel.
+ */
+void ADC::rdy_alert(int gpio, int level, uint32_t tick, void *arg)
+{
+    ADC *adc = (ADC *) arg;
+
+    (void)(gpio);
+
+    if ((level != 0) || ((int32_t) (tick - adc->_selectTick) < 0)) {
+        return;
+    }
+
+    pthread_mutex_lock(&adc->_mutex);
+    adc->_rdy++;
+    pthread_cond_broadcast(&adc->_cond);
+    pthread_mutex_unlock(&adc->_mutex);
+}
+
+/*
+ * Pick the data rate for the requested channel rates and start converting
+ * the first channel due.
+ */
+void ADC::schedule(void)
+{
+    unsigned int i, total = 0;
+    uint64_t now;
+
+    pthread_mutex_lock(&_mutex);
+    _reschedule = false;
+    now = now_us();
+    for (i = 0; i < ADC_CHANNELS; i++) {
+        total += _chan[i].hz;
+        _chan[i].due_us = now;
+    }
+    pthread_mutex_unlock(&_mutex);
+
+    for (i = 0; i < (sizeof(data_rates) / sizeof(data_rates[0])) - 1; i++) {
+        if (data_rates[i].sps >= total * ADC_SPS_MARGIN) {
+            break;
+        }
+    }
+    _dr = data_rates[i].dr;
+    _sps = data_rates[i].sps;
+    _mux = -1;
+
+    if (total == 0) {
+        writeReg(CONFIG_REG, _config | MODE_SING);
+        return;
+    }
+
+    select(nextChannel());
+}
+
+/*
+ * Switching the mux restarts the conversion in progress.
+ */
+bool ADC::select(unsigned int chan)
+{
+    if (writeReg(CONFIG_REG, _config | _dr | muxes[chan]) != 0) {
+        return false;
+    }
+
+    pthread_mutex_lock(&_mutex);
+    _selectTick = gpioTick();
+    _rdySeen = _rdy;
+    pthread_mutex_unlock(&_mutex);
+    _mux = (int) chan;
+
+    return true;
+}
+
+/*
+ * The sampled channel due the earliest.
+ */
+unsigned int ADC::nextChannel(void) const
+{
+    unsigned int i, next = ADC_CHANNELS;
+
+    for (i = 0; i < ADC_CHANNELS; i++) {
+        if (_chan[i].hz == 0) {
+            continue;
+        }
+
+        if ((next == ADC_CHANNELS) || (_chan[i].due_us < _chan[next].due_us)) {
+            next = i;
+        }
+    }
+
+    return next;
+}
+
 void ADC::run(void)
 {
     struct timespec ts, tloop;
-
-    tloop.tv_sec = 0;
-    tloop.tv_nsec = 100000000;
+    uint64_t now, period_ns;
+    unsigned int next;
+    bool rdy;
 
     while (_running) {
-        clock_gettime(CLOCK_REALTIME, &ts);
-        timespecadd(&ts, &tloop, &ts);
-
         if (_handle == -1) {
             probeOpenDevice();
-        } else {
-            convert(0);
-            convert(1);
-            convert(2);
-            convert(3);
         }
 
+        if ((_handle != -1) && _reschedule) {
+            schedule();
+        }
+
+        /* Idle while offline or with nothing to sample */
+        if ((_handle == -1) || (_mux == -1)) {
+            tloop.tv_sec = 0;
+            tloop.tv_nsec = ADC_IDLE_MS * 1000000;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            timespecadd(&ts, &tloop, &ts);
+            pthread_mutex_lock(&_mutex);
+            if (_running && !_reschedule) {
+                pthread_cond_timedwait(&_cond, &_mutex, &ts);
+            }
+            pthread_mutex_unlock(&_mutex);
+            continue;
+        }
+
+        /* Wait for RDY, or for the conversion time without it */
+        period_ns = (uint64_t) (1000000000.0 * ADC_POLL_PERIODS / _sps);
+        tloop.tv_sec = period_ns / 1000000000;
+        tloop.tv_nsec = period_ns % 1000000000;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        timespecadd(&ts, &tloop, &ts);
+
         pthread_mutex_lock(&_mutex);
-        pthread_cond_timedwait(&_cond, &_mutex, &ts);
+        while (_running && !_reschedule && (_rdy == _rdySeen)) {
+            if (pthread_cond_timedwait(&_cond, &_mutex, &ts) == ETIMEDOUT) {
+                break;
+            }
+        }
+        rdy = (_rdy != _rdySeen);
+        _rdySeen = _rdy;
         pthread_mutex_unlock(&_mutex);
+
+        if (!_running || _reschedule) {
+            continue;
+        }
+
+        _rdyPaced = rdy;
+        now = now_us();
+        convert((unsigned int) _mux, now);
+
+        if (_handle == -1) {
+            continue;
+        }
+
+        next = nextChannel();
+        if ((next < ADC_CHANNELS) && ((int) next != _mux)) {
+            select(next);
+        }
     }
 }
 
-void ADC::convert(unsigned int chan)
+/*
+ * Read the conversion of a channel, kept only if the channel is due.
+ */
+void ADC::convert(unsigned int chan, uint64_t us)
 {
     float v = 0.0;
     int ret;
-    uint16_t config;
     int16_t conv;
-    struct timespec now, interval, next;
+    struct adc_channel *c = &_chan[chan];
+    uint64_t period_us;
 
-    if (_handle < 0) {
+    if ((_handle < 0) || (chan >= ADC_CHANNELS)) {
         return;
     }
 
-    config = _config & ~0x7000;
-    config |= OS;
-    switch (chan) {
-    case 0: config |= MUX_AIN0_GND; break;
-    case 1: config |= MUX_AIN1_GND; break;
-    case 2: config |= MUX_AIN2_GND; break;
-    case 3: config |= MUX_AIN3_GND; break;
-    default:
-        return;
-    }
-
-    /* Setup CONFIG register to perform a single shot sampling */
-    ret = writeReg(CONFIG_REG, config);
+    ret = readReg(CONVERSION_REG, (uint16_t *) &conv);
     if (ret != 0) {
         return;
     }
 
-    /* Conversion delay */
-    interval.tv_sec = 0;
-    switch (config & DR_860_SPS) {
-    case DR_8_SPS:   interval.tv_nsec = 125000000; break;
-    case DR_16_SPS:  interval.tv_nsec =  62500000; break;
-    case DR_32_SPS:  interval.tv_nsec =  31250000; break;
-    case DR_64_SPS:  interval.tv_nsec =  15625000; break;
-    case DR_128_SPS: interval.tv_nsec =   7812500; break;
-    case DR_250_SPS: interval.tv_nsec =   4000000; break;
-    case DR_475_SPS: interval.tv_nsec =   2105263; break;
-    case DR_860_SPS: interval.tv_nsec =   1162791; break;
-    default:         interval.tv_nsec = 125000000; break;
-    }
-    pthread_mutex_lock(&_mutex);
-    clock_gettime(CLOCK_REALTIME, &now);
-    timespecadd(&now, &interval, &next);
-    pthread_cond_timedwait(&_cond, &_mutex, &next);
-    pthread_mutex_unlock(&_mutex);
-
-    /* Read result */
-    ret = readReg(CONVERSION_REG, (uint16_t *) &conv);
-    if (ret != 0) {
+    if ((c->hz == 0) || (us + (500000 / _sps) < c->due_us)) {
         return;
     }
 
     /* Apply Multiplier */
     v = (float) ((int16_t) conv);
-    switch (config & (7 << 9)) {
+    switch (_config & (7 << 9)) {
     case PGA_FSR_6_144V:    v = v * 6.144 / 32768.0; break;
     case PGA_FSR_4_096V:    v = v * 4.096 / 32768.0; break;
     case PGA_FSR_2_048V:    v = v * 2.048 / 32768.0; break;
@@ -246,7 +417,24 @@ void ADC::convert(unsigned int chan)
 
     //printf("chan%u: %.3f\n", chan, v);
     v = v * 2.20;
-    _hist[chan]->addSample(v);
+    _filter[chan].addSample(v);
+    _topic[chan]->publish(v, us);
+
+    pthread_mutex_lock(&_mutex);
+    c->history[c->head].us = us;
+    c->history[c->head].v = v;
+    c->head = (c->head + 1) % ADC_HISTORY;
+    if (c->count < ADC_HISTORY) {
+        c->count++;
+    }
+    c->samples++;
+
+    period_us = 1000000 / c->hz;
+    c->due_us += period_us;
+    if (c->due_us < us) {
+        c->due_us = us;
+    }
+    pthread_mutex_unlock(&_mutex);
 }
 
 float ADC::v(unsigned int chan) const
@@ -255,7 +443,87 @@ float ADC::v(unsigned int chan) const
         return 0.0;
     }
 
-    return _hist[chan]->average();
+    return _filter[chan].filtered();
+}
+
+SampleTopic<float> *ADC::topic(unsigned int chan)
+{
+    if (chan >= ADC_CHANNELS) {
+        return NULL;
+    }
+
+    return _topic[chan];
+}
+
+float ADC::rawV(unsigned int chan) const
+{
+    if (chan >= ADC_CHANNELS) {
+        return 0.0;
+    }
+
+    return _filter[chan].raw();
+}
+
+/*
+ * Request a sample rate for a channel, 0 to stop sampling it.
+ */
+bool ADC::setRate(unsigned int chan, unsigned int hz)
+{
+    if ((chan >= ADC_CHANNELS) || (hz > ADC_MAX_HZ)) {
+        return false;
+    }
+
+    pthread_mutex_lock(&_mutex);
+    _chan[chan].hz = hz;
+    _reschedule = true;
+    pthread_cond_broadcast(&_cond);
+    pthread_mutex_unlock(&_mutex);
+
+    return true;
+}
+
+unsigned int ADC::rate(unsigned int chan) const
+{
+    if (chan >= ADC_CHANNELS) {
+        return 0;
+    }
+
+    return _chan[chan].hz;
+}
+
+/*
+ * Copy up to max of the latest samples of a channel, oldest first.
+ */
+unsigned int ADC::history(unsigned int chan, struct adc_sample *samples,
+                          unsigned int max)
+{
+    struct adc_channel *c;
+    unsigned int i, n, start;
+
+    if (chan >= ADC_CHANNELS) {
+        return 0;
+    }
+
+    c = &_chan[chan];
+
+    pthread_mutex_lock(&_mutex);
+    n = (c->count < max) ? c->count : max;
+    start = (c->head + ADC_HISTORY - n) % ADC_HISTORY;
+    for (i = 0; i < n; i++) {
+        samples[i] = c->history[(start + i) % ADC_HISTORY];
+    }
+    pthread_mutex_unlock(&_mutex);
+
+    return n;
+}
+
+unsigned long ADC::samples(unsigned int chan) const
+{
+    if (chan >= ADC_CHANNELS) {
+        return 0;
+    }
+
+    return _chan[chan].samples;
 }
 
 /*
@@ -7,10 +7,34 @@
 #ifndef ADC_HXX
 #define ADC_HXX
 
-#include "medianfilter.hxx"
+#include <stdint.h>
+#include "filterpipeline.hxx"
+#include "samplebus.hxx"
 
-#define ADC_CHANNELS 4
+#define ADC_CHANNELS   4
+#define ADC_HISTORY  512
+#define ADC_FILTER    50
 
+struct adc_sample {
+    uint64_t us;           // When the conversion was ready, CLOCK_MONOTONIC
+    float v;
+};
+
+struct adc_channel {
+    unsigned int hz;       // Requested sample rate, 0 if not sampled
+    uint64_t due_us;       // When the next sample is wanted
+    struct adc_sample history[ADC_HISTORY];
+    unsigned int head;     // Where the next sample goes
+    unsigned int count;
+    unsigned long samples;
+};
+
+/*
+ * ADS1115 in continuous mode. Channels take turns on the mux according to
+ * their sample rates, and the data rate is the lowest one that keeps up
+ * with all of them. Conversions are paced by the ALERT/RDY pin, or by the
+ * conversion time if it is not wired.
+ */
 class ADC {
 
 public:
@@ -20,6 +44,16 @@ public:
 
     bool isDeviceOnline(void) const;
     float v(unsigned int chan) const;
+    float rawV(unsigned int chan) const;
+
+    bool setRate(unsigned int chan, unsigned int hz);
+    unsigned int rate(unsigned int chan) const;
+    unsigned int history(unsigned int chan, struct adc_sample *samples,
+                         unsigned int max);
+    unsigned long samples(unsigned int chan) const;
+    unsigned int dataRate(void) const;
+    bool isRdyPaced(void) const;
+    SampleTopic<float> *topic(unsigned int chan);
 
 private:
 
@@ -28,17 +62,31 @@ private:
     int writeReg(uint8_t reg, uint16_t val);
 
     static void *thread_func(void *args);
+    static void rdy_alert(int gpio, int level, uint32_t tick, void *arg);
     void run(void);
-    void convert(unsigned int chan);
+    void schedule(void);
+    bool select(unsigned int chan);
+    void convert(unsigned int chan, uint64_t us);
+    unsigned int nextChannel(void) const;
 
     int _handle;
     uint16_t _config;
+    unsigned int _dr;
+    unsigned int _sps;
+    int _mux;
+    bool _reschedule;
+    unsigned int _rdy;
+    unsigned int _rdySeen;
+    uint32_t _selectTick;
+    bool _rdyPaced;
+    struct adc_channel _chan[ADC_CHANNELS];
+    SampleTopic<float> *_topic[ADC_CHANNELS];
 
     bool _running;
     pthread_t _thread;
     pthread_mutex_t _mutex;
     pthread_cond_t _cond;
-    MedianFilter<float> *_hist[ADC_CHANNELS];
+    FilterPipeline<float, 1, FilterMean<ADC_FILTER> > _filter[ADC_CHANNELS];
 
 };
 
@@ -47,6 +95,16 @@ inline bool ADC::isDeviceOnline(void) const
     return _handle != -1;
 }
 
+inline unsigned int ADC::dataRate(void) const
+{
+    return _sps;
+}
+
+inline bool ADC::isRdyPaced(void) const
+{
+    return _rdyPaced;
+}
+
 #endif
 
 /*
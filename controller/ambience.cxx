@@ -23,6 +23,13 @@
 #define BME280_I2C_BUS  1
 #define BME280_I2C_ADDR 0x76
 
+/*
+ * SoC temperature from sysfs, the thermal zone of the CPU if there is one.
+ */
+#define THERMAL_SYSFS   "/sys/class/thermal"
+#define THERMAL_CPU     "cpu-thermal"
+#define THERMAL_ZONES   16
+
 static unsigned int instance = 0;
 
 static int8_t user_i2c_read(uint8_t reg_addr, uint8_t *data,
@@ -85,11 +92,33 @@ static void user_delay_us(uint32_t period, void *intf_ptr)
     usleep(period);
 }
 
+static bool read_line(const char *path, char *buf, size_t size)
+{
+    FILE *fin;
+    bool ret = false;
+
+    fin = fopen(path, "r");
+    if (fin == NULL) {
+        return false;
+    }
+
+    if (fgets(buf, size, fin) != NULL) {
+        buf[strcspn(buf, "\n")] = '\0';
+        ret = true;
+    }
+
+    fclose(fin);
+
+    return ret;
+}
+
 Ambience::Ambience()
     : _dev(),
       _settings(),
       _bme280_delay_us(0),
       _bme280(-1),
+      _socTemp(0.0),
+      _topic("ambience"),
       _running(false)
 {
     if (instance != 0) {
@@ -99,6 +128,8 @@ Ambience::Ambience()
         instance++;
     }
 
+    findThermalZone();
+
     _running = true;
     pthread_mutex_init(&_mutex, NULL);
     pthread_cond_init(&_cond, NULL);
@@ -134,6 +165,39 @@ void *Ambience::thread_func(void *args)
     return NULL;
 }
 
+void Ambience::findThermalZone(void)
+{
+    char path[128];
+    char type[64];
+    unsigned int i;
+
+    snprintf(_thermalZone, sizeof(_thermalZone) - 1,
+             THERMAL_SYSFS "/thermal_zone0/temp");
+
+    for (i = 0; i < THERMAL_ZONES; i++) {
+        snprintf(path, sizeof(path) - 1,
+                 THERMAL_SYSFS "/thermal_zone%u/type", i);
+        if (!read_line(path, type, sizeof(type))) {
+            break;
+        }
+
+        if (strcmp(type, THERMAL_CPU) == 0) {
+            snprintf(_thermalZone, sizeof(_thermalZone) - 1,
+                     THERMAL_SYSFS "/thermal_zone%u/temp", i);
+            break;
+        }
+    }
+}
+
+void Ambience::readSocTemp(void)
+{
+    char buf[32];
+
+    if (read_line(_thermalZone, buf, sizeof(buf))) {
+        _socTemp = atoi(buf) / 1000.0;
+    }
+}
+
 void Ambience::probeOpenDevice(void)
 {
     int8_t rslt = BME280_OK;
@@ -207,10 +271,9 @@ bme280_done:
 void Ambience::run(void)
 {
     int8_t rslt;
-    char cmd[128];
-    char result[128];
-    FILE *fin;
     struct bme280_data data;
+    float sample[3];
+    struct ambience_sample bus;
     struct timespec ts, tbme, tloop;
 
     tbme.tv_sec = 0;
@@ -219,25 +282,7 @@ void Ambience::run(void)
     tloop.tv_nsec = 0;
 
     while (_running) {
-        /* Run vcgencmd to measure the SoC temperature */
-        snprintf(cmd, sizeof(cmd) - 1, "vcgencmd measure_temp");
-        fin = popen(cmd, "r");
-        if (fin != NULL) {
-            if (fgets(result, sizeof(result), fin) != NULL) {
-                size_t len;
-                len = strlen(result);
-                if (strncmp(result, "temp=", 5) == 0 &&
-                    len > 3 &&
-                    result[len - 2] == 'C' &&
-                    result[len - 3] == '\'') {
-                    result[len - 3] = '\0';
-                    _socTemp = atof(&result[5]);
-                }
-            }
-
-            pclose(fin);
-            fin = NULL;
-        }
+        readSocTemp();
 
         /* Probe and open device */
         if (_bme280 == -1) {
@@ -276,15 +321,16 @@ void Ambience::run(void)
             continue;
         }
 
-        _histTemp.addSample(data.temperature);
-        _temp = _histTemp.median();
-        _histPressure.addSample(data.pressure * 0.01);
-        _pressure = _histPressure.median();
-        _histHumidity.addSample(data.humidity);
-        _humidity = _histHumidity.median();
+        sample[0] = data.temperature;
+        sample[1] = data.pressure * 0.01;
+        sample[2] = data.humidity;
+        _filter.addSample(sample);
+        _temp = _filter.filtered(0);
+        _pressure = _filter.filtered(1);
+        _humidity = _filter.filtered(2);
 
         mosquitto->publish("rabbit/ambience/socTemp",
-                           sizeof(float), &_temp, 2, 0);
+                           sizeof(float), &_socTemp, 2, 0);
         mosquitto->publish("rabbit/ambience/temp",
                            sizeof(float), &_temp, 2, 0);
         mosquitto->publish("rabbit/ambience/pressure",
@@ -292,6 +338,12 @@ void Ambience::run(void)
         mosquitto->publish("rabbit/ambience/humidity",
                            sizeof(float), &_humidity, 2, 0);
 
+        bus.temp = _temp;
+        bus.pressure = _pressure;
+        bus.humidity = _humidity;
+        bus.socTemp = _socTemp;
+        _topic.publish(bus);
+
         clock_gettime(CLOCK_REALTIME, &ts);
         timespecadd(&ts, &tloop, &ts);
         pthread_mutex_lock(&_mutex);
@@ -8,7 +8,15 @@
 #define AMBIENCE_HXX
 
 #include "bme280.h"
-#include "medianfilter.hxx"
+#include "filterpipeline.hxx"
+#include "samplebus.hxx"
+
+struct ambience_sample {
+    float temp;            // C
+    float pressure;        // hPa
+    float humidity;        // %
+    float socTemp;         // C
+};
 
 class Ambience {
 
@@ -22,9 +30,15 @@ public:
     float temp(void) const;
     float pressure(void) const;
     float humidity(void) const;
+    float rawTemp(void) const;
+    float rawPressure(void) const;
+    float rawHumidity(void) const;
+    SampleTopic<struct ambience_sample> &topic(void);
 
 private:
 
+    void findThermalZone(void);
+    void readSocTemp(void);
     void probeOpenDevice(void);
     static void *thread_func(void *args);
     void run(void);
@@ -34,14 +48,15 @@ private:
     uint32_t _bme280_delay_us;
     int _bme280;
 
+    char _thermalZone[64];
     float _socTemp;
     float _temp;
     float _pressure;
     float _humidity;
 
-    MedianFilter<float> _histTemp;
-    MedianFilter<float> _histPressure;
-    MedianFilter<float> _histHumidity;
+    /* Temperature, pressure and humidity */
+    FilterPipeline<float, 3, FilterMedian<10> > _filter;
+    SampleTopic<struct ambience_sample> _topic;
 
     pthread_t _thread;
     pthread_mutex_t _mutex;
@@ -74,6 +89,26 @@ inline float Ambience::humidity(void) const
     return _humidity;
 }
 
+inline SampleTopic<struct ambience_sample> &Ambience::topic(void)
+{
+    return _topic;
+}
+
+inline float Ambience::rawTemp(void) const
+{
+    return _filter.raw(0);
+}
+
+inline float Ambience::rawPressure(void) const
+{
+    return _filter.raw(1);
+}
+
+inline float Ambience::rawHumidity(void) const
+{
+    return _filter.raw(2);
+}
+
 #endif
 
 /*
@@ -0,0 +1,443 @@
+/*
+ * armguard.cxx
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include "rabbit.hxx"
+
+/*
+ * Capsule model of the torso, head and both arms. All dimensions are in
+ * mm, in the body frame: x forward, y left, z up, origin at the base of
+ * the torso. The right arm is modeled and mirrored (y -> -y) for the left
+ * arm.
+ *
+ * Shoulder rotation swings the arm forward (+) or backward (-) from
+ * hanging straight down, shoulder extension raises it sideways (-90 is
+ * against the body), and elbow/wrist extension flex the forearm and hand
+ * forward (-90 elbow is straight). Wrist rotation and gripper opening are
+ * absorbed by the hand capsule radius.
+ */
+#define SHOULDER_Y        110.0
+#define SHOULDER_Z        300.0
+#define UPPER_ARM_LEN     100.0
+#define FOREARM_LEN       100.0
+#define HAND_LEN           80.0
+#define ARM_RADIUS         18.0
+#define HAND_RADIUS        20.0
+#define TORSO_Z0            0.0
+#define TORSO_Z1          280.0
+#define TORSO_RADIUS       60.0
+#define HEAD_Z0           390.0
+#define HEAD_Z1           440.0
+#define HEAD_RADIUS        55.0
+#define CLEARANCE_MM        5.0
+
+/*
+ * Joint speed limit, plans faster than this are re-timed.
+ */
+#define MAX_JOINT_DPS     360.0
+
+#define DEG2RAD(x)        ((x) * M_PI / 180.0)
+
+struct vec3 {
+    float x;
+    float y;
+    float z;
+};
+
+struct capsule {
+    struct vec3 a;
+    struct vec3 b;
+    float r;
+    const char *name;
+};
+
+enum {
+    UPPER_ARM = 0,
+    FOREARM = 1,
+    HAND = 2,
+};
+
+static const char *seg_names[2][3] = {
+    { "right upper arm", "right forearm", "right hand", },
+    { "left upper arm", "left forearm", "left hand", },
+};
+
+static const struct capsule torso = {
+    { 0.0, 0.0, TORSO_Z0, }, { 0.0, 0.0, TORSO_Z1, }, TORSO_RADIUS, "torso",
+};
+
+static const struct capsule headc = {
+    { 0.0, 0.0, HEAD_Z0, }, { 0.0, 0.0, HEAD_Z1, }, HEAD_RADIUS, "head",
+};
+
+/*
+ * Soft joint limits, { lo, hi } for sr, se, ee, we, wr, grip.
+ */
+static const float limits[6][2] = {
+    { -90.0, 90.0, },
+    { -90.0, 90.0, },
+    { -90.0, 90.0, },
+    { -90.0, 90.0, },
+    { -90.0, 90.0, },
+    {   0.0, 100.0, },
+};
+
+static const char *joint_names[6] = {
+    "shoulder rotation",
+    "shoulder extension",
+    "elbow extension",
+    "wrist extension",
+    "wrist rotation",
+    "gripper position",
+};
+
+static inline struct vec3 vadd(struct vec3 a, struct vec3 b)
+{
+    struct vec3 v = { a.x + b.x, a.y + b.y, a.z + b.z, };
+    return v;
+}
+
+static inline struct vec3 vsub(struct vec3 a, struct vec3 b)
+{
+    struct vec3 v = { a.x - b.x, a.y - b.y, a.z - b.z, };
+    return v;
+}
+
+static inline struct vec3 vscale(struct vec3 a, float s)
+{
+    struct vec3 v = { a.x * s, a.y * s, a.z * s, };
+    return v;
+}
+
+static inline float vdot(struct vec3 a, struct vec3 b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static inline float clampf(float v, float lo, float hi)
+{
+    return v < lo ? lo : (v > hi ? hi : v);
+}
+
+/*
+ * Closest distance between segments p1-q1 and p2-q2.
+ * Ericson, Real-Time Collision Detection, 5.1.9.
+ */
+static float segment_distance(struct vec3 p1, struct vec3 q1,
+                              struct vec3 p2, struct vec3 q2)
+{
+    struct vec3 d1 = vsub(q1, p1);
+    struct vec3 d2 = vsub(q2, p2);
+    struct vec3 r = vsub(p1, p2);
+    struct vec3 c1, c2;
+    float a = vdot(d1, d1);
+    float e = vdot(d2, d2);
+    float f = vdot(d2, r);
+    float s, t;
+
+    if (a <= 1e-6 && e <= 1e-6) {
+        s = t = 0.0;
+    } else if (a <= 1e-6) {
+        s = 0.0;
+        t = clampf(f / e, 0.0, 1.0);
+    } else {
+        float c = vdot(d1, r);
+
+        if (e <= 1e-6) {
+            t = 0.0;
+            s = clampf(-c / a, 0.0, 1.0);
+        } else {
+            float b = vdot(d1, d2);
+            float denom = a * e - b * b;
+
+            if (denom != 0.0) {
+                s = clampf((b * f - c * e) / denom, 0.0, 1.0);
+            } else {
+                s = 0.0;
+            }
+
+            t = (b * s + f) / e;
+            if (t < 0.0) {
+                t = 0.0;
+                s = clampf(-c / a, 0.0, 1.0);
+            } else if (t > 1.0) {
+                t = 1.0;
+                s = clampf((b - c) / a, 0.0, 1.0);
+            }
+        }
+    }
+
+    c1 = vadd(p1, vscale(d1, s));
+    c2 = vadd(p2, vscale(d2, t));
+    r = vsub(c1, c2);
+
+    return sqrtf(vdot(r, r));
+}
+
+/*
+ * Forward kinematics: pose -> upper arm, forearm and hand capsules.
+ */
+static void arm_capsules(unsigned int side, const struct arm_pose *pose,
+                         struct capsule *caps)
+{
+    float ab, sa, ca, sp, cp, f, g;
+    struct vec3 s, e, w, h, u, fw, v, hd;
+    float mirror = (side == RIGHT_ARM) ? 1.0 : -1.0;
+
+    ab = DEG2RAD(pose->se + 90.0);
+    sa = sinf(ab);
+    ca = cosf(ab);
+    sp = sinf(DEG2RAD(pose->sr));
+    cp = cosf(DEG2RAD(pose->sr));
+    f = DEG2RAD(pose->ee + 90.0);
+    g = DEG2RAD(pose->ee + 90.0 + pose->we);
+
+    /* Upper arm: hanging down, raised sideways, then swung forward */
+    u.x = ca * sp;
+    u.y = -sa;
+    u.z = -ca * cp;
+
+    /* Direction the elbow and wrist flex towards */
+    fw.x = cp;
+    fw.y = 0.0;
+    fw.z = sp;
+
+    v = vadd(vscale(u, cosf(f)), vscale(fw, sinf(f)));
+    hd = vadd(vscale(u, cosf(g)), vscale(fw, sinf(g)));
+
+    s.x = 0.0;
+    s.y = -SHOULDER_Y;
+    s.z = SHOULDER_Z;
+    e = vadd(s, vscale(u, UPPER_ARM_LEN));
+    w = vadd(e, vscale(v, FOREARM_LEN));
+    h = vadd(w, vscale(hd, HAND_LEN));
+
+    s.y *= mirror;
+    e.y *= mirror;
+    w.y *= mirror;
+    h.y *= mirror;
+
+    caps[UPPER_ARM].a = s;
+    caps[UPPER_ARM].b = e;
+    caps[UPPER_ARM].r = ARM_RADIUS;
+    caps[FOREARM].a = e;
+    caps[FOREARM].b = w;
+    caps[FOREARM].r = ARM_RADIUS;
+    caps[HAND].a = w;
+    caps[HAND].b = h;
+    caps[HAND].r = HAND_RADIUS;
+
+    caps[UPPER_ARM].name = seg_names[side][UPPER_ARM];
+    caps[FOREARM].name = seg_names[side][FOREARM];
+    caps[HAND].name = seg_names[side][HAND];
+}
+
+static bool capsules_clear(const struct capsule *c1, const struct capsule *c2,
+                           char *reason, size_t len)
+{
+    float d;
+
+    d = segment_distance(c1->a, c1->b, c2->a, c2->b);
+    d -= (c1->r + c2->r);
+    if (d < CLEARANCE_MM) {
+        if (reason) {
+            snprintf(reason, len, "%s hits %s (%.0fmm)",
+                     c1->name, c2->name, d);
+        }
+        return false;
+    }
+
+    return true;
+}
+
+bool armguard_check_limits(const struct arm_pose *pose,
+                           char *reason, size_t len)
+{
+    const float *joints = &pose->sr;
+    unsigned int i;
+
+    for (i = 0; i < 6; i++) {
+        if (isnan(joints[i]) ||
+            joints[i] < limits[i][0] || joints[i] > limits[i][1]) {
+            if (reason) {
+                snprintf(reason, len, "%s %.1f out of range",
+                         joint_names[i], joints[i]);
+            }
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool armguard_check_pose(const struct arm_pose *right,
+                         const struct arm_pose *left,
+                         char *reason, size_t len)
+{
+    struct capsule caps[2][3];
+    const struct arm_pose *poses[2] = { right, left, };
+    bool present[2];
+    unsigned int side, i, j;
+
+    for (side = 0; side < 2; side++) {
+        present[side] = (poses[side] != NULL && !isnan(poses[side]->sr));
+        if (present[side]) {
+            arm_capsules(side, poses[side], caps[side]);
+        }
+    }
+
+    /* Each arm against the body and itself */
+    for (side = 0; side < 2; side++) {
+        if (!present[side]) {
+            continue;
+        }
+
+        if (!capsules_clear(&caps[side][FOREARM], &torso, reason, len) ||
+            !capsules_clear(&caps[side][HAND], &torso, reason, len) ||
+            !capsules_clear(&caps[side][UPPER_ARM], &headc, reason, len) ||
+            !capsules_clear(&caps[side][FOREARM], &headc, reason, len) ||
+            !capsules_clear(&caps[side][HAND], &headc, reason, len) ||
+            !capsules_clear(&caps[side][HAND], &caps[side][UPPER_ARM],
+                            reason, len)) {
+            return false;
+        }
+    }
+
+    /* Arm against arm, the grippers are allowed to meet for transfers */
+    if (present[RIGHT_ARM] && present[LEFT_ARM]) {
+        for (i = 0; i < 3; i++) {
+            for (j = 0; j < 3; j++) {
+                if (i == HAND && j == HAND) {
+                    continue;
+                }
+
+                if (!capsules_clear(&caps[RIGHT_ARM][i], &caps[LEFT_ARM][j],
+                                    reason, len)) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+bool armguard_check_motion(unsigned int side,
+                           const struct arm_pose *from,
+                           const struct arm_pose *to,
+                           unsigned int startMs,
+                           unsigned int *ms,
+                           void (*otherAt)(unsigned int ms,
+                                           struct arm_pose *pose,
+                                           void *arg),
+                           void *arg,
+                           char *reason, size_t len)
+{
+    const float *j0 = &from->sr;
+    const float *j1 = &to->sr;
+    float delta, maxDelta = 0.0;
+    unsigned int minMs;
+    unsigned int steps, i, k;
+    struct arm_pose pose, other;
+    float *jp = &pose.sr;
+
+    if (!armguard_check_limits(to, reason, len)) {
+        return false;
+    }
+
+    /* Re-time motions that exceed the joint speed limit */
+    for (k = 0; k < 5; k++) {
+        delta = fabsf(j1[k] - j0[k]);
+        if (delta > maxDelta) {
+            maxDelta = delta;
+        }
+    }
+
+    minMs = (unsigned int) ceilf(maxDelta * 1000.0 / MAX_JOINT_DPS);
+    if (maxDelta > 1.0 && *ms < minMs) {
+        *ms = minMs;
+    }
+
+    /* Sample the interpolated motion at the servo schedule interval */
+    steps = *ms / SERVO_SCHEDULE_INTERVAL_MS;
+    if (steps == 0) {
+        steps = 1;
+    }
+
+    for (i = 1; i <= steps; i++) {
+        float t = (float) i / (float) steps;
+
+        for (k = 0; k < 6; k++) {
+            jp[k] = j0[k] + ((j1[k] - j0[k]) * t);
+        }
+
+        other.sr = NAN;
+        if (otherAt) {
+            otherAt(startMs + (unsigned int) (t * (*ms)), &other, arg);
+        }
+
+        if (side == RIGHT_ARM) {
+            if (!armguard_check_pose(&pose, &other, reason, len)) {
+                return false;
+            }
+        } else {
+            if (!armguard_check_pose(&other, &pose, reason, len)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool armguard_plan_motion(unsigned int side,
+                          const struct arm_pose *from,
+                          const struct arm_pose *to,
+                          unsigned int startMs,
+                          unsigned int otherMs,
+                          unsigned int *ms,
+                          unsigned int *holdMs,
+                          void (*otherAt)(unsigned int ms,
+                                          struct arm_pose *pose,
+                                          void *arg),
+                          void *arg,
+                          char *reason, size_t len)
+{
+    *holdMs = 0;
+
+    if (armguard_check_motion(side, from, to, startMs, ms,
+                              otherAt, arg, reason, len)) {
+        return true;
+    }
+
+    /*
+     * In the way of the other arm only while that arm is still moving,
+     * hold until the other arm's plan has finished.
+     */
+    if (otherMs <= startMs ||
+        !armguard_check_motion(side, from, to, otherMs, ms,
+                               otherAt, arg, NULL, 0)) {
+        return false;
+    }
+
+    *holdMs = otherMs - startMs;
+    if (*holdMs <= SERVO_SCHEDULE_INTERVAL_MS) {
+        *holdMs = SERVO_SCHEDULE_INTERVAL_MS * 2;
+    }
+
+    return true;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,86 @@
+/*
+ * armguard.hxx
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#ifndef ARMGUARD_HXX
+#define ARMGUARD_HXX
+
+#include <stddef.h>
+
+/*
+ * Joint angles of one arm, in the same units that Arm uses: degrees for
+ * the five joints, 0-100 for the gripper.
+ */
+struct arm_pose {
+    float sr;    // Shoulder rotation
+    float se;    // Shoulder extension
+    float ee;    // Elbow extension
+    float we;    // Wrist extension
+    float wr;    // Wrist rotation
+    float grip;  // Gripper position
+};
+
+/*
+ * Check a pose against the soft joint limits.
+ */
+extern bool armguard_check_limits(const struct arm_pose *pose,
+                                  char *reason, size_t len);
+
+/*
+ * Check the right and left arm poses against each other and against the
+ * body.
+ */
+extern bool armguard_check_pose(const struct arm_pose *right,
+                                const struct arm_pose *left,
+                                char *reason, size_t len);
+
+/*
+ * Check a planned motion of one arm (side) from 'from' to 'to' lasting
+ * *ms, starting startMs from now. The other arm's pose at any time
+ * (relative to now) is given by the callback. The duration is stretched
+ * in place if the motion exceeds the joint speed limit.
+ */
+extern bool armguard_check_motion(unsigned int side,
+                                  const struct arm_pose *from,
+                                  const struct arm_pose *to,
+                                  unsigned int startMs,
+                                  unsigned int *ms,
+                                  void (*otherAt)(unsigned int ms,
+                                                  struct arm_pose *pose,
+                                                  void *arg),
+                                  void *arg,
+                                  char *reason, size_t len);
+
+/*
+ * Plan a motion of one arm to follow its plan (startMs from now), as
+ * armguard_check_motion() does. A motion that is only in the way of the
+ * other arm while that arm is still moving (its plan ends otherMs from
+ * now) is accepted with *holdMs set to how long the arm has to hold still
+ * first, *holdMs is 0 otherwise. The reason is that of the first check.
+ */
+extern bool armguard_plan_motion(unsigned int side,
+                                 const struct arm_pose *from,
+                                 const struct arm_pose *to,
+                                 unsigned int startMs,
+                                 unsigned int otherMs,
+                                 unsigned int *ms,
+                                 unsigned int *holdMs,
+                                 void (*otherAt)(unsigned int ms,
+                                                 struct arm_pose *pose,
+                                                 void *arg),
+                                 void *arg,
+                                 char *reason, size_t len);
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -165,6 +165,80 @@ void Arm::setPulse(unsigned int index, unsigned int pulse, unsigned int ms)
     }
 }
 
+float Arm::degree(unsigned int index, unsigned int pulse) const
+{
+    float degree;
+
+    if (index == 5) {
+        return (float) ((int) pulse - (int) _loRange[index]) / _ppd[index];
+    }
+
+    if (_side == RIGHT_ARM) {
+        degree = (float) ((int) pulse - (int) _center[index]);
+    } else {
+        degree = (float) ((int) _center[index] - (int) pulse);
+    }
+
+    degree *= 180.0;
+    degree /= (float) _range[index];
+
+    return degree;
+}
+
+unsigned int Arm::plannedMs(void) const
+{
+    unsigned int i;
+    unsigned int servoId;
+    unsigned int ms;
+    unsigned int maxMs = 0;
+
+    for (i = 0; i < 6; i++) {
+        if (_side == RIGHT_ARM) {
+            servoId = i;
+        } else {
+            servoId = i + 6;
+        }
+
+        ms = servos->plannedMs(servoId);
+        if (ms > maxMs) {
+            maxMs = ms;
+        }
+    }
+
+    return maxMs;
+}
+
+void Arm::plannedPoseAt(unsigned int ms, struct arm_pose *pose) const
+{
+    unsigned int i;
+    unsigned int servoId;
+    float *joints = &pose->sr;
+
+    for (i = 0; i < 6; i++) {
+        if (_side == RIGHT_ARM) {
+            servoId = i;
+        } else {
+            servoId = i + 6;
+        }
+
+        joints[i] = degree(i, servos->plannedPulseAt(servoId, ms));
+    }
+}
+
+void Arm::otherArmAt(unsigned int ms, struct arm_pose *pose, void *arg)
+{
+    const Arm *arm = (const Arm *) arg;
+    const Arm *other;
+
+    other = (arm->_side == RIGHT_ARM) ? leftArm : rightArm;
+    if (other == NULL) {
+        pose->sr = NAN;
+        return;
+    }
+
+    other->plannedPoseAt(ms, pose);
+}
+
 void Arm::clearMotions(void)
 {
     unsigned int i;
@@ -659,13 +733,21 @@ bool Arm::isAtPosition(float shoulderRotateDeg, float shoulderExtensionDeg,
          isGripperPosition(gripperPositionPos));
 }
 
-void Arm::planMotions(float shoulderRotateDeg, float shoulderExtensionDeg,
+bool Arm::planMotions(float shoulderRotateDeg, float shoulderExtensionDeg,
                       float elbowExtensionDeg,
                       float wristExtensionDeg, float wristRotationDeg,
                       float gripperPositionPos,
                       unsigned int ms,
                       bool skipIfAtPoint)
 {
+    struct arm_pose from, to;
+    unsigned int startMs, otherMs, holdMs;
+    unsigned int requestedMs = ms;
+    const Arm *other;
+    char reason[80];
+    char buf[128];
+    unsigned int i;
+
     /* Normalize the NAN values */
     if (isnan(shoulderRotateDeg)) {
         shoulderRotateDeg = lastShoulderRotationInPlan();
@@ -692,10 +774,59 @@ void Arm::planMotions(float shoulderRotateDeg, float shoulderExtensionDeg,
                          elbowExtensionDeg,
                          wristExtensionDeg, wristRotationDeg,
                          (gripperPositionPos))) {
-            return;
+            return true;
         }
     }
 
+    /*
+     * Validate the motion against joint limits, the body and the other
+     * arm's plan. If it only collides with the other arm while that arm
+     * is still moving, hold until the other arm's plan has finished.
+     */
+    from.sr = lastShoulderRotationInPlan();
+    from.se = lastShoulderExtensionInPlan();
+    from.ee = lastElbowExtensionInPlan();
+    from.we = lastWristExtensionInPlan();
+    from.wr = lastWristRotationInPlan();
+    from.grip = lastGripperPositionInPlan();
+    to.sr = shoulderRotateDeg;
+    to.se = shoulderExtensionDeg;
+    to.ee = elbowExtensionDeg;
+    to.we = wristExtensionDeg;
+    to.wr = wristRotationDeg;
+    to.grip = gripperPositionPos;
+
+    startMs = plannedMs();
+    other = (_side == RIGHT_ARM) ? leftArm : rightArm;
+    otherMs = (other != NULL) ? other->plannedMs() : 0;
+    if (armguard_plan_motion(_side, &from, &to, startMs, otherMs, &ms,
+                             &holdMs, Arm::otherArmAt, this,
+                             reason, sizeof(reason)) == false) {
+        snprintf(buf, sizeof(buf) - 1,
+                 "%s arm plan rejected: %s\n",
+                 _side == RIGHT_ARM ? "Right" : "Left", reason);
+        LOG(buf);
+        return false;
+    }
+
+    if (holdMs > 0) {
+        for (i = 0; i < 6; i++) {
+            setPulse(i, lastPlannedPulse(i), holdMs);
+        }
+
+        snprintf(buf, sizeof(buf) - 1,
+                 "%s arm holds %ums: %s\n",
+                 _side == RIGHT_ARM ? "Right" : "Left", holdMs, reason);
+        LOG(buf);
+    }
+
+    if (ms != requestedMs) {
+        snprintf(buf, sizeof(buf) - 1,
+                 "%s arm plan re-timed from %ums to %ums\n",
+                 _side == RIGHT_ARM ? "Right" : "Left", requestedMs, ms);
+        LOG(buf);
+    }
+
     /* Schedule the motions */
 #if 0
     printf("plan %f %f %f %f %f %f\n",
@@ -710,6 +841,20 @@ void Arm::planMotions(float shoulderRotateDeg, float shoulderExtensionDeg,
     extendWrist(wristExtensionDeg, ms);
     rotateWrist(wristRotationDeg, ms);
     setGripperPosition(gripperPositionPos, ms);
+
+    return true;
+}
+
+void Arm::playGesture(const char *name)
+{
+    char gesture[64];
+
+    snprintf(gesture, sizeof(gesture) - 1, "%s-%s", name,
+             _side == RIGHT_ARM ? "right" : "left");
+
+    if (gestures) {
+        gestures->play(gesture);
+    }
 }
 
 void Arm::rest(void)
@@ -784,36 +929,13 @@ void Arm::surrender(void)
 
 void Arm::hug(void)
 {
-    clearMotions();
     if (isAtPosition(10.0, 85.0,
                      45.0,
                      0.0, 0.0,
                      NAN)) {
-        if (_side == RIGHT_ARM) {
-            speech->speak("Sweet! Hagooshka Hagooshka!");
-            LOG("Bend right arm inward\n");
-        } else {
-            LOG("Bend left arm inward\n");
-        }
-
-        planMotions(10.0, 85.0,
-                    20.0,
-                    0.0, 0.0,
-                    NAN,
-                    1500);
+        playGesture("hug-inward");
     } else {
-        if (_side == RIGHT_ARM) {
-            speech->speak("I need a big hug");
-            LOG("Move right arm forward\n");
-        } else {
-            LOG("Move left arm forward\n");
-        }
-
-        planMotions(10.0, 85.0,
-                    45.0,
-                    0.0, 0.0,
-                    NAN,
-                    1500);
+        playGesture("hug");
     }
 }
 
@@ -844,326 +966,63 @@ void Arm::extend(void)
 
 void Arm::hi(void)
 {
-    if (_side == RIGHT_ARM) {
-        speech->speak("Hello, it is very nice to see you");
-        LOG("Wave right arm to say hi\n");
-    } else {
-        speech->speak("I am very pleased to see you");
-        LOG("Wave left arm to say hi\n");
-    }
-
-    clearMotions();
-    planMotions(50.0, 65.0,
-                25.0,
-                0.0, 0.0,
-                50.0,
-                1500);
-    planMotions(90.0, 65.0,
-                25.0,
-                0.0, -90.0,
-                NAN,
-                500);
-
-    for (unsigned int i = 0; i < 3; i++) {
-        planMotions(NAN, NAN,
-                    NAN,
-                    45.0, NAN,
-                    NAN,
-                    500);
-        planMotions(NAN, NAN,
-                    NAN,
-                    0.0, NAN,
-                    NAN,
-                    500);
-    }
+    playGesture("hi");
 }
 
 void Arm::pickup(void)
 {
-    if (_side == RIGHT_ARM) {
-        speech->speak("Picking up object with right arm");
-        LOG("Right arm picks up\n");
-    } else {
-        speech->speak("Picking up object with left arm");
-        LOG("Left arm picks up\n");
-    }
-
-    clearMotions();
-    planMotions(NAN, NAN,
-                NAN,
-                NAN, NAN,
-                0.0,
-                1500);
-    planMotions(-35.0, 40.0,
-                -25.0,
-                -5.0, -90.0,
-                0.0,
-                1500);
-    planMotions(NAN, NAN,
-                NAN,
-                NAN, NAN,
-                98.0,
-                1500);
-    planMotions(0.0, -85.0,
-                -90.0,
-                -40.0, -90.0,
-                NAN,
-                1500);
+    playGesture("pickup");
 }
 
 void Arm::xferRL(void)
 {
-    static const float xfer_R_SR_Deg = -5.0;
-    static const float xfer_R_SE_Deg = 88.0;
-    static const float xfer_R_EE_Deg = 30.0;
-    static const float xfer_R_WE_Deg = -70.0;
-    static const float xfer_R_WR_Deg = -90.0;
-    static const float xfer_L_SR_Deg = 5.0;
-    static const float xfer_L_SE_Deg = 88.0;
-    static const float xfer_L_EE_Deg = 40.0;
-    static const float xfer_L_WE_Deg = -85.0;
-    static const float xfer_L_WR_Deg = -90.0;
-    bool inPosition = false;
-
-    if (_side == RIGHT_ARM) {
-        speech->speak("Transfer grip object from right to left");
-        LOG("Transfer grip object from right to left\n");
-    }
-
-    clearMotions();
+    bool inPosition;
 
     if (_side == RIGHT_ARM) {
-        if (isAtPosition(xfer_R_SR_Deg, xfer_R_SE_Deg,
-                         xfer_R_EE_Deg,
-                         xfer_R_WE_Deg, xfer_R_WR_Deg,
-                         NAN)) {
-            inPosition = true;
-        }
+        inPosition = isAtPosition(-5.0, 88.0,
+                                  30.0,
+                                  -70.0, -90.0,
+                                  NAN);
     } else {
-        if (isAtPosition(xfer_L_SR_Deg, xfer_L_SE_Deg,
-                         xfer_L_EE_Deg,
-                         xfer_L_WE_Deg, xfer_L_WR_Deg,
-                         NAN)) {
-            inPosition = true;
-        }
+        inPosition = isAtPosition(5.0, 88.0,
+                                  40.0,
+                                  -85.0, -90.0,
+                                  NAN);
     }
 
     if (inPosition == false) {
-        /* Move into position */
-        if (_side == RIGHT_ARM) {
-            planMotions(10.0, 85.0,
-                        45.0,
-                        0.0, xfer_R_WR_Deg,
-                        NAN,
-                        1500, true);
-            planMotions(xfer_R_SR_Deg - 10.0, xfer_R_SE_Deg,
-                        xfer_R_EE_Deg,
-                        xfer_R_WE_Deg, NAN,
-                        NAN,
-                        1000,
-                        true);
-        } else {
-            planMotions(10.0, 85.0,
-                        45.0,
-                        0.0, xfer_L_WR_Deg,
-                        0.0,
-                        1500, true);
-            planMotions(xfer_L_SR_Deg + 10.0, xfer_L_SE_Deg,
-                        xfer_L_EE_Deg,
-                        xfer_L_WE_Deg, NAN,
-                        NAN,
-                        1000,
-                        true);
-        }
-
-        if (_side == RIGHT_ARM) {
-            planMotions(xfer_R_SR_Deg, NAN,
-                        NAN,
-                        NAN, NAN,
-                        NAN,
-                        2000);
-        } else {
-            planMotions(xfer_L_SR_Deg, NAN,
-                        NAN,
-                        NAN, NAN,
-                        NAN,
-                        2000);
-        }
+        playGesture("xfer-rl-ready");
     } else {
-        /* Transfer gripped object */
-        if (_side == RIGHT_ARM) {
-            planMotions(NAN, NAN,
-                        NAN,
-                        NAN, NAN,
-                        NAN,
-                        1000);
-            planMotions(NAN, NAN,
-                        NAN,
-                        NAN, NAN,
-                        0.0,
-                        1000);
-        } else {
-            planMotions(NAN, NAN,
-                        NAN,
-                        NAN, NAN,
-                        98.0,
-                        1000);
-            planMotions(NAN, NAN,
-                        NAN,
-                        NAN, NAN,
-                        NAN,
-                        1000);
-        }
+        playGesture("xfer-rl");
     }
 }
 
 void Arm::xferLR(void)
 {
-    static const float xfer_R_SR_Deg = 5.0;
-    static const float xfer_R_SE_Deg = 88.0;
-    static const float xfer_R_EE_Deg = 30.0;
-    static const float xfer_R_WE_Deg = -70.0;
-    static const float xfer_R_WR_Deg = -90.0;
-    static const float xfer_L_SR_Deg = -5.0;
-    static const float xfer_L_SE_Deg = 88.0;
-    static const float xfer_L_EE_Deg = 40.0;
-    static const float xfer_L_WE_Deg = -85.0;
-    static const float xfer_L_WR_Deg = -90.0;
-    bool inPosition = false;
-
-    if (_side == RIGHT_ARM) {
-        speech->speak("Transfer grip object from left to right");
-        LOG("Transfer grip object from left to right\n");
-    }
-
-    clearMotions();
+    bool inPosition;
 
     if (_side == RIGHT_ARM) {
-        if (isAtPosition(xfer_R_SR_Deg, xfer_R_SE_Deg,
-                         xfer_R_EE_Deg,
-                         xfer_R_WE_Deg, xfer_R_WR_Deg,
-                         NAN)) {
-            inPosition = true;
-        }
+        inPosition = isAtPosition(5.0, 88.0,
+                                  30.0,
+                                  -70.0, -90.0,
+                                  NAN);
     } else {
-        if (isAtPosition(xfer_L_SR_Deg, xfer_L_SE_Deg,
-                         xfer_L_EE_Deg,
-                         xfer_L_WE_Deg, xfer_L_WR_Deg,
-                         NAN)) {
-            inPosition = true;
-        }
+        inPosition = isAtPosition(-5.0, 88.0,
+                                  40.0,
+                                  -85.0, -90.0,
+                                  NAN);
     }
 
     if (inPosition == false) {
-        /* Move into position */
-        if (_side == RIGHT_ARM) {
-            planMotions(10.0, 85.0,
-                        45.0,
-                        0.0, xfer_R_WR_Deg,
-                        0.0,
-                        1500, true);
-            planMotions(xfer_R_SR_Deg + 10.0, xfer_R_SE_Deg,
-                        xfer_R_EE_Deg,
-                        xfer_R_WE_Deg, NAN,
-                        NAN,
-                        1000,
-                        true);
-        } else {
-            planMotions(10.0, 85.0,
-                        45.0,
-                        0.0, xfer_L_WR_Deg,
-                        NAN,
-                        1500, true);
-            planMotions(xfer_L_SR_Deg - 10.0, xfer_L_SE_Deg,
-                        xfer_L_EE_Deg,
-                        xfer_L_WE_Deg, NAN,
-                        NAN,
-                        1000,
-                        true);
-        }
-
-        if (_side == RIGHT_ARM) {
-            planMotions(xfer_R_SR_Deg, NAN,
-                        NAN,
-                        NAN, NAN,
-                        NAN,
-                        2000);
-        } else {
-            planMotions(xfer_L_SR_Deg, NAN,
-                        NAN,
-                        NAN, NAN,
-                        NAN,
-                        2000);
-        }
+        playGesture("xfer-lr-ready");
     } else {
-        /* Transfer gripped object */
-        if (_side == RIGHT_ARM) {
-            planMotions(NAN, NAN,
-                        NAN,
-                        NAN, NAN,
-                        98.0,
-                        1000);
-            planMotions(NAN, NAN,
-                        NAN,
-                        NAN, NAN,
-                        NAN,
-                        1000);
-        } else {
-            planMotions(NAN, NAN,
-                        NAN,
-                        NAN, NAN,
-                        NAN,
-                        1000);
-            planMotions(NAN, NAN,
-                        NAN,
-                        NAN, NAN,
-                        0.0,
-                        1000);
-        }
+        playGesture("xfer-lr");
     }
 }
 
 void Arm::muscles(void)
 {
-    if (_side == RIGHT_ARM) {
-        speech->speak("I am the Rabbit Bot.\n"
-                      "I am strong!\n"
-                      "I am courageous!\n"
-                      "I have muscles hard like a rock!");
-        LOG("Flex muscles\n");
-    }
-
-    clearMotions();
-    planMotions(90.0, 10.0,
-                45.0,
-                0.0, 0.0,
-                50.0,
-                1500);
-    planMotions(90.0, 10.0,
-                -45.0,
-                0.0, 0.0,
-                50.0,
-                1500);
-    planMotions(90.0, 10.0,
-                45.0,
-                0.0, 0.0,
-                50.0,
-                1500);
-    planMotions(90.0, 10.0,
-                -45.0,
-                0.0, 0.0,
-                50.0,
-                1500);
-    planMotions(90.0, 10.0,
-                45.0,
-                0.0, 0.0,
-                50.0,
-                1500);
-    planMotions(90.0, 10.0,
-                -45.0,
-                0.0, 0.0,
-                50.0,
-                1500);
+    playGesture("muscles");
 }
 
 /*
@@ -62,7 +62,10 @@ public:
                       float wristExtensionDeg, float wristRotationDeg,
                       float gripperPositionPos);
 
-    void planMotions(float shoulderRotateDeg, float shoulderExtensionDeg,
+    unsigned int plannedMs(void) const;
+    void plannedPoseAt(unsigned int ms, struct arm_pose *pose) const;
+
+    bool planMotions(float shoulderRotateDeg, float shoulderExtensionDeg,
                      float elbowExtensionDeg,
                      float wristExtensionDeg, float wristRotationDeg,
                      float gripperPositionPos,
@@ -80,13 +83,17 @@ public:
     void xferLR(void);
     void muscles(void);
 
+    void clearMotions(void);
+
 private:
 
+    static void otherArmAt(unsigned int ms, struct arm_pose *pose, void *arg);
     void updateTrims(void);
+    float degree(unsigned int index, unsigned int pulse) const;
     unsigned int pulse(unsigned int index) const;
     unsigned int lastPlannedPulse(unsigned index) const;
     void setPulse(unsigned int index, unsigned int pulse, unsigned int ms);
-    void clearMotions(void);
+    void playGesture(const char *name);
     void syncMotions(bool bothArms = false);
 
     unsigned int _side;
@@ -0,0 +1,155 @@
+/*
+ * audiometer.cxx
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#include <math.h>
+#include <string.h>
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#include "audiometer.hxx"
+
+#define AUDIO_METER_LOW_HZ  125.0
+#define AUDIO_METER_Q       1.414     // One octave wide
+
+static float to_db(double power)
+{
+    double db;
+
+    if (power <= 0.0) {
+        return AUDIO_METER_FLOOR_DB;
+    }
+
+    db = 10.0 * log10(power);
+
+    return db < AUDIO_METER_FLOOR_DB ? AUDIO_METER_FLOOR_DB : db;
+}
+
+AudioMeter::AudioMeter(unsigned int rate, bool bands)
+    : _bands(bands)
+{
+    double w0, alpha, a0;
+    unsigned int b;
+
+    /* RBJ band-pass biquads with 0 dB peak gain */
+    for (b = 0; b < AUDIO_METER_BANDS; b++) {
+        _hz[b] = AUDIO_METER_LOW_HZ * (1 << b);
+        w0 = 2.0 * M_PI * _hz[b] / rate;
+        alpha = sin(w0) / (2.0 * AUDIO_METER_Q);
+        a0 = 1.0 + alpha;
+        _b0[b] = alpha / a0;
+        _b2[b] = -alpha / a0;
+        _a1[b] = -2.0 * cos(w0) / a0;
+        _a2[b] = (1.0 - alpha) / a0;
+    }
+
+    memset(_z1, 0, sizeof(_z1));
+    memset(_z2, 0, sizeof(_z2));
+}
+
+AudioMeter::~AudioMeter()
+{
+
+}
+
+void AudioMeter::setBands(bool en)
+{
+    if (en && !_bands) {
+        memset(_z1, 0, sizeof(_z1));
+        memset(_z2, 0, sizeof(_z2));
+    }
+
+    _bands = en;
+}
+
+void AudioMeter::measure(const int16_t *pcm, unsigned int n,
+                         struct audio_level *level)
+{
+    int16_t lmin = INT16_MAX, lmax = INT16_MIN;
+    int64_t sumsq = 0;
+    float energy[AUDIO_METER_BANDS], x, y;
+    unsigned int i = 0, b;
+
+#if defined(__ARM_NEON)
+    int16x8_t vmin = vdupq_n_s16(INT16_MAX);
+    int16x8_t vmax = vdupq_n_s16(INT16_MIN);
+    int64x2_t vsum = vdupq_n_s64(0);
+    int16_t lanes[8];
+
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t v = vld1q_s16(&pcm[i]);
+        int16x4_t lo = vget_low_s16(v);
+        int16x4_t hi = vget_high_s16(v);
+
+        vmin = vminq_s16(vmin, v);
+        vmax = vmaxq_s16(vmax, v);
+        /* Two squares of -32768 overflow an int32, so widen each half */
+        vsum = vpadalq_s32(vsum, vmull_s16(lo, lo));
+        vsum = vpadalq_s32(vsum, vmull_s16(hi, hi));
+    }
+
+    vst1q_s16(lanes, vmin);
+    for (b = 0; b < 8; b++) {
+        lmin = lanes[b] < lmin ? lanes[b] : lmin;
+    }
+    vst1q_s16(lanes, vmax);
+    for (b = 0; b < 8; b++) {
+        lmax = lanes[b] > lmax ? lanes[b] : lmax;
+    }
+    sumsq = vgetq_lane_s64(vsum, 0) + vgetq_lane_s64(vsum, 1);
+#endif
+
+    for (; i < n; i++) {
+        lmin = pcm[i] < lmin ? pcm[i] : lmin;
+        lmax = pcm[i] > lmax ? pcm[i] : lmax;
+        sumsq += (int32_t) pcm[i] * pcm[i];
+    }
+
+    if (n == 0) {
+        lmin = lmax = 0;
+    }
+
+    level->min = lmin;
+    level->max = lmax;
+    level->peak = (uint16_t) (-(int32_t) lmin > lmax ? -(int32_t) lmin : lmax);
+    level->reserved = 0;
+    level->rms = n ? sqrt((double) sumsq / n) / 32768.0 : 0.0;
+    level->rmsDb = to_db((double) level->rms * level->rms);
+    level->peakDb = to_db(((double) level->peak / 32768.0) *
+                          ((double) level->peak / 32768.0));
+
+    if (!_bands || (n == 0)) {
+        for (b = 0; b < AUDIO_METER_BANDS; b++) {
+            level->bandDb[b] = AUDIO_METER_FLOOR_DB;
+        }
+        return;
+    }
+
+    /* Transposed direct form II, all bands at once per sample */
+    memset(energy, 0, sizeof(energy));
+    for (i = 0; i < n; i++) {
+        x = pcm[i] / 32768.0f;
+        for (b = 0; b < AUDIO_METER_BANDS; b++) {
+            y = _b0[b] * x + _z1[b];
+            _z1[b] = _z2[b] - _a1[b] * y;
+            _z2[b] = _b2[b] * x - _a2[b] * y;
+            energy[b] += y * y;
+        }
+    }
+
+    for (b = 0; b < AUDIO_METER_BANDS; b++) {
+        level->bandDb[b] = to_db(energy[b] / n);
+    }
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,83 @@
+/*
+ * audiometer.hxx
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#ifndef AUDIOMETER_HXX
+#define AUDIOMETER_HXX
+
+#include <stdint.h>
+
+#define AUDIO_METER_BANDS     6       // Octaves from 125 Hz to 4 kHz
+#define AUDIO_METER_FLOOR_DB  -120.0
+
+/*
+ * Levels of one block of samples. Decibels are relative to full scale,
+ * where a full-scale square wave reads 0 dBFS and a sine -3 dBFS.
+ */
+struct audio_level {
+    int16_t min;
+    int16_t max;
+    uint16_t peak;                    // Largest magnitude
+    uint16_t reserved;
+    float rms;                        // Of full scale
+    float rmsDb;
+    float peakDb;
+    float bandDb[AUDIO_METER_BANDS];  // AUDIO_METER_FLOOR_DB when off
+};
+
+/*
+ * Measures blocks of S16 samples as they are captured. The min, max and
+ * sum of squares are taken 8 samples at a time with NEON where there is
+ * one. The band energies come from a bank of octave band-pass filters,
+ * and can be turned off.
+ */
+class AudioMeter
+{
+
+public:
+
+    AudioMeter(unsigned int rate, bool bands = true);
+    ~AudioMeter();
+
+    void measure(const int16_t *pcm, unsigned int n,
+                 struct audio_level *level);
+    void setBands(bool en);
+    bool hasBands(void) const;
+    float bandHz(unsigned int band) const;
+
+private:
+
+    bool _bands;
+    float _hz[AUDIO_METER_BANDS];
+    float _b0[AUDIO_METER_BANDS];
+    float _b2[AUDIO_METER_BANDS];     // b1 is 0, and b2 is -b0
+    float _a1[AUDIO_METER_BANDS];
+    float _a2[AUDIO_METER_BANDS];
+    float _z1[AUDIO_METER_BANDS];
+    float _z2[AUDIO_METER_BANDS];
+
+};
+
+inline bool AudioMeter::hasBands(void) const
+{
+    return _bands;
+}
+
+inline float AudioMeter::bandHz(unsigned int band) const
+{
+    return band < AUDIO_METER_BANDS ? _hz[band] : 0.0;
+}
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
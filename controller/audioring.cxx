@@ -0,0 +1,444 @@
+/*
+ * audioring.cxx
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <grp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/futex.h>
+#include "audioring.hxx"
+
+#define AUDIO_RING_POLL_MS  100
+
+static unsigned int instance = 0;
+
+static gid_t audio_group(void)
+{
+    struct group *gr;
+
+    gr = getgrnam(AUDIO_RING_GROUP);
+
+    return gr ? gr->gr_gid : (gid_t) -1;
+}
+
+AudioRing::AudioRing(const char *tcpAddr)
+    : _ring(NULL),
+      _unixfd(-1),
+      _tcpfd(-1),
+      _wakefd(-1),
+      _clients(0)
+{
+    unsigned int i;
+    int fd;
+
+    if (instance != 0) {
+        fprintf(stderr, "AudioRing can be instantiated only once!\n");
+        exit(EXIT_FAILURE);
+    } else {
+        instance++;
+    }
+
+    for (i = 0; i < AUDIO_RING_CLIENTS; i++) {
+        _clientfd[i] = -1;
+        _clientSeq[i] = 0;
+        _clientEnabled[i] = false;
+    }
+
+    /*
+     * Readers still holding the ring of a run that crashed see it unlinked
+     * once they run dry, and open this one.
+     */
+    shm_unlink(RABBIT_AUDIO_SHM);
+    fd = shm_open(RABBIT_AUDIO_SHM, O_RDWR | O_CREAT | O_EXCL, 0640);
+    if ((fd >= 0) && (fchown(fd, (uid_t) -1, audio_group()) != 0)) {
+        perror(RABBIT_AUDIO_SHM);     // Left to our own group
+    }
+
+    if (fd < 0) {
+        perror(RABBIT_AUDIO_SHM);
+    } else if (ftruncate(fd, sizeof(*_ring)) != 0) {
+        perror(RABBIT_AUDIO_SHM);
+        close(fd);
+        shm_unlink(RABBIT_AUDIO_SHM);
+    } else {
+        _ring = (struct rabbit_audio_ring *)
+            mmap(NULL, sizeof(*_ring), PROT_READ | PROT_WRITE,
+                 MAP_SHARED, fd, 0);
+        close(fd);
+        if (_ring == MAP_FAILED) {
+            perror(RABBIT_AUDIO_SHM);
+            _ring = NULL;
+            shm_unlink(RABBIT_AUDIO_SHM);
+        }
+    }
+
+    if (_ring) {
+        _ring->version = RABBIT_AUDIO_VERSION;
+        _ring->rate = RABBIT_AUDIO_RATE;
+        _ring->block = RABBIT_AUDIO_BLOCK;
+        _ring->blocks = RABBIT_AUDIO_BLOCKS;
+        _ring->enabled = 0;
+        _ring->futex = 0;
+        _ring->claimed = 0;
+        _ring->head = 0;
+        __atomic_store_n(&_ring->magic, RABBIT_AUDIO_MAGIC,
+                         __ATOMIC_RELEASE);
+        openListeners(tcpAddr);
+    }
+
+    _wakefd = eventfd(0, EFD_NONBLOCK);
+
+    _running = true;
+    pthread_create(&_thread, NULL, AudioRing::thread_func, this);
+    pthread_setname_np(_thread, "R'AudioRing");
+}
+
+AudioRing::~AudioRing()
+{
+    unsigned int i;
+
+    _running = false;
+    pthread_join(_thread, NULL);
+
+    for (i = 0; i < AUDIO_RING_CLIENTS; i++) {
+        if (_clientfd[i] >= 0) {
+            dropClient(i);
+        }
+    }
+
+    if (_unixfd >= 0) {
+        close(_unixfd);
+        unlink(RABBIT_AUDIO_SOCKET);
+    }
+
+    if (_tcpfd >= 0) {
+        close(_tcpfd);
+    }
+
+    if (_wakefd >= 0) {
+        close(_wakefd);
+    }
+
+    if (_ring) {
+        /* Wake up the readers to find it gone */
+        __atomic_store_n(&_ring->magic, 0, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&_ring->futex, 1, __ATOMIC_RELEASE);
+        syscall(SYS_futex, &_ring->futex, FUTEX_WAKE, INT_MAX,
+                NULL, NULL, 0);
+        munmap(_ring, sizeof(*_ring));
+        _ring = NULL;
+        shm_unlink(RABBIT_AUDIO_SHM);
+    }
+
+    instance--;
+}
+
+/*
+ * The Unix socket always, the TCP port only if an address is given:
+ * whoever reaches it hears the microphone.
+ */
+void AudioRing::openListeners(const char *tcpAddr)
+{
+    struct sockaddr_un sun;
+    struct sockaddr_in sin;
+    int on = 1;
+
+    _unixfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (_unixfd >= 0) {
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        strncpy(sun.sun_path, RABBIT_AUDIO_SOCKET, sizeof(sun.sun_path) - 1);
+        unlink(RABBIT_AUDIO_SOCKET);
+        if ((bind(_unixfd, (struct sockaddr *) &sun, sizeof(sun)) != 0) ||
+            (listen(_unixfd, AUDIO_RING_CLIENTS) != 0)) {
+            perror(RABBIT_AUDIO_SOCKET);
+            close(_unixfd);
+            _unixfd = -1;
+        } else if ((chown(RABBIT_AUDIO_SOCKET, (uid_t) -1,
+                          audio_group()) != 0) ||
+                   (chmod(RABBIT_AUDIO_SOCKET, 0660) != 0)) {
+            perror(RABBIT_AUDIO_SOCKET);
+        }
+    }
+
+    if (tcpAddr == NULL) {
+        return;
+    }
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(RABBIT_AUDIO_PORT);
+    if (inet_pton(AF_INET, tcpAddr, &sin.sin_addr) != 1) {
+        fprintf(stderr, "AudioRing: invalid address '%s'\n", tcpAddr);
+        return;
+    }
+
+    _tcpfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (_tcpfd >= 0) {
+        setsockopt(_tcpfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if ((bind(_tcpfd, (struct sockaddr *) &sin, sizeof(sin)) != 0) ||
+            (listen(_tcpfd, AUDIO_RING_CLIENTS) != 0)) {
+            perror("AudioRing");
+            close(_tcpfd);
+            _tcpfd = -1;
+        }
+    }
+}
+
+/*
+ * Called by the capture thread only, with RABBIT_AUDIO_BLOCK samples.
+ */
+void AudioRing::publish(const int16_t *pcm, uint64_t us, uint32_t flags)
+{
+    struct rabbit_audio_block *block;
+    uint64_t seq;
+
+    if (_ring == NULL) {
+        return;
+    }
+
+    seq = _ring->head;
+    block = &_ring->ring[seq & (RABBIT_AUDIO_BLOCKS - 1)];
+
+    __atomic_store_n(&_ring->claimed, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    block->t_us = us;
+    block->flags = flags;
+    memcpy(block->pcm, pcm, sizeof(block->pcm));
+
+    __atomic_store_n(&_ring->head, seq + 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&_ring->futex, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &_ring->futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+
+    if ((_clients > 0) && (_wakefd >= 0)) {
+        uint64_t one = 1;
+        if (write(_wakefd, &one, sizeof(one)) != sizeof(one)) {
+            /* Already pending */
+        }
+    }
+}
+
+void AudioRing::setEnabled(bool en)
+{
+    if (_ring == NULL) {
+        return;
+    }
+
+    __atomic_store_n(&_ring->enabled, en ? 1 : 0, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&_ring->futex, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &_ring->futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+
+    if (_wakefd >= 0) {
+        uint64_t one = 1;
+        if (write(_wakefd, &one, sizeof(one)) != sizeof(one)) {
+            /* Already pending */
+        }
+    }
+}
+
+void AudioRing::acceptClient(int listener)
+{
+    unsigned int i;
+    int fd;
+
+    fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK);
+    if (fd < 0) {
+        perror("AudioRing");
+        return;
+    }
+
+    for (i = 0; i < AUDIO_RING_CLIENTS; i++) {
+        if (_clientfd[i] < 0) {
+            break;
+        }
+    }
+
+    if (i == AUDIO_RING_CLIENTS) {
+        fprintf(stderr, "AudioRing is full, turning a reader away\n");
+        close(fd);
+        return;
+    }
+
+    _clientfd[i] = fd;
+    _clientSeq[i] = __atomic_load_n(&_ring->head, __ATOMIC_ACQUIRE);
+    _clientEnabled[i] = !_ring->enabled;    // Tell it the state first
+    _clients++;
+}
+
+void AudioRing::dropClient(unsigned int i)
+{
+    close(_clientfd[i]);
+    _clientfd[i] = -1;
+    _clients--;
+}
+
+/*
+ * Send block seq, or only the capture state if seq is ~0. A reader whose
+ * socket is full has fallen seconds behind, and is dropped.
+ */
+bool AudioRing::sendFrame(unsigned int i, uint64_t seq)
+{
+    struct rabbit_audio_frame frame;
+    const struct rabbit_audio_block *block;
+    ssize_t n;
+
+    memset(&frame, 0, sizeof(frame));
+    frame.magic = RABBIT_AUDIO_FRAME_MAGIC;
+    frame.enabled = _clientEnabled[i];
+
+    if (seq != UINT64_MAX) {
+        block = &_ring->ring[seq & (RABBIT_AUDIO_BLOCKS - 1)];
+        frame.t_us = block->t_us;
+        frame.flags = (uint8_t) block->flags;
+        memcpy(frame.pcm, block->pcm, sizeof(frame.pcm));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (seq + RABBIT_AUDIO_BLOCKS <
+            __atomic_load_n(&_ring->claimed, __ATOMIC_RELAXED)) {
+            return true;          // Overwritten while we copied
+        }
+        frame.samples = RABBIT_AUDIO_BLOCK;
+        frame.seq = seq;
+    }
+
+    n = send(_clientfd[i], &frame, sizeof(frame), MSG_NOSIGNAL);
+    if (n != (ssize_t) sizeof(frame)) {
+        if ((n >= 0) || (errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+            fprintf(stderr, "AudioRing reader fell behind, dropped\n");
+        }
+        dropClient(i);
+        return false;
+    }
+
+    return true;
+}
+
+void *AudioRing::thread_func(void *args)
+{
+    AudioRing *audioring = (AudioRing *) args;
+
+    audioring->run();
+
+    return NULL;
+}
+
+void AudioRing::run(void)
+{
+    struct pollfd pfd[3 + AUDIO_RING_CLIENTS];
+    unsigned int nfds, i, slot[3 + AUDIO_RING_CLIENTS];
+    uint64_t head, seq, count;
+    bool enabled;
+    char discard[64];
+    int ret;
+
+    while (_running) {
+        nfds = 0;
+        if (_wakefd >= 0) {
+            pfd[nfds].fd = _wakefd;
+            pfd[nfds].events = POLLIN;
+            nfds++;
+        }
+        if (_unixfd >= 0) {
+            pfd[nfds].fd = _unixfd;
+            pfd[nfds].events = POLLIN;
+            nfds++;
+        }
+        if (_tcpfd >= 0) {
+            pfd[nfds].fd = _tcpfd;
+            pfd[nfds].events = POLLIN;
+            nfds++;
+        }
+        for (i = 0; i < AUDIO_RING_CLIENTS; i++) {
+            if (_clientfd[i] >= 0) {
+                slot[nfds] = i;
+                pfd[nfds].fd = _clientfd[i];
+                pfd[nfds].events = POLLIN;
+                nfds++;
+            }
+        }
+
+        ret = poll(pfd, nfds, AUDIO_RING_POLL_MS);
+        if (ret < 0) {
+            if (errno != EINTR) {
+                perror("AudioRing");
+                usleep(AUDIO_RING_POLL_MS * 1000);
+            }
+            continue;
+        }
+
+        for (i = 0; (ret > 0) && (i < nfds); i++) {
+            if (pfd[i].revents == 0) {
+                continue;
+            }
+
+            if (pfd[i].fd == _wakefd) {
+                if (read(_wakefd, &count, sizeof(count)) < 0) {
+                    /* Nothing pending */
+                }
+            } else if ((pfd[i].fd == _unixfd) || (pfd[i].fd == _tcpfd)) {
+                acceptClient(pfd[i].fd);
+            } else if (_clientfd[slot[i]] == pfd[i].fd) {
+                /* Readers have nothing to say, other than hanging up */
+                if (recv(pfd[i].fd, discard, sizeof(discard), 0) <= 0) {
+                    dropClient(slot[i]);
+                }
+            }
+        }
+
+        if ((_ring == NULL) || (_clients == 0)) {
+            continue;
+        }
+
+        head = __atomic_load_n(&_ring->head, __ATOMIC_ACQUIRE);
+        enabled = __atomic_load_n(&_ring->enabled, __ATOMIC_ACQUIRE);
+        for (i = 0; i < AUDIO_RING_CLIENTS; i++) {
+            if (_clientfd[i] < 0) {
+                continue;
+            }
+
+            if (_clientEnabled[i] != enabled) {
+                _clientEnabled[i] = enabled;
+                if (!sendFrame(i, UINT64_MAX)) {
+                    continue;
+                }
+            }
+
+            if (_clientSeq[i] + RABBIT_AUDIO_BLOCKS <= head) {
+                _clientSeq[i] = head - RABBIT_AUDIO_BLOCKS + 1;
+            }
+
+            for (seq = _clientSeq[i]; seq < head; seq++) {
+                if (!sendFrame(i, seq)) {
+                    break;
+                }
+            }
+            _clientSeq[i] = head;
+        }
+    }
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,80 @@
+/*
+ * audioring.hxx
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#ifndef AUDIORING_HXX
+#define AUDIORING_HXX
+
+#include <stdint.h>
+#include <pthread.h>
+#include "rabbit_audio.h"
+
+#define AUDIO_RING_CLIENTS  4
+#define AUDIO_RING_GROUP    "audio"
+
+/*
+ * The producer side of rabbit_audio.h. publish() fills in the shared
+ * memory ring and wakes its readers without taking a lock; a thread of
+ * its own serves the stream sockets from the ring, so that a slow or
+ * remote reader never holds up capture. The ring and the Unix socket are
+ * open to the AUDIO_RING_GROUP group only, and the TCP port is served
+ * only when given an address to bind it to.
+ */
+class AudioRing {
+
+public:
+
+    AudioRing(const char *tcpAddr = NULL);
+    ~AudioRing();
+
+    void publish(const int16_t *pcm, uint64_t us, uint32_t flags = 0);
+    void setEnabled(bool en);
+    bool isEnabled(void) const;
+    unsigned int clients(void) const;
+
+private:
+
+    void openListeners(const char *tcpAddr);
+    void acceptClient(int listener);
+    void dropClient(unsigned int i);
+    bool sendFrame(unsigned int i, uint64_t seq);
+    static void *thread_func(void *args);
+    void run(void);
+
+    struct rabbit_audio_ring *_ring;
+    int _unixfd;
+    int _tcpfd;
+    int _wakefd;
+    int _clientfd[AUDIO_RING_CLIENTS];
+    uint64_t _clientSeq[AUDIO_RING_CLIENTS];
+    bool _clientEnabled[AUDIO_RING_CLIENTS];
+    unsigned int _clients;
+
+    bool _running;
+    pthread_t _thread;
+
+};
+
+inline bool AudioRing::isEnabled(void) const
+{
+    return _ring && _ring->enabled;
+}
+
+inline unsigned int AudioRing::clients(void) const
+{
+    return _clients;
+}
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -28,6 +28,8 @@
 #define TILT_ANGLE_MULT     ((TILT_HI_PULSE - TILT_LO_PULSE) /  \
                              TILT_ANGLE_RANGE)
 
+#define FACE_HOLD_MS       1000
+
 using namespace std;
 using namespace cv;
 
@@ -38,6 +40,7 @@ Camera::Camera()
       _running(false),
       _vision(0),
       _fr(0.0),
+      _frLimit(0.0),
       _sentry(false)
 {
     if (instance != 0) {
@@ -47,6 +50,8 @@ Camera::Camera()
         instance++;
     }
 
+    timerclear(&_lastFace);
+
     try {
         _vc = new VideoCapture(V4L_CAPTURE_DEVICE, CAP_V4L);
         _vc->set(CAP_PROP_FRAME_WIDTH, CAMERA_RES_WIDTH);
@@ -220,6 +225,10 @@ void Camera::run(void)
         if (!ptFaces.empty()) {
             float panDeg, tiltDeg;
 
+            pthread_mutex_lock(&_mutex);
+            gettimeofday(&_lastFace, NULL);
+            pthread_mutex_unlock(&_mutex);
+
             if (ptFaces[0].x > (CAMERA_RES_WIDTH / 2)) {
                 panDeg = -0.5;
             } else {
@@ -236,6 +245,19 @@ void Camera::run(void)
 
             ptFaces.clear();
         }
+
+        /* Hold off the next frame if the frame rate is limited */
+        if (_frLimit > 0.0) {
+            uint64_t ns;
+
+            ns = (uint64_t) (1000000000.0 / _frLimit) +
+                (uint64_t) now.tv_usec * 1000;
+            twait.tv_sec = now.tv_sec + (ns / 1000000000);
+            twait.tv_nsec = ns % 1000000000;
+            pthread_mutex_lock(&_mutex);
+            pthread_cond_timedwait(&_cond, &_mutex, &twait);
+            pthread_mutex_unlock(&_mutex);
+        }
     } while (_running);
 }
 
@@ -255,6 +277,27 @@ void Camera::enVision(bool enable)
     }
 }
 
+bool Camera::hasFace(void) const
+{
+    struct timeval now, hold, since, lastFace;
+
+    /* Written by the camera thread */
+    pthread_mutex_lock(&_mutex);
+    lastFace = _lastFace;
+    pthread_mutex_unlock(&_mutex);
+
+    if (!timerisset(&lastFace)) {
+        return false;
+    }
+
+    gettimeofday(&now, NULL);
+    hold.tv_sec = FACE_HOLD_MS / 1000;
+    hold.tv_usec = (FACE_HOLD_MS % 1000) * 1000;
+    timersub(&now, &hold, &since);
+
+    return timercmp(&lastFace, &since, >=);
+}
+
 void Camera::detectFaces(Mat &frame, vector<Point> &ptFaces)
 {
     vector<Rect> faces;
@@ -293,6 +336,21 @@ void Camera::detectFaces(Mat &frame, vector<Point> &ptFaces)
     }
 }
 
+/*
+ * Cap the capture rate to save power, 0 for as fast as the camera goes.
+ */
+void Camera::limitFrameRate(float fps)
+{
+    if (fps < 0.0) {
+        fps = 0.0;
+    }
+
+    if (_frLimit != fps) {
+        _frLimit = fps;
+        pthread_cond_broadcast(&_cond);
+    }
+}
+
 void Camera::enSentry(bool enable)
 {
     enable = (enable ? true : false);
@@ -29,6 +29,10 @@ public:
     float tiltAt(void) const;
 
     float frameRate(void) const;
+    void limitFrameRate(float fps);
+    float frameRateLimit(void) const;
+
+    bool hasFace(void) const;
 
 private:
 
@@ -41,12 +45,14 @@ private:
 
     cv::VideoCapture *_vc;
     pthread_t _thread;
-    pthread_mutex_t _mutex;
+    mutable pthread_mutex_t _mutex;
     pthread_cond_t _cond;
     bool _running;
     bool _vision;
     float _fr;
+    float _frLimit;
     bool _sentry;
+    struct timeval _lastFace;
     cv::CascadeClassifier _cascade;
 
 };
@@ -66,6 +72,11 @@ inline float Camera::frameRate(void) const
     return _fr;
 }
 
+inline float Camera::frameRateLimit(void) const
+{
+    return _frLimit;
+}
+
 #endif
 
 /*
@@ -4,6 +4,9 @@
  * Copyright (C) 2023, Charles Chiou
  */
 
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
 #include <sys/time.h>
 #include <bsd/sys/time.h>
 #include <math.h>
@@ -18,6 +21,18 @@
 #define COMPASS_I2C_BUS    1
 #define COMPASS_I2C_ADDR   0x0d
 
+/*
+ * DRDY goes high when a measurement is ready. Without it, the status
+ * register is polled at the output data rate.
+ */
+#define COMPASS_DRDY_GPIO  25
+#define COMPASS_ODR_HZ     100
+#define COMPASS_WAIT_MS    ((1000 / COMPASS_ODR_HZ) + 2)
+#define COMPASS_PUBLISH_SAMPLES  5
+
+/*
+ * Calibration used until there is a fit, from a manual min/max sweep.
+ */
 #define MIN_X_VAL -1227
 #define MAX_X_VAL 935
 #define MIN_Y_VAL -1543
@@ -25,11 +40,40 @@
 #define MIN_Z_VAL -760
 #define MAX_Z_VAL 922
 
+/*
+ * Samples go into the fit only once they have moved COMPASS_FIT_MIN_STEP
+ * from the last one that did, so that sitting still does not swamp it,
+ * and, once there is a fit, only if their corrected magnitude is within
+ * COMPASS_FIT_MAX_DEV of the radius: anything else is a nearby magnet or
+ * chunk of steel. If that keeps rejecting, the fit is started over.
+ */
+#define COMPASS_FIT_MIN_STEP      40.0
+#define COMPASS_FIT_MAX_DEV       0.25
+#define COMPASS_FIT_MAX_REJECTS    200
+#define COMPASS_FIT_BATCH           50
+#define COMPASS_FIT_FORGET       0.999
+#define COMPASS_CAL_FILE         "/var/lib/rabbit/compass.cal"
+#define COMPASS_SAVE_INTERVAL_S     60
+
 static unsigned int instance = 0;
 
 Compass::Compass()
-    : _handle(-1)
+    : _handle(-1),
+      _topic("compass"),
+      _fitted(false),
+      _fit(COMPASS_FIT_FORGET),
+      _fitPending(0),
+      _fitRejects(0),
+      _unsaved(false),
+      _savedAt(0),
+      _drdy(0),
+      _drdySeen(0),
+      _drdyPaced(false)
 {
+    float min[3] = { MIN_X_VAL, MIN_Y_VAL, MIN_Z_VAL, };
+    float max[3] = { MAX_X_VAL, MAX_Y_VAL, MAX_Z_VAL, };
+    unsigned int i;
+
     if (instance != 0) {
         fprintf(stderr, "Compass can be instantiated only once!\n");
         exit(EXIT_FAILURE);
@@ -37,30 +81,27 @@ Compass::Compass()
         instance++;
     }
 
-    _minX = MIN_X_VAL;
-    _maxX = MAX_X_VAL;
-    _minY = MIN_Y_VAL;
-    _maxY = MAX_Y_VAL;
-    _minZ = MIN_Z_VAL;
-    _maxZ = MAX_Z_VAL;
-    _offsetX = (_minX + _maxX) / 2;
-    _offsetY = (_minY + _maxY) / 2;
-    _offsetZ = (_minZ + _maxZ) / 2;
-    _avgDeltaX = (_maxX - _minX) / 2;
-    _avgDeltaY = (_maxY - _minY) / 2;
-    _avgDeltaZ = (_maxZ - _minZ) / 2;
-    _avgDelta = (_avgDeltaX + _avgDeltaY + _avgDeltaZ) / 3;
-    if (_avgDelta == 0.0) {
-        _scaleX = _scaleY = _scaleZ = 1.0;
+    memset(&_cal, 0, sizeof(_cal));
+    memset(_lastFit, 0, sizeof(_lastFit));
+    if (loadCalibration()) {
+        _fitted = true;
     } else {
-        _scaleX = (float) _avgDelta / (float) _avgDeltaX;
-        _scaleY = (float) _avgDelta / (float) _avgDeltaY;
-        _scaleZ = (float) _avgDelta / (float) _avgDeltaZ;
+        _cal.radius = ((max[0] - min[0]) + (max[1] - min[1]) +
+                       (max[2] - min[2])) / 6.0;
+        for (i = 0; i < 3; i++) {
+            _cal.offset[i] = (min[i] + max[i]) / 2.0;
+            _cal.soft[i][i] = _cal.radius / ((max[i] - min[i]) / 2.0);
+        }
     }
 
     _running = true;
     pthread_mutex_init(&_mutex, NULL);
     pthread_cond_init(&_cond, NULL);
+
+    gpioSetMode(COMPASS_DRDY_GPIO, PI_INPUT);
+    gpioSetPullUpDown(COMPASS_DRDY_GPIO, PI_PUD_DOWN);
+    gpioSetAlertFuncEx(COMPASS_DRDY_GPIO, Compass::drdy_alert, this);
+
     pthread_create(&_thread, NULL, Compass::thread_func, this);
     pthread_setname_np(_thread, "R'Compass");
 
@@ -69,12 +110,18 @@ Compass::Compass()
 
 Compass::~Compass()
 {
+    gpioSetAlertFuncEx(COMPASS_DRDY_GPIO, NULL, NULL);
+
     _running = false;
     pthread_cond_broadcast(&_cond);
     pthread_join(_thread, NULL);
     pthread_mutex_destroy(&_mutex);
     pthread_cond_destroy(&_cond);
 
+    if (_unsaved) {
+        saveCalibration();
+    }
+
     if (_handle >= 0) {
         i2cWriteByteData(_handle, CTRL_2_REG, SOFT_RST);
         i2cClose(_handle);
@@ -116,6 +163,7 @@ void Compass::probeOpenDevice(void)
             goto done;
         }
 
+        /* Reset leaves INT_ENB clear, so that DRDY drives its pin */
         ret = i2cWriteByteData(_handle, CTRL_2_REG, SOFT_RST);
         if (ret != 0) {
             fprintf(stderr, "QMC5883L write CTRL_2_REG failed!\n");
@@ -154,191 +202,312 @@ void *Compass::thread_func(void *args)
     return NULL;
 }
 
-void Compass::run(void)
+void Compass::drdy_alert(int gpio, int level, uint32_t tick, void *arg)
 {
-    int ret = 0;
-    uint8_t status;
-    int16_t x, y, z;
-    struct timespec ts, tloop;
-    bool dirtyX, dirtyY, dirtyZ;
-    float heading_now;
+    Compass *compass = (Compass *) arg;
 
-    tloop.tv_sec = 0;
-    tloop.tv_nsec = 50000000;
+    (void)(gpio);
+    (void)(tick);
 
-    while (_running) {
-        clock_gettime(CLOCK_REALTIME, &ts);
-        timespecadd(&ts, &tloop, &ts);
+    if (level != 1) {
+        return;
+    }
 
-        /* Probe and open device */
-        if (_handle == -1) {
-            probeOpenDevice();
-            if (_handle == -1) {
-                goto done;
-            }
-        }
+    pthread_mutex_lock(&compass->_mutex);
+    compass->_drdy++;
+    pthread_cond_broadcast(&compass->_cond);
+    pthread_mutex_unlock(&compass->_mutex);
+}
+
+/*
+ * Read a measurement in one burst: -1 on error, 0 if there is none, 1 if
+ * raw is filled in. Paced by DRDY, the status register is read in the
+ * same burst, after the data; polling, it is read first to see whether
+ * there is anything new.
+ */
+int Compass::readSample(bool paced, float *raw)
+{
+    char buf[7];
+    unsigned int len = paced ? 7 : 6;
+    uint8_t status = 0;
+    int ret;
 
-        /* Check status register for data ready */
+    if (!paced) {
         ret = i2cReadByteData(_handle, STATUS_REG);
         if (ret < 0) {
             fprintf(stderr, "QMC5883L read STATUS_REG failed!\n");
-            goto done;
-        } else {
-            status = (uint8_t) ret;
+            return -1;
         }
 
+        status = (uint8_t) ret;
         if ((status & STATUS_DRDY) == 0) {
-            goto done;
+            return 0;
         }
+    }
 
-        /* Request read from first register */
-        ret = i2cWriteByte(_handle, DATA_X_LSB_REG);
-        if (ret != 0) {
-            fprintf(stderr, "QMC5883L write byte DATA_X_LSB_REG failed!\n");
-            goto done;
-        }
+    ret = i2cReadI2CBlockData(_handle, DATA_X_LSB_REG, buf, len);
+    if (ret != (int) len) {
+        fprintf(stderr, "QMC5883L read DATA_X_LSB_REG failed!\n");
+        return -1;
+    }
 
-        /*
-         * Read 6 consecutive bytes for x/y/z axis
-         */
+    if (paced) {
+        status = (uint8_t) buf[6];
+    }
 
-        ret = i2cReadByte(_handle);
-        if (ret < 0) {
-            fprintf(stderr, "QMC5883L read byte failed!\n");
-            goto done;
-        }
-        x = ret;
+    if (status & STATUS_OVL) {
+        return 0;
+    }
 
-        ret = i2cReadByte(_handle);
-        if (ret < 0) {
-            fprintf(stderr, "QMC5883L read byte failed!\n");
-            goto done;
-        }
-        x |= (ret << 8);
+    raw[0] = (int16_t) ((uint8_t) buf[0] | ((uint8_t) buf[1] << 8));
+    raw[1] = (int16_t) ((uint8_t) buf[2] | ((uint8_t) buf[3] << 8));
+    raw[2] = (int16_t) ((uint8_t) buf[4] | ((uint8_t) buf[5] << 8));
 
-        ret = i2cReadByte(_handle);
-        if (ret < 0) {
-            fprintf(stderr, "QMC5883L read byte failed!\n");
-            goto done;
-        }
-        y = ret;
+    return 1;
+}
 
-        ret = i2cReadByte(_handle);
-        if (ret < 0) {
-            fprintf(stderr, "QMC5883L read byte failed!\n");
-            goto done;
-        }
-        y |= (ret << 8);
+void Compass::correct(const float *raw, float *v) const
+{
+    unsigned int i, j;
 
-        ret = i2cReadByte(_handle);
-        if (ret < 0) {
-            fprintf(stderr, "QMC5883L read byte failed!\n");
-            goto done;
+    for (i = 0; i < 3; i++) {
+        v[i] = 0.0;
+        for (j = 0; j < 3; j++) {
+            v[i] += _cal.soft[i][j] * (raw[j] - _cal.offset[j]);
         }
-        z = ret;
+    }
+}
 
-        ret = i2cReadByte(_handle);
-        if (ret < 0) {
-            fprintf(stderr, "QMC5883L read byte failed!\n");
-            goto done;
+void Compass::calibrate(const float *raw)
+{
+    struct compass_cal cal;
+    float v[3], d, m;
+    unsigned int i;
+
+    d = sqrtf((raw[0] - _lastFit[0]) * (raw[0] - _lastFit[0]) +
+              (raw[1] - _lastFit[1]) * (raw[1] - _lastFit[1]) +
+              (raw[2] - _lastFit[2]) * (raw[2] - _lastFit[2]));
+    if (d < COMPASS_FIT_MIN_STEP) {
+        return;
+    }
+
+    if (_fitted) {
+        correct(raw, v);
+        m = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+        if (fabsf(m - _cal.radius) > COMPASS_FIT_MAX_DEV * _cal.radius) {
+            _fitRejects++;
+            if (_fitRejects >= COMPASS_FIT_MAX_REJECTS) {
+                LOG("Compass calibration looks stale, refitting\n");
+                _fit.clear();
+                _fitted = false;
+                _fitRejects = 0;
+            }
+            return;
         }
-        z |= (ret << 8);
+    }
 
-        dirtyX = false;
-        dirtyY = false;
-        dirtyZ = false;
+    _fitRejects = 0;
+    for (i = 0; i < 3; i++) {
+        _lastFit[i] = raw[i];
+    }
 
-        if (x < _minX) {
-            _minX = x;
-            dirtyX = true;
-        }
+    _fit.addSample(raw);
+    _fitPending++;
+    if (_fitPending < COMPASS_FIT_BATCH) {
+        return;
+    }
 
-        if (x > _maxX) {
-            _maxX = x;
-            dirtyX = true;
-        }
+    _fitPending = 0;
+    if (!_fit.solve(cal.offset, cal.soft, &cal.radius)) {
+        return;
+    }
 
-        if (dirtyX) {
-            _offsetX = (_minX + _maxX) / 2;
-            _avgDeltaX = (_maxX - _minX) / 2;
-        }
+    if (!_fitted) {
+        LOG("Compass calibrated\n");
+    }
 
-        if (y < _minY) {
-            _minY = y;
-            dirtyY = true;
-        }
+    pthread_mutex_lock(&_mutex);
+    memcpy(&_cal, &cal, sizeof(_cal));
+    pthread_mutex_unlock(&_mutex);
+    _fitted = true;
+    _unsaved = true;
+}
 
-        if (y > _maxY) {
-            _maxY = y;
-            dirtyY = true;
-        }
+void Compass::calibration(struct compass_cal *cal)
+{
+    pthread_mutex_lock(&_mutex);
+    memcpy(cal, &_cal, sizeof(_cal));
+    pthread_mutex_unlock(&_mutex);
+}
 
-        if (dirtyY) {
-            _offsetY = (_minY + _maxY) / 2;
-            _avgDeltaY = (_maxY - _minY) / 2;
-        }
+bool Compass::loadCalibration(void)
+{
+    struct compass_cal cal;
+    FILE *fp;
+    int n;
 
-        if (z < _minZ) {
-            _minZ = z;
-            dirtyZ = true;
-        }
+    fp = fopen(COMPASS_CAL_FILE, "r");
+    if (fp == NULL) {
+        return false;
+    }
 
-        if (z > _maxZ) {
-            _maxZ = z;
-            dirtyZ = true;
-        }
+    n = fscanf(fp, "offset %f %f %f\n"
+               "soft %f %f %f %f %f %f %f %f %f\n"
+               "radius %f\n",
+               &cal.offset[0], &cal.offset[1], &cal.offset[2],
+               &cal.soft[0][0], &cal.soft[0][1], &cal.soft[0][2],
+               &cal.soft[1][0], &cal.soft[1][1], &cal.soft[1][2],
+               &cal.soft[2][0], &cal.soft[2][1], &cal.soft[2][2],
+               &cal.radius);
+    fclose(fp);
+
+    if ((n != 13) || (cal.radius <= 0.0)) {
+        fprintf(stderr, "%s is corrupt, ignored\n", COMPASS_CAL_FILE);
+        return false;
+    }
 
-        if (dirtyZ) {
-            _offsetZ = (_minZ + _maxZ) / 2;
-            _avgDeltaZ = (_maxZ - _minZ) / 2;
-        }
+    memcpy(&_cal, &cal, sizeof(_cal));
 
-        if (dirtyX || dirtyY || dirtyZ) {
-            _avgDelta = (_avgDeltaX + _avgDeltaY + _avgDeltaZ) / 3;
-            _scaleX = (float) _avgDelta / (float) _avgDeltaX;
-            _scaleY = (float) _avgDelta / (float) _avgDeltaY;
-            _scaleZ = (float) _avgDelta / (float) _avgDeltaZ;
-        }
+    return true;
+}
+
+/*
+ * Written to a temporary file and renamed, so that a crash never leaves
+ * half a calibration behind.
+ */
+void Compass::saveCalibration(void)
+{
+    const char *tmp = COMPASS_CAL_FILE ".tmp";
+    FILE *fp;
+    int ret;
+
+    _unsaved = false;
+    _savedAt = time(NULL);
 
-        //printf("%d <= x <= %d, %d <= y <=%d, %d <= z <= %d\n",
-        //       _minX, _maxX, _minY, _maxY, _minZ, _maxZ);
+    fp = fopen(tmp, "w");
+    if (fp == NULL) {
+        perror(tmp);
+        return;
+    }
 
-        _histX.addSample(((float) x - _offsetX) * _scaleX);
-        _histY.addSample(((float) y - _offsetY) * _scaleY);
-        _histZ.addSample(((float) z - _offsetZ) * _scaleZ);
+    fprintf(fp, "offset %f %f %f\n",
+            _cal.offset[0], _cal.offset[1], _cal.offset[2]);
+    fprintf(fp, "soft %f %f %f %f %f %f %f %f %f\n",
+            _cal.soft[0][0], _cal.soft[0][1], _cal.soft[0][2],
+            _cal.soft[1][0], _cal.soft[1][1], _cal.soft[1][2],
+            _cal.soft[2][0], _cal.soft[2][1], _cal.soft[2][2]);
+    fprintf(fp, "radius %f\n", _cal.radius);
+    ret = fclose(fp);
+
+    if ((ret != 0) || (rename(tmp, COMPASS_CAL_FILE) != 0)) {
+        perror(COMPASS_CAL_FILE);
+    }
+}
 
-        heading_now = heading();
-        mosquitto->publish("rabbit/compass/heading",
-                           sizeof(float), &heading_now, 2, 0);
+void Compass::run(void)
+{
+    struct timespec ts, tw;
+    float raw[3], gated[3], xyz[3];
+    float heading_now;
+    struct compass_sample sample;
+    unsigned int i, n = 0;
+    bool outlier, drdy;
+    int ret;
 
-        ret = 0;
+    tw.tv_sec = 0;
+    tw.tv_nsec = COMPASS_WAIT_MS * 1000000;
 
-    done:
+    while (_running) {
+        /* Probe and open device */
+        if (_handle == -1) {
+            probeOpenDevice();
+            if (_handle == -1) {
+                clock_gettime(CLOCK_REALTIME, &ts);
+                ts.tv_sec += 1;
+                pthread_mutex_lock(&_mutex);
+                pthread_cond_timedwait(&_cond, &_mutex, &ts);
+                pthread_mutex_unlock(&_mutex);
+                continue;
+            }
+        }
 
-        if (ret != 0) {
+        /* Wait for DRDY, or for the data rate without it */
+        clock_gettime(CLOCK_REALTIME, &ts);
+        timespecadd(&ts, &tw, &ts);
+        pthread_mutex_lock(&_mutex);
+        while (_running && (_drdy == _drdySeen)) {
+            if (pthread_cond_timedwait(&_cond, &_mutex, &ts) != 0) {
+                break;
+            }
+        }
+        drdy = (_drdy != _drdySeen);
+        _drdySeen = _drdy;
+        pthread_mutex_unlock(&_mutex);
+        if (!_running) {
+            break;
+        }
+
+        _drdyPaced = drdy;
+
+        ret = readSample(drdy, raw);
+        if (ret < 0) {
             i2cClose(_handle);
             _handle = -1;
+            continue;
+        } else if (ret == 0) {
+            continue;
         }
 
-        pthread_mutex_lock(&_mutex);
-        pthread_cond_timedwait(&_cond, &_mutex, &ts);
-        pthread_mutex_unlock(&_mutex);
+        /* Spikes are held back from the heading and from the fit */
+        _gate.addSample(raw);
+        outlier = false;
+        for (i = 0; i < 3; i++) {
+            gated[i] = _gate.filtered(i);
+            if (gated[i] != raw[i]) {
+                outlier = true;
+            }
+        }
+
+        if (!outlier) {
+            calibrate(raw);
+        }
+
+        correct(gated, xyz);
+        _filter.addSample(xyz);
+
+        heading_now = heading();
+        sample.x = _filter.filtered(0);
+        sample.y = _filter.filtered(1);
+        sample.z = _filter.filtered(2);
+        sample.heading = heading_now;
+        _topic.publish(sample);
+
+        n++;
+        if ((n % COMPASS_PUBLISH_SAMPLES) == 0) {
+            mosquitto->publish("rabbit/compass/heading",
+                               sizeof(float), &heading_now, 2, 0);
+        }
+
+        if (_unsaved &&
+            (time(NULL) - _savedAt >= COMPASS_SAVE_INTERVAL_S)) {
+            saveCalibration();
+        }
     }
 }
 
 float Compass::x(void)
 {
-    return _histX.average();
+    return _filter.filtered(0);
 }
 
 float Compass::y(void)
 {
-    return _histY.average();
+    return _filter.filtered(1);
 }
 
 float Compass::z(void)
 {
-    return _histZ.average();
+    return _filter.filtered(2);
 }
 
 float Compass::heading(void)
@@ -7,7 +7,26 @@
 #ifndef COMPASS_HXX
 #define COMPASS_HXX
 
-#include "medianfilter.hxx"
+#include "filterpipeline.hxx"
+#include "samplebus.hxx"
+#include "ellipsoidfit.hxx"
+
+#define COMPASS_GATE_LSB  500    // Largest believable jump between samples
+
+struct compass_sample {
+    float x, y, z;         // Filtered
+    float heading;
+};
+
+/*
+ * Hard and soft iron calibration: a reading r is corrected to
+ * soft (r - offset), which lies on a sphere of the given radius.
+ */
+struct compass_cal {
+    float offset[3];
+    float soft[3][3];
+    float radius;
+};
 
 class Compass {
 
@@ -20,24 +39,46 @@ public:
     float x(void);
     float y(void);
     float z(void);
+    float rawX(void) const;
+    float rawY(void) const;
+    float rawZ(void) const;
     float heading(void);
+    SampleTopic<struct compass_sample> &topic(void);
+
+    bool isDrdyPaced(void) const;
+    bool isCalibrated(void) const;
+    void calibration(struct compass_cal *cal);
 
 private:
 
     void probeOpenDevice(void);
+    static void drdy_alert(int gpio, int level, uint32_t tick, void *arg);
     static void *thread_func(void *);
     void run(void);
+    int readSample(bool paced, float *raw);
+    void correct(const float *raw, float *v) const;
+    void calibrate(const float *raw);
+    bool loadCalibration(void);
+    void saveCalibration(void);
 
     int _handle;
 
-    MedianFilter<float> _histX;
-    MedianFilter<float> _histY;
-    MedianFilter<float> _histZ;
-    int16_t _minX, _maxX, _offsetX, _avgDeltaX;
-    int16_t _minY, _maxY, _offsetY, _avgDeltaY;
-    int16_t _minZ, _maxZ, _offsetZ, _avgDeltaZ;
-    int16_t _avgDelta;
-    float _scaleX, _scaleY, _scaleZ;
+    FilterPipeline<float, 3, FilterOutlierGate<COMPASS_GATE_LSB> > _gate;
+    FilterPipeline<float, 3, FilterMean<50> > _filter;
+    SampleTopic<struct compass_sample> _topic;
+
+    struct compass_cal _cal;
+    bool _fitted;              // _cal is from a fit, not the defaults
+    EllipsoidFit _fit;
+    float _lastFit[3];
+    unsigned int _fitPending;
+    unsigned int _fitRejects;
+    bool _unsaved;
+    time_t _savedAt;
+
+    unsigned int _drdy;
+    unsigned int _drdySeen;
+    bool _drdyPaced;
 
     bool _running;
     pthread_t _thread;
@@ -51,6 +92,36 @@ inline bool Compass::isDeviceOnline(void) const
     return _handle != -1;
 }
 
+inline SampleTopic<struct compass_sample> &Compass::topic(void)
+{
+    return _topic;
+}
+
+inline bool Compass::isDrdyPaced(void) const
+{
+    return _drdyPaced;
+}
+
+inline bool Compass::isCalibrated(void) const
+{
+    return _fitted;
+}
+
+inline float Compass::rawX(void) const
+{
+    return _filter.raw(0);
+}
+
+inline float Compass::rawY(void) const
+{
+    return _filter.raw(1);
+}
+
+inline float Compass::rawZ(void) const
+{
+    return _filter.raw(2);
+}
+
 #endif
 
 /*
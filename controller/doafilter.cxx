@@ -0,0 +1,172 @@
+/*
+ * doafilter.cxx
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "doafilter.hxx"
+
+#define DEG2RAD(x)  ((x) * M_PI / 180.0)
+#define RAD2DEG(x)  ((x) * 180.0 / M_PI)
+
+/*
+ * Smallest angle between two bearings, in [0, 180].
+ */
+static float angle_between(float a, float b)
+{
+    float d;
+
+    d = fmodf(fabsf(a - b), 360.0);
+    if (d > 180.0) {
+        d = 360.0 - d;
+    }
+
+    return d;
+}
+
+DOAFilter::DOAFilter(unsigned int windowMs, float outlierDeg,
+                     unsigned int minInliers)
+    : _windowMs(windowMs),
+      _outlierDeg(outlierDeg),
+      _minInliers(minInliers),
+      _index(0),
+      _sampleCount(0)
+{
+    if (_minInliers == 0) {
+        _minInliers = 1;
+    }
+}
+
+DOAFilter::~DOAFilter()
+{
+
+}
+
+void DOAFilter::addSample(float deg, uint64_t ms)
+{
+    _deg[_index] = deg;
+    _ms[_index] = ms;
+    _index++;
+    _index %= DOA_FILTER_SIZE;
+    if (_sampleCount < DOA_FILTER_SIZE) {
+        _sampleCount++;
+    }
+}
+
+bool DOAFilter::estimate(uint64_t ms, float *deg) const
+{
+    float window[DOA_FILTER_SIZE];
+    unsigned int i, j, len = 0;
+    unsigned int medoid = 0, inliers = 0;
+    float cost, best = -1.0;
+    double s = 0.0, c = 0.0;
+
+    for (i = 0; i < _sampleCount; i++) {
+        if (ms - _ms[i] <= _windowMs) {
+            window[len++] = _deg[i];
+        }
+    }
+
+    if (len < _minInliers) {
+        return false;
+    }
+
+    /* Medoid: the reading closest to all others, robust against outliers */
+    for (i = 0; i < len; i++) {
+        cost = 0.0;
+        for (j = 0; j < len; j++) {
+            cost += angle_between(window[i], window[j]);
+        }
+
+        if (best < 0.0 || cost < best) {
+            best = cost;
+            medoid = i;
+        }
+    }
+
+    /* Circular mean of the inliers */
+    for (i = 0; i < len; i++) {
+        if (angle_between(window[i], window[medoid]) <= _outlierDeg) {
+            s += sin(DEG2RAD(window[i]));
+            c += cos(DEG2RAD(window[i]));
+            inliers++;
+        }
+    }
+
+    if (inliers < _minInliers) {
+        return false;
+    }
+
+    *deg = (float) RAD2DEG(atan2(s, c));
+
+    return true;
+}
+
+void DOAFilter::clear(void)
+{
+    _index = 0;
+    _sampleCount = 0;
+}
+
+SoundTracker::SoundTracker(unsigned int windowMs, float outlierDeg,
+                           unsigned int minInliers, float deadbandDeg)
+    : _filter(windowMs, outlierDeg, minInliers),
+      _deadbandDeg(deadbandDeg),
+      _samples(0)
+{
+
+}
+
+SoundTracker::~SoundTracker()
+{
+
+}
+
+/*
+ * Feed a DOA reading in 0-359 degrees, true if the head facing rotation
+ * should turn to *deg.
+ */
+bool SoundTracker::track(uint32_t doa, bool speechDetected, uint64_t ms,
+                         float rotation, float *deg)
+{
+    float est;
+
+    if (!speechDetected) {
+        return false;
+    }
+
+    // Filter out sounds from servo motors mounted behind
+    if (doa <= 90 || doa >= 270) {
+        est = (float) doa;
+        if (est > 180.0) {
+            est = est - 360.0;
+        }
+        _filter.addSample(est, ms);
+        _samples++;
+    }
+
+    if (!_filter.estimate(ms, &est)) {
+        return false;
+    }
+
+    if (fabsf(est - rotation) < _deadbandDeg) {
+        return false;
+    }
+
+    *deg = est;
+
+    return true;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
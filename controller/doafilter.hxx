@@ -0,0 +1,87 @@
+/*
+ * doafilter.hxx
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#ifndef DOAFILTER_HXX
+#define DOAFILTER_HXX
+
+#include <stdint.h>
+
+#define DOA_FILTER_SIZE  16
+
+/*
+ * Fuses direction-of-arrival readings over a short time window. Readings
+ * further than the outlier threshold from the medoid of the window are
+ * rejected and the rest are averaged on the circle. Timestamps are passed
+ * in by the caller so that logged traces can be replayed.
+ */
+class DOAFilter
+{
+
+public:
+
+    DOAFilter(unsigned int windowMs = 1000, float outlierDeg = 30.0,
+              unsigned int minInliers = 3);
+    ~DOAFilter();
+
+    void addSample(float deg, uint64_t ms);
+    bool estimate(uint64_t ms, float *deg) const;
+    void clear(void);
+
+private:
+
+    unsigned int _windowMs;
+    float _outlierDeg;
+    unsigned int _minInliers;
+    float _deg[DOA_FILTER_SIZE];
+    uint64_t _ms[DOA_FILTER_SIZE];
+    unsigned int _index;
+    unsigned int _sampleCount;
+
+};
+
+/*
+ * Decides when the head turns toward a speaker and to where. Readings
+ * from behind, where the servo motors are, are left out. The others are
+ * fused by a DOAFilter, and a turn is called for once the fused bearing
+ * is more than the deadband away from where the head faces.
+ */
+class SoundTracker
+{
+
+public:
+
+    SoundTracker(unsigned int windowMs = 1000, float outlierDeg = 30.0,
+                 unsigned int minInliers = 3, float deadbandDeg = 5.0);
+    ~SoundTracker();
+
+    bool track(uint32_t doa, bool speechDetected, uint64_t ms,
+               float rotation, float *deg);
+    unsigned int samples(void) const;
+
+private:
+
+    DOAFilter _filter;
+    float _deadbandDeg;
+    unsigned int _samples;
+
+};
+
+inline unsigned int SoundTracker::samples(void) const
+{
+    return _samples;
+}
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,304 @@
+/*
+ * ellipsoidfit.cxx
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#include <math.h>
+#include <string.h>
+#include "ellipsoidfit.hxx"
+
+#define ELLIPSOID_FIT_MIN_POINTS   100
+#define ELLIPSOID_FIT_MAX_RATIO    2.0   // Longest over shortest axis
+#define ELLIPSOID_FIT_MIN_SPREAD  0.25   // Of the radius, on every axis
+
+/*
+ * Solve a x = b in place by Gaussian elimination with partial pivoting,
+ * the answer is left in b.
+ */
+static bool solve_linear(double *a, double *b, unsigned int n)
+{
+    unsigned int i, j, k, p;
+    double t;
+
+    for (k = 0; k < n; k++) {
+        p = k;
+        for (i = k + 1; i < n; i++) {
+            if (fabs(a[i * n + k]) > fabs(a[p * n + k])) {
+                p = i;
+            }
+        }
+
+        if (fabs(a[p * n + k]) < 1e-12) {
+            return false;
+        }
+
+        if (p != k) {
+            for (j = 0; j < n; j++) {
+                t = a[k * n + j];
+                a[k * n + j] = a[p * n + j];
+                a[p * n + j] = t;
+            }
+            t = b[k];
+            b[k] = b[p];
+            b[p] = t;
+        }
+
+        for (i = k + 1; i < n; i++) {
+            t = a[i * n + k] / a[k * n + k];
+            for (j = k; j < n; j++) {
+                a[i * n + j] -= t * a[k * n + j];
+            }
+            b[i] -= t * b[k];
+        }
+    }
+
+    for (k = n; k-- > 0; ) {
+        for (j = k + 1; j < n; j++) {
+            b[k] -= a[k * n + j] * b[j];
+        }
+        b[k] /= a[k * n + k];
+    }
+
+    return true;
+}
+
+/*
+ * Eigen-decomposition of a symmetric 3x3 matrix by Jacobi rotations. The
+ * eigenvectors are the columns of v.
+ */
+static void eigen_sym3(const double m[3][3], double e[3], double v[3][3])
+{
+    double a[3][3], t, c, s, theta, apq;
+    unsigned int i, k, p, q, sweep;
+
+    memcpy(a, m, sizeof(a));
+    for (i = 0; i < 3; i++) {
+        for (k = 0; k < 3; k++) {
+            v[i][k] = (i == k) ? 1.0 : 0.0;
+        }
+    }
+
+    for (sweep = 0; sweep < 50; sweep++) {
+        if (fabs(a[0][1]) + fabs(a[0][2]) + fabs(a[1][2]) < 1e-15) {
+            break;
+        }
+
+        for (p = 0; p < 2; p++) {
+            for (q = p + 1; q < 3; q++) {
+                apq = a[p][q];
+                if (fabs(apq) < 1e-18) {
+                    continue;
+                }
+
+                theta = (a[q][q] - a[p][p]) / (2.0 * apq);
+                t = (theta >= 0.0 ? 1.0 : -1.0) /
+                    (fabs(theta) + sqrt(theta * theta + 1.0));
+                c = 1.0 / sqrt(t * t + 1.0);
+                s = t * c;
+
+                for (k = 0; k < 3; k++) {
+                    double akp = a[k][p], akq = a[k][q];
+                    a[k][p] = c * akp - s * akq;
+                    a[k][q] = s * akp + c * akq;
+                }
+                for (k = 0; k < 3; k++) {
+                    double apk = a[p][k], aqk = a[q][k];
+                    a[p][k] = c * apk - s * aqk;
+                    a[q][k] = s * apk + c * aqk;
+                }
+                for (k = 0; k < 3; k++) {
+                    double vkp = v[k][p], vkq = v[k][q];
+                    v[k][p] = c * vkp - s * vkq;
+                    v[k][q] = s * vkp + c * vkq;
+                }
+            }
+        }
+    }
+
+    for (i = 0; i < 3; i++) {
+        e[i] = a[i][i];
+    }
+}
+
+EllipsoidFit::EllipsoidFit(double forget, double scale)
+    : _forget(forget),
+      _scale(scale)
+{
+    clear();
+}
+
+EllipsoidFit::~EllipsoidFit()
+{
+
+}
+
+void EllipsoidFit::clear(void)
+{
+    memset(_ata, 0, sizeof(_ata));
+    memset(_atb, 0, sizeof(_atb));
+    memset(_sum, 0, sizeof(_sum));
+    memset(_sum2, 0, sizeof(_sum2));
+    _weight = 0.0;
+    _count = 0;
+}
+
+/*
+ * The ellipsoid is
+ *   a x^2 + b y^2 + c z^2 + 2d xy + 2e xz + 2f yz + 2g x + 2h y + 2i z = 1
+ */
+void EllipsoidFit::addSample(const float *v)
+{
+    double x, y, z, d[ELLIPSOID_FIT_PARAMS];
+    unsigned int i, j;
+
+    x = v[0] * _scale;
+    y = v[1] * _scale;
+    z = v[2] * _scale;
+
+    d[0] = x * x;
+    d[1] = y * y;
+    d[2] = z * z;
+    d[3] = 2.0 * x * y;
+    d[4] = 2.0 * x * z;
+    d[5] = 2.0 * y * z;
+    d[6] = 2.0 * x;
+    d[7] = 2.0 * y;
+    d[8] = 2.0 * z;
+
+    for (i = 0; i < ELLIPSOID_FIT_PARAMS; i++) {
+        for (j = 0; j < ELLIPSOID_FIT_PARAMS; j++) {
+            _ata[i][j] = _ata[i][j] * _forget + d[i] * d[j];
+        }
+        _atb[i] = _atb[i] * _forget + d[i];
+    }
+
+    _weight = _weight * _forget + 1.0;
+    for (i = 0; i < 3; i++) {
+        _sum[i] = _sum[i] * _forget + v[i] * _scale;
+        for (j = 0; j < 3; j++) {
+            _sum2[i][j] = _sum2[i][j] * _forget +
+                (v[i] * _scale) * (v[j] * _scale);
+        }
+    }
+
+    _count++;
+}
+
+bool EllipsoidFit::solve(float *center, float soft[3][3],
+                         float *radius) const
+{
+    double a[ELLIPSOID_FIT_PARAMS * ELLIPSOID_FIT_PARAMS];
+    double p[ELLIPSOID_FIT_PARAMS];
+    double m[3][3], mc[9], c[3], k, e[3], v[3][3], axis[3], r;
+    double cov[3][3], spread[3], ev[3][3];
+    unsigned int i, j, l;
+
+    if (_count < ELLIPSOID_FIT_MIN_POINTS) {
+        return false;
+    }
+
+    for (i = 0; i < ELLIPSOID_FIT_PARAMS; i++) {
+        for (j = 0; j < ELLIPSOID_FIT_PARAMS; j++) {
+            a[i * ELLIPSOID_FIT_PARAMS + j] = _ata[i][j];
+        }
+        p[i] = _atb[i];
+    }
+
+    if (!solve_linear(a, p, ELLIPSOID_FIT_PARAMS)) {
+        return false;
+    }
+
+    m[0][0] = p[0];
+    m[1][1] = p[1];
+    m[2][2] = p[2];
+    m[0][1] = m[1][0] = p[3];
+    m[0][2] = m[2][0] = p[4];
+    m[1][2] = m[2][1] = p[5];
+
+    /* Centre: m c = -g */
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j < 3; j++) {
+            mc[i * 3 + j] = m[i][j];
+        }
+        c[i] = -p[6 + i];
+    }
+
+    if (!solve_linear(mc, c, 3)) {
+        return false;
+    }
+
+    /* (x - c)' m (x - c) = 1 + c' m c */
+    k = 1.0;
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j < 3; j++) {
+            k += c[i] * m[i][j] * c[j];
+        }
+    }
+
+    if (k <= 0.0) {
+        return false;
+    }
+
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j < 3; j++) {
+            m[i][j] /= k;
+        }
+    }
+
+    eigen_sym3(m, e, v);
+    for (i = 0; i < 3; i++) {
+        if (e[i] <= 0.0) {
+            return false;      // Not an ellipsoid
+        }
+        axis[i] = 1.0 / sqrt(e[i]);
+    }
+
+    r = cbrt(axis[0] * axis[1] * axis[2]);
+    if ((fmax(fmax(axis[0], axis[1]), axis[2]) /
+         fmin(fmin(axis[0], axis[1]), axis[2])) > ELLIPSOID_FIT_MAX_RATIO) {
+        return false;
+    }
+
+    /* The points must spread out along every axis */
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j < 3; j++) {
+            cov[i][j] = _sum2[i][j] / _weight -
+                (_sum[i] / _weight) * (_sum[j] / _weight);
+        }
+    }
+
+    eigen_sym3(cov, spread, ev);
+    for (i = 0; i < 3; i++) {
+        if ((spread[i] <= 0.0) ||
+            (sqrt(spread[i]) < ELLIPSOID_FIT_MIN_SPREAD * r)) {
+            return false;
+        }
+    }
+
+    /* soft = r v diag(sqrt(e)) v' */
+    for (i = 0; i < 3; i++) {
+        center[i] = c[i] / _scale;
+        for (j = 0; j < 3; j++) {
+            soft[i][j] = 0.0;
+            for (l = 0; l < 3; l++) {
+                soft[i][j] += v[i][l] * sqrt(e[l]) * v[j][l];
+            }
+            soft[i][j] *= r;
+        }
+    }
+
+    *radius = r / _scale;
+
+    return true;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
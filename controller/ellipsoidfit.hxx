@@ -0,0 +1,62 @@
+/*
+ * ellipsoidfit.hxx
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#ifndef ELLIPSOIDFIT_HXX
+#define ELLIPSOIDFIT_HXX
+
+#define ELLIPSOID_FIT_PARAMS  9
+
+/*
+ * Least-squares fit of an ellipsoid to 3D points, for hard and soft iron
+ * calibration of a magnetometer. Points are folded into the normal
+ * equations as they come, with older ones forgotten at a fixed rate, so
+ * memory and time per point are constant. solve() returns the centre and
+ * the symmetric matrix that maps the ellipsoid onto a sphere of the same
+ * volume, and refuses if the points do not span all three axes well
+ * enough to pin the ellipsoid down.
+ */
+class EllipsoidFit
+{
+
+public:
+
+    EllipsoidFit(double forget = 0.999, double scale = 0.001);
+    ~EllipsoidFit();
+
+    void addSample(const float *v);
+    bool solve(float *center, float soft[3][3], float *radius) const;
+    unsigned int count(void) const;
+    void clear(void);
+
+private:
+
+    double _forget;
+    double _scale;             // Keeps the sums well conditioned
+    double _ata[ELLIPSOID_FIT_PARAMS][ELLIPSOID_FIT_PARAMS];
+    double _atb[ELLIPSOID_FIT_PARAMS];
+    double _weight;
+    double _sum[3];
+    double _sum2[3][3];
+    unsigned int _count;
+
+};
+
+inline unsigned int EllipsoidFit::count(void) const
+{
+    return _count;
+}
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,423 @@
+/*
+ * filterpipeline.hxx
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#ifndef FILTERPIPELINE_HXX
+#define FILTERPIPELINE_HXX
+
+#include "medianfilter.hxx"
+
+/*
+ * A sensor's filter chain, declared as a type:
+ *
+ *     FilterPipeline<float, 3, FilterOutlierGate<50>, FilterMedian<5>,
+ *                    FilterEMA<1, 4> > _filter;
+ *
+ * filters 3-axis samples through each stage in turn. The stages are
+ * expanded at compile time, there are no virtual calls. Each stage keeps
+ * its state as one array per quantity indexed by axis, so that the loops
+ * over the axes vectorize. Parameters are integer ratios, as C++11 takes
+ * no floating-point template arguments.
+ *
+ * A stage is a class with a nested Stage<T, A> that has apply(), which
+ * filters the A values in place, and clear().
+ */
+
+/*
+ * Replaces a sample that jumps more than Limit / Den away from the last
+ * accepted one on any axis with the last accepted one. After MaxRejects
+ * rejections in a row the signal is taken to have really moved.
+ */
+template <unsigned int Limit, unsigned int Den = 1,
+          unsigned int MaxRejects = 3>
+struct FilterOutlierGate {
+    template <typename T, unsigned int A>
+    class Stage {
+    public:
+        Stage() : _primed(false), _rejects(0) { }
+
+        void apply(T *v) {
+            const T limit = (T) Limit / (T) Den;
+            bool outlier = false;
+            unsigned int a;
+
+            if (_primed) {
+                for (a = 0; a < A; a++) {
+                    if ((v[a] - _last[a] > limit) ||
+                        (_last[a] - v[a] > limit)) {
+                        outlier = true;
+                    }
+                }
+            }
+
+            if (outlier && (_rejects < MaxRejects)) {
+                _rejects++;
+                for (a = 0; a < A; a++) {
+                    v[a] = _last[a];
+                }
+                return;
+            }
+
+            _rejects = 0;
+            _primed = true;
+            for (a = 0; a < A; a++) {
+                _last[a] = v[a];
+            }
+        }
+
+        void clear(void) {
+            _primed = false;
+            _rejects = 0;
+        }
+
+    private:
+        T _last[A];
+        bool _primed;
+        unsigned int _rejects;
+    };
+};
+
+/*
+ * Median of the last N samples, per axis.
+ */
+template <unsigned int N>
+struct FilterMedian {
+    template <typename T, unsigned int A>
+    class Stage {
+    public:
+        void apply(T *v) {
+            unsigned int a;
+
+            for (a = 0; a < A; a++) {
+                _median[a].addSample(v[a]);
+                v[a] = _median[a].median();
+            }
+        }
+
+        void clear(void) {
+            unsigned int a;
+
+            for (a = 0; a < A; a++) {
+                _median[a].clear();
+            }
+        }
+
+    private:
+        MedianFilter<T, N> _median[A];
+    };
+};
+
+/*
+ * Mean of the last N samples. The sums are recomputed every time the
+ * window wraps, so that rounding errors don't accumulate.
+ */
+template <unsigned int N>
+struct FilterMean {
+    template <typename T, unsigned int A>
+    class Stage {
+    public:
+        Stage() { clear(); }
+
+        void apply(T *v) {
+            unsigned int a, i;
+
+            if (_count == N) {
+                for (a = 0; a < A; a++) {
+                    _sum[a] -= _ring[_index][a];
+                }
+            } else {
+                _count++;
+            }
+
+            for (a = 0; a < A; a++) {
+                _ring[_index][a] = v[a];
+                _sum[a] += v[a];
+            }
+
+            _index++;
+            if (_index == N) {
+                _index = 0;
+                for (a = 0; a < A; a++) {
+                    _sum[a] = (T) 0;
+                }
+                for (i = 0; i < N; i++) {
+                    for (a = 0; a < A; a++) {
+                        _sum[a] += _ring[i][a];
+                    }
+                }
+            }
+
+            for (a = 0; a < A; a++) {
+                v[a] = _sum[a] / (T) _count;
+            }
+        }
+
+        void clear(void) {
+            unsigned int a;
+
+            _index = 0;
+            _count = 0;
+            for (a = 0; a < A; a++) {
+                _sum[a] = (T) 0;
+            }
+        }
+
+    private:
+        T _ring[N][A];
+        T _sum[A];
+        unsigned int _index;
+        unsigned int _count;
+    };
+};
+
+/*
+ * Exponential moving average with alpha = Num / Den, seeded with the
+ * first sample.
+ */
+template <unsigned int Num, unsigned int Den>
+struct FilterEMA {
+    template <typename T, unsigned int A>
+    class Stage {
+    public:
+        Stage() : _primed(false) { }
+
+        void apply(T *v) {
+            const T alpha = (T) Num / (T) Den;
+            unsigned int a;
+
+            if (!_primed) {
+                _primed = true;
+                for (a = 0; a < A; a++) {
+                    _s[a] = v[a];
+                }
+                return;
+            }
+
+            for (a = 0; a < A; a++) {
+                _s[a] += alpha * (v[a] - _s[a]);
+                v[a] = _s[a];
+            }
+        }
+
+        void clear(void) {
+            _primed = false;
+        }
+
+    private:
+        T _s[A];
+        bool _primed;
+    };
+};
+
+/*
+ * Kalman filter for a constant signal in noise, per axis, with process
+ * noise Q / Den and measurement noise R / Den. The error covariance does
+ * not depend on the measurements, so one is shared by all axes.
+ */
+template <unsigned int Q, unsigned int R, unsigned int Den = 1000>
+struct FilterKalman {
+    template <typename T, unsigned int A>
+    class Stage {
+    public:
+        Stage() : _p((T) R / (T) Den), _primed(false) { }
+
+        void apply(T *v) {
+            const T q = (T) Q / (T) Den;
+            const T r = (T) R / (T) Den;
+            unsigned int a;
+            T k;
+
+            if (!_primed) {
+                _primed = true;
+                for (a = 0; a < A; a++) {
+                    _x[a] = v[a];
+                }
+                return;
+            }
+
+            _p += q;
+            k = _p / (_p + r);
+            _p *= ((T) 1 - k);
+            for (a = 0; a < A; a++) {
+                _x[a] += k * (v[a] - _x[a]);
+                v[a] = _x[a];
+            }
+        }
+
+        void clear(void) {
+            _p = (T) R / (T) Den;
+            _primed = false;
+        }
+
+    private:
+        T _x[A];
+        T _p;
+        bool _primed;
+    };
+};
+
+/*
+ * The stages, nested one in the next.
+ */
+template <typename T, unsigned int A, typename... Filters>
+class FilterChain;
+
+template <typename T, unsigned int A>
+class FilterChain<T, A> {
+public:
+    void apply(T *v) { (void)(v); }
+    void clear(void) { }
+};
+
+template <typename T, unsigned int A, typename F, typename... Filters>
+class FilterChain<T, A, F, Filters...> {
+public:
+    void apply(T *v) {
+        _stage.apply(v);
+        _next.apply(v);
+    }
+
+    void clear(void) {
+        _stage.clear();
+        _next.clear();
+    }
+
+private:
+    typename F::template Stage<T, A> _stage;
+    FilterChain<T, A, Filters...> _next;
+};
+
+template <typename T, unsigned int A, typename... Filters>
+class FilterPipeline
+{
+
+public:
+
+    FilterPipeline();
+    ~FilterPipeline();
+
+    void addSample(const T *v);
+    void addSample(T v);
+    T raw(unsigned int axis = 0) const;
+    T filtered(unsigned int axis = 0) const;
+    unsigned int count(void) const;
+    void clear(void);
+
+private:
+
+    FilterChain<T, A, Filters...> _chain;
+    T _raw[A];
+    T _filtered[A];
+    unsigned int _sampleCount;
+
+};
+
+template <typename T, unsigned int A, typename... Filters>
+FilterPipeline<T, A, Filters...>::FilterPipeline()
+    : _sampleCount(0)
+{
+    unsigned int a;
+
+    for (a = 0; a < A; a++) {
+        _raw[a] = (T) 0;
+        _filtered[a] = (T) 0;
+    }
+}
+
+template <typename T, unsigned int A, typename... Filters>
+FilterPipeline<T, A, Filters...>::~FilterPipeline()
+{
+
+}
+
+/*
+ * A sample with a NaN on any axis is kept whole as the raw value but not
+ * filtered.
+ */
+template <typename T, unsigned int A, typename... Filters>
+void FilterPipeline<T, A, Filters...>::addSample(const T *v)
+{
+    T s[A];
+    unsigned int a;
+    bool nan = false;
+
+    for (a = 0; a < A; a++) {
+        _raw[a] = v[a];
+        s[a] = v[a];
+        if (v[a] != v[a]) {
+            nan = true;
+        }
+    }
+
+    if (nan) {
+        return;
+    }
+
+    _chain.apply(s);
+
+    for (a = 0; a < A; a++) {
+        _filtered[a] = s[a];
+    }
+    _sampleCount++;
+}
+
+template <typename T, unsigned int A, typename... Filters>
+void FilterPipeline<T, A, Filters...>::addSample(T v)
+{
+    static_assert(A == 1, "one value per sample is for 1-axis pipelines");
+
+    addSample(&v);
+}
+
+template <typename T, unsigned int A, typename... Filters>
+T FilterPipeline<T, A, Filters...>::raw(unsigned int axis) const
+{
+    if (axis >= A) {
+        return (T) 0;
+    }
+
+    return _raw[axis];
+}
+
+template <typename T, unsigned int A, typename... Filters>
+T FilterPipeline<T, A, Filters...>::filtered(unsigned int axis) const
+{
+    if (axis >= A) {
+        return (T) 0;
+    }
+
+    return _filtered[axis];
+}
+
+template <typename T, unsigned int A, typename... Filters>
+unsigned int FilterPipeline<T, A, Filters...>::count(void) const
+{
+    return _sampleCount;
+}
+
+template <typename T, unsigned int A, typename... Filters>
+void FilterPipeline<T, A, Filters...>::clear(void)
+{
+    unsigned int a;
+
+    _chain.clear();
+    _sampleCount = 0;
+    for (a = 0; a < A; a++) {
+        _raw[a] = (T) 0;
+        _filtered[a] = (T) 0;
+    }
+}
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,644 @@
+/*
+ * gestures.cxx
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/time.h>
+#include <bsd/sys/time.h>
+#include "rabbit.hxx"
+
+/*
+ * Gestures are loaded once at startup from *.gst files. Each line of a
+ * file is one step, '#' starts a comment:
+ *
+ *   gesture <name>
+ *   right|left|both <sr> <se> <ee> <we> <wr> <grip> <ms> [skip]
+ *   clear right|left|both
+ *   head <rotation> <tilt>
+ *   ears up|back|down|fold|halfdown
+ *   eyebrows relaxed|perplexed|surprised|happy|jubilant|angry|...
+ *   mouth beh|smile|cylon|speak
+ *   speak "<text>"
+ *   log "<text>"
+ *   wait <ms>
+ *
+ * A '-' in place of a number keeps the last planned value. Arm keyframes
+ * are appended to the servo schedules as they are reached, 'wait' delays
+ * the steps that follow it.
+ */
+
+#define GESTURE_MAX_TOKENS  12
+
+using namespace std;
+
+static const char *gesture_dirs[] = {
+    "/usr/local/share/rabbit/gestures",
+    "gestures",
+    NULL,
+};
+
+static const char *ears_names[] = {
+    "up", "back", "down", "fold", "halfdown", NULL,
+};
+
+static const char *eyebrows_names[] = {
+    "relaxed", "perplexed", "surprised", "happy", "jubilant",
+    "angry", "furious", "sad", "depressed", NULL,
+};
+
+static const char *mouth_names[] = {
+    "beh", "smile", "cylon", "speak", NULL,
+};
+
+static unsigned int instance = 0;
+
+Gestures::Gestures()
+{
+    unsigned int i;
+    char buf[128];
+
+    if (instance != 0) {
+        fprintf(stderr, "Gestures can be instantiated only once!\n");
+        exit(EXIT_FAILURE);
+    } else {
+        instance++;
+    }
+
+    for (i = 0; gesture_dirs[i] != NULL; i++) {
+        if (load(gesture_dirs[i]) == 0) {
+            break;
+        }
+    }
+
+    if (gesture_dirs[i] == NULL) {
+        fprintf(stderr, "Gestures: no gesture directory found!\n");
+    } else {
+        snprintf(buf, sizeof(buf) - 1, "Loaded %zu gestures from %s\n",
+                 _gestures.size(), gesture_dirs[i]);
+        LOG(buf);
+    }
+
+    _generation = 0;
+    _running = true;
+    pthread_mutex_init(&_mutex, NULL);
+    pthread_cond_init(&_cond, NULL);
+    pthread_create(&_thread, NULL, Gestures::thread_func, this);
+    pthread_setname_np(_thread, "R'Gestures");
+
+    printf("Gestures is online\n");
+}
+
+Gestures::~Gestures()
+{
+    pthread_mutex_lock(&_mutex);
+    _running = false;
+    pthread_cond_broadcast(&_cond);
+    pthread_mutex_unlock(&_mutex);
+    pthread_join(_thread, NULL);
+    pthread_mutex_destroy(&_mutex);
+    pthread_cond_destroy(&_cond);
+
+    instance--;
+    printf("Gestures is offline\n");
+}
+
+int Gestures::load(const char *dir)
+{
+    DIR *dp;
+    struct dirent *de;
+    char path[256];
+    size_t len;
+
+    dp = opendir(dir);
+    if (dp == NULL) {
+        return -1;
+    }
+
+    while ((de = readdir(dp)) != NULL) {
+        len = strlen(de->d_name);
+        if (len < 4 || strcmp(de->d_name + len - 4, ".gst") != 0) {
+            continue;
+        }
+
+        snprintf(path, sizeof(path) - 1, "%s/%s", dir, de->d_name);
+        loadFile(path);
+    }
+
+    closedir(dp);
+
+    return 0;
+}
+
+int Gestures::loadFile(const char *path)
+{
+    int ret = 0;
+    FILE *fp = NULL;
+    char line[256];
+    unsigned int lineno = 0;
+    bool inGesture = false;
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Gestures: cannot open %s!\n", path);
+        ret = -1;
+        goto done;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        lineno++;
+        if (parseLine(line, path, lineno, &inGesture) != 0) {
+            ret = -1;
+        }
+    }
+
+done:
+
+    if (fp) {
+        fclose(fp);
+    }
+
+    return ret;
+}
+
+uint16_t Gestures::addString(const char *s)
+{
+    uint16_t offset;
+
+    offset = _strings.size();
+    _strings.insert(_strings.end(), s, s + strlen(s) + 1);
+
+    return offset;
+}
+
+/*
+ * Split a line into whitespace separated tokens in place. Double quoted
+ * tokens may contain whitespace and '\n' escapes.
+ */
+static unsigned int tokenize(char *line, char *tokens[], unsigned int max)
+{
+    unsigned int n = 0;
+    char *s = line;
+    char *d;
+
+    while (*s != '\0' && n < max) {
+        while (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n') {
+            s++;
+        }
+
+        if (*s == '\0' || *s == '#') {
+            break;
+        }
+
+        if (*s == '"') {
+            s++;
+            tokens[n++] = s;
+            for (d = s; *s != '\0' && *s != '"'; s++) {
+                if (s[0] == '\\' && s[1] == 'n') {
+                    *d++ = '\n';
+                    s++;
+                } else {
+                    *d++ = *s;
+                }
+            }
+            if (*s == '"') {
+                s++;
+            }
+            *d = '\0';
+        } else {
+            tokens[n++] = s;
+            while (*s != '\0' && *s != ' ' && *s != '\t' &&
+                   *s != '\r' && *s != '\n') {
+                s++;
+            }
+            if (*s != '\0') {
+                *s++ = '\0';
+            }
+        }
+    }
+
+    return n;
+}
+
+static int lookup(const char *name, const char *names[])
+{
+    int i;
+
+    for (i = 0; names[i] != NULL; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static int parse_value(const char *token, float *v)
+{
+    char *endptr;
+
+    if (strcmp(token, "-") == 0) {
+        *v = NAN;
+        return 0;
+    }
+
+    *v = strtof(token, &endptr);
+    if (endptr == token || *endptr != '\0') {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int parse_arms(const char *token)
+{
+    if (strcmp(token, "right") == 0) {
+        return GESTURE_RIGHT_ARM;
+    } else if (strcmp(token, "left") == 0) {
+        return GESTURE_LEFT_ARM;
+    } else if (strcmp(token, "both") == 0) {
+        return GESTURE_RIGHT_ARM | GESTURE_LEFT_ARM;
+    }
+
+    return -1;
+}
+
+int Gestures::parseLine(char *line, const char *path, unsigned int lineno,
+                        bool *inGesture)
+{
+    char *tokens[GESTURE_MAX_TOKENS];
+    unsigned int n;
+    unsigned int i;
+    int arg;
+    float ms;
+    struct gesture_step step;
+    struct gesture g;
+
+    n = tokenize(line, tokens, GESTURE_MAX_TOKENS);
+    if (n == 0) {
+        return 0;
+    }
+
+    memset(&step, 0x0, sizeof(step));
+    for (i = 0; i < 6; i++) {
+        step.v[i] = NAN;
+    }
+
+    if (strcmp(tokens[0], "gesture") == 0) {
+        *inGesture = false;
+        if (n != 2) {
+            goto invalid;
+        }
+
+        for (i = 0; i < _gestures.size(); i++) {
+            if (strcmp(str(_gestures[i].name), tokens[1]) == 0) {
+                fprintf(stderr, "%s:%u: duplicate gesture '%s'!\n",
+                        path, lineno, tokens[1]);
+                return -1;
+            }
+        }
+
+        g.name = addString(tokens[1]);
+        g.first = _steps.size();
+        g.count = 0;
+        _gestures.push_back(g);
+        *inGesture = true;
+        return 0;
+    }
+
+    if (*inGesture == false) {
+        fprintf(stderr, "%s:%u: step outside of a gesture!\n", path, lineno);
+        return -1;
+    }
+
+    if ((arg = parse_arms(tokens[0])) > 0) {
+        if (n != 8 && !(n == 9 && strcmp(tokens[8], "skip") == 0)) {
+            goto invalid;
+        }
+
+        step.op = GOP_ARM;
+        step.arg = arg | (n == 9 ? GESTURE_SKIP : 0);
+        for (i = 0; i < 6; i++) {
+            if (parse_value(tokens[i + 1], &step.v[i]) != 0) {
+                goto invalid;
+            }
+        }
+        if (parse_value(tokens[7], &ms) != 0 || isnan(ms) || ms < 0) {
+            goto invalid;
+        }
+        step.ms = (uint32_t) ms;
+    } else if (strcmp(tokens[0], "clear") == 0) {
+        if (n != 2 || (arg = parse_arms(tokens[1])) < 0) {
+            goto invalid;
+        }
+        step.op = GOP_CLEAR;
+        step.arg = arg;
+    } else if (strcmp(tokens[0], "head") == 0) {
+        if (n != 3 ||
+            parse_value(tokens[1], &step.v[0]) != 0 ||
+            parse_value(tokens[2], &step.v[1]) != 0) {
+            goto invalid;
+        }
+        step.op = GOP_HEAD;
+    } else if (strcmp(tokens[0], "ears") == 0) {
+        if (n != 2 || (arg = lookup(tokens[1], ears_names)) < 0) {
+            goto invalid;
+        }
+        step.op = GOP_EARS;
+        step.arg = arg;
+    } else if (strcmp(tokens[0], "eyebrows") == 0) {
+        if (n != 2 || (arg = lookup(tokens[1], eyebrows_names)) < 0) {
+            goto invalid;
+        }
+        step.op = GOP_EYEBROWS;
+        step.arg = arg;
+    } else if (strcmp(tokens[0], "mouth") == 0) {
+        if (n != 2 || (arg = lookup(tokens[1], mouth_names)) < 0) {
+            goto invalid;
+        }
+        step.op = GOP_MOUTH;
+        step.arg = arg;
+    } else if (strcmp(tokens[0], "speak") == 0) {
+        if (n != 2) {
+            goto invalid;
+        }
+        step.op = GOP_SPEAK;
+        step.text = addString(tokens[1]);
+    } else if (strcmp(tokens[0], "log") == 0) {
+        if (n != 2) {
+            goto invalid;
+        }
+        step.op = GOP_LOG;
+        step.text = addString(tokens[1]);
+    } else if (strcmp(tokens[0], "wait") == 0) {
+        if (n != 2 || parse_value(tokens[1], &ms) != 0 ||
+            isnan(ms) || ms < 0) {
+            goto invalid;
+        }
+        step.op = GOP_WAIT;
+        step.ms = (uint32_t) ms;
+    } else {
+        goto invalid;
+    }
+
+    _steps.push_back(step);
+    _gestures.back().count++;
+
+    return 0;
+
+invalid:
+
+    fprintf(stderr, "%s:%u: invalid '%s' step!\n", path, lineno, tokens[0]);
+
+    return -1;
+}
+
+bool Gestures::play(const char *name)
+{
+    unsigned int i;
+    struct gesture_player player;
+    char buf[128];
+
+    for (i = 0; i < _gestures.size(); i++) {
+        if (strcmp(str(_gestures[i].name), name) == 0) {
+            break;
+        }
+    }
+
+    if (i == _gestures.size()) {
+        snprintf(buf, sizeof(buf) - 1, "Gesture '%s' not found\n", name);
+        LOG(buf);
+        return false;
+    }
+
+    player.gesture = i;
+    player.pc = 0;
+    clock_gettime(CLOCK_REALTIME, &player.wake);
+
+    pthread_mutex_lock(&_mutex);
+    _players.push_back(player);
+    _generation++;
+    pthread_cond_signal(&_cond);
+    pthread_mutex_unlock(&_mutex);
+
+    return true;
+}
+
+bool Gestures::isPlaying(void) const
+{
+    bool playing;
+
+    pthread_mutex_lock(&_mutex);
+    playing = !_players.empty();
+    pthread_mutex_unlock(&_mutex);
+
+    return playing;
+}
+
+void Gestures::stop(void)
+{
+    pthread_mutex_lock(&_mutex);
+    _players.clear();
+    pthread_mutex_unlock(&_mutex);
+}
+
+void Gestures::execute(const struct gesture_step *step)
+{
+    char buf[128];
+
+    switch (step->op) {
+    case GOP_ARM:
+        if ((step->arg & GESTURE_RIGHT_ARM) && rightArm) {
+            rightArm->planMotions(step->v[0], step->v[1],
+                                  step->v[2],
+                                  step->v[3], step->v[4],
+                                  step->v[5],
+                                  step->ms,
+                                  (step->arg & GESTURE_SKIP) != 0);
+        }
+        if ((step->arg & GESTURE_LEFT_ARM) && leftArm) {
+            leftArm->planMotions(step->v[0], step->v[1],
+                                 step->v[2],
+                                 step->v[3], step->v[4],
+                                 step->v[5],
+                                 step->ms,
+                                 (step->arg & GESTURE_SKIP) != 0);
+        }
+        break;
+    case GOP_CLEAR:
+        if ((step->arg & GESTURE_RIGHT_ARM) && rightArm) {
+            rightArm->clearMotions();
+        }
+        if ((step->arg & GESTURE_LEFT_ARM) && leftArm) {
+            leftArm->clearMotions();
+        }
+        break;
+    case GOP_HEAD:
+        if (head) {
+            if (!isnan(step->v[0])) {
+                head->rotate(step->v[0]);
+            }
+            if (!isnan(step->v[1])) {
+                head->tilt(step->v[1]);
+            }
+        }
+        break;
+    case GOP_EARS:
+        if (head) {
+            switch (step->arg) {
+            case GEARS_UP:
+                head->earsUp();
+                break;
+            case GEARS_BACK:
+                head->earsBack();
+                break;
+            case GEARS_DOWN:
+                head->earsDown();
+                break;
+            case GEARS_FOLD:
+                head->earsFold();
+                break;
+            case GEARS_HALFDOWN:
+                head->earsHalfDown();
+                break;
+            default:
+                break;
+            }
+        }
+        break;
+    case GOP_EYEBROWS:
+        if (head) {
+            head->eyebrowSetDisposition(
+                (enum Head::EyebrowDisposition) step->arg);
+        }
+        break;
+    case GOP_MOUTH:
+        if (mouth) {
+            switch (step->arg) {
+            case GMOUTH_BEH:
+                mouth->beh();
+                break;
+            case GMOUTH_SMILE:
+                mouth->smile();
+                break;
+            case GMOUTH_CYLON:
+                mouth->cylon();
+                break;
+            case GMOUTH_SPEAK:
+                mouth->speak();
+                break;
+            default:
+                break;
+            }
+        }
+        break;
+    case GOP_SPEAK:
+        if (speech) {
+            speech->speak(str(step->text));
+        }
+        break;
+    case GOP_LOG:
+        snprintf(buf, sizeof(buf) - 1, "%s\n", str(step->text));
+        LOG(buf);
+        break;
+    default:
+        break;
+    }
+}
+
+void *Gestures::thread_func(void *args)
+{
+    Gestures *gestures = (Gestures *) args;
+
+    gestures->run();
+
+    return NULL;
+}
+
+void Gestures::run(void)
+{
+    struct timespec now, twait, tms;
+    vector<struct gesture_player>::iterator it;
+    vector<const struct gesture_step *> due;
+    vector<const struct gesture_step *>::iterator it2;
+    unsigned int generation;
+    bool waiting;
+
+    while (_running) {
+        due.clear();
+
+        pthread_mutex_lock(&_mutex);
+
+        /* Collect the steps that are due from every playing gesture */
+        clock_gettime(CLOCK_REALTIME, &now);
+        for (it = _players.begin(); it != _players.end(); ) {
+            const struct gesture &g = _gestures[it->gesture];
+
+            while (it->pc < g.count && timespeccmp(&it->wake, &now, <=)) {
+                const struct gesture_step *step = &_steps[g.first + it->pc];
+
+                it->pc++;
+                if (step->op == GOP_WAIT) {
+                    tms.tv_sec = step->ms / 1000;
+                    tms.tv_nsec = (step->ms % 1000) * 1000000;
+                    timespecadd(&it->wake, &tms, &it->wake);
+                } else {
+                    due.push_back(step);
+                }
+            }
+
+            if (it->pc >= g.count) {
+                it = _players.erase(it);
+            } else {
+                it++;
+            }
+        }
+
+        /* Sleep until the earliest wake up, or until a new gesture */
+        generation = _generation;
+        waiting = false;
+        for (it = _players.begin(); it != _players.end(); it++) {
+            if (waiting == false || timespeccmp(&it->wake, &twait, <)) {
+                twait = it->wake;
+                waiting = true;
+            }
+        }
+
+        pthread_mutex_unlock(&_mutex);
+
+        for (it2 = due.begin(); it2 != due.end(); it2++) {
+            execute(*it2);
+        }
+
+        if (!due.empty()) {
+            continue;
+        }
+
+        /* A play() since the players were looked at has already signaled */
+        pthread_mutex_lock(&_mutex);
+        if (_running && (generation == _generation)) {
+            if (_players.empty()) {
+                pthread_cond_wait(&_cond, &_mutex);
+            } else if (waiting) {
+                pthread_cond_timedwait(&_cond, &_mutex, &twait);
+            }
+        }
+        pthread_mutex_unlock(&_mutex);
+    }
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,122 @@
+/*
+ * gestures.hxx
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#ifndef GESTURES_HXX
+#define GESTURES_HXX
+
+#include <stdint.h>
+#include <vector>
+
+enum gesture_op {
+    GOP_ARM = 0,       // Arm keyframe
+    GOP_CLEAR = 1,     // Clear arm motion schedules
+    GOP_HEAD = 2,      // Head rotation and tilt
+    GOP_EARS = 3,      // Ear pose
+    GOP_EYEBROWS = 4,  // Eyebrow disposition
+    GOP_MOUTH = 5,     // Mouth mode
+    GOP_SPEAK = 6,     // Speech cue
+    GOP_LOG = 7,       // Log message
+    GOP_WAIT = 8,      // Delay the following steps
+};
+
+enum gesture_ears {
+    GEARS_UP = 0,
+    GEARS_BACK = 1,
+    GEARS_DOWN = 2,
+    GEARS_FOLD = 3,
+    GEARS_HALFDOWN = 4,
+};
+
+enum gesture_mouth {
+    GMOUTH_BEH = 0,
+    GMOUTH_SMILE = 1,
+    GMOUTH_CYLON = 2,
+    GMOUTH_SPEAK = 3,
+};
+
+#define GESTURE_RIGHT_ARM  0x1
+#define GESTURE_LEFT_ARM   0x2
+#define GESTURE_SKIP       0x4  // Arm keyframe skipped if already at point
+
+struct gesture_step {
+    uint8_t op;
+    uint8_t arg;       // Arm mask, ear pose, disposition or mouth mode
+    uint16_t text;     // Offset into the string pool
+    uint32_t ms;
+    float v[6];        // NAN keeps the last planned value
+};
+
+struct gesture {
+    uint16_t name;     // Offset into the string pool
+    uint16_t first;    // Index of the first step
+    uint16_t count;    // Number of steps
+};
+
+struct gesture_player {
+    unsigned int gesture;
+    unsigned int pc;
+    struct timespec wake;
+};
+
+class Gestures {
+
+public:
+
+    Gestures();
+    ~Gestures();
+
+    bool play(const char *name);
+    bool isPlaying(void) const;
+    void stop(void);
+    unsigned int count(void) const;
+
+private:
+
+    int load(const char *dir);
+    int loadFile(const char *path);
+    int parseLine(char *line, const char *path, unsigned int lineno,
+                  bool *inGesture);
+    uint16_t addString(const char *s);
+    const char *str(uint16_t offset) const;
+    void execute(const struct gesture_step *step);
+
+    static void *thread_func(void *);
+    void run(void);
+
+    std::vector<struct gesture> _gestures;
+    std::vector<struct gesture_step> _steps;
+    std::vector<char> _strings;
+    std::vector<struct gesture_player> _players;
+    unsigned int _generation;  // Bumped by play()
+
+    bool _running;
+    pthread_t _thread;
+    mutable pthread_mutex_t _mutex;
+    pthread_cond_t _cond;
+
+};
+
+inline unsigned int Gestures::count(void) const
+{
+    return _gestures.size();
+}
+
+inline const char *Gestures::str(uint16_t offset) const
+{
+    return &_strings[offset];
+}
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
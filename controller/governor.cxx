@@ -0,0 +1,306 @@
+/*
+ * governor.cxx
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#include <sys/time.h>
+#include <bsd/sys/time.h>
+#include "rabbit.hxx"
+
+/*
+ * Levels are entered at these thresholds and left only once the reading
+ * has recovered by the hysteresis.
+ */
+#define GOVERNOR_INTERVAL_MS      1000
+#define GOVERNOR_SOC_HYST          5.0
+#define GOVERNOR_TEMP_HYST         5.0
+#define GOVERNOR_CAMERA_FPS        5.0
+
+static const float soc_thresholds[GOVERNOR_CRITICAL] = {
+    40.0, 25.0, 10.0,
+};
+
+static const float temp_thresholds[GOVERNOR_CRITICAL] = {
+    70.0, 75.0, 80.0,
+};
+
+static const char *level_names[] = {
+    "normal",
+    "eco",
+    "low",
+    "critical",
+};
+
+static bool face_detection_on(void)
+{
+    return camera && camera->isVisionEn();
+}
+
+static void face_detection_enable(bool en)
+{
+    camera->enVision(en);
+}
+
+static bool camera_full_rate(void)
+{
+    return camera && (camera->frameRateLimit() == 0.0);
+}
+
+static void camera_full_rate_enable(bool en)
+{
+    camera->limitFrameRate(en ? 0.0 : GOVERNOR_CAMERA_FPS);
+}
+
+static bool stereo_on(void)
+{
+    return stereovision && stereovision->isVisionEn();
+}
+
+static void stereo_enable(bool en)
+{
+    stereovision->enVision(en);
+}
+
+static bool lidar_on(void)
+{
+    return lidar && lidar->isEnabled();
+}
+
+static void lidar_enable(bool en)
+{
+    lidar->enable(en);
+}
+
+static bool voice_on(void)
+{
+    return voice && voice->isEnabled();
+}
+
+static void voice_enable(bool en)
+{
+    voice->enable(en);
+}
+
+static const struct governor_load loads[] = {
+    { "face detection",    1.5, GOVERNOR_ECO,
+      face_detection_on, face_detection_enable, },
+    { "camera frame rate", 0.5, GOVERNOR_ECO,
+      camera_full_rate, camera_full_rate_enable, },
+    { "stereo-vision",     3.5, GOVERNOR_LOW,
+      stereo_on, stereo_enable, },
+    { "LiDAR",             2.2, GOVERNOR_LOW,
+      lidar_on, lidar_enable, },
+    { "voice",             0.8, GOVERNOR_CRITICAL,
+      voice_on, voice_enable, },
+};
+
+#define GOVERNOR_LOADS  (sizeof(loads) / sizeof(loads[0]))
+
+static unsigned int instance = 0;
+
+/*
+ * Level of a reading that gets worse as it rises, with hysteresis on the
+ * way down.
+ */
+static enum governor_level stepped(float value, const float *thresholds,
+                                   float hysteresis,
+                                   enum governor_level current)
+{
+    unsigned int level = GOVERNOR_NORMAL;
+    unsigned int held;
+
+    while ((level < GOVERNOR_CRITICAL) && (value >= thresholds[level])) {
+        level++;
+    }
+
+    held = current;
+    while ((held > level) && (value < thresholds[held - 1] - hysteresis)) {
+        held--;
+    }
+
+    return (enum governor_level) (held > level ? held : level);
+}
+
+Governor::Governor()
+    : _level(GOVERNOR_NORMAL),
+      _battery(GOVERNOR_NORMAL),
+      _thermal(GOVERNOR_NORMAL),
+      _shed(0),
+      _running(false)
+{
+    if (instance != 0) {
+        fprintf(stderr, "Governor can be instantiated only once!\n");
+        exit(EXIT_FAILURE);
+    } else {
+        instance++;
+    }
+
+    _running = true;
+    pthread_mutex_init(&_mutex, NULL);
+    pthread_cond_init(&_cond, NULL);
+    pthread_create(&_thread, NULL, Governor::thread_func, this);
+    pthread_setname_np(_thread, "R'Governor");
+
+    printf("Governor is online\n");
+}
+
+Governor::~Governor()
+{
+    pthread_mutex_lock(&_mutex);
+    _running = false;
+    pthread_cond_broadcast(&_cond);
+    pthread_mutex_unlock(&_mutex);
+    pthread_join(_thread, NULL);
+    pthread_mutex_destroy(&_mutex);
+    pthread_cond_destroy(&_cond);
+
+    instance--;
+    printf("Governor is offline\n");
+}
+
+const char *Governor::levelName(void) const
+{
+    return level_names[_level];
+}
+
+float Governor::shedWatts(void) const
+{
+    float watts = 0.0;
+    unsigned int i;
+
+    for (i = 0; i < GOVERNOR_LOADS; i++) {
+        if (_shed & (1 << i)) {
+            watts += loads[i].watts;
+        }
+    }
+
+    return watts;
+}
+
+void *Governor::thread_func(void *args)
+{
+    Governor *governor = (Governor *) args;
+
+    governor->run();
+
+    return NULL;
+}
+
+/*
+ * Thresholds are on the state of charge negated, so that rising is worse.
+ */
+enum governor_level Governor::batteryLevel(void)
+{
+    float thresholds[GOVERNOR_CRITICAL];
+    unsigned int i;
+
+    if ((power == NULL) || !power->isValid()) {
+        return GOVERNOR_NORMAL;
+    }
+
+    for (i = 0; i < GOVERNOR_CRITICAL; i++) {
+        thresholds[i] = -soc_thresholds[i];
+    }
+
+    _battery = stepped(-power->soc(), thresholds, GOVERNOR_SOC_HYST,
+                       _battery);
+
+    return _battery;
+}
+
+enum governor_level Governor::thermalLevel(void)
+{
+    if ((ambience == NULL) || (ambience->socTemp() <= 0.0)) {
+        return GOVERNOR_NORMAL;
+    }
+
+    _thermal = stepped(ambience->socTemp(), temp_thresholds,
+                       GOVERNOR_TEMP_HYST, _thermal);
+
+    return _thermal;
+}
+
+/*
+ * Shed the loads of the new level that are on, restore those we shed
+ * that the new level allows again.
+ */
+void Governor::apply(enum governor_level level)
+{
+    unsigned int i;
+    char buf[128];
+
+    for (i = 0; i < GOVERNOR_LOADS; i++) {
+        if ((loads[i].level <= level) && loads[i].isOn()) {
+            loads[i].enable(false);
+            _shed |= (1 << i);
+            snprintf(buf, sizeof(buf) - 1, "Governor shed %s (%.1fW)\n",
+                     loads[i].name, loads[i].watts);
+            LOG(buf);
+        } else if ((loads[i].level > level) && (_shed & (1 << i))) {
+            loads[i].enable(true);
+            _shed &= ~(1 << i);
+            snprintf(buf, sizeof(buf) - 1, "Governor restored %s\n",
+                     loads[i].name);
+            LOG(buf);
+        }
+    }
+}
+
+void Governor::run(void)
+{
+    struct timespec ts, tloop;
+    enum governor_level battery, thermal, level;
+    char buf[128];
+    int l;
+
+    tloop.tv_sec = GOVERNOR_INTERVAL_MS / 1000;
+    tloop.tv_nsec = (GOVERNOR_INTERVAL_MS % 1000) * 1000000;
+
+    while (_running) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        timespecadd(&ts, &tloop, &ts);
+
+        battery = batteryLevel();
+        thermal = thermalLevel();
+        level = battery > thermal ? battery : thermal;
+
+        if (level != _level) {
+            snprintf(buf, sizeof(buf) - 1,
+                     "Governor %s -> %s (battery %s, thermal %s)\n",
+                     level_names[_level], level_names[level],
+                     level_names[battery], level_names[thermal]);
+            LOG(buf);
+            if (level > _level) {
+                snprintf(buf, sizeof(buf) - 1, "Power saving %s",
+                         level_names[level]);
+                speech->speak(buf);
+            }
+
+            _level = level;
+            apply(level);
+
+            if (mosquitto) {
+                l = (int) level;
+                mosquitto->publish("rabbit/governor/level",
+                                   sizeof(l), &l, 2, 0);
+            }
+        }
+
+        pthread_mutex_lock(&_mutex);
+        if (_running) {
+            pthread_cond_timedwait(&_cond, &_mutex, &ts);
+        }
+        pthread_mutex_unlock(&_mutex);
+    }
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
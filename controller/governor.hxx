@@ -0,0 +1,78 @@
+/*
+ * governor.hxx
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#ifndef GOVERNOR_HXX
+#define GOVERNOR_HXX
+
+enum governor_level {
+    GOVERNOR_NORMAL = 0,
+    GOVERNOR_ECO = 1,
+    GOVERNOR_LOW = 2,
+    GOVERNOR_CRITICAL = 3,
+};
+
+struct governor_load {
+    const char *name;
+    float watts;               // Saved by shedding it
+    enum governor_level level; // Shed from this level up
+    bool (*isOn)(void);
+    void (*enable)(bool en);
+};
+
+/*
+ * Sheds load in steps when the battery runs low or the SoC runs hot.
+ * Each load declares its power and the level from which it is shed, the
+ * least important ones first. Only what the governor shed is restored,
+ * and nothing is touched while the level holds, so that manual changes
+ * stick.
+ */
+class Governor {
+
+public:
+
+    Governor();
+    ~Governor();
+
+    enum governor_level level(void) const;
+    const char *levelName(void) const;
+    float shedWatts(void) const;
+
+private:
+
+    static void *thread_func(void *args);
+    void run(void);
+    enum governor_level batteryLevel(void);
+    enum governor_level thermalLevel(void);
+    void apply(enum governor_level level);
+
+    enum governor_level _level;
+    enum governor_level _battery;
+    enum governor_level _thermal;
+    unsigned int _shed;        // Bit n set if load n was shed by us
+
+    bool _running;
+    pthread_t _thread;
+    pthread_mutex_t _mutex;
+    pthread_cond_t _cond;
+
+};
+
+inline enum governor_level Governor::level(void) const
+{
+    return _level;
+}
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -4,8 +4,8 @@
  * Copyright (C) 2023, Charles Chiou
  */
 
-#include <sys/time.h>
-#include <bsd/sys/time.h>
+#include <math.h>
+#include <string.h>
 #include "rabbit.hxx"
 
 #define HEAD_ROTATION_SERVO         16
@@ -80,6 +80,12 @@
 
 #define EAR_DROP_SECONDS            15
 
+#define TRACK_WINDOW_MS           1000
+#define TRACK_OUTLIER_DEG         30.0
+#define TRACK_MIN_INLIERS            3
+#define TRACK_DEADBAND_DEG         5.0
+#define TRACK_DPS                180.0
+
 #define TOOTH_R_ROTATION_SERVO          28
 #define TOOTH_R_ROTATION_LO_PULSE     1000
 #define TOOTH_R_ROTATION_HI_PULSE     1900
@@ -117,7 +123,15 @@ Head::Head()
       _whiskersAnimateEn(false),
       _whiskersAnimateSync(true),
       _whiskersRandPct(0),
-      _sentry(false)
+      _sentry(false),
+      _doa(0),
+      _speechDetected(false),
+      _lastDoa(0),
+      _tracking(false),
+      _trackingCamera(false),
+      _soundTracker(TRACK_WINDOW_MS, TRACK_OUTLIER_DEG, TRACK_MIN_INLIERS,
+                    TRACK_DEADBAND_DEG),
+      _events(0)
 {
     if (instance != 0) {
         fprintf(stderr, "Head can be instantiated only once!\n");
@@ -126,6 +140,12 @@ Head::Head()
         instance++;
     }
 
+    /* The setters below arm timers and raise events, ready these first */
+    bzero(_timer, sizeof(_timer));
+    _running = true;
+    pthread_mutex_init(&_mutex, NULL);
+    pthread_cond_init(&_cond, NULL);
+
     servos->setRange(HEAD_ROTATION_SERVO,
                      HEAD_ROTATION_LO_PULSE,
                      HEAD_ROTATION_HI_PULSE);
@@ -184,9 +204,6 @@ Head::Head()
     whiskersCenter();
     whiskersRandomize(1);
 
-    _running = true;
-    pthread_mutex_init(&_mutex, NULL);
-    pthread_cond_init(&_cond, NULL);
     pthread_create(&_thread, NULL, Head::thread_func, this);
     pthread_setname_np(_thread, "R'Head");
 
@@ -195,11 +212,20 @@ Head::Head()
 
 Head::~Head()
 {
+    unsigned int ids[EV_COUNT];
+    unsigned int i;
+
+    pthread_mutex_lock(&_mutex);
     _running = false;
+    memcpy(ids, _timer, sizeof(ids));
+    bzero(_timer, sizeof(_timer));
     pthread_cond_broadcast(&_cond);
+    pthread_mutex_unlock(&_mutex);
     pthread_join(_thread, NULL);
-    pthread_mutex_destroy(&_mutex);
-    pthread_cond_destroy(&_cond);
+
+    for (i = 0; i < EV_COUNT; i++) {
+        timers->cancel(ids[i], true);
+    }
 
     rotate(0.0);
     tilt(0.0);
@@ -208,6 +234,9 @@ Head::~Head()
     teethDown();
     whiskersDown();
 
+    pthread_mutex_destroy(&_mutex);
+    pthread_cond_destroy(&_cond);
+
     instance--;
     printf("Head is offline\n");
 }
@@ -223,52 +252,159 @@ void *Head::thread_func(void *args)
 
 void Head::run(void)
 {
-    struct timespec ts, tloop;
-    vector<struct servo_motion> sentry_motions;
-    struct servo_motion motion;
+    unsigned int events;
 
-    tloop.tv_sec = 0;
-    tloop.tv_nsec = 100000000;
-
-    /* Set up sentry motion vector */
-    motion.pulse = (HEAD_ROTATION_HI_PULSE - HEAD_ROTATION_LO_PULSE) / 2 +
-        HEAD_ROTATION_LO_PULSE;
-    motion.ms = 50;
-    sentry_motions.push_back(motion);
-    motion.pulse = HEAD_ROTATION_HI_PULSE;
-    motion.ms = 5000;
-    sentry_motions.push_back(motion);
-    motion.pulse = HEAD_ROTATION_LO_PULSE;
-    motion.ms = 10000;
-    sentry_motions.push_back(motion);
-    motion.pulse = (HEAD_ROTATION_HI_PULSE - HEAD_ROTATION_LO_PULSE) / 2 +
-        HEAD_ROTATION_LO_PULSE;
-    motion.ms = 5000;
-    sentry_motions.push_back(motion);
+    pthread_mutex_lock(&_mutex);
 
     while (_running) {
-        clock_gettime(CLOCK_REALTIME, &ts);
-        timespecadd(&ts, &tloop, &ts);
+        if (_events == 0) {
+            pthread_cond_wait(&_cond, &_mutex);
+            continue;
+        }
 
-        updateEyebrows();
-        updateEars();
-        updateTeeth();
-        updateWhiskers();
+        events = _events;
+        _events = 0;
+        pthread_mutex_unlock(&_mutex);
 
-        if (_sentry) {
-            if (servos->hasMotionSchedule(HEAD_ROTATION_SERVO) == false) {
-                servos->scheduleMotions(HEAD_ROTATION_SERVO, sentry_motions);
-            }
-        } else {
-            if (servos->hasMotionSchedule(HEAD_ROTATION_SERVO) == true) {
-                servos->center(HEAD_ROTATION_SERVO);
-            }
+        if (events & (1 << EV_VOICE)) {
+            updateEars();
+        }
+
+        if (events & (1 << EV_EAR_DROP)) {
+            dropEars();
+        }
+
+        if (events & (1 << EV_EYEBROW_TWITCH)) {
+            twitchEyebrows();
+        }
+
+        if (events & (1 << EV_TEETH)) {
+            animateTeeth();
+        }
+
+        if (events & (1 << EV_TEETH_TWITCH)) {
+            twitchTeeth();
+        }
+
+        if (events & (1 << EV_WHISKERS)) {
+            animateWhiskers();
+        }
+
+        if (events & (1 << EV_WHISKERS_TWITCH)) {
+            twitchWhiskers();
+        }
+
+        if (events & (1 << EV_SENTRY)) {
+            updateSentry();
         }
 
         pthread_mutex_lock(&_mutex);
-        pthread_cond_timedwait(&_cond, &_mutex, &ts);
-        pthread_mutex_unlock(&_mutex);
     }
+
+    pthread_mutex_unlock(&_mutex);
+}
+
+void Head::post(enum Event ev)
+{
+    pthread_mutex_lock(&_mutex);
+    _events |= (1 << ev);
+    pthread_cond_signal(&_cond);
+    pthread_mutex_unlock(&_mutex);
+}
+
+/*
+ * (Re-)arm the timer that raises event 'ev' after 'ms'. A timer that was
+ * already armed for the event is dropped.
+ */
+void Head::arm(enum Event ev, unsigned int ms)
+{
+    pthread_mutex_lock(&_mutex);
+    if (_running && timers != NULL) {
+        timers->cancel(_timer[ev]);
+        _timer[ev] = timers->add(ms, Head::timer_expired, this);
+    }
+    pthread_mutex_unlock(&_mutex);
+}
+
+void Head::disarm(enum Event ev)
+{
+    pthread_mutex_lock(&_mutex);
+    if (_timer[ev] != 0) {
+        timers->cancel(_timer[ev]);
+        _timer[ev] = 0;
+    }
+    pthread_mutex_unlock(&_mutex);
+}
+
+void Head::timer_expired(unsigned int id, void *arg)
+{
+    Head *head = (Head *) arg;
+    unsigned int i;
+
+    pthread_mutex_lock(&head->_mutex);
+    for (i = 0; i < EV_COUNT; i++) {
+        /* Stale expirations of re-armed timers don't match */
+        if (head->_timer[i] == id) {
+            head->_timer[i] = 0;
+            head->_events |= (1 << i);
+            pthread_cond_signal(&head->_cond);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&head->_mutex);
+}
+
+/*
+ * Random twitches used to be rolled every 100ms with a probability of
+ * per1000 / 1000. Draw the equivalent exponentially distributed interval
+ * to the next twitch instead.
+ */
+static unsigned int twitch_interval_ms(unsigned int per1000)
+{
+    double u, ms;
+
+    u = ((double) (random() % 1000000) + 1.0) / 1000001.0;
+    ms = -log(u) * 100.0 * 1000.0 / (double) per1000;
+    if (ms < 500.0) {
+        ms = 500.0;
+    }
+
+    return (unsigned int) ms;
+}
+
+void Head::updateSentry(void)
+{
+    vector<struct servo_motion> sentry_motions;
+    struct servo_motion motion;
+
+    if (_sentry == false) {
+        if (servos->hasMotionSchedule(HEAD_ROTATION_SERVO) == true) {
+            servos->center(HEAD_ROTATION_SERVO);
+        }
+        return;
+    }
+
+    if (servos->hasMotionSchedule(HEAD_ROTATION_SERVO) == false) {
+        motion.pulse = (HEAD_ROTATION_HI_PULSE - HEAD_ROTATION_LO_PULSE) / 2 +
+            HEAD_ROTATION_LO_PULSE;
+        motion.ms = 50;
+        sentry_motions.push_back(motion);
+        motion.pulse = HEAD_ROTATION_HI_PULSE;
+        motion.ms = 5000;
+        sentry_motions.push_back(motion);
+        motion.pulse = HEAD_ROTATION_LO_PULSE;
+        motion.ms = 10000;
+        sentry_motions.push_back(motion);
+        motion.pulse = (HEAD_ROTATION_HI_PULSE - HEAD_ROTATION_LO_PULSE) / 2 +
+            HEAD_ROTATION_LO_PULSE;
+        motion.ms = 5000;
+        sentry_motions.push_back(motion);
+        servos->scheduleMotions(HEAD_ROTATION_SERVO, sentry_motions);
+    }
+
+    /* Sweep again once this one is done */
+    arm(EV_SENTRY, servos->plannedMs(HEAD_ROTATION_SERVO) +
+        SERVO_SCHEDULE_INTERVAL_MS);
 }
 
 void Head::enSentry(bool enable)
@@ -277,6 +413,10 @@ void Head::enSentry(bool enable)
 
     if (_sentry != enable) {
         _sentry = enable;
+        if (!enable) {
+            disarm(EV_SENTRY);
+        }
+        post(EV_SENTRY);
         if (enable) {
             speech->speak("Head sentry mode enabled");
             LOG("Head sentry mode enabled\n");
@@ -292,6 +432,77 @@ bool Head::isSentryEn(void) const
     return _sentry;
 }
 
+void Head::enTracking(bool enable, bool camera)
+{
+    enable = (enable ? true : false);
+    camera = (enable && camera) ? true : false;
+
+    if (_tracking != enable || _trackingCamera != camera) {
+        _tracking = enable;
+        _trackingCamera = camera;
+        if (enable) {
+            speech->speak("Head sound tracking enabled");
+            LOG("Head sound tracking enabled\n");
+        } else {
+            speech->speak("Head sound tracking disabled");
+            LOG("Head sound tracking disabled\n");
+        }
+    }
+}
+
+bool Head::isTrackingEn(void) const
+{
+    return _tracking;
+}
+
+/*
+ * Turn the head (and camera) toward the fused direction of a speaker.
+ * Once the camera holds a face, face tracking steers and we back off.
+ */
+void Head::trackSound(uint32_t doa, bool speechDetected)
+{
+    vector<struct servo_motion> motions;
+    struct servo_motion motion;
+    struct timespec ts;
+    uint64_t ms;
+    unsigned int center;
+    float deg, delta;
+    char buf[128];
+
+    if (!_tracking || _sentry) {
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ms = ((uint64_t) ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+
+    if (!_soundTracker.track(doa, speechDetected, ms, _rotation, &deg)) {
+        return;
+    }
+
+    if (camera != NULL && camera->isVisionEn() && camera->hasFace()) {
+        return;
+    }
+
+    delta = fabsf(deg - _rotation);
+    center = ((servos->hiRange(HEAD_ROTATION_SERVO) -
+               servos->loRange(HEAD_ROTATION_SERVO)) / 2) +
+        HEAD_ROTATION_LO_PULSE;
+    motion.pulse = (unsigned int)
+        ((float) center - deg * HEAD_ROTATION_ANGLE_MULT);
+    motion.ms = (unsigned int) (delta * 1000.0 / TRACK_DPS);
+    motions.push_back(motion);
+    servos->scheduleMotions(HEAD_ROTATION_SERVO, motions);
+    _rotation = deg;
+
+    if (_trackingCamera && camera != NULL) {
+        camera->pan(deg);
+    }
+
+    snprintf(buf, sizeof(buf) - 1, "Head tracks sound at %.1f\n", deg);
+    LOG(buf);
+}
+
 void Head::rotate(float deg, bool relative)
 {
     unsigned int pulse;
@@ -527,6 +738,9 @@ void Head::eyebrowSetDisposition(enum EyebrowDisposition disposition)
     default:
         break;
     }
+
+    /* Hold off twitching for a while after a change */
+    arm(EV_EYEBROW_TWITCH, twitch_interval_ms(1));
 }
 
 float Head::eyebrowRotationAt(unsigned int lr) const
@@ -587,11 +801,10 @@ static unsigned int random_servo_pos_unadjusted(unsigned int id)
     return newpulse;
 }
 
-void Head::updateEyebrows(void)
+void Head::twitchEyebrows(void)
 {
     /* Twitch from time to time */
-    if (((random() % 1000) == 888) &&
-        (servos->hasMotionSchedule(EB_R_ROTATION_SERVO) == false) &&
+    if ((servos->hasMotionSchedule(EB_R_ROTATION_SERVO) == false) &&
         (servos->hasMotionSchedule(EB_R_TILT_SERVO) == false) &&
         (servos->hasMotionSchedule(EB_L_ROTATION_SERVO) == false) &&
         (servos->hasMotionSchedule(EB_L_TILT_SERVO) == false)) {
@@ -648,6 +861,8 @@ void Head::updateEyebrows(void)
         servos->clearMotionSchedule(id);
         servos->scheduleMotions(id, motions);
     }
+
+    arm(EV_EYEBROW_TWITCH, twitch_interval_ms(1));
 }
 
 void Head::earTilt(float deg, bool relative, unsigned int lr)
@@ -759,9 +974,9 @@ void Head::earsUp(void)
         return;  // Keep the ears foldeed to not obstruct lidar
     }
 
-    gettimeofday(&_last_earsup, NULL);
     earTilt(0.0);
     earRotate(0.0);
+    arm(EV_EAR_DROP, EAR_DROP_SECONDS * 1000);
 }
 
 void Head::earsBack(void)
@@ -898,38 +1113,50 @@ float Head::earRotationAt(unsigned int lr) const
     return ((float) pulse - (float) center) / EAR_L_ROTATION_ANGLE_MULT;
 }
 
+void Head::notifyVoice(uint32_t doa, bool speechDetected)
+{
+    pthread_mutex_lock(&_mutex);
+    _doa = doa;
+    _speechDetected = speechDetected;
+    _events |= (1 << EV_VOICE);
+    pthread_cond_signal(&_cond);
+    pthread_mutex_unlock(&_mutex);
+}
+
 void Head::updateEars(void)
 {
-    struct timeval now;
-
-    gettimeofday(&now, NULL);
-    now.tv_sec -= EAR_DROP_SECONDS;
-
-    if (earTiltAt(0x1) == 0.0 && earTiltAt(0x2) == 0.0 &&
-        voice != NULL) {
-        static uint32_t last_doa = 0;
-        uint32_t doa;
-        bool speech_detected;
-        float deg;
-
-        doa = voice->getProp().DOAAngle;
-        speech_detected = voice->getProp().SpeechDetected;
-        if (speech_detected && (doa <= 90 || doa >= 270)) {
-            // Filter out sounds from servo motors mounted behind
-            if (doa != last_doa) {
-                // Skip updating servo if doa is same as last sampling time
-                last_doa = doa;
-                deg = (float) doa;
-                if (deg > 180.0) {
-                    deg = deg - 360.0;
-                }
-                earRotate(deg);
+    uint32_t doa;
+    bool speech_detected;
+    float deg;
+
+    pthread_mutex_lock(&_mutex);
+    doa = _doa;
+    speech_detected = _speechDetected;
+    pthread_mutex_unlock(&_mutex);
+
+    trackSound(doa, speech_detected);
+
+    if (earTiltAt(0x1) != 0.0 || earTiltAt(0x2) != 0.0) {
+        return;
+    }
+
+    if (speech_detected && (doa <= 90 || doa >= 270)) {
+        // Filter out sounds from servo motors mounted behind
+        if (doa != _lastDoa) {
+            // Skip updating servo if doa is same as last time
+            _lastDoa = doa;
+            deg = (float) doa;
+            if (deg > 180.0) {
+                deg = deg - 360.0;
             }
+            earRotate(deg);
         }
     }
+}
 
-    if (earTiltAt(0x1) == 0.0 && earTiltAt(0x2) == 0.0 &&
-        timercmp(&now, &_last_earsup, >=)) {
+void Head::dropEars(void)
+{
+    if (earTiltAt(0x1) == 0.0 && earTiltAt(0x2) == 0.0) {
         earsHalfDown();
     }
 }
@@ -949,7 +1176,10 @@ void Head::teethAnimate(bool en, bool sync)
     _teethAnimateEn = en ? true : false;
     _teethAnimateSync = sync ? true : false;
 
-    if (en == false) {
+    if (en) {
+        post(EV_TEETH);
+    } else {
+        disarm(EV_TEETH);
         servos->clearMotionSchedule(TOOTH_R_ROTATION_SERVO);
         servos->clearMotionSchedule(TOOTH_L_ROTATION_SERVO);
         teethDown();
@@ -962,6 +1192,12 @@ void Head::teethRandomize(unsigned int probPct)
         probPct = 100;
     }
     _teethRandPct = probPct;
+
+    if (probPct > 0) {
+        arm(EV_TEETH_TWITCH, twitch_interval_ms(probPct + 1));
+    } else {
+        disarm(EV_TEETH_TWITCH);
+    }
 }
 
 void Head::toothRotate(float deg, bool relative, unsigned int lr)
@@ -1034,10 +1270,11 @@ float Head::toothRotationAt(unsigned int lr) const
     return ((float) pulse - (float) center) / TOOTH_L_ROTATION_ANGLE_MULT;
 }
 
-void Head::updateTeeth(void)
+void Head::animateTeeth(void)
 {
     vector<struct servo_motion> motions;
     struct servo_motion motion;
+    unsigned int ms;
 
     if (_teethAnimateEn) {
         if (servos->hasMotionSchedule(TOOTH_R_ROTATION_SERVO) == false) {
@@ -1083,12 +1320,21 @@ void Head::updateTeeth(void)
                 servos->scheduleMotions(TOOTH_L_ROTATION_SERVO, motions);
             }
         }
+
+        /* Go again when this cycle is done */
+        ms = servos->plannedMs(TOOTH_R_ROTATION_SERVO);
+        if (ms < SERVO_SCHEDULE_INTERVAL_MS) {
+            ms = SERVO_SCHEDULE_INTERVAL_MS;
+        }
+        arm(EV_TEETH, ms);
     }
+}
 
+void Head::twitchTeeth(void)
+{
     if ((_teethRandPct) > 0 &&
         (servos->hasMotionSchedule(TOOTH_R_ROTATION_SERVO) == false) &&
-        (servos->hasMotionSchedule(TOOTH_L_ROTATION_SERVO) == false) &&
-        ((((unsigned int) rand()) % 1000) <= _teethRandPct)) {
+        (servos->hasMotionSchedule(TOOTH_L_ROTATION_SERVO) == false)) {
         unsigned int id;
         vector<struct servo_motion> motions;
         struct servo_motion motion;
@@ -1116,6 +1362,10 @@ void Head::updateTeeth(void)
         motions.push_back(motion);
         servos->scheduleMotions(id, motions);
     }
+
+    if (_teethRandPct > 0) {
+        arm(EV_TEETH_TWITCH, twitch_interval_ms(_teethRandPct + 1));
+    }
 }
 
 void Head::whiskersUp(void)
@@ -1138,7 +1388,10 @@ void Head::whiskersAnimate(bool en, bool sync)
     _whiskersAnimateEn = en ? true : false;
     _whiskersAnimateSync = sync ? true : false;
 
-    if (en == false) {
+    if (en) {
+        post(EV_WHISKERS);
+    } else {
+        disarm(EV_WHISKERS);
         servos->clearMotionSchedule(WHISKER_R_ROTATION_SERVO);
         servos->clearMotionSchedule(WHISKER_L_ROTATION_SERVO);
         whiskersCenter();
@@ -1151,6 +1404,12 @@ void Head::whiskersRandomize(unsigned int probPct)
         probPct = 100;
     }
     _whiskersRandPct = probPct;
+
+    if (probPct > 0) {
+        arm(EV_WHISKERS_TWITCH, twitch_interval_ms(probPct + 1));
+    } else {
+        disarm(EV_WHISKERS_TWITCH);
+    }
 }
 
 void Head::whiskerRotate(float deg, bool relative, unsigned int lr)
@@ -1223,14 +1482,15 @@ float Head::whiskerRotationAt(unsigned int lr) const
     return ((float) center - (float) pulse) / WHISKER_L_ROTATION_ANGLE_MULT;
 }
 
-void Head::updateWhiskers(void)
+void Head::animateWhiskers(void)
 {
     vector<struct servo_motion> motions;
     struct servo_motion motion;
+    unsigned int ms;
 
-    if (_teethAnimateEn) {
+    if (_whiskersAnimateEn) {
         if (servos->hasMotionSchedule(WHISKER_R_ROTATION_SERVO) == false) {
-            if (_teethAnimateSync) {
+            if (_whiskersAnimateSync) {
                 servos->clearMotionSchedule(WHISKER_L_ROTATION_SERVO);
 
                 motions.clear();
@@ -1272,12 +1532,21 @@ void Head::updateWhiskers(void)
                 servos->scheduleMotions(WHISKER_L_ROTATION_SERVO, motions);
             }
         }
+
+        /* Go again when this cycle is done */
+        ms = servos->plannedMs(WHISKER_R_ROTATION_SERVO);
+        if (ms < SERVO_SCHEDULE_INTERVAL_MS) {
+            ms = SERVO_SCHEDULE_INTERVAL_MS;
+        }
+        arm(EV_WHISKERS, ms);
     }
+}
 
+void Head::twitchWhiskers(void)
+{
     if ((_whiskersRandPct) > 0 &&
         (servos->hasMotionSchedule(WHISKER_R_ROTATION_SERVO) == false) &&
-        (servos->hasMotionSchedule(WHISKER_L_ROTATION_SERVO) == false) &&
-        ((((unsigned int) rand()) % 1000) <= _whiskersRandPct)) {
+        (servos->hasMotionSchedule(WHISKER_L_ROTATION_SERVO) == false)) {
         unsigned int id;
         vector<struct servo_motion> motions;
         struct servo_motion motion;
@@ -1305,6 +1574,10 @@ void Head::updateWhiskers(void)
         motions.push_back(motion);
         servos->scheduleMotions(id, motions);
     }
+
+    if (_whiskersRandPct > 0) {
+        arm(EV_WHISKERS_TWITCH, twitch_interval_ms(_whiskersRandPct + 1));
+    }
 }
 
 /*
@@ -68,14 +68,41 @@ public:
     void enSentry(bool enable);
     bool isSentryEn(void) const;
 
+    void enTracking(bool enable, bool camera = false);
+    bool isTrackingEn(void) const;
+
+    void notifyVoice(uint32_t doa, bool speechDetected);
+
 private:
 
+    enum Event {
+        EV_VOICE = 0,
+        EV_EAR_DROP = 1,
+        EV_EYEBROW_TWITCH = 2,
+        EV_TEETH = 3,
+        EV_TEETH_TWITCH = 4,
+        EV_WHISKERS = 5,
+        EV_WHISKERS_TWITCH = 6,
+        EV_SENTRY = 7,
+        EV_COUNT = 8,
+    };
+
+    void post(enum Event ev);
+    void arm(enum Event ev, unsigned int ms);
+    void disarm(enum Event ev);
+    static void timer_expired(unsigned int id, void *arg);
+
     static void *thread_func(void *args);
     void run(void);
-    void updateEyebrows(void);
+    void twitchEyebrows(void);
     void updateEars(void);
-    void updateTeeth(void);
-    void updateWhiskers(void);
+    void dropEars(void);
+    void animateTeeth(void);
+    void twitchTeeth(void);
+    void animateWhiskers(void);
+    void twitchWhiskers(void);
+    void updateSentry(void);
+    void trackSound(uint32_t doa, bool speechDetected);
 
     float _rotation;
     float _tilt;
@@ -84,7 +111,6 @@ private:
     float _eb_r_tilt;
     float _eb_l_rotation;
     float _eb_l_tilt;
-    struct timeval _last_earsup;
     bool _teethAnimateEn;
     bool _teethAnimateSync;
     unsigned int _teethRandPct;
@@ -92,6 +118,15 @@ private:
     bool _whiskersAnimateSync;
     unsigned int _whiskersRandPct;
     bool _sentry;
+    uint32_t _doa;
+    bool _speechDetected;
+    uint32_t _lastDoa;
+    bool _tracking;
+    bool _trackingCamera;
+    SoundTracker _soundTracker;
+
+    unsigned int _events;
+    unsigned int _timer[EV_COUNT];
 
     pthread_t _thread;
     pthread_mutex_t _mutex;
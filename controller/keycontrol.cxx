@@ -9,7 +9,12 @@
 
 using namespace std;
 
-#define WHEEL_DRIVE_LIMIT_MS  100
+/*
+ * Wheel commands of the keypad, renewed by key repeats.
+ */
+#define KEY_DRIVE_MMPS  WHEEL_MAX_MMPS
+#define KEY_SPIN_DPS    90.0
+#define KEY_CURVE_DPS   60.0
 
 static unsigned int chan = 12;
 
@@ -42,7 +47,7 @@ static void action_up(void)
         camera->tilt(-1.0, true);
         break;
     case RABBIT_CONSOLE_MODE_WHEEL:
-        wheels->fwd(WHEEL_DRIVE_LIMIT_MS);
+        wheels->command(KEY_DRIVE_MMPS, 0.0);
         break;
     case RABBIT_CONSOLE_MODE_R_SHOULDER:
         rightArm->rotateShoulder(1.0, 5, true);
@@ -101,7 +106,7 @@ static void action_down(void)
         camera->tilt(1.0, true);
         break;
     case RABBIT_CONSOLE_MODE_WHEEL:
-        wheels->bwd(WHEEL_DRIVE_LIMIT_MS);
+        wheels->command(-KEY_DRIVE_MMPS, 0.0);
         break;
     case RABBIT_CONSOLE_MODE_R_SHOULDER:
         rightArm->rotateShoulder(-1.0, 5, true);
@@ -160,7 +165,7 @@ static void action_right(void)
         camera->pan(-1, true);
         break;
     case RABBIT_CONSOLE_MODE_WHEEL:
-        wheels->ror(WHEEL_DRIVE_LIMIT_MS);
+        wheels->command(0.0, -KEY_SPIN_DPS);
         break;
     case RABBIT_CONSOLE_MODE_R_SHOULDER:
         rightArm->extendShoulder(-1.0, 5, true);
@@ -219,7 +224,7 @@ static void action_left(void)
         camera->pan(1.0, true);
         break;
     case RABBIT_CONSOLE_MODE_WHEEL:
-        wheels->rol(WHEEL_DRIVE_LIMIT_MS);
+        wheels->command(0.0, KEY_SPIN_DPS);
         break;
     case RABBIT_CONSOLE_MODE_R_SHOULDER:
         rightArm->extendShoulder(1.0, 5, true);
@@ -279,7 +284,7 @@ static void action_upright(void)
         camera->pan(-1.0, true);
         break;
     case RABBIT_CONSOLE_MODE_WHEEL:
-        wheels->fwr(WHEEL_DRIVE_LIMIT_MS);
+        wheels->command(KEY_DRIVE_MMPS, -KEY_CURVE_DPS);
         break;
     case RABBIT_CONSOLE_MODE_R_SHOULDER:
         rightArm->extendWrist(-1.0, 5, true);
@@ -304,7 +309,7 @@ static void action_upleft(void)
         camera->pan(1.0, true);
         break;
     case RABBIT_CONSOLE_MODE_WHEEL:
-        wheels->fwl(WHEEL_DRIVE_LIMIT_MS);
+        wheels->command(KEY_DRIVE_MMPS, KEY_CURVE_DPS);
         break;
     case RABBIT_CONSOLE_MODE_R_SHOULDER:
         rightArm->extendElbow(-1.0, 5, true);
@@ -328,7 +333,7 @@ static void action_downright(void)
         camera->pan(-1.0, true);
         break;
     case RABBIT_CONSOLE_MODE_WHEEL:
-        wheels->bwr(WHEEL_DRIVE_LIMIT_MS);
+        wheels->command(-KEY_DRIVE_MMPS, KEY_CURVE_DPS);
         break;
     case RABBIT_CONSOLE_MODE_R_SHOULDER:
         rightArm->extendWrist(1.0, 5, true);
@@ -353,7 +358,7 @@ static void action_downleft(void)
         camera->pan(1.0, true);
         break;
     case RABBIT_CONSOLE_MODE_WHEEL:
-        wheels->bwl(WHEEL_DRIVE_LIMIT_MS);
+        wheels->command(-KEY_DRIVE_MMPS, -KEY_CURVE_DPS);
         break;
     case RABBIT_CONSOLE_MODE_R_SHOULDER:
         rightArm->extendElbow(1.0, 5, true);
@@ -500,6 +505,7 @@ void rabbit_keycontrol(uint8_t key)
         break;
     case ' ':
         wheels->halt();
+        gestures->stop();
         rightArm->freeze();
         leftArm->freeze();
         camera->pan(0.0);
@@ -530,6 +536,20 @@ void rabbit_keycontrol(uint8_t key)
             head->enSentry(!head->isSentryEn());
         }
         break;
+    case 'o':
+    case 'O':
+        if (mode == RABBIT_CONSOLE_MODE_WHEEL) {
+            safety->enable(!safety->isEnabled());
+        }
+        break;
+    case 'l':
+    case 'L':
+        if (mode == RABBIT_CONSOLE_MODE_CAMERA) {
+            head->enTracking(!head->isTrackingEn(), true);
+        } else if (mode == RABBIT_CONSOLE_MODE_HEAD) {
+            head->enTracking(!head->isTrackingEn());
+        }
+        break;
     case 'x':
         mouth->beh();
         rightArm->rest();
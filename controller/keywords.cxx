@@ -0,0 +1,593 @@
+/*
+ * keywords.cxx
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "rabbit_audio.h"
+#include "rabbit_vad.h"
+#include "rabbit.hxx"
+
+#define KEYWORDS_LOW_HZ        100.0
+#define KEYWORDS_HIGH_HZ      7600.0
+#define KEYWORDS_HANGOVER_MS   250
+#define KEYWORDS_MAX_MS       2500    // Longer is not a command
+#define KEYWORDS_MAX_FRAMES   (KEYWORDS_PREROLL + KEYWORDS_MAX_MS / 10)
+#define KEYWORDS_THRESHOLD       3.0  // Mean distance per step of the path
+#define KEYWORDS_MARGIN          0.8  // Of the next best phrase
+
+using namespace std;
+
+static unsigned int instance = 0;
+
+static float hz_to_mel(float hz)
+{
+    return 2595.0 * log10(1.0 + hz / 700.0);
+}
+
+static float mel_to_hz(float mel)
+{
+    return 700.0 * (pow(10.0, mel / 2595.0) - 1.0);
+}
+
+Keywords::Keywords()
+    : _mtime(0)
+{
+    float edge[KEYWORDS_MELS + 2], hz, lo, mid, hi;
+    unsigned int i, m, k;
+
+    if (instance != 0) {
+        fprintf(stderr, "Keywords can be instantiated only once!\n");
+        exit(EXIT_FAILURE);
+    } else {
+        instance++;
+    }
+
+    for (i = 0; i < KEYWORDS_WINDOW; i++) {
+        _hamming[i] = 0.54 - 0.46 * cos(2.0 * M_PI * i /
+                                        (KEYWORDS_WINDOW - 1));
+    }
+
+    for (i = 0; i < KEYWORDS_FFT / 2; i++) {
+        _cos[i] = cos(2.0 * M_PI * i / KEYWORDS_FFT);
+        _sin[i] = -sin(2.0 * M_PI * i / KEYWORDS_FFT);
+    }
+
+    /* Triangles evenly spaced on the mel scale */
+    for (m = 0; m < KEYWORDS_MELS + 2; m++) {
+        edge[m] = mel_to_hz(hz_to_mel(KEYWORDS_LOW_HZ) +
+                            (hz_to_mel(KEYWORDS_HIGH_HZ) -
+                             hz_to_mel(KEYWORDS_LOW_HZ)) *
+                            m / (KEYWORDS_MELS + 1));
+    }
+    for (m = 0; m < KEYWORDS_MELS; m++) {
+        lo = edge[m];
+        mid = edge[m + 1];
+        hi = edge[m + 2];
+        for (k = 0; k < KEYWORDS_BINS; k++) {
+            hz = (float) k * RABBIT_AUDIO_RATE / KEYWORDS_FFT;
+            if ((hz > lo) && (hz <= mid)) {
+                _mel[m][k] = (hz - lo) / (mid - lo);
+            } else if ((hz > mid) && (hz < hi)) {
+                _mel[m][k] = (hi - hz) / (hi - mid);
+            } else {
+                _mel[m][k] = 0.0;
+            }
+        }
+    }
+
+    /* Orthonormal DCT-II, without c0 */
+    for (k = 0; k < KEYWORDS_CEPS; k++) {
+        for (m = 0; m < KEYWORDS_MELS; m++) {
+            _dct[k][m] = sqrt(2.0 / KEYWORDS_MELS) *
+                cos(M_PI * (k + 1) * (m + 0.5) / KEYWORDS_MELS);
+        }
+    }
+
+    _running = true;
+    pthread_mutex_init(&_mutex, NULL);
+    pthread_cond_init(&_cond, NULL);
+    pthread_create(&_thread, NULL, Keywords::thread_func, this);
+    pthread_setname_np(_thread, "R'Keywords");
+
+    printf("Keywords is online\n");
+}
+
+Keywords::~Keywords()
+{
+    pthread_mutex_lock(&_mutex);
+    _running = false;
+    pthread_cond_broadcast(&_cond);
+    pthread_mutex_unlock(&_mutex);
+    pthread_join(_thread, NULL);
+    pthread_mutex_destroy(&_mutex);
+    pthread_cond_destroy(&_cond);
+
+    instance--;
+    printf("Keywords is offline\n");
+}
+
+bool Keywords::openStream(struct keyword_stream *ks)
+{
+    struct rabbit_vad_config config;
+
+    rabbit_vad_defaults(&config);
+    config.rate = RABBIT_AUDIO_RATE;
+    config.hangover_ms = KEYWORDS_HANGOVER_MS;
+    config.preroll_ms = 0;            // Kept as cepstra instead
+    ks->vad = rabbit_vad_new(&config);
+    if (ks->vad == NULL) {
+        return false;
+    }
+
+    memset(ks->history, 0, sizeof(ks->history));
+    ks->recent.clear();
+    ks->utt.clear();
+    ks->overlong = false;
+
+    return true;
+}
+
+void Keywords::closeStream(struct keyword_stream *ks)
+{
+    rabbit_vad_free(ks->vad);
+    ks->vad = NULL;
+}
+
+/*
+ * The cepstra of the window that ends with this block.
+ */
+void Keywords::cepstra(struct keyword_stream *ks, const int16_t *pcm,
+                       float *ceps) const
+{
+    float re[KEYWORDS_FFT], im[KEYWORDS_FFT];
+    float power[KEYWORDS_BINS], logmel[KEYWORDS_MELS];
+    float tr, ti, e;
+    unsigned int i, j, k, m, len, step;
+
+    memmove(ks->history, &ks->history[RABBIT_AUDIO_BLOCK],
+            (KEYWORDS_WINDOW - RABBIT_AUDIO_BLOCK) * sizeof(float));
+    for (i = 0; i < RABBIT_AUDIO_BLOCK; i++) {
+        ks->history[KEYWORDS_WINDOW - RABBIT_AUDIO_BLOCK + i] =
+            pcm[i] / 32768.0f;
+    }
+
+    /* Windowed and zero padded, in bit-reversed order */
+    for (i = 0; i < KEYWORDS_FFT; i++) {
+        for (j = 0, k = i, m = 1; m < KEYWORDS_FFT; m <<= 1, k >>= 1) {
+            j = (j << 1) | (k & 1);
+        }
+        re[j] = i < KEYWORDS_WINDOW ? ks->history[i] * _hamming[i] : 0.0f;
+        im[j] = 0.0f;
+    }
+
+    /* Radix-2 decimation in time */
+    for (len = 2; len <= KEYWORDS_FFT; len <<= 1) {
+        step = KEYWORDS_FFT / len;
+        for (i = 0; i < KEYWORDS_FFT; i += len) {
+            for (j = 0; j < len / 2; j++) {
+                k = i + j + len / 2;
+                tr = re[k] * _cos[j * step] - im[k] * _sin[j * step];
+                ti = re[k] * _sin[j * step] + im[k] * _cos[j * step];
+                re[k] = re[i + j] - tr;
+                im[k] = im[i + j] - ti;
+                re[i + j] += tr;
+                im[i + j] += ti;
+            }
+        }
+    }
+
+    for (k = 0; k < KEYWORDS_BINS; k++) {
+        power[k] = re[k] * re[k] + im[k] * im[k];
+    }
+
+    for (m = 0; m < KEYWORDS_MELS; m++) {
+        for (k = 0, e = 1e-10f; k < KEYWORDS_BINS; k++) {
+            e += _mel[m][k] * power[k];
+        }
+        logmel[m] = logf(e);
+    }
+
+    for (k = 0; k < KEYWORDS_CEPS; k++) {
+        for (m = 0, e = 0.0f; m < KEYWORDS_MELS; m++) {
+            e += _dct[k][m] * logmel[m];
+        }
+        ceps[k] = e;
+    }
+}
+
+/*
+ * Takes a block and returns true when it ended an utterance of command
+ * length, which is then in ks->utt.
+ */
+bool Keywords::feed(struct keyword_stream *ks, const int16_t *pcm)
+{
+    float ceps[KEYWORDS_CEPS];
+    size_t frames;
+
+    cepstra(ks, pcm, ceps);
+
+    switch (rabbit_vad_process(ks->vad, pcm, RABBIT_AUDIO_BLOCK)) {
+    case RABBIT_VAD_START:
+        ks->utt = ks->recent;
+        ks->overlong = false;
+        /* Fall through */
+    case RABBIT_VAD_SPEECH:
+        if (ks->utt.size() >= KEYWORDS_MAX_FRAMES * KEYWORDS_CEPS) {
+            ks->overlong = true;
+        } else {
+            ks->utt.insert(ks->utt.end(), ceps, ceps + KEYWORDS_CEPS);
+        }
+        break;
+    case RABBIT_VAD_END:
+        /* Drop the hangover, which is only the quiet after */
+        frames = KEYWORDS_PREROLL + rabbit_vad_utterance_ms(ks->vad) / 10;
+        if (ks->utt.size() > frames * KEYWORDS_CEPS) {
+            ks->utt.resize(frames * KEYWORDS_CEPS);
+        }
+        ks->recent.clear();
+        return !ks->overlong;
+    default:
+        break;
+    }
+
+    ks->recent.insert(ks->recent.end(), ceps, ceps + KEYWORDS_CEPS);
+    if (ks->recent.size() > KEYWORDS_PREROLL * KEYWORDS_CEPS) {
+        ks->recent.erase(ks->recent.begin(),
+                         ks->recent.begin() + KEYWORDS_CEPS);
+    }
+
+    return false;
+}
+
+/*
+ * A template is the longest utterance in a 16 kHz mono S16_LE WAV file,
+ * cut the same way as what the microphone hears.
+ */
+bool Keywords::loadTemplate(const char *path, struct keyword_template *kt)
+{
+    struct {
+        char riff[4];
+        uint32_t size;
+        char wave[4];
+    } __attribute__((packed)) riff;
+    struct {
+        char id[4];
+        uint32_t size;
+    } __attribute__((packed)) chunk;
+    struct {
+        uint16_t type;
+        uint16_t chans;
+        uint32_t rate;
+        uint32_t byteRate;
+        uint16_t align;
+        uint16_t bits;
+    } __attribute__((packed)) fmt;
+    struct keyword_stream ks;
+    int16_t pcm[RABBIT_AUDIO_BLOCK];
+    bool haveFmt = false, found = false;
+    unsigned int i;
+    FILE *fp;
+
+    fp = fopen(path, "rb");
+    if (fp == NULL) {
+        perror(path);
+        return false;
+    }
+
+    if ((fread(&riff, sizeof(riff), 1, fp) != 1) ||
+        (memcmp(riff.riff, "RIFF", 4) != 0) ||
+        (memcmp(riff.wave, "WAVE", 4) != 0)) {
+        goto bad;
+    }
+
+    while (fread(&chunk, sizeof(chunk), 1, fp) == 1) {
+        if (memcmp(chunk.id, "fmt ", 4) == 0) {
+            if ((chunk.size < sizeof(fmt)) ||
+                (fread(&fmt, sizeof(fmt), 1, fp) != 1)) {
+                goto bad;
+            }
+            fseek(fp, chunk.size - sizeof(fmt) + (chunk.size & 1),
+                  SEEK_CUR);
+            haveFmt = true;
+        } else if (memcmp(chunk.id, "data", 4) == 0) {
+            found = true;
+            break;
+        } else {
+            fseek(fp, chunk.size + (chunk.size & 1), SEEK_CUR);
+        }
+    }
+
+    if (!found) {
+        goto bad;
+    }
+
+    if (!haveFmt || (fmt.type != 1) || (fmt.chans != 1) ||
+        (fmt.rate != RABBIT_AUDIO_RATE) || (fmt.bits != 16)) {
+        fprintf(stderr, "%s is not 16 kHz mono S16_LE\n", path);
+        fclose(fp);
+        return false;
+    }
+
+    if (!openStream(&ks)) {
+        fclose(fp);
+        return false;
+    }
+
+    /* Lead in and out with silence, so that the onset is not missed */
+    memset(pcm, 0, sizeof(pcm));
+    for (i = 0; i < 50; i++) {
+        feed(&ks, pcm);
+    }
+
+    kt->ceps.clear();
+    while (fread(pcm, sizeof(pcm), 1, fp) == 1) {
+        if (feed(&ks, pcm) && (ks.utt.size() > kt->ceps.size())) {
+            kt->ceps = ks.utt;
+        }
+    }
+
+    memset(pcm, 0, sizeof(pcm));
+    for (i = 0; i <= KEYWORDS_HANGOVER_MS / 10; i++) {
+        if (feed(&ks, pcm) && (ks.utt.size() > kt->ceps.size())) {
+            kt->ceps = ks.utt;
+        }
+    }
+
+    closeStream(&ks);
+    fclose(fp);
+
+    if (kt->ceps.empty()) {
+        fprintf(stderr, "%s has no speech of command length\n", path);
+        return false;
+    }
+
+    return true;
+
+bad:
+
+    fprintf(stderr, "%s is not a WAV file\n", path);
+    fclose(fp);
+
+    return false;
+}
+
+void Keywords::loadTemplates(void)
+{
+    DIR *d;
+    struct dirent *dir;
+    struct keyword_template kt;
+    string path;
+    size_t len, i;
+
+    _templates.clear();
+
+    d = opendir(KEYWORDS_DIR);
+    if (d == NULL) {
+        return;
+    }
+
+    while ((dir = readdir(d)) != NULL) {
+        len = strlen(dir->d_name);
+        if ((len <= 4) || (strcmp(&dir->d_name[len - 4], ".wav") != 0)) {
+            continue;
+        }
+
+        /* "raise_arms-2.wav" is a take of "raise arms" */
+        kt.phrase.assign(dir->d_name, len - 4);
+        i = kt.phrase.find('-');
+        if (i != string::npos) {
+            kt.phrase.resize(i);
+        }
+        for (i = 0; i < kt.phrase.length(); i++) {
+            if (kt.phrase[i] == '_') {
+                kt.phrase[i] = ' ';
+            }
+        }
+
+        path = string(KEYWORDS_DIR) + "/" + dir->d_name;
+        if (loadTemplate(path.c_str(), &kt)) {
+            _templates.push_back(kt);
+        }
+    }
+
+    closedir(d);
+
+    printf("Keywords has %zu templates\n", _templates.size());
+}
+
+static void normalize(const vector<float> &in, vector<float> &out)
+{
+    size_t frames = in.size() / KEYWORDS_CEPS, i;
+    float mean[KEYWORDS_CEPS];
+    unsigned int k;
+
+    /* Take out the cepstral mean, the microphone and the room */
+    memset(mean, 0, sizeof(mean));
+    for (i = 0; i < frames; i++) {
+        for (k = 0; k < KEYWORDS_CEPS; k++) {
+            mean[k] += in[i * KEYWORDS_CEPS + k] / frames;
+        }
+    }
+
+    out.resize(in.size());
+    for (i = 0; i < frames; i++) {
+        for (k = 0; k < KEYWORDS_CEPS; k++) {
+            out[i * KEYWORDS_CEPS + k] = in[i * KEYWORDS_CEPS + k] - mean[k];
+        }
+    }
+}
+
+/*
+ * Dynamic time warping of two utterances, kept within a band about the
+ * diagonal. Returns the mean distance per step of the best path, or
+ * FLT_MAX when one is more than twice as long as the other.
+ */
+float Keywords::match(const vector<float> &a, const vector<float> &b) const
+{
+    vector<float> x, y, prev, cur;
+    size_t n, m, i, j, band, lo, hi, diag;
+    float d, e, best;
+    unsigned int k;
+
+    normalize(a, x);
+    normalize(b, y);
+    n = x.size() / KEYWORDS_CEPS;
+    m = y.size() / KEYWORDS_CEPS;
+    if ((n == 0) || (m == 0) || (n > 2 * m) || (m > 2 * n)) {
+        return FLT_MAX;
+    }
+
+    band = (n > m ? n : m) / 4 + 2;
+    prev.assign(m + 1, FLT_MAX);
+    cur.assign(m + 1, FLT_MAX);
+    prev[0] = 0.0f;
+
+    for (i = 1; i <= n; i++) {
+        cur.assign(m + 1, FLT_MAX);
+        diag = (i * m) / n;
+        lo = diag > band ? diag - band : 1;
+        lo = lo < 1 ? 1 : lo;
+        hi = diag + band < m ? diag + band : m;
+        for (j = lo; j <= hi; j++) {
+            for (k = 0, d = 0.0f; k < KEYWORDS_CEPS; k++) {
+                e = x[(i - 1) * KEYWORDS_CEPS + k] -
+                    y[(j - 1) * KEYWORDS_CEPS + k];
+                d += e * e;
+            }
+            best = prev[j - 1];
+            best = prev[j] < best ? prev[j] : best;
+            best = cur[j - 1] < best ? cur[j - 1] : best;
+            if (best != FLT_MAX) {
+                cur[j] = best + sqrtf(d);
+            }
+        }
+        prev.swap(cur);
+    }
+
+    return prev[m] == FLT_MAX ? FLT_MAX : prev[m] / (n + m);
+}
+
+void Keywords::spot(const vector<float> &utt)
+{
+    vector<struct keyword_template>::const_iterator it;
+    vector<float> d;
+    size_t i, best = 0;
+    float nextd = FLT_MAX;
+
+    if (_templates.empty()) {
+        return;
+    }
+
+    for (it = _templates.begin(); it != _templates.end(); it++) {
+        d.push_back(match(utt, it->ceps));
+        if (d.back() < d[best]) {
+            best = d.size() - 1;
+        }
+    }
+
+    /* Only a clear winner over every other phrase will do */
+    for (i = 0; i < d.size(); i++) {
+        if ((d[i] < nextd) &&
+            (_templates[i].phrase != _templates[best].phrase)) {
+            nextd = d[i];
+        }
+    }
+
+    if ((d[best] > KEYWORDS_THRESHOLD) ||
+        ((nextd != FLT_MAX) && (d[best] > nextd * KEYWORDS_MARGIN))) {
+        return;                       // Up to whisper
+    }
+
+    const string &phrase = _templates[best].phrase;
+    printf("Keywords heard \"%s\" (%.2f, next %.2f)\n",
+           phrase.c_str(), d[best], nextd);
+    mosquitto->publish("rabbit/voice/keyword",
+                       phrase.length(), phrase.c_str(), 1, 0);
+    mosquitto->hear(phrase.c_str(), true);
+}
+
+void *Keywords::thread_func(void *args)
+{
+    Keywords *keywords = (Keywords *) args;
+
+    keywords->run();
+
+    return NULL;
+}
+
+void Keywords::run(void)
+{
+    struct rabbit_audio *audio = NULL;
+    struct keyword_stream ks;
+    struct timespec ts;
+    struct stat st;
+    int16_t pcm[RABBIT_AUDIO_BLOCK];
+    unsigned int loops = 0;
+    int ret;
+
+    if (!openStream(&ks)) {
+        fprintf(stderr, "Keywords failed to set up voice detection\n");
+        return;
+    }
+
+    while (_running) {
+        /* Pick up templates that were added or taken away */
+        if ((loops++ % 100) == 0) {
+            if (stat(KEYWORDS_DIR, &st) != 0) {
+                st.st_mtime = 0;
+            }
+            if (st.st_mtime != _mtime) {
+                _mtime = st.st_mtime;
+                loadTemplates();
+            }
+        }
+
+        if ((audio == NULL) && !_templates.empty()) {
+            audio = rabbit_audio_open(NULL);
+        }
+
+        if (audio == NULL) {
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += 1;
+            pthread_mutex_lock(&_mutex);
+            if (_running) {
+                pthread_cond_timedwait(&_cond, &_mutex, &ts);
+            }
+            pthread_mutex_unlock(&_mutex);
+            loops = 0;
+            continue;
+        }
+
+        ret = rabbit_audio_read(audio, pcm, NULL, 100);
+        if (ret < 0) {
+            rabbit_audio_close(audio);
+            audio = NULL;
+            continue;
+        } else if ((ret > 0) && feed(&ks, pcm)) {
+            spot(ks.utt);
+        }
+    }
+
+    if (audio) {
+        rabbit_audio_close(audio);
+    }
+    closeStream(&ks);
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,99 @@
+/*
+ * keywords.hxx
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#ifndef KEYWORDS_HXX
+#define KEYWORDS_HXX
+
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+#define KEYWORDS_DIR        "/var/lib/rabbit/keywords"
+#define KEYWORDS_WINDOW     400       // Samples, 25 ms
+#define KEYWORDS_FFT        512
+#define KEYWORDS_BINS       (KEYWORDS_FFT / 2 + 1)
+#define KEYWORDS_MELS       26
+#define KEYWORDS_CEPS       12        // c1 to c12, c0 is only loudness
+#define KEYWORDS_PREROLL    10        // Frames before the onset
+
+struct rabbit_vad;
+
+struct keyword_template {
+    std::string phrase;
+    std::vector<float> ceps;          // KEYWORDS_CEPS per 10 ms frame
+};
+
+/*
+ * Cuts one stream of blocks into utterances of cepstra.
+ */
+struct keyword_stream {
+    struct rabbit_vad *vad;
+    float history[KEYWORDS_WINDOW];
+    std::vector<float> recent;        // The last KEYWORDS_PREROLL frames
+    std::vector<float> utt;
+    bool overlong;
+};
+
+/*
+ * Spots the wake word and the fixed commands in the microphone capture
+ * long before whisper is done with them. Every 10 ms block from the
+ * audio ring is turned into mel cepstra. Each utterance of command length
+ * is then matched by dynamic time warping against templates recorded by
+ * the user, one WAV file per take in KEYWORDS_DIR named after the phrase,
+ * e.g. "raise_arms.wav" and "raise_arms-2.wav". A match is acted on as if
+ * the phrase had been transcribed; anything else is left to whisper.
+ */
+class Keywords {
+
+public:
+
+    Keywords();
+    ~Keywords();
+
+private:
+
+    bool openStream(struct keyword_stream *ks);
+    void closeStream(struct keyword_stream *ks);
+    bool feed(struct keyword_stream *ks, const int16_t *pcm);
+    void cepstra(struct keyword_stream *ks, const int16_t *pcm,
+                 float *ceps) const;
+    void loadTemplates(void);
+    bool loadTemplate(const char *path, struct keyword_template *kt);
+    float match(const std::vector<float> &a,
+                const std::vector<float> &b) const;
+    void spot(const std::vector<float> &utt);
+    static void *thread_func(void *args);
+    void run(void);
+
+    std::vector<struct keyword_template> _templates;
+    time_t _mtime;
+
+    float _hamming[KEYWORDS_WINDOW];
+    float _mel[KEYWORDS_MELS][KEYWORDS_BINS];
+    float _dct[KEYWORDS_CEPS][KEYWORDS_MELS];
+    float _cos[KEYWORDS_FFT / 2];
+    float _sin[KEYWORDS_FFT / 2];
+
+    bool _running;
+    pthread_t _thread;
+    pthread_mutex_t _mutex;
+    pthread_cond_t _cond;
+
+};
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -16,6 +16,8 @@
 #include <sys/time.h>
 #include <bsd/sys/time.h>
 #include <pthread.h>
+#include <math.h>
+#include <time.h>
 #include "rabbit.hxx"
 
 /*
@@ -34,6 +36,12 @@
 #define LIDAR_ROT_LO_PULSE         6000
 #define LIDAR_ROT_HI_PULSE        19990
 
+/*
+ * Half-width of the sectors, around 0 (forward) and 180 degrees, that are
+ * watched for obstacles.
+ */
+#define LIDAR_SECTOR_DEG             30.0
+
 struct cldr_message {
     uint16_t ph;
     uint8_t ct;
@@ -45,11 +53,24 @@ struct cldr_message {
 
 static unsigned int instance = 0;
 
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t) ts.tv_sec * 1000000ULL) + (ts.tv_nsec / 1000);
+}
+
 LiDAR::LiDAR()
     : _handle(-1),
       _operational(false),
       _speed(25),
-      _rpm(0)
+      _rpm(0),
+      _frontMin(NAN),
+      _rearMin(NAN),
+      _packetUs(0),
+      _topic("lidar")
 {
     if (instance != 0) {
         fprintf(stderr, "LiDAR can be instantiated only once!\n");
@@ -110,6 +131,7 @@ bool LiDAR::processData(const uint8_t *buf, size_t size)
     const uint16_t *si;
     double distance;
     double angle;
+    struct lidar_sample sample;
 
     if (size < sizeof(struct cldr_message)) {
         fprintf(stderr, "LiDAR short packet %zu\n", size);
@@ -162,6 +184,17 @@ bool LiDAR::processData(const uint8_t *buf, size_t size)
     /* Grab new RPM info */
     if ((message->ct & 0x1) == 0x1) {
         _rpm = (message->ct >> 1) * 60 / 10;
+
+        /* A revolution is complete, report what it saw */
+        if (safety) {
+            safety->report(SAFETY_LIDAR, _frontMin, _rearMin, _packetUs);
+        }
+        sample.front_mm = _frontMin;
+        sample.rear_mm = _rearMin;
+        sample.rpm = _rpm;
+        _topic.publish(sample, _packetUs);
+        _frontMin = NAN;
+        _rearMin = NAN;
     }
 
     fsa = (double) (message->fsa >> 1) / 64;
@@ -181,6 +214,14 @@ bool LiDAR::processData(const uint8_t *buf, size_t size)
         if (0) {
             printf("(%.0f, %.2f)\n", distance, angle);
         }
+        if (distance > 0.0) {
+            if (angle <= LIDAR_SECTOR_DEG ||
+                angle >= 360.0 - LIDAR_SECTOR_DEG) {
+                _frontMin = fminf(_frontMin, distance);
+            } else if (fabs(angle - 180.0) <= LIDAR_SECTOR_DEG) {
+                _rearMin = fminf(_rearMin, distance);
+            }
+        }
         angle += anglepp;
         if (angle > 360.0) {
             angle -= 360.0;
@@ -315,6 +356,7 @@ void LiDAR::run(void)
             if (buf[pos] != 0xaa) {
                 pos = 0;   /* Rewind */
             } else {
+                _packetUs = now_us();
                 pos++;
             }
             continue;
@@ -7,6 +7,17 @@
 #ifndef LIDAR_HXX
 #define LIDAR_HXX
 
+#include "samplebus.hxx"
+
+/*
+ * The nearest return ahead and behind over one revolution, NAN if none.
+ */
+struct lidar_sample {
+    float front_mm;
+    float rear_mm;
+    uint32_t rpm;
+};
+
 class LiDAR {
 
 public:
@@ -21,6 +32,7 @@ public:
     void setSpeed(unsigned int speed);
     unsigned int rpm(void) const;
     unsigned int pps(void) const;
+    SampleTopic<struct lidar_sample> &topic(void);
 
 private:
 
@@ -34,6 +46,10 @@ private:
     unsigned int _speed;
     unsigned int _rpm;
     unsigned int _pps;
+    float _frontMin;
+    float _rearMin;
+    uint64_t _packetUs;  // When the packet being read began to arrive
+    SampleTopic<struct lidar_sample> _topic;
 
     bool _running;
     pthread_t _thread;
@@ -57,6 +73,11 @@ inline unsigned int LiDAR::pps(void) const
     return _pps;
 }
 
+inline SampleTopic<struct lidar_sample> &LiDAR::topic(void)
+{
+    return _topic;
+}
+
 #endif
 
 /*
@@ -0,0 +1,105 @@
+/*
+ * mcudecoder.cxx
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#include <string.h>
+#include "mcudecoder.hxx"
+
+MCUDecoder::MCUDecoder()
+{
+    reset();
+}
+
+MCUDecoder::~MCUDecoder()
+{
+
+}
+
+void MCUDecoder::reset(void)
+{
+    _len = 0;
+    _synced = false;
+    _seq = 0;
+    _frames = 0;
+    _lost = 0;
+    _corrupt = 0;
+}
+
+void MCUDecoder::feed(const uint8_t *data, size_t len)
+{
+    /* Keep the newest bytes if the caller fell behind */
+    if (len > sizeof(_buf)) {
+        data += len - sizeof(_buf);
+        len = sizeof(_buf);
+    }
+
+    if (_len + len > sizeof(_buf)) {
+        discard(_len + len - sizeof(_buf));
+        _synced = false;
+    }
+
+    memcpy(_buf + _len, data, len);
+    _len += len;
+}
+
+void MCUDecoder::discard(size_t len)
+{
+    if (len >= _len) {
+        _len = 0;
+        return;
+    }
+
+    memmove(_buf, _buf + len, _len - len);
+    _len -= len;
+}
+
+bool MCUDecoder::next(struct rabbit_frame *frame)
+{
+    const uint8_t *sync;
+    uint16_t crc;
+
+    while (_len >= sizeof(*frame)) {
+        if (_buf[0] != RABBIT_FRAME_SYNC0 || _buf[1] != RABBIT_FRAME_SYNC1) {
+            sync = (const uint8_t *) memchr(_buf + 1, RABBIT_FRAME_SYNC0,
+                                            _len - 1);
+            discard(sync ? (size_t) (sync - _buf) : _len);
+            continue;
+        }
+
+        memcpy(frame, _buf, sizeof(*frame));
+        crc = rabbit_crc16(_buf + RABBIT_FRAME_CRC_OFFSET,
+                           RABBIT_FRAME_CRC_LEN);
+        if (frame->version != RABBIT_FRAME_VERSION ||
+            frame->len != sizeof(*frame) || frame->crc != crc) {
+            /* Not a frame after all, or a damaged one */
+            _corrupt++;
+            discard(1);
+            continue;
+        }
+
+        discard(sizeof(*frame));
+
+        if (_synced) {
+            _lost += (uint16_t) (frame->seq - _seq - 1);
+        }
+        _synced = true;
+        _seq = frame->seq;
+        _frames++;
+
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,77 @@
+/*
+ * mcudecoder.hxx
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#ifndef MCUDECODER_HXX
+#define MCUDECODER_HXX
+
+#include <stddef.h>
+#include <stdint.h>
+#include <rabbit_mcu_proto.h>
+
+#define MCU_DECODER_BUF_SIZE  512
+
+/*
+ * Reassembles the binary frames of a Rabbit MCU out of a byte stream fed
+ * in whatever chunks the serial port returns. Bad frames are dropped and
+ * the decoder resynchronizes on the next sync bytes; gaps in the sequence
+ * numbers are counted as lost frames.
+ */
+class MCUDecoder
+{
+
+public:
+
+    MCUDecoder();
+    ~MCUDecoder();
+
+    void reset(void);
+    void feed(const uint8_t *data, size_t len);
+    bool next(struct rabbit_frame *frame);
+
+    unsigned int frames(void) const;
+    unsigned int lost(void) const;
+    unsigned int corrupt(void) const;
+
+private:
+
+    void discard(size_t len);
+
+    uint8_t _buf[MCU_DECODER_BUF_SIZE];
+    size_t _len;
+    bool _synced;
+    uint16_t _seq;
+    unsigned int _frames;
+    unsigned int _lost;
+    unsigned int _corrupt;
+
+};
+
+inline unsigned int MCUDecoder::frames(void) const
+{
+    return _frames;
+}
+
+inline unsigned int MCUDecoder::lost(void) const
+{
+    return _lost;
+}
+
+inline unsigned int MCUDecoder::corrupt(void) const
+{
+    return _corrupt;
+}
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -7,33 +7,175 @@
 #ifndef MEDIANFILTER_HXX
 #define MEDIANFILTER_HXX
 
-template <typename T>
+#include <string.h>
+
+#define MEDIAN_FILTER_SCAN_N  16
+
+/*
+ * Sliding-window median and mean over the last N samples. The window is
+ * kept both in arrival order and sorted, so median() is a lookup and the
+ * mean a running sum. Once the window is full, a new sample takes the
+ * place of the oldest one in the sorted window and moves along to where
+ * it belongs, which costs the distance between the two rather than the
+ * size of the window. The oldest one is found by binary search, or by a
+ * walk in windows of up to MEDIAN_FILTER_SCAN_N. The sum is recomputed
+ * every time the window wraps, so that rounding errors don't accumulate.
+ */
+template <typename T, unsigned int N = 10>
 class MedianFilter
 {
 
 public:
 
-    MedianFilter(unsigned int windowSize = 10);
+    MedianFilter();
     ~MedianFilter();
 
     void addSample(T s);
-    T median(void);
-    T average(void);
+    T median(void) const;
+    T average(void) const;
+    unsigned int count(void) const;
+    void clear(void);
 
 private:
 
-    unsigned int _windowSize;
-    T *_samples;
-    T *_sorted;
-    unsigned int _index;
+    unsigned int lowerBound(T s) const;
+
+    T _samples[N];             // In arrival order, a ring
+    T _sorted[N];
+    unsigned int _index;       // Where the next sample goes
     unsigned int _sampleCount;
-    T _median;
-    bool _medianUp2date;
-    T _average;
-    bool _averageUp2date;
+    double _sum;
 
 };
 
+template <typename T, unsigned int N>
+MedianFilter<T, N>::MedianFilter()
+    : _index(0),
+      _sampleCount(0),
+      _sum(0.0)
+{
+
+}
+
+template <typename T, unsigned int N>
+MedianFilter<T, N>::~MedianFilter()
+{
+
+}
+
+/*
+ * First position in _sorted not less than s.
+ */
+template <typename T, unsigned int N>
+unsigned int MedianFilter<T, N>::lowerBound(T s) const
+{
+    unsigned int lo = 0, hi = _sampleCount, mid;
+
+    /* Few enough to walk, which beats halving */
+    if (N <= MEDIAN_FILTER_SCAN_N) {
+        while (lo < hi && _sorted[lo] < s) {
+            lo++;
+        }
+        return lo;
+    }
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (_sorted[mid] < s) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+template <typename T, unsigned int N>
+void MedianFilter<T, N>::addSample(T s)
+{
+    unsigned int i, j;
+
+    /* NaN has no place in the order */
+    if (s != s) {
+        return;
+    }
+
+    if (N == 1) {
+        /* Its own median, and the sum is redone on every wrap */
+        _sampleCount = N;
+    } else if (_sampleCount == N) {
+        /* Over the oldest sample, then along to where it belongs */
+        i = lowerBound(_samples[_index]);
+        _sum -= _samples[_index];
+        while (i > 0 && _sorted[i - 1] > s) {
+            _sorted[i] = _sorted[i - 1];
+            i--;
+        }
+        while (i < N - 1 && _sorted[i + 1] < s) {
+            _sorted[i] = _sorted[i + 1];
+            i++;
+        }
+        _sorted[i] = s;
+    } else {
+        j = lowerBound(s);
+        memmove(&_sorted[j + 1], &_sorted[j],
+                (_sampleCount - j) * sizeof(T));
+        _sorted[j] = s;
+        _sampleCount++;
+    }
+
+    _samples[_index] = s;
+    _index++;
+    if (_index == N) {
+        _index = 0;
+        _sum = 0.0;
+        for (i = 0; i < N; i++) {
+            _sum += _samples[i];
+        }
+    } else {
+        _sum += s;
+    }
+}
+
+template <typename T, unsigned int N>
+T MedianFilter<T, N>::median(void) const
+{
+    if (_sampleCount == 0) {
+        return (T) 0;
+    }
+
+    if (N == 1) {
+        return _samples[0];
+    }
+
+    return _sorted[_sampleCount / 2];
+}
+
+template <typename T, unsigned int N>
+T MedianFilter<T, N>::average(void) const
+{
+    if (_sampleCount == 0) {
+        return (T) 0;
+    }
+
+    return (T) (_sum / _sampleCount);
+}
+
+template <typename T, unsigned int N>
+unsigned int MedianFilter<T, N>::count(void) const
+{
+    return _sampleCount;
+}
+
+template <typename T, unsigned int N>
+void MedianFilter<T, N>::clear(void)
+{
+    _index = 0;
+    _sampleCount = 0;
+    _sum = 0.0;
+}
+
 #endif
 
 /*
@@ -4,12 +4,16 @@
  * Copyright (C) 2023, Charles Chiou
  */
 
+#include <time.h>
+#include <pthread.h>
 #include <string>
 #include <mosquitto.h>
 #include "rabbit.hxx"
 
 using namespace std;
 
+#define SPOTTED_HOLD_MS  8000    // For whisper to catch up
+
 struct mosquitto *mosq = NULL;
 
 struct mosq_sub_action {
@@ -19,6 +23,9 @@ struct mosq_sub_action {
 };
 
 static bool attention = false;
+static pthread_mutex_t hear_mutex = PTHREAD_MUTEX_INITIALIZER;
+static string last_spotted;
+static struct timespec last_spotted_ts;
 
 static int match_keywords(const char *text, const char *argv[])
 {
@@ -37,9 +44,60 @@ static int match_keywords(const char *text, const char *argv[])
     return 1;
 }
 
-static void do_hear(const struct mosquitto_message *msg)
+/*
+ * Whether each word of the phrase starts a word of the text, so that "ok"
+ * takes whisper's "Okay,". The words of the text not taken by the phrase
+ * are left in rest.
+ */
+static int strip_phrase(const char *text, const char *phrase, string &rest)
+{
+    static const char *delim = " \t\r\n,.;:!?";
+    char buf[128], words[256], *word, *save, *w;
+    size_t len;
+
+    strncpy(buf, phrase, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+    strncpy(words, text, sizeof(words) - 1);
+    words[sizeof(words) - 1] = '\0';
+
+    for (word = strtok_r(buf, " ", &save);
+         word != NULL;
+         word = strtok_r(NULL, " ", &save)) {
+        len = strlen(word);
+        for (w = words + strspn(words, delim); *w != '\0';
+             w += strcspn(w, delim), w += strspn(w, delim)) {
+            if (strncasecmp(w, word, len) == 0) {
+                break;
+            }
+        }
+
+        if (*w == '\0') {
+            return 0;
+        }
+
+        /* Taken, blank it out */
+        memset(w, ' ', strcspn(w, delim));
+    }
+
+    rest.clear();
+    for (w = strtok_r(words, delim, &save);
+         w != NULL;
+         w = strtok_r(NULL, delim, &save)) {
+        if (!rest.empty()) {
+            rest += ' ';
+        }
+        rest += w;
+    }
+
+    return 1;
+}
+
+/*
+ * What was said along with a spotted phrase may hold no command at all,
+ * and is then let go without an apology.
+ */
+static void do_command(const char *text, bool apologize = true)
 {
-    const char *text = (const char *) msg->payload;
     static const char *ok_robot[] = { "ok", "robot", NULL, };
     static const char *ok2_robot[] = { "okay", "robot", NULL, };
     static const char *give_hug[] = { "give", "hug", NULL, };
@@ -63,10 +121,6 @@ static void do_hear(const struct mosquitto_message *msg)
     static const char *earsback[] = { "ears", "back", NULL, };
     static const char *earsdown[] = { "ears", "down", NULL, };
 
-    if (strchr(text, ' ') == NULL) {
-        return;  // Less than two words
-    }
-
     head->earsUp();
 
     if (attention == false) {
@@ -107,44 +161,7 @@ static void do_hear(const struct mosquitto_message *msg)
         } else if (match_keywords(text, whoareyou)) {
             rabbit_keycontrol('t');
         } else if (match_keywords(text, emotions)) {
-            speech->speak("I'm relaxed");
-            mouth->beh();
-            head->eyebrowSetDisposition(Head::EB_RELAXED);
-            sleep(2);
-            speech->speak("perplexed");
-            mouth->beh();
-            head->eyebrowSetDisposition(Head::EB_PERPLEXED);
-            sleep(2);
-            speech->speak("surprised");
-            mouth->beh();
-            head->eyebrowSetDisposition(Head::EB_SURPRISED);
-            sleep(2);
-            speech->speak("happy");
-            mouth->smile();
-            head->eyebrowSetDisposition(Head::EB_HAPPY);
-            sleep(2);
-            speech->speak("jubilant");
-            mouth->smile();
-            head->eyebrowSetDisposition(Head::EB_JUBILANT);
-            sleep(2);
-            speech->speak("angry");
-            mouth->beh();
-            head->eyebrowSetDisposition(Head::EB_ANGRY);
-            sleep(2);
-            speech->speak("furiuous");
-            mouth->beh();
-            head->eyebrowSetDisposition(Head::EB_FURIOUS);
-            sleep(2);
-            speech->speak("sad");
-            mouth->beh();
-            head->eyebrowSetDisposition(Head::EB_SAD);
-            sleep(2);
-            speech->speak("depressed");
-            mouth->beh();
-            head->eyebrowSetDisposition(Head::EB_DEPRESSED);
-            sleep(2);
-            head->eyebrowSetDisposition(Head::EB_RELAXED);
-            mouth->cylon();
+            gestures->play("emotions");
         } else if (match_keywords(text, earsup)) {
             speech->speak("I'm all ears");
             head->earsUp();
@@ -157,7 +174,7 @@ static void do_hear(const struct mosquitto_message *msg)
             speech->speak("yikes");
             head->earsDown();
             head->eyebrowSetDisposition(Head::EB_DEPRESSED);
-        } else {
+        } else if (apologize) {
             mouth->beh();
             speech->speak("sorry!");
             attention = false;
@@ -165,6 +182,13 @@ static void do_hear(const struct mosquitto_message *msg)
     }
 }
 
+static void do_hear(const struct mosquitto_message *msg)
+{
+    if (mosquitto) {
+        mosquitto->hear((const char *) msg->payload, false);
+    }
+}
+
 static void do_speak(const struct mosquitto_message *msg)
 {
     if (speech) {
@@ -364,6 +388,40 @@ void Mosquitto::onMessage(struct mosquitto *mosq, void *obj,
     }
 }
 
+/*
+ * Act on what was heard, whether transcribed by whisper or spotted by
+ * Keywords. Whisper gets round to what was spotted later on, and that
+ * is not acted on twice, but whatever else it heard along with it is.
+ */
+void Mosquitto::hear(const char *text, bool spotted)
+{
+    struct timespec now;
+    string rest;
+    long ms;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    pthread_mutex_lock(&hear_mutex);
+    if (spotted) {
+        last_spotted = text;
+        last_spotted_ts = now;
+        do_command(text);
+    } else {
+        ms = (now.tv_sec - last_spotted_ts.tv_sec) * 1000 +
+            (now.tv_nsec - last_spotted_ts.tv_nsec) / 1000000;
+        if (!last_spotted.empty() && (ms < SPOTTED_HOLD_MS) &&
+            strip_phrase(text, last_spotted.c_str(), rest)) {
+            last_spotted.clear();     // Already acted on
+            if (!rest.empty()) {
+                do_command(rest.c_str(), false);     // Said along with it
+            }
+        } else if (strchr(text, ' ') != NULL) {
+            do_command(text);     // At least two words
+        }
+    }
+    pthread_mutex_unlock(&hear_mutex);
+}
+
 int Mosquitto::publish(const char *topic,
                        int payloadlen, const void *payload,
                        int qos, bool retain)
@@ -20,6 +20,7 @@ public:
     int publish(const char *topic,
                 int payloadlen, const void *payload,
                 int qos, bool retain);
+    void hear(const char *text, bool spotted = false);
 
     unsigned int published(void) const;
     unsigned int publishConfirmed(void) const;
@@ -31,6 +31,8 @@ static int baseline = 0;
 static Size textSize;
 static const Scalar fontColor(255, 255, 255);
 static struct timeval since;
+static pthread_mutex_t osd_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bool osd_stopped = false;
 
 void OsdCam::initialize(void)
 {
@@ -57,10 +59,20 @@ void OsdCam::genOsdFrame(cv::Mat &osdFrame, float videoFrameRate)
     struct timeval now, tdiff;
     unsigned int updays, uphours, upminutes, upseconds;
     struct wifi_stat wifi_stat;
+    struct audio_level level;
+    unsigned int b;
+    int bar, x;
     char buf[128];
     time_t tt;
     struct tm *tm;
 
+    /* The OSD reads most of the robot, which goes away on shutdown */
+    pthread_mutex_lock(&osd_mutex);
+    if (osd_stopped) {
+        pthread_mutex_unlock(&osd_mutex);
+        return;
+    }
+
     gettimeofday(&now, NULL);
 
     osdFrame.setTo(Scalar::all(0));
@@ -138,6 +150,26 @@ void OsdCam::genOsdFrame(cv::Mat &osdFrame, float videoFrameRate)
     putText(osdFrame, text, pos,
             fontFace, fontScale, fontColor, thickness, LINE_8, false);
 
+    if (power->runtimeMin() >= 0.0) {
+        snprintf(buf, sizeof(buf) - 1, "%.0f%% %.0fmin",
+                 power->soc(), power->runtimeMin());
+    } else {
+        snprintf(buf, sizeof(buf) - 1, "%.0f%%", power->soc());
+    }
+    text = String("Batt Charge: ") + buf;
+    pos.y += textSize.height;
+    putText(osdFrame, text, pos,
+            fontFace, fontScale, fontColor, thickness, LINE_8, false);
+
+    if (governor->level() != GOVERNOR_NORMAL) {
+        snprintf(buf, sizeof(buf) - 1, "%s (-%.1fW)",
+                 governor->levelName(), governor->shedWatts());
+        text = String("Governor: ") + buf;
+        pos.y += textSize.height;
+        putText(osdFrame, text, pos,
+                fontFace, fontScale, fontColor, thickness, LINE_8, false);
+    }
+
     snprintf(buf, sizeof(buf) - 1, "%.1f", compass->heading());
     text = String("Heading: ") + buf + String(" deg");
     pos.y += textSize.height;
@@ -180,6 +212,27 @@ void OsdCam::genOsdFrame(cv::Mat &osdFrame, float videoFrameRate)
     putText(osdFrame, text, pos,
             fontFace, fontScale, fontColor, thickness, LINE_8, false);
 
+    if (voice->getLevel(&level)) {
+        /* VU from -60 to 0 dBFS, then a bar per octave band */
+        bar = (int) ((level.rmsDb + 60.0) / 3.0);
+        bar = bar < 0 ? 0 : bar > 20 ? 20 : bar;
+        snprintf(buf, sizeof(buf) - 1, "%.1f dBFS ", level.rmsDb);
+        text = String("Voice: ") + buf + string(bar, '|') +
+            string(20 - bar, '.');
+        pos.y += textSize.height;
+        putText(osdFrame, text, pos,
+                fontFace, fontScale, fontColor, thickness, LINE_8, false);
+
+        x = pos.x + getTextSize(text, fontFace, fontScale, thickness,
+                                &baseline).width + 8;
+        for (b = 0; b < AUDIO_METER_BANDS; b++) {
+            bar = (int) ((level.bandDb[b] + 60.0) * textSize.height / 60.0);
+            bar = bar < 1 ? 1 : bar > textSize.height ? textSize.height : bar;
+            rectangle(osdFrame, Point(x + b * 5, pos.y - bar),
+                      Point(x + b * 5 + 3, pos.y), fontColor, FILLED);
+        }
+    }
+
     text = String("LiDAR RPM: ") +
         (lidar->isEnabled() ? to_string(lidar->rpm()) : "off");
     pos.y += textSize.height;
@@ -192,7 +245,9 @@ void OsdCam::genOsdFrame(cv::Mat &osdFrame, float videoFrameRate)
     putText(osdFrame, text, pos,
             fontFace, fontScale, fontColor, thickness, LINE_8, false);
 
-    text = String("Wheels: ") + wheels->stateStr();
+    snprintf(buf, sizeof(buf) - 1, "%.0fmm/s %.0fdeg/s",
+             wheels->speed(), wheels->turnRate());
+    text = String("Wheels: ") + buf;
     pos.y += textSize.height;
     putText(osdFrame, text, pos,
             fontFace, fontScale, fontColor, thickness, LINE_8, false);
@@ -311,6 +366,19 @@ void OsdCam::genOsdFrame(cv::Mat &osdFrame, float videoFrameRate)
     pos.y += textSize.height;
     putText(osdFrame, text, pos,
             fontFace, fontScale, fontColor, thickness, LINE_8, false);
+
+    pthread_mutex_unlock(&osd_mutex);
+}
+
+/*
+ * Wait out an OSD being drawn and draw no more, the camera threads keep the
+ * last one they got.
+ */
+void OsdCam::shutdown(void)
+{
+    pthread_mutex_lock(&osd_mutex);
+    osd_stopped = true;
+    pthread_mutex_unlock(&osd_mutex);
 }
 
 /*
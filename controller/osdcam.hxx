@@ -14,6 +14,7 @@ public:
     static void initialize(void);
     static void genOsdFrame(cv::Mat &osdFrame,
                             float videoFrameRate);
+    static void shutdown(void);
 
 };
 
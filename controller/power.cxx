@@ -4,6 +4,8 @@
  * Copyright (C) 2023, Charles Chiou
  */
 
+#include <sys/time.h>
+#include <bsd/sys/time.h>
 #include "rabbit.hxx"
 
 /*
@@ -17,10 +19,90 @@
  */
 #define CURRENT_ADC_CHAN 1
 
+/*
+ * Current is sampled fast enough to profile the load of the motors and
+ * servos, the battery voltage moves slowly.
+ */
+#define VOLTAGE_ADC_HZ   10
+#define CURRENT_ADC_HZ  250
+
+/*
+ * 2S Li-ion pack. The open-circuit voltage is estimated from the terminal
+ * voltage and the internal resistance, and the state of charge is pulled
+ * towards it by POWER_OCV_GAIN per sample.
+ */
+#define POWER_CELLS             2
+#define POWER_CAPACITY_AH     3.0
+#define POWER_INTERNAL_OHM   0.15
+#define POWER_OCV_GAIN      0.002
+#define POWER_LOW_SOC        20.0
+
+#define POWER_SAMPLE_MS       100
+#define POWER_PUBLISH_SAMPLES  10
+#define POWER_AVG_ALPHA      0.01     // About 10s
+#define POWER_BASE_ALPHA     0.05     // About 2s of idle
+
+static const char *subsystem_names[POWER_SUBSYSTEMS] = {
+    "base",
+    "wheels",
+    "lidar",
+    "stereo",
+    "vision",
+    "voice",
+};
+
+/* Nominal draw above the baseline, in A, for the attribution */
+static const float subsystem_amps[POWER_SUBSYSTEMS] = {
+    0.0,
+    1.20,
+    0.45,
+    0.70,
+    0.35,
+    0.15,
+};
+
+/* Open-circuit voltage of a Li-ion cell, every 10% from empty */
+static const float cell_ocv[11] = {
+    3.00, 3.45, 3.68, 3.74, 3.77, 3.79, 3.82, 3.87, 3.92, 3.98, 4.20,
+};
+
 static unsigned int instance = 0;
 
+static float ocv_to_soc(float v)
+{
+    unsigned int i;
+
+    v /= POWER_CELLS;
+    if (v <= cell_ocv[0]) {
+        return 0.0;
+    }
+
+    for (i = 1; i < 11; i++) {
+        if (v < cell_ocv[i]) {
+            return 10.0 * ((i - 1) +
+                           (v - cell_ocv[i - 1]) /
+                           (cell_ocv[i] - cell_ocv[i - 1]));
+        }
+    }
+
+    return 100.0;
+}
+
+static float adc_to_amps(float v)
+{
+    return (v - 2.5) * 5.0;
+}
+
 Power::Power()
+    : _valid(false),
+      _soc(0.0),
+      _avgCurrent(0.0),
+      _baseCurrent(0.0),
+      _lastUs(0),
+      _running(false)
 {
+    unsigned int i;
+
     if (instance != 0) {
         fprintf(stderr, "Power can be instantiated only once!\n");
         exit(EXIT_FAILURE);
@@ -28,11 +110,34 @@ Power::Power()
         instance++;
     }
 
+    for (i = 0; i < POWER_SUBSYSTEMS; i++) {
+        _energyWh[i] = 0.0;
+    }
+
+    if (adc) {
+        adc->setRate(VOLTAGE_ADC_CHAN, VOLTAGE_ADC_HZ);
+        adc->setRate(CURRENT_ADC_CHAN, CURRENT_ADC_HZ);
+    }
+
+    _running = true;
+    pthread_mutex_init(&_mutex, NULL);
+    pthread_cond_init(&_cond, NULL);
+    pthread_create(&_thread, NULL, Power::thread_func, this);
+    pthread_setname_np(_thread, "R'Power");
+
     printf("Power is online\n");
 }
 
 Power::~Power()
 {
+    pthread_mutex_lock(&_mutex);
+    _running = false;
+    pthread_cond_broadcast(&_cond);
+    pthread_mutex_unlock(&_mutex);
+    pthread_join(_thread, NULL);
+    pthread_mutex_destroy(&_mutex);
+    pthread_cond_destroy(&_cond);
+
     instance--;
     printf("Power is offline\n");
 }
@@ -52,11 +157,236 @@ float Power::current(void) const
     float v;
 
     v = adc->v(CURRENT_ADC_CHAN);
-    v = (v - 2.5) * 5.0;
+    v = adc_to_amps(v);
 
     return v;
 }
 
+/*
+ * Minutes left at the average current of the last several seconds,
+ * negative if unknown or charging.
+ */
+float Power::runtimeMin(void) const
+{
+    if (!_valid || (_avgCurrent <= 0.05)) {
+        return -1.0;
+    }
+
+    return (_soc / 100.0) * POWER_CAPACITY_AH / _avgCurrent * 60.0;
+}
+
+bool Power::isLow(void) const
+{
+    return _valid && (_soc < POWER_LOW_SOC);
+}
+
+float Power::energyWh(enum power_subsystem subsystem) const
+{
+    if (subsystem >= POWER_SUBSYSTEMS) {
+        return 0.0;
+    }
+
+    return _energyWh[subsystem];
+}
+
+const char *Power::subsystemName(enum power_subsystem subsystem) const
+{
+    if (subsystem >= POWER_SUBSYSTEMS) {
+        return NULL;
+    }
+
+    return subsystem_names[subsystem];
+}
+
+void *Power::thread_func(void *args)
+{
+    Power *power = (Power *) args;
+
+    power->run();
+
+    return NULL;
+}
+
+void Power::run(void)
+{
+    struct timespec ts, tloop;
+    unsigned int n = 0;
+
+    tloop.tv_sec = 0;
+    tloop.tv_nsec = POWER_SAMPLE_MS * 1000000;
+
+    while (_running) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        timespecadd(&ts, &tloop, &ts);
+
+        sample();
+
+        n++;
+        if ((n % POWER_PUBLISH_SAMPLES) == 0) {
+            publish();
+        }
+
+        pthread_mutex_lock(&_mutex);
+        if (_running) {
+            pthread_cond_timedwait(&_cond, &_mutex, &ts);
+        }
+        pthread_mutex_unlock(&_mutex);
+    }
+}
+
+/*
+ * Bitmap of the subsystems drawing power right now.
+ */
+unsigned int Power::activeSubsystems(void) const
+{
+    unsigned int active = 0;
+
+    if (wheels && wheels->isMoving()) {
+        active |= (1 << POWER_WHEELS);
+    }
+
+    if (lidar && lidar->isEnabled()) {
+        active |= (1 << POWER_LIDAR);
+    }
+
+    if (stereovision && stereovision->isVisionEn()) {
+        active |= (1 << POWER_STEREO);
+    }
+
+    if (camera && camera->isVisionEn()) {
+        active |= (1 << POWER_VISION);
+    }
+
+    if (voice && voice->isEnabled()) {
+        active |= (1 << POWER_VOICE);
+    }
+
+    return active;
+}
+
+/*
+ * The baseline is learnt while nothing is active. Above it, the current
+ * is split among the active subsystems by their nominal draw.
+ */
+void Power::attribute(float v, float i, float dt)
+{
+    unsigned int active, k;
+    float nominal = 0.0, excess;
+
+    active = activeSubsystems();
+    if (active == 0) {
+        _baseCurrent += POWER_BASE_ALPHA * (i - _baseCurrent);
+        _energyWh[POWER_BASE] += v * i * dt / 3600.0;
+        return;
+    }
+
+    for (k = 1; k < POWER_SUBSYSTEMS; k++) {
+        if (active & (1 << k)) {
+            nominal += subsystem_amps[k];
+        }
+    }
+
+    excess = i - _baseCurrent;
+    if (excess < 0.0) {
+        excess = 0.0;
+    }
+
+    _energyWh[POWER_BASE] += v * (i - excess) * dt / 3600.0;
+    for (k = 1; k < POWER_SUBSYSTEMS; k++) {
+        if (active & (1 << k)) {
+            _energyWh[k] +=
+                v * excess * (subsystem_amps[k] / nominal) * dt / 3600.0;
+        }
+    }
+}
+
+/*
+ * Integrate the current samples taken since the last call.
+ */
+void Power::sample(void)
+{
+    struct adc_sample samples[ADC_HISTORY];
+    unsigned int n, k;
+    float v, i, ocv, dt;
+
+    if ((adc == NULL) || !adc->isDeviceOnline()) {
+        return;
+    }
+
+    v = voltage();
+    if (v <= 0.0) {
+        return;
+    }
+
+    n = adc->history(CURRENT_ADC_CHAN, samples, ADC_HISTORY);
+    if (n == 0) {
+        return;
+    }
+
+    if (!_valid) {
+        _soc = ocv_to_soc(v + adc_to_amps(samples[n - 1].v) *
+                          POWER_INTERNAL_OHM);
+        _baseCurrent = adc_to_amps(samples[n - 1].v);
+        _avgCurrent = _baseCurrent;
+        _lastUs = samples[n - 1].us;
+        _valid = true;
+        return;
+    }
+
+    for (k = 0; k < n; k++) {
+        if (samples[k].us <= _lastUs) {
+            continue;
+        }
+
+        dt = (samples[k].us - _lastUs) / 1000000.0;
+        _lastUs = samples[k].us;
+        if (dt > 1.0) {
+            continue;        // A gap in the samples, don't extrapolate
+        }
+
+        i = adc_to_amps(samples[k].v);
+        _soc -= i * dt / (POWER_CAPACITY_AH * 3600.0) * 100.0;
+        attribute(v, i, dt);
+    }
+
+    i = current();
+    _avgCurrent += POWER_AVG_ALPHA * (i - _avgCurrent);
+
+    /* Voltage-curve correction */
+    ocv = v + i * POWER_INTERNAL_OHM;
+    _soc += POWER_OCV_GAIN * (ocv_to_soc(ocv) - _soc);
+    if (_soc < 0.0) {
+        _soc = 0.0;
+    } else if (_soc > 100.0) {
+        _soc = 100.0;
+    }
+}
+
+void Power::publish(void)
+{
+    float v, i, runtime;
+    unsigned int k;
+    char topic[64];
+
+    if (!_valid || (mosquitto == NULL)) {
+        return;
+    }
+
+    v = voltage();
+    i = current();
+    runtime = runtimeMin();
+
+    mosquitto->publish("rabbit/power/voltage", sizeof(float), &v, 2, 0);
+    mosquitto->publish("rabbit/power/current", sizeof(float), &i, 2, 0);
+    mosquitto->publish("rabbit/power/soc", sizeof(float), &_soc, 2, 0);
+    mosquitto->publish("rabbit/power/runtime", sizeof(float), &runtime, 2, 0);
+    for (k = 0; k < POWER_SUBSYSTEMS; k++) {
+        snprintf(topic, sizeof(topic) - 1, "rabbit/power/energy/%s",
+                 subsystem_names[k]);
+        mosquitto->publish(topic, sizeof(float), &_energyWh[k], 2, 0);
+    }
+}
+
 /*
  * Local variables:
  * mode: C++
@@ -7,6 +7,25 @@
 #ifndef POWER_HXX
 #define POWER_HXX
 
+#include <stdint.h>
+
+enum power_subsystem {
+    POWER_BASE = 0,        // Whatever is left: SoC, idle sensors, ...
+    POWER_WHEELS = 1,
+    POWER_LIDAR = 2,
+    POWER_STEREO = 3,
+    POWER_VISION = 4,
+    POWER_VOICE = 5,
+    POWER_SUBSYSTEMS = 6,
+};
+
+/*
+ * Battery telemetry. Current is integrated from the ADC samples into a
+ * coulomb-counted state of charge, which is pulled slowly towards the one
+ * read off the open-circuit voltage curve so that it does not drift.
+ * Energy above the idle baseline is attributed to the subsystems that are
+ * active, in proportion to their nominal draw.
+ */
 class Power {
 
 public:
@@ -17,8 +36,46 @@ public:
     float voltage(void) const;
     float current(void) const;
 
+    bool isValid(void) const;
+    float soc(void) const;
+    float runtimeMin(void) const;
+    bool isLow(void) const;
+    float energyWh(enum power_subsystem subsystem) const;
+    const char *subsystemName(enum power_subsystem subsystem) const;
+
+private:
+
+    static void *thread_func(void *args);
+    void run(void);
+    void sample(void);
+    unsigned int activeSubsystems(void) const;
+    void attribute(float v, float i, float dt);
+    void publish(void);
+
+    bool _valid;
+    float _soc;
+    float _avgCurrent;
+    float _baseCurrent;
+    float _energyWh[POWER_SUBSYSTEMS];
+    uint64_t _lastUs;
+
+    bool _running;
+    pthread_t _thread;
+    pthread_mutex_t _mutex;
+    pthread_cond_t _cond;
+
 };
 
+inline bool Power::isValid(void) const
+{
+    return _valid;
+}
+
+inline float Power::soc(void) const
+{
+    return _soc;
+}
+
 #endif
 
 /*
@@ -15,18 +15,69 @@
 #include <bsd/sys/time.h>
 #include <pthread.h>
 #include <termios.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
 #include <errno.h>
-#include <pigpio.h>
+#include <math.h>
 #include <string>
-#include "proximity.hxx"
+#include "rabbit.hxx"
+
+/*
+ * MCU 0 carries the sensors facing forward, MCU 1 those facing backward.
+ * An IR sensor reads IR_OBSTACLE_LEVEL when something is within about
+ * IR_RANGE_MM.
+ */
+#define FRONT_MCU             0
+#define REAR_MCU              1
+#define IR_OBSTACLE_LEVEL     1
+#define IR_RANGE_MM         100.0
+
+/*
+ * Readings older than PROXIMITY_STALE_MS are not trusted, an MCU silent
+ * for PROXIMITY_SILENT_MS while streaming is closed. Hotplugged MCUs are
+ * probed up to PROXIMITY_PROBE_RETRIES times, a second apart.
+ */
+#define PROXIMITY_POLL_MS          100
+#define PROXIMITY_STALE_MS         200
+#define PROXIMITY_SILENT_MS       1000
+#define PROXIMITY_PROBE_RETRIES      3
+#define PROXIMITY_HOTPLUG_ID      RABBIT_MCUS
+
+/*
+ * MCUs report only changes beyond PROXIMITY_DEADBAND_MM, and repeat their
+ * state every PROXIMITY_HEARTBEAT_MS, well within PROXIMITY_STALE_MS.
+ * Firmware that predates "report change" ignores it and pushes everything.
+ */
+#define PROXIMITY_DEADBAND_MM       10
+#define PROXIMITY_HEARTBEAT_MS      80
 
 using namespace std;
 
 static unsigned int instance = 0;
 
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t) ts.tv_sec * 1000ULL) + (ts.tv_nsec / 1000000);
+}
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t) ts.tv_sec * 1000000ULL) + (ts.tv_nsec / 1000);
+}
+
 Proximity::Proximity()
-    : _enabled(true)
+    : _enabled(true),
+      _topic("proximity")
 {
+    struct epoll_event ev;
     unsigned int i;
 
     if (instance != 0) {
@@ -39,14 +90,48 @@ Proximity::Proximity()
     for (i = 0; i < RABBIT_MCUS; i++) {
         _handle[i] = -1;
         _node[i] = "";
+        _binary[i] = false;
+        _lineLen[i] = 0;
+        _lastRx[i] = 0;
+        _probeRetries[i] = PROXIMITY_PROBE_RETRIES;
+        _lineSeq[i] = 0;
         _temp_c[i] = 0.0;
     }
 
     bzero(&_ir, sizeof(_ir));
     bzero(&_us, sizeof(_us));
+    bzero(&_irHistory, sizeof(_irHistory));
+    bzero(&_usHistory, sizeof(_usHistory));
+    _updates = 0;
+    _updatedUs = 0;
+    _nextSubscriber = 1;
+
+    _epollfd = epoll_create1(EPOLL_CLOEXEC);
+    if (_epollfd == -1) {
+        perror("epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Watch for MCUs being plugged in, fall back to polling without */
+    _inotifyfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (_inotifyfd != -1) {
+        if (inotify_add_watch(_inotifyfd, "/dev", IN_CREATE | IN_ATTRIB) ==
+            -1) {
+            perror("inotify_add_watch");
+            close(_inotifyfd);
+            _inotifyfd = -1;
+        } else {
+            ev.events = EPOLLIN;
+            ev.data.u32 = PROXIMITY_HOTPLUG_ID;
+            epoll_ctl(_epollfd, EPOLL_CTL_ADD, _inotifyfd, &ev);
+        }
+    } else {
+        perror("inotify_init1");
+    }
 
     _running = true;
     pthread_mutex_init(&_mutex, NULL);
+    pthread_mutex_init(&_subMutex, NULL);
     pthread_cond_init(&_cond, NULL);
     pthread_create(&_thread, NULL, Proximity::thread_func, this);
     pthread_setname_np(_thread, "R'Proximity");
@@ -61,8 +146,6 @@ Proximity::~Proximity()
     _running = false;
     pthread_cond_broadcast(&_cond);
     pthread_join(_thread, NULL);
-    pthread_mutex_destroy(&_mutex);
-    pthread_cond_destroy(&_cond);
 
     stop();
 
@@ -72,6 +155,15 @@ Proximity::~Proximity()
         }
     }
 
+    if (_inotifyfd != -1) {
+        close(_inotifyfd);
+    }
+    close(_epollfd);
+
+    pthread_mutex_destroy(&_mutex);
+    pthread_mutex_destroy(&_subMutex);
+    pthread_cond_destroy(&_cond);
+
     instance--;
     printf("Proximity is offline\n");
 }
@@ -148,7 +240,9 @@ void Proximity::probeOpenDevice(unsigned int id)
     int ret = 0;
     char devname[32];
     char devid[64];
+    char *proto;
     struct termios tty;
+    struct epoll_event ev;
     char buf[128];
 
     if (id >= RABBIT_MCUS) {
@@ -231,21 +325,38 @@ void Proximity::probeOpenDevice(unsigned int id)
     if (strstr(devid, "Rabbit MCU on ") != devid) {
         ret = -1;
         goto done;
-    } else {
-        _node[id] = string(devid + 14);
     }
 
-    printf("MCU %s is online\n", _node[id].c_str());
+    /* MCUs that speak the binary protocol say so at the end of the banner */
+    proto = strstr(devid, RABBIT_PROTO_BANNER);
+    _binary[id] = (proto != NULL);
+    if (proto != NULL) {
+        *proto = '\0';
+    }
+    _node[id] = string(devid + 14);
+    _decoder[id].reset();
+    _lineLen[id] = 0;
+    _lastRx[id] = now_ms();
+
+    printf("MCU %s is online%s\n", _node[id].c_str(),
+           _binary[id] ? " (binary)" : "");
 
     /* Start streaming */
     if (_enabled) {
-        ret = write(_handle[id], "stream\r", 7);
-        if (ret != 7) {
+        if (!startStream(id)) {
             ret = -1;
             goto done;
         }
     }
 
+    ev.events = EPOLLIN;
+    ev.data.u32 = id;
+    ret = epoll_ctl(_epollfd, EPOLL_CTL_ADD, _handle[id], &ev);
+    if (ret != 0) {
+        perror("epoll_ctl");
+        goto done;
+    }
+
     ret = 0;
 
 done:
@@ -271,8 +382,15 @@ void Proximity::errCloseDevice(unsigned int id)
         return;
     }
 
-    printf("Put MCU %s offline\n", _node[id].c_str());
+    if (_binary[id]) {
+        printf("Put MCU %s offline after %u frames, %u lost, %u corrupt\n",
+               _node[id].c_str(), _decoder[id].frames(),
+               _decoder[id].lost(), _decoder[id].corrupt());
+    } else {
+        printf("Put MCU %s offline\n", _node[id].c_str());
+    }
 
+    epoll_ctl(_epollfd, EPOLL_CTL_DEL, _handle[id], NULL);
     ret = close(_handle[id]);
     if (ret != 0) {
         perror("close");
@@ -283,117 +401,495 @@ void Proximity::errCloseDevice(unsigned int id)
 
 void Proximity::run(void)
 {
-    while (_running) {
-        int ret;
-        unsigned int id;
-        char line[128];
-        char *part, *partctx;
-        char *subpart, *subpartctx;
-        unsigned int valid;
-        struct timeval now, last_probe = { 0, 0, };
-
-        for (id = 0, valid = 0; id < RABBIT_MCUS; id++) {
-            unsigned int k;
-
-            if ((id == RABBIT_MCUS - 1) && (valid == 0) && (_running == true)) {
-                /* Sleep to prevent thrashing if no device present */
-                struct timespec ts;
-                clock_gettime(CLOCK_REALTIME, &ts);
-                ts.tv_sec += 1;
-                pthread_mutex_lock(&_mutex);
-                pthread_cond_timedwait(&_cond, &_mutex, &ts);
-                pthread_mutex_unlock(&_mutex);
-            }
+    struct epoll_event events[RABBIT_MCUS + 1];
+    uint64_t now, last_probe = 0;
+    unsigned int id;
+    int i, n;
 
-            /* Probe and open device */
-            gettimeofday(&now, NULL);
-            if (now.tv_sec > last_probe.tv_sec) {
-                last_probe.tv_sec = now.tv_sec;
-                last_probe.tv_usec = now.tv_usec;
+    while (_running) {
+        /* Probe MCUs that are expected but not open yet */
+        now = now_ms();
+        if (now - last_probe >= 1000) {
+            last_probe = now;
+            for (id = 0; id < RABBIT_MCUS; id++) {
+                if (_handle[id] != -1) {
+                    continue;
+                }
 
-                if (_handle[id] == -1) {
+                if (_inotifyfd == -1) {
+                    probeOpenDevice(id);
+                } else if (_probeRetries[id] > 0) {
+                    _probeRetries[id]--;
                     probeOpenDevice(id);
                 }
             }
+        }
+
+        n = epoll_wait(_epollfd, events, RABBIT_MCUS + 1, PROXIMITY_POLL_MS);
+        for (i = 0; i < n; i++) {
+            id = events[i].data.u32;
+            if (id == PROXIMITY_HOTPLUG_ID) {
+                hotplug();
+                continue;
+            }
 
             if (_handle[id] == -1) {
                 continue;
             }
 
-            valid++;
+            if ((events[i].events & (EPOLLERR | EPOLLHUP)) ||
+                !readDevice(id)) {
+                errCloseDevice(id);
+                _probeRetries[id] = PROXIMITY_PROBE_RETRIES;
+            }
+        }
 
-            /* Process streaming data from MCU */
-            ret = serial_scan_line(_handle[id], line, sizeof(line), 50000);
-            if (ret == 0) {
+        /* Close MCUs that stopped streaming */
+        now = now_ms();
+        for (id = 0; id < RABBIT_MCUS; id++) {
+            if ((_handle[id] != -1) && _enabled &&
+                (now - _lastRx[id] > PROXIMITY_SILENT_MS)) {
                 errCloseDevice(id);
+                _probeRetries[id] = PROXIMITY_PROBE_RETRIES;
             }
+        }
+    }
+}
 
-            /*
-             * Parse the output and update states
-             */
-            //printf("id=%u line='%s'\n", id, line);
+/*
+ * Probe ttyACM nodes as they show up or change permissions.
+ */
+void Proximity::hotplug(void)
+{
+    char buf[1024]
+        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *event;
+    unsigned int id;
+    ssize_t len;
+    char *p;
 
-            /* Process the IR part */
-            part = strtok_r(line, ";", &partctx);
-            if (part == NULL) {
-                errCloseDevice(id);
+    for (;;) {
+        len = read(_inotifyfd, buf, sizeof(buf));
+        if (len <= 0) {
+            break;
+        }
+
+        for (p = buf; p < buf + len;
+             p += sizeof(struct inotify_event) + event->len) {
+            event = (const struct inotify_event *) p;
+            if ((event->len == 0) ||
+                (sscanf(event->name, "ttyACM%u", &id) != 1) ||
+                (id >= RABBIT_MCUS)) {
                 continue;
             }
 
-            for (subpart = strtok_r(part, ",", &subpartctx), k = 0;
-                 (subpart != NULL) && (k < (IR_DEVICES / RABBIT_MCUS));
-                 subpart = strtok_r(NULL, ",", &subpartctx), k++) {
-                _ir[id * 2 + k] = (unsigned int) atoi(subpart);
-                //printf("_ir[%u]=%u\n", id * 2 + k, _ir[id * 2 + k]);
+            _probeRetries[id] = PROXIMITY_PROBE_RETRIES;
+            if (_handle[id] == -1) {
+                probeOpenDevice(id);
             }
+        }
+    }
+}
 
-            if ((k != (IR_DEVICES / RABBIT_MCUS)) ||
-                (subpart != NULL)) {
-                errCloseDevice(id);
-                continue;
-            }
+/*
+ * Drain the MCU's input, assembling frames or text lines from it. Returns
+ * false on a read error, a hangup is reported by epoll.
+ */
+bool Proximity::readDevice(unsigned int id)
+{
+    struct rabbit_frame frame;
+    uint8_t buf[256];
+    ssize_t len, i;
+    bool updated = false;
+    char c;
 
-            /* Process the US part */
-            part = strtok_r(NULL, ";", &partctx);
-            if (part == NULL) {
-                errCloseDevice(id);
-                continue;
+    for (;;) {
+        /* With VMIN and VTIME at 0 the tty returns 0 once drained */
+        len = read(_handle[id], buf, sizeof(buf));
+        if (len == 0) {
+            break;
+        } else if (len < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
             }
+            return false;
+        }
+
+        _lastRx[id] = now_ms();
 
-            for (subpart = strtok_r(part, ",", &subpartctx), k = 0;
-                 (subpart != NULL) && (k < (ULTRASOUND_DEVICES / RABBIT_MCUS));
-                 subpart = strtok_r(NULL, ",", &subpartctx), k++) {
-                _us[id * 2 + k] = (unsigned int) atoi(subpart);
-                //printf("_us[%u]=%u\n", id * 2 + k, _us[id * 2 + k]);
+        if (_binary[id]) {
+            _decoder[id].feed(buf, (size_t) len);
+            while (_decoder[id].next(&frame)) {
+                applyFrame(id, &frame);
+                updated = true;
             }
+            continue;
+        }
 
-            if ((k != (ULTRASOUND_DEVICES / RABBIT_MCUS)) ||
-                (subpart != NULL)) {
-                errCloseDevice(id);
-                continue;
+        for (i = 0; i < len; i++) {
+            c = (char) buf[i];
+            if (c == '\r' || c == '\n') {
+                if (_lineLen[id] > 0) {
+                    _line[id][_lineLen[id]] = '\0';
+                    if (parseLine(id, _line[id])) {
+                        updated = true;
+                    }
+                }
+                _lineLen[id] = 0;
+            } else if (_lineLen[id] < MCU_LINE_SIZE - 1) {
+                _line[id][_lineLen[id]] = c;
+                _lineLen[id]++;
+            } else {
+                _lineLen[id] = 0;  // Garbage, wait for the next line
             }
+        }
+    }
 
-            /* Process the temp_c part */
-            part = strtok_r(NULL, ";", &partctx);
-            if (part == NULL) {
-                errCloseDevice(id);
+    if (updated) {
+        notify(id);
+    }
+
+    return true;
+}
+
+/*
+ * Text line of MCUs that don't speak the binary protocol:
+ * "ir0,ir1,...;us0,us1,...;temp_c"
+ */
+bool Proximity::parseLine(unsigned int id, char *line)
+{
+    bool ir[IR_DEVICES / RABBIT_MCUS];
+    unsigned int us[ULTRASOUND_DEVICES / RABBIT_MCUS];
+    float temp_c = 0.0;
+    char *part, *partctx;
+    char *subpart, *subpartctx;
+    unsigned int k;
+
+    /* Process the IR part */
+    part = strtok_r(line, ";", &partctx);
+    if (part == NULL) {
+        return false;
+    }
+
+    for (subpart = strtok_r(part, ",", &subpartctx), k = 0;
+         (subpart != NULL) && (k < (IR_DEVICES / RABBIT_MCUS));
+         subpart = strtok_r(NULL, ",", &subpartctx), k++) {
+        ir[k] = atoi(subpart) != 0;
+    }
+
+    if ((k != (IR_DEVICES / RABBIT_MCUS)) ||
+        (subpart != NULL)) {
+        return false;
+    }
+
+    /* Process the US part */
+    part = strtok_r(NULL, ";", &partctx);
+    if (part == NULL) {
+        return false;
+    }
+
+    for (subpart = strtok_r(part, ",", &subpartctx), k = 0;
+         (subpart != NULL) && (k < (ULTRASOUND_DEVICES / RABBIT_MCUS));
+         subpart = strtok_r(NULL, ",", &subpartctx), k++) {
+        us[k] = (unsigned int) atoi(subpart);
+    }
+
+    if ((k != (ULTRASOUND_DEVICES / RABBIT_MCUS)) ||
+        (subpart != NULL)) {
+        return false;
+    }
+
+    /* Process the temp_c part */
+    part = strtok_r(NULL, ";", &partctx);
+    if (part == NULL) {
+        return false;
+    }
+
+    for (subpart = strtok_r(part, ",", &subpartctx), k = 0;
+         (subpart != NULL) && (k < 1);
+         subpart = strtok_r(NULL, ",", &subpartctx), k++) {
+        temp_c = (float) atof(subpart);
+    }
+
+    if ((k != 1) ||
+        (subpart != NULL)) {
+        return false;
+    }
+
+    /* Text lines carry no MCU time, number them here */
+    update(id, ir, us, NULL, temp_c, 0, _lineSeq[id]++);
+
+    return true;
+}
+
+void Proximity::applyFrame(unsigned int id, const struct rabbit_frame *frame)
+{
+    bool ir[IR_DEVICES / RABBIT_MCUS];
+    unsigned int us[ULTRASOUND_DEVICES / RABBIT_MCUS];
+    uint32_t us_age_us[ULTRASOUND_DEVICES / RABBIT_MCUS];
+    unsigned int k;
+
+    for (k = 0; k < (IR_DEVICES / RABBIT_MCUS); k++) {
+        ir[k] = (k < RABBIT_FRAME_IR) && ((frame->ir >> k) & 0x1);
+    }
+
+    for (k = 0; k < (ULTRASOUND_DEVICES / RABBIT_MCUS); k++) {
+        us[k] = (k < RABBIT_FRAME_US) ? frame->us_mm[k] : 0;
+        us_age_us[k] = (k < RABBIT_FRAME_US) ? frame->us_age_us[k] : 0;
+    }
+
+    update(id, ir, us, us_age_us, frame->temp_c10 / 10.0, frame->t_us,
+           frame->seq);
+}
+
+static void history_add(struct proximity_history *history,
+                        unsigned int value, uint32_t mcu_us, uint16_t seq,
+                        uint64_t host_us)
+{
+    struct proximity_sample *sample;
+
+    sample = &history->samples[history->head];
+    sample->host_us = host_us;
+    sample->mcu_us = mcu_us;
+    sample->seq = seq;
+    sample->value = value;
+
+    history->head = (history->head + 1) % PROXIMITY_HISTORY;
+    if (history->count < PROXIMITY_HISTORY) {
+        history->count++;
+    }
+}
+
+/*
+ * Record one sample of each sensor of an MCU and wake up the waiters.
+ * Ultrasound readings are taken at their own times, us_age_us before
+ * mcu_us, and are backdated accordingly.
+ */
+void Proximity::update(unsigned int id, const bool *ir, const unsigned int *us,
+                       const uint32_t *us_age_us, float temp_c,
+                       uint32_t mcu_us, uint16_t seq)
+{
+    uint64_t host_us;
+    uint32_t age;
+    unsigned int k, n;
+    struct proximity_report report;
+
+    host_us = now_us();
+    report.mcu_us = mcu_us;
+    report.seq = seq;
+    report.mcu = id;
+    report.ir = 0;
+
+    pthread_mutex_lock(&_mutex);
+
+    n = IR_DEVICES / RABBIT_MCUS;
+    for (k = 0; k < n; k++) {
+        _ir[id * n + k] = ir[k];
+        history_add(&_irHistory[id * n + k], ir[k], mcu_us, seq, host_us);
+        if (ir[k]) {
+            report.ir |= (1 << k);
+        }
+    }
+
+    n = ULTRASOUND_DEVICES / RABBIT_MCUS;
+    for (k = 0; k < n; k++) {
+        age = us_age_us ? us_age_us[k] : 0;
+        _us[id * n + k] = us[k];
+        history_add(&_usHistory[id * n + k], us[k],
+                    mcu_us ? mcu_us - age : 0, seq, host_us - age);
+        report.us_mm[k] = us[k] > RABBIT_US_NO_ECHO ?
+            RABBIT_US_NO_ECHO : us[k];
+    }
+
+    _temp_c[id] = temp_c;
+    _updates++;
+    _updatedUs = host_us;
+    pthread_cond_broadcast(&_cond);
+
+    pthread_mutex_unlock(&_mutex);
+
+    _topic.publish(report, host_us);
+}
+
+/*
+ * Subscribers are called with _subMutex held, so that unsubscribe()
+ * returns only once its callback is no longer running.
+ */
+void Proximity::notify(unsigned int id)
+{
+    std::vector<struct proximity_subscriber>::iterator it;
+
+    pthread_mutex_lock(&_subMutex);
+    for (it = _subscribers.begin(); it != _subscribers.end(); it++) {
+        it->f(id, it->arg);
+    }
+    pthread_mutex_unlock(&_subMutex);
+}
+
+unsigned int Proximity::subscribe(proximity_callback f, void *arg)
+{
+    struct proximity_subscriber subscriber;
+
+    pthread_mutex_lock(&_subMutex);
+    subscriber.id = _nextSubscriber++;
+    subscriber.f = f;
+    subscriber.arg = arg;
+    _subscribers.push_back(subscriber);
+    pthread_mutex_unlock(&_subMutex);
+
+    return subscriber.id;
+}
+
+/*
+ * Must not be called from a subscriber callback.
+ */
+void Proximity::unsubscribe(unsigned int id)
+{
+    std::vector<struct proximity_subscriber>::iterator it;
+
+    pthread_mutex_lock(&_subMutex);
+    for (it = _subscribers.begin(); it != _subscribers.end(); it++) {
+        if (it->id == id) {
+            _subscribers.erase(it);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&_subMutex);
+}
+
+/*
+ * Wait for samples newer than *seen, which is updated. Returns false on
+ * timeout.
+ */
+bool Proximity::waitForSamples(uint64_t *seen, unsigned int timeout_ms)
+{
+    struct timespec ts, tadd;
+    bool updated;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    tadd.tv_sec = timeout_ms / 1000;
+    tadd.tv_nsec = (timeout_ms % 1000) * 1000000;
+    timespecadd(&ts, &tadd, &ts);
+
+    pthread_mutex_lock(&_mutex);
+    while (_running && (_updates == *seen)) {
+        if (pthread_cond_timedwait(&_cond, &_mutex, &ts) == ETIMEDOUT) {
+            break;
+        }
+    }
+    updated = (_updates != *seen);
+    *seen = _updates;
+    pthread_mutex_unlock(&_mutex);
+
+    return updated;
+}
+
+struct proximity_history *Proximity::historyOf(enum proximity_sensor type,
+                                               unsigned int id)
+{
+    if (type == PROXIMITY_IR && id < IR_DEVICES) {
+        return &_irHistory[id];
+    } else if (type == PROXIMITY_US && id < ULTRASOUND_DEVICES) {
+        return &_usHistory[id];
+    }
+
+    return NULL;
+}
+
+/*
+ * Copy up to max of the latest samples of a sensor, oldest first.
+ */
+unsigned int Proximity::history(enum proximity_sensor type, unsigned int id,
+                                struct proximity_sample *samples,
+                                unsigned int max)
+{
+    struct proximity_history *history;
+    unsigned int i, n, start;
+
+    history = historyOf(type, id);
+    if (history == NULL) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&_mutex);
+    n = history->count < max ? history->count : max;
+    start = (history->head + PROXIMITY_HISTORY - n) % PROXIMITY_HISTORY;
+    for (i = 0; i < n; i++) {
+        samples[i] = history->samples[(start + i) % PROXIMITY_HISTORY];
+    }
+    pthread_mutex_unlock(&_mutex);
+
+    return n;
+}
+
+bool Proximity::latest(enum proximity_sensor type, unsigned int id,
+                       struct proximity_sample *sample)
+{
+    return history(type, id, sample, 1) == 1;
+}
+
+/*
+ * Closest obstacle seen by the sensors of the front and rear MCUs, NAN if
+ * none. Sensors that have not been heard from lately don't count. us is
+ * set to when the latest samples came in.
+ */
+void Proximity::clearance(float *front_mm, float *rear_mm, uint64_t *us)
+{
+    float clearance_mm[RABBIT_MCUS];
+    const struct proximity_sample *sample;
+    unsigned int id, i, n;
+    uint64_t now;
+    float d;
+
+    now = now_us();
+
+    pthread_mutex_lock(&_mutex);
+
+    for (id = 0; id < RABBIT_MCUS; id++) {
+        d = NAN;
+
+        n = IR_DEVICES / RABBIT_MCUS;
+        for (i = id * n; i < (id + 1) * n; i++) {
+            if (_irHistory[i].count == 0) {
                 continue;
             }
 
-            for (subpart = strtok_r(part, ",", &subpartctx), k = 0;
-                 (subpart != NULL) && (k < 1);
-                 subpart = strtok_r(NULL, ",", &subpartctx), k++) {
-                _temp_c[id] = (float) atof(subpart);
-                //printf("_temp_c[%u]=%.1f\n", id, _temp_c[id]);
+            sample = &_irHistory[i].samples[(_irHistory[i].head +
+                                             PROXIMITY_HISTORY - 1) %
+                                            PROXIMITY_HISTORY];
+            if ((now - sample->host_us <= PROXIMITY_STALE_MS * 1000) &&
+                (sample->value == IR_OBSTACLE_LEVEL)) {
+                d = fminf(d, IR_RANGE_MM);
             }
+        }
 
-            if ((k != 1) ||
-                (subpart != NULL)) {
-                errCloseDevice(id);
+        n = ULTRASOUND_DEVICES / RABBIT_MCUS;
+        for (i = id * n; i < (id + 1) * n; i++) {
+            if (_usHistory[i].count == 0) {
                 continue;
             }
+
+            sample = &_usHistory[i].samples[(_usHistory[i].head +
+                                             PROXIMITY_HISTORY - 1) %
+                                            PROXIMITY_HISTORY];
+            if ((now - sample->host_us <= PROXIMITY_STALE_MS * 1000) &&
+                (sample->value != 0) &&  // Not pinged yet
+                (sample->value != RABBIT_US_NO_ECHO)) {
+                d = fminf(d, (float) sample->value);
+            }
         }
+
+        clearance_mm[id] = d;
     }
+
+    if (us) {
+        *us = _updatedUs;
+    }
+
+    pthread_mutex_unlock(&_mutex);
+
+    *front_mm = clearance_mm[FRONT_MCU];
+    *rear_mm = clearance_mm[REAR_MCU];
 }
 
 void Proximity::enable(bool en)
@@ -412,7 +908,6 @@ void Proximity::enable(bool en)
 
 void Proximity::stream(void)
 {
-    int ret;
     unsigned int id;
 
     if (_enabled == true) {
@@ -425,13 +920,25 @@ void Proximity::stream(void)
             continue;
         }
 
-        ret = write(_handle[id], "stream\r", 7);
-        if (ret != 7) {
+        if (!startStream(id)) {
             errCloseDevice(id);
         }
     }
 }
 
+bool Proximity::startStream(unsigned int id)
+{
+    char cmd[64];
+    int len, ret;
+
+    len = snprintf(cmd, sizeof(cmd) - 1, "report change %u %u\r%s",
+                   PROXIMITY_DEADBAND_MM, PROXIMITY_HEARTBEAT_MS,
+                   _binary[id] ? "stream bin\r" : "stream\r");
+    ret = write(_handle[id], cmd, len);
+
+    return ret == len;
+}
+
 void Proximity::stop(void)
 {
     int ret;
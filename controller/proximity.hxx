@@ -7,9 +7,56 @@
 #ifndef PROXIMITY_HXX
 #define PROXIMITY_HXX
 
+#include <stdint.h>
+#include <vector>
+#include "samplebus.hxx"
+
 #define RABBIT_MCUS          2
 #define IR_DEVICES           8
 #define ULTRASOUND_DEVICES  12
+#define MCU_LINE_SIZE      128
+#define PROXIMITY_HISTORY   32
+
+enum proximity_sensor {
+    PROXIMITY_IR = 0,
+    PROXIMITY_US = 1,
+};
+
+struct proximity_sample {
+    uint64_t host_us;      // When it was taken, CLOCK_MONOTONIC
+    uint32_t mcu_us;       // When the MCU captured it, 0 if unknown
+    uint16_t seq;          // Sample sequence number of the MCU
+    unsigned int value;    // IR level, or ultrasound distance in mm
+                           // (RABBIT_US_NO_ECHO if out of range)
+};
+
+struct proximity_history {
+    struct proximity_sample samples[PROXIMITY_HISTORY];
+    unsigned int head;     // Where the next sample goes
+    unsigned int count;
+};
+
+/*
+ * What one MCU reported, as put on the sample bus.
+ */
+struct proximity_report {
+    uint32_t mcu_us;
+    uint16_t seq;
+    uint8_t mcu;
+    uint8_t ir;                                      // Bit per sensor
+    uint16_t us_mm[ULTRASOUND_DEVICES / RABBIT_MCUS];
+};
+
+/*
+ * Called on the Proximity thread after new samples from an MCU are in.
+ */
+typedef void (*proximity_callback)(unsigned int mcu, void *arg);
+
+struct proximity_subscriber {
+    unsigned int id;
+    proximity_callback f;
+    void *arg;
+};
 
 class Proximity {
 
@@ -25,6 +72,21 @@ public:
     bool ir_state(unsigned int id) const;
     unsigned int ultrasound_d_mm(unsigned int id) const;
 
+    unsigned int framesLost(void) const;
+    unsigned int framesCorrupt(void) const;
+
+    unsigned int history(enum proximity_sensor type, unsigned int id,
+                         struct proximity_sample *samples,
+                         unsigned int max);
+    bool latest(enum proximity_sensor type, unsigned int id,
+                struct proximity_sample *sample);
+    void clearance(float *front_mm, float *rear_mm, uint64_t *us = NULL);
+
+    unsigned int subscribe(proximity_callback f, void *arg);
+    void unsubscribe(unsigned int id);
+    bool waitForSamples(uint64_t *seen, unsigned int timeout_ms);
+    SampleTopic<struct proximity_report> &topic(void);
+
 private:
 
     void probeOpenDevice(unsigned int id);
@@ -33,18 +95,47 @@ private:
     void run(void);
     void stream(void);
     void stop(void);
+    bool startStream(unsigned int id);
+    bool parseLine(unsigned int id, char *line);
+    bool readDevice(unsigned int id);
+    void applyFrame(unsigned int id, const struct rabbit_frame *frame);
+    void update(unsigned int id, const bool *ir, const unsigned int *us,
+                const uint32_t *us_age_us, float temp_c,
+                uint32_t mcu_us, uint16_t seq);
+    struct proximity_history *historyOf(enum proximity_sensor type,
+                                        unsigned int id);
+    void notify(unsigned int id);
+    void hotplug(void);
 
     bool _enabled;
     int _handle[RABBIT_MCUS];
     std::string _node[RABBIT_MCUS];
+    bool _binary[RABBIT_MCUS];
+    MCUDecoder _decoder[RABBIT_MCUS];
+    char _line[RABBIT_MCUS][MCU_LINE_SIZE];
+    unsigned int _lineLen[RABBIT_MCUS];
+    uint64_t _lastRx[RABBIT_MCUS];
+    unsigned int _probeRetries[RABBIT_MCUS];
+    uint16_t _lineSeq[RABBIT_MCUS];
     float _temp_c[RABBIT_MCUS];
     bool _ir[IR_DEVICES];
     unsigned int _us[ULTRASOUND_DEVICES];
+    struct proximity_history _irHistory[IR_DEVICES];
+    struct proximity_history _usHistory[ULTRASOUND_DEVICES];
+    SampleTopic<struct proximity_report> _topic;
+    uint64_t _updates;
+    uint64_t _updatedUs;      // When the last samples came in
+    int _epollfd;
+    int _inotifyfd;
+
+    std::vector<struct proximity_subscriber> _subscribers;
+    unsigned int _nextSubscriber;
+    pthread_mutex_t _subMutex;
 
     bool _running;
     pthread_t _thread;
-    pthread_mutex_t _mutex;
-    pthread_cond_t _cond;
+    pthread_mutex_t _mutex;   // Guards the samples
+    pthread_cond_t _cond;     // Signals new samples
 
 };
 
@@ -84,6 +175,33 @@ inline unsigned int Proximity::ultrasound_d_mm(unsigned int id) const
     return _us[id];
 }
 
+inline unsigned int Proximity::framesLost(void) const
+{
+    unsigned int i, n = 0;
+
+    for (i = 0; i < RABBIT_MCUS; i++) {
+        n += _decoder[i].lost();
+    }
+
+    return n;
+}
+
+inline unsigned int Proximity::framesCorrupt(void) const
+{
+    unsigned int i, n = 0;
+
+    for (i = 0; i < RABBIT_MCUS; i++) {
+        n += _decoder[i].corrupt();
+    }
+
+    return n;
+}
+
+inline SampleTopic<struct proximity_report> &Proximity::topic(void)
+{
+    return _topic;
+}
+
 #endif
 
 /*
@@ -23,15 +23,19 @@ static struct termios t_old;
 
 nadjieb::MJPEGStreamer *mjpeg_streamer = NULL;
 Mosquitto *mosquitto = NULL;
+SampleBus *samplebus = NULL;
+Timers *timers = NULL;
 Servos *servos = NULL;
 ADC *adc = NULL;
 Camera *camera = NULL;
 StereoVision *stereovision = NULL;
 Proximity *proximity = NULL;
 Wheels *wheels = NULL;
+Safety *safety = NULL;
 Arm *rightArm = NULL;
 Arm *leftArm = NULL;
 Power *power = NULL;
+Governor *governor = NULL;
 Compass *compass = NULL;
 Ambience *ambience = NULL;
 Head *head = NULL;
@@ -39,7 +43,9 @@ LiDAR *lidar = NULL;
 Mouth *mouth = NULL;
 Speech *speech = NULL;
 Voice *voice = NULL;
+Keywords *keywords = NULL;
 Crond *crond = NULL;
+Gestures *gestures = NULL;
 
 static void announce_clock(void);
 
@@ -49,11 +55,53 @@ static void cleanup(void)
         tcsetattr(fileno(stdin), TCSANOW, &t_old);
     }
 
+    /*
+     * The camera and stereo-vision threads draw an OSD from most of what
+     * is torn down below. Power and the governor look at the cameras from
+     * their own threads, so they cannot simply go after them.
+     */
+    OsdCam::shutdown();
+
     if (crond) {
         delete crond;
         crond = NULL;
     }
 
+    /* Sheds and restores the loads below, the OSD no longer reads it */
+    if (governor) {
+        delete governor;
+        governor = NULL;
+    }
+
+    if (gestures) {
+        delete gestures;
+        gestures = NULL;
+    }
+
+    if (power) {
+        delete power;
+        power = NULL;
+    }
+
+    /*
+     * Keywords and Voice call into the head, and the head thread steers
+     * the camera when it tracks sound, so all three go before the camera.
+     */
+    if (keywords) {
+        delete keywords;
+        keywords = NULL;
+    }
+
+    if (voice) {
+        delete voice;
+        voice = NULL;
+    }
+
+    if (head) {
+        delete head;
+        head = NULL;
+    }
+
     if (camera) {
         delete camera;
         camera = NULL;
@@ -64,6 +112,11 @@ static void cleanup(void)
         stereovision = NULL;
     }
 
+    if (safety) {
+        delete safety;
+        safety = NULL;
+    }
+
     if (wheels) {
         delete wheels;
         wheels = NULL;
@@ -84,26 +137,11 @@ static void cleanup(void)
         leftArm = NULL;
     }
 
-    if (voice) {
-        delete voice;
-        voice = NULL;
-    }
-
-    if (power) {
-        delete power;
-        power = NULL;
-    }
-
     if (compass) {
         delete compass;
         compass = NULL;
     }
 
-    if (head) {
-        delete head;
-        head = NULL;
-    }
-
     if (lidar) {
         delete lidar;
         lidar = NULL;
@@ -134,6 +172,16 @@ static void cleanup(void)
         speech = NULL;
     }
 
+    if (timers) {
+        delete timers;
+        timers = NULL;
+    }
+
+    if (samplebus) {
+        delete samplebus;
+        samplebus = NULL;
+    }
+
     if (mosquitto) {
         delete mosquitto;
         mosquitto = NULL;
@@ -177,21 +225,31 @@ static void print_help(int argc, char **argv)
     printf("Usage: %s [OPTIONS]\n", argv[0]);
     printf("  --help,-h      This message\n");
     printf("  --daemon,-d    Run %s as daemon\n", argv[0]);
+    printf("  --record,-r    Record the sensor samples to a file\n");
+    printf("  --wav,-w       Play a 16 kHz mono WAV file as the microphone\n");
+    printf("  --audio-tcp,-a Serve the microphone on TCP, bound to an address\n");
 }
 
 static const struct option long_options[] = {
     { "help", no_argument, NULL, 'h', },
     { "daemon", no_argument, NULL, 'd', },
+    { "record", required_argument, NULL, 'r', },
+    { "wav", required_argument, NULL, 'w', },
+    { "audio-tcp", required_argument, NULL, 'a', },
+    { NULL, 0, NULL, 0, },
 };
 
 int main(int argc, char **argv)
 {
     int ret;
     struct termios t_new;
+    const char *record = NULL;
+    const char *wav = NULL;
+    const char *audioTcp = NULL;
 
     for (;;) {
         int option_index = 0;
-        int c = getopt_long(argc, argv, "hd",
+        int c = getopt_long(argc, argv, "hdr:w:a:",
                             long_options, &option_index);
         if (c == -1) {
             break;
@@ -204,6 +262,15 @@ int main(int argc, char **argv)
         case 'd':
             daemonize = 1;
             break;
+        case 'r':
+            record = optarg;
+            break;
+        case 'w':
+            wav = optarg;
+            break;
+        case 'a':
+            audioTcp = optarg;
+            break;
         default:
             print_help(argc, argv);
             return -1;
@@ -255,12 +322,19 @@ int main(int argc, char **argv)
     mjpeg_streamer = new nadjieb::MJPEGStreamer();
     mjpeg_streamer->start(8000);
     mosquitto = new Mosquitto();
+    samplebus = new SampleBus();
+    if (record) {
+        samplebus->startRecording(record);
+    }
+    timers = new Timers();
     servos = new Servos();
     adc = new ADC();
+    power = new Power();
     camera = new Camera();
     stereovision = new StereoVision();
     proximity = new Proximity();
     wheels = new Wheels();
+    safety = new Safety();
     rightArm = new Arm(RIGHT_ARM);
     leftArm = new Arm(LEFT_ARM);
     compass = new Compass();
@@ -269,8 +343,11 @@ int main(int argc, char **argv)
     lidar = new LiDAR();
     speech = new Speech();
     mouth = new Mouth();
-    voice = new Voice();
+    voice = new Voice(wav, audioTcp);
+    keywords = new Keywords();
     crond = new Crond();
+    gestures = new Gestures();
+    governor = new Governor();
     crond->activate(announce_clock, "*/2 * * * *");
 
     cout << "Rabbit'bot is alive!" << endl;
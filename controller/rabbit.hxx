@@ -10,37 +10,50 @@
 #include <pigpio.h>
 #include <nadjieb/mjpeg_streamer.hpp>
 #include "mosquitto.hxx"
+#include "samplebus.hxx"
+#include "timers.hxx"
 #include "servos.hxx"
 #include "adc.hxx"
 #include "camera.hxx"
 #include "stereovision.hxx"
+#include "mcudecoder.hxx"
 #include "proximity.hxx"
 #include "wheels.hxx"
+#include "safety.hxx"
+#include "armguard.hxx"
 #include "arms.hxx"
 #include "power.hxx"
+#include "governor.hxx"
 #include "compass.hxx"
 #include "ambience.hxx"
+#include "doafilter.hxx"
 #include "head.hxx"
 #include "lidar.hxx"
 #include "mouth.hxx"
 #include "wifi.hxx"
 #include "speech.hxx"
 #include "voice.hxx"
+#include "keywords.hxx"
 #include "websock.hxx"
 #include "logging.hxx"
 #include "crond.hxx"
+#include "gestures.hxx"
 
 extern nadjieb::MJPEGStreamer *mjpeg_streamer;
 extern Mosquitto *mosquitto;
+extern SampleBus *samplebus;
+extern Timers *timers;
 extern Servos *servos;
 extern ADC *adc;
 extern Camera *camera;
 extern StereoVision *stereovision;
 extern Proximity *proximity;
 extern Wheels *wheels;
+extern Safety *safety;
 extern Arm *rightArm;
 extern Arm *leftArm;
 extern Power *power;
+extern Governor *governor;
 extern Compass *compass;
 extern Ambience *ambience;
 extern Head *head;
@@ -49,7 +62,9 @@ extern Mouth *mouth;
 extern WIFI *wifi;
 extern Speech *speech;
 extern Voice *voice;
+extern Keywords *keywords;
 extern Crond *crond;
+extern Gestures *gestures;
 
 extern "C" void rabbit_keycontrol(uint8_t key);
 
@@ -0,0 +1,339 @@
+/*
+ * rabbit_audio.c
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <netdb.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <linux/futex.h>
+#include "rabbit_audio.h"
+
+struct rabbit_audio {
+    const struct rabbit_audio_ring *ring;
+    int shmfd;                    // Of the ring, to tell when it is unlinked
+    int fd;
+    uint64_t seq;
+    uint64_t dropped;
+    int enabled;
+    uint32_t flags;               // Of the last block read
+};
+
+static struct rabbit_audio *open_shm(void)
+{
+    struct rabbit_audio *audio;
+    const struct rabbit_audio_ring *ring;
+    int fd;
+
+    fd = shm_open(RABBIT_AUDIO_SHM, O_RDONLY, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    ring = (const struct rabbit_audio_ring *)
+        mmap(NULL, sizeof(*ring), PROT_READ, MAP_SHARED, fd, 0);
+    if (ring == MAP_FAILED) {
+        perror(RABBIT_AUDIO_SHM);
+        close(fd);
+        return NULL;
+    }
+
+    if ((ring->magic != RABBIT_AUDIO_MAGIC) ||
+        (ring->version != RABBIT_AUDIO_VERSION) ||
+        (ring->block != RABBIT_AUDIO_BLOCK) ||
+        (ring->blocks != RABBIT_AUDIO_BLOCKS)) {
+        munmap((void *) ring, sizeof(*ring));
+        close(fd);
+        return NULL;
+    }
+
+    audio = (struct rabbit_audio *) calloc(1, sizeof(*audio));
+    audio->ring = ring;
+    audio->shmfd = fd;
+    audio->fd = -1;
+    audio->seq = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    return audio;
+}
+
+static struct rabbit_audio *open_socket(const char *source)
+{
+    struct rabbit_audio *audio;
+    struct addrinfo hints, *res, *ai;
+    struct sockaddr_un sun;
+    char host[256], port[16];
+    const char *colon;
+    int fd = -1, ret;
+
+    if (source[0] == '/') {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            perror("socket");
+            return NULL;
+        }
+
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        strncpy(sun.sun_path, source, sizeof(sun.sun_path) - 1);
+        if (connect(fd, (struct sockaddr *) &sun, sizeof(sun)) != 0) {
+            perror(source);
+            close(fd);
+            return NULL;
+        }
+    } else {
+        colon = strchr(source, ':');
+        if (colon) {
+            snprintf(host, sizeof(host), "%.*s",
+                     (int) (colon - source), source);
+            snprintf(port, sizeof(port), "%s", colon + 1);
+        } else {
+            snprintf(host, sizeof(host), "%s", source);
+            snprintf(port, sizeof(port), "%u", RABBIT_AUDIO_PORT);
+        }
+
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        ret = getaddrinfo(host, port, &hints, &res);
+        if (ret != 0) {
+            fprintf(stderr, "%s: %s\n", host, gai_strerror(ret));
+            return NULL;
+        }
+
+        for (ai = res; ai != NULL; ai = ai->ai_next) {
+            fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (fd < 0) {
+                continue;
+            }
+            if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+                break;
+            }
+            close(fd);
+            fd = -1;
+        }
+        freeaddrinfo(res);
+
+        if (fd < 0) {
+            fprintf(stderr, "%s:%s: %s\n", host, port, strerror(errno));
+            return NULL;
+        }
+    }
+
+    audio = (struct rabbit_audio *) calloc(1, sizeof(*audio));
+    audio->ring = NULL;
+    audio->shmfd = -1;
+    audio->fd = fd;
+
+    return audio;
+}
+
+struct rabbit_audio *rabbit_audio_open(const char *source)
+{
+    struct rabbit_audio *audio;
+
+    if (source != NULL) {
+        return open_socket(source);
+    }
+
+    audio = open_shm();
+    if (audio == NULL) {
+        audio = open_socket(RABBIT_AUDIO_HOST);
+    }
+
+    return audio;
+}
+
+void rabbit_audio_close(struct rabbit_audio *audio)
+{
+    if (audio == NULL) {
+        return;
+    }
+
+    if (audio->ring) {
+        munmap((void *) audio->ring, sizeof(*audio->ring));
+    }
+
+    if (audio->shmfd >= 0) {
+        close(audio->shmfd);
+    }
+
+    if (audio->fd >= 0) {
+        close(audio->fd);
+    }
+
+    free(audio);
+}
+
+/*
+ * A controller that crashed leaves its ring behind, magic and all. The
+ * next one unlinks it before creating its own, so a ring that has gone
+ * quiet and has no name any more is dead.
+ */
+static int ring_unlinked(const struct rabbit_audio *audio)
+{
+    struct stat st;
+
+    return (fstat(audio->shmfd, &st) == 0) && (st.st_nlink == 0);
+}
+
+static int read_ring(struct rabbit_audio *audio, int16_t *pcm,
+                     uint64_t *t_us, unsigned int timeout_ms)
+{
+    const struct rabbit_audio_ring *ring = audio->ring;
+    struct timespec ts;
+    uint64_t head, claimed, us;
+    uint32_t futex, flags;
+
+    for (;;) {
+        futex = __atomic_load_n(&ring->futex, __ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&ring->magic, __ATOMIC_RELAXED) !=
+            RABBIT_AUDIO_MAGIC) {
+            return -1;            // The producer is gone
+        }
+
+        audio->enabled = __atomic_load_n(&ring->enabled, __ATOMIC_RELAXED);
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (audio->seq + RABBIT_AUDIO_BLOCKS <= head) {
+            audio->dropped += head - RABBIT_AUDIO_BLOCKS + 1 - audio->seq;
+            audio->seq = head - RABBIT_AUDIO_BLOCKS + 1;
+        }
+
+        if (audio->seq == head) {
+            if (timeout_ms == 0) {
+                return ring_unlinked(audio) ? -1 : 0;
+            }
+
+            ts.tv_sec = timeout_ms / 1000;
+            ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+            timeout_ms = 0;
+            syscall(SYS_futex, &ring->futex, FUTEX_WAIT, futex,
+                    &ts, NULL, 0);
+            continue;
+        }
+
+        us = ring->ring[audio->seq & (RABBIT_AUDIO_BLOCKS - 1)].t_us;
+        flags = ring->ring[audio->seq & (RABBIT_AUDIO_BLOCKS - 1)].flags;
+        memcpy(pcm, ring->ring[audio->seq & (RABBIT_AUDIO_BLOCKS - 1)].pcm,
+               sizeof(ring->ring[0].pcm));
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        claimed = __atomic_load_n(&ring->claimed, __ATOMIC_RELAXED);
+        if (audio->seq + RABBIT_AUDIO_BLOCKS < claimed) {
+            continue;             // Overwritten while we copied
+        }
+
+        audio->seq++;
+        audio->flags = flags;
+        if (t_us) {
+            *t_us = us;
+        }
+
+        return RABBIT_AUDIO_BLOCK;
+    }
+}
+
+static int read_socket(struct rabbit_audio *audio, int16_t *pcm,
+                       uint64_t *t_us, unsigned int timeout_ms)
+{
+    struct rabbit_audio_frame frame;
+    struct pollfd pfd;
+    size_t got = 0;
+    ssize_t n;
+    int ret;
+
+    pfd.fd = audio->fd;
+    pfd.events = POLLIN;
+    ret = poll(&pfd, 1, timeout_ms);
+    if (ret < 0) {
+        return errno == EINTR ? 0 : -1;
+    } else if (ret == 0) {
+        return 0;
+    }
+
+    while (got < sizeof(frame)) {
+        n = recv(audio->fd, ((uint8_t *) &frame) + got,
+                 sizeof(frame) - got, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            return -1;
+        }
+        got += n;
+    }
+
+    if (frame.magic != RABBIT_AUDIO_FRAME_MAGIC) {
+        fprintf(stderr, "rabbit_audio: lost framing\n");
+        return -1;
+    }
+
+    audio->enabled = frame.enabled;
+    if (frame.samples == 0) {
+        return 0;
+    }
+
+    if ((audio->seq != 0) && (frame.seq > audio->seq)) {
+        audio->dropped += frame.seq - audio->seq;
+    }
+    audio->seq = frame.seq + 1;
+
+    memcpy(pcm, frame.pcm, sizeof(frame.pcm));
+    audio->flags = frame.flags;
+    if (t_us) {
+        *t_us = frame.t_us;
+    }
+
+    return RABBIT_AUDIO_BLOCK;
+}
+
+/*
+ * Wait up to timeout_ms for the next block. Returns RABBIT_AUDIO_BLOCK
+ * samples, 0 when none came, or -1 when the source went away and should
+ * be opened again.
+ */
+int rabbit_audio_read(struct rabbit_audio *audio, int16_t *pcm,
+                      uint64_t *t_us, unsigned int timeout_ms)
+{
+    if (audio->ring) {
+        return read_ring(audio, pcm, t_us, timeout_ms);
+    }
+
+    return read_socket(audio, pcm, t_us, timeout_ms);
+}
+
+int rabbit_audio_enabled(const struct rabbit_audio *audio)
+{
+    return audio->enabled;
+}
+
+uint32_t rabbit_audio_flags(const struct rabbit_audio *audio)
+{
+    return audio->flags;
+}
+
+uint64_t rabbit_audio_dropped(const struct rabbit_audio *audio)
+{
+    return audio->dropped;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,111 @@
+/*
+ * rabbit_audio.h
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#ifndef RABBIT_AUDIO_H
+#define RABBIT_AUDIO_H
+
+#include <stdint.h>
+
+/*
+ * The controller's microphone capture, handed to the speech recognizers
+ * in 10 ms blocks of 16 kHz mono S16_LE.
+ *
+ * Local readers map the ring in POSIX shared memory RABBIT_AUDIO_SHM
+ * read-only and sleep on its futex word, which the controller wakes on
+ * every block. Other readers connect to the Unix socket
+ * RABBIT_AUDIO_SOCKET, or from other hosts to RABBIT_AUDIO_PORT when the
+ * controller was told to serve it (rabbit --audio-tcp), and get a stream
+ * of rabbit_audio_frame. The ring and the socket are open to the "audio"
+ * group only. A frame with no samples tells that capture was
+ * turned on or off. Timestamps are microseconds of the controller's
+ * CLOCK_MONOTONIC at the first sample of the block. The flags carry what
+ * the microphone array's own voice detector made of it, when it has one.
+ */
+#define RABBIT_AUDIO_SHM          "/rabbit-audio"
+#define RABBIT_AUDIO_SOCKET       "/run/rabbit-audio.sock"
+#define RABBIT_AUDIO_HOST         "rabbit"
+#define RABBIT_AUDIO_PORT         18889
+#define RABBIT_AUDIO_MAGIC        0x41524252    // "RBRA"
+#define RABBIT_AUDIO_FRAME_MAGIC  0x46524252    // "RBRF"
+#define RABBIT_AUDIO_VERSION      2
+#define RABBIT_AUDIO_RATE         16000
+#define RABBIT_AUDIO_BLOCK        160           // Samples, 10 ms
+#define RABBIT_AUDIO_BLOCKS       512           // Power of two, 5.12 s
+
+#define RABBIT_AUDIO_VAD_KNOWN    0x01          // The array reports these
+#define RABBIT_AUDIO_VAD          0x02          // VoiceActivity
+#define RABBIT_AUDIO_SPEECH       0x04          // SpeechDetected
+
+struct rabbit_audio_block {
+    uint64_t t_us;
+    uint32_t flags;
+    uint32_t reserved;
+    int16_t pcm[RABBIT_AUDIO_BLOCK];
+};
+
+/*
+ * The producer claims block head, fills it in, then publishes it by
+ * advancing head, and bumps the futex word. A reader that copied a block
+ * checks claimed afterwards to tell whether it was overwritten meanwhile.
+ */
+struct rabbit_audio_ring {
+    uint32_t magic;                       // Zeroed when the producer exits
+    uint32_t version;
+    uint32_t rate;
+    uint32_t block;
+    uint32_t blocks;
+    uint32_t enabled;
+    uint32_t futex;                       // Bumped on every change
+    uint32_t reserved;
+    uint64_t claimed;
+    uint64_t head;
+    struct rabbit_audio_block ring[RABBIT_AUDIO_BLOCKS];
+};
+
+struct rabbit_audio_frame {
+    uint32_t magic;
+    uint16_t samples;                     // 0 or RABBIT_AUDIO_BLOCK
+    uint8_t enabled;
+    uint8_t flags;
+    uint64_t seq;
+    uint64_t t_us;
+    int16_t pcm[RABBIT_AUDIO_BLOCK];
+} __attribute__((packed));
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Reader side, in rabbit_audio.c. The source is NULL for the local ring,
+ * falling back to RABBIT_AUDIO_HOST, a path for a Unix socket, or
+ * "host[:port]".
+ */
+struct rabbit_audio;
+
+extern struct rabbit_audio *rabbit_audio_open(const char *source);
+extern void rabbit_audio_close(struct rabbit_audio *audio);
+extern int rabbit_audio_read(struct rabbit_audio *audio, int16_t *pcm,
+                             uint64_t *t_us, unsigned int timeout_ms);
+extern int rabbit_audio_enabled(const struct rabbit_audio *audio);
+extern uint32_t rabbit_audio_flags(const struct rabbit_audio *audio);
+extern uint64_t rabbit_audio_dropped(const struct rabbit_audio *audio);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
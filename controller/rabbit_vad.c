@@ -0,0 +1,316 @@
+/*
+ * rabbit_vad.c
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "rabbit_vad.h"
+
+#define VAD_FLOOR_DB       -120.0f
+#define VAD_FLOOR_FALL        0.2f    // Per 10 ms, into a quieter room
+#define VAD_FLOOR_RISE        0.02f   // Per 10 ms, about half a second
+#define VAD_FLOOR_CREEP       0.002f  // Per 10 ms while voiced, 5 s
+#define VAD_ZCR_ONSET_DB      6.0f    // Extra needed by hiss to start
+#define VAD_BLOCK_SLACK      10       // Blocks of up to 1/10 s
+
+struct rabbit_vad {
+    struct rabbit_vad_config config;
+    unsigned int onset;           // In samples from here on
+    unsigned int hangover;
+    unsigned int max;
+    int16_t *preroll;
+    unsigned int prerollSize;     // Kept, with room for the last block
+    unsigned int prerollWant;
+    unsigned int prerollHead;
+    unsigned int prerollFill;
+    unsigned int last;            // Size of the last block
+    int hint;
+    int active;
+    unsigned int run;             // Voiced in a row before the start
+    unsigned int quiet;           // Unvoiced in a row since the start
+    unsigned int length;
+    unsigned int voiced;          // Up to the end of the last voiced block
+    int floorValid;
+    float floor;
+    float energy;
+};
+
+void rabbit_vad_defaults(struct rabbit_vad_config *config)
+{
+    config->rate = 16000;
+    config->snr_db = 9.0f;
+    config->min_db = -55.0f;
+    config->zcr_max = 0.35f;
+    config->onset_ms = 30;
+    config->hangover_ms = 300;
+    config->preroll_ms = 300;
+    config->max_ms = 0;
+}
+
+static unsigned int ms_to_samples(const struct rabbit_vad_config *config,
+                                  unsigned int ms)
+{
+    return (unsigned int) (((uint64_t) ms * config->rate) / 1000);
+}
+
+struct rabbit_vad *rabbit_vad_new(const struct rabbit_vad_config *config)
+{
+    struct rabbit_vad *vad;
+
+    if ((config == NULL) || (config->rate == 0)) {
+        return NULL;
+    }
+
+    vad = (struct rabbit_vad *) calloc(1, sizeof(*vad));
+    if (vad == NULL) {
+        return NULL;
+    }
+
+    vad->config = *config;
+    vad->onset = ms_to_samples(config, config->onset_ms);
+    vad->hangover = ms_to_samples(config, config->hangover_ms);
+    vad->max = ms_to_samples(config, config->max_ms);
+    vad->prerollWant = ms_to_samples(config, config->preroll_ms);
+    if (vad->prerollWant > 0) {
+        vad->prerollSize = vad->prerollWant + config->rate / VAD_BLOCK_SLACK;
+        vad->preroll = (int16_t *) calloc(vad->prerollSize, sizeof(int16_t));
+        if (vad->preroll == NULL) {
+            free(vad);
+            return NULL;
+        }
+    }
+
+    rabbit_vad_reset(vad);
+
+    return vad;
+}
+
+void rabbit_vad_free(struct rabbit_vad *vad)
+{
+    if (vad == NULL) {
+        return;
+    }
+
+    free(vad->preroll);
+    free(vad);
+}
+
+void rabbit_vad_reset(struct rabbit_vad *vad)
+{
+    vad->prerollHead = 0;
+    vad->prerollFill = 0;
+    vad->last = 0;
+    vad->hint = -1;
+    vad->active = 0;
+    vad->run = 0;
+    vad->quiet = 0;
+    vad->length = 0;
+    vad->voiced = 0;
+    vad->floorValid = 0;
+    vad->floor = VAD_FLOOR_DB;
+    vad->energy = VAD_FLOOR_DB;
+}
+
+void rabbit_vad_hint(struct rabbit_vad *vad, int voice)
+{
+    vad->hint = voice < 0 ? -1 : (voice != 0);
+}
+
+static void push_preroll(struct rabbit_vad *vad, const int16_t *pcm,
+                         unsigned int n)
+{
+    unsigned int chunk;
+
+    if (vad->prerollSize == 0) {
+        return;
+    }
+
+    if (n > vad->prerollSize) {
+        pcm += n - vad->prerollSize;
+        n = vad->prerollSize;
+    }
+
+    while (n > 0) {
+        chunk = vad->prerollSize - vad->prerollHead;
+        chunk = chunk < n ? chunk : n;
+        memcpy(&vad->preroll[vad->prerollHead], pcm,
+               chunk * sizeof(int16_t));
+        vad->prerollHead = (vad->prerollHead + chunk) % vad->prerollSize;
+        vad->prerollFill += chunk;
+        if (vad->prerollFill > vad->prerollSize) {
+            vad->prerollFill = vad->prerollSize;
+        }
+        pcm += chunk;
+        n -= chunk;
+    }
+}
+
+static void follow_floor(struct rabbit_vad *vad, float db, int voiced,
+                         unsigned int n)
+{
+    float rate, blocks;
+
+    if (!vad->floorValid) {
+        vad->floor = db;
+        vad->floorValid = 1;
+        return;
+    }
+
+    if (db < vad->floor) {
+        rate = VAD_FLOOR_FALL;
+    } else if (voiced || (vad->hint == 1)) {
+        rate = VAD_FLOOR_CREEP;   // So that a steady new noise wears off
+    } else {
+        rate = VAD_FLOOR_RISE;
+    }
+
+    /* The rates are per 10 ms, whatever the size of the block */
+    blocks = (float) n * 100.0f / vad->config.rate;
+    rate = 1.0f - powf(1.0f - rate, blocks);
+    vad->floor += rate * (db - vad->floor);
+}
+
+enum rabbit_vad_event rabbit_vad_process(struct rabbit_vad *vad,
+                                         const int16_t *pcm,
+                                         unsigned int n)
+{
+    enum rabbit_vad_event event = RABBIT_VAD_SILENCE;
+    int64_t sum = 0, sumsq = 0;
+    int32_t mean, x, last = 0;
+    unsigned int i, crossings = 0;
+    double var;
+    float db, zcr, snr;
+    int voiced, tonal;
+
+    if (n == 0) {
+        return vad->active ? RABBIT_VAD_SPEECH : RABBIT_VAD_SILENCE;
+    }
+
+    for (i = 0; i < n; i++) {
+        sum += pcm[i];
+        sumsq += (int32_t) pcm[i] * pcm[i];
+    }
+
+    /* Crossings of the block's mean, so that a DC offset is not silence */
+    mean = (int32_t) (sum / (int64_t) n);
+    for (i = 0; i < n; i++) {
+        x = pcm[i] - mean;
+        if ((i > 0) && (((x < 0) && (last >= 0)) ||
+                        ((x >= 0) && (last < 0)))) {
+            crossings++;
+        }
+        last = x;
+    }
+    zcr = (float) crossings / n;
+
+    var = ((double) sumsq - (double) sum * sum / n) / n;
+    var /= 32768.0 * 32768.0;
+    db = var > 0.0 ? (float) (10.0 * log10(var)) : VAD_FLOOR_DB;
+    db = db < VAD_FLOOR_DB ? VAD_FLOOR_DB : db;
+    vad->energy = db;
+
+    snr = vad->config.snr_db;
+    if (vad->hint == 1) {
+        snr *= 0.5f;
+    } else if (vad->hint == 0) {
+        snr *= 1.5f;
+    }
+
+    voiced = vad->floorValid && (db >= vad->config.min_db) &&
+        (db >= vad->floor + snr);
+    tonal = zcr <= vad->config.zcr_max;
+    if (voiced && !vad->active && !tonal) {
+        /* Fricatives are let through once an utterance is under way */
+        voiced = db >= vad->floor + snr + VAD_ZCR_ONSET_DB;
+    }
+
+    /* Hiss that goes on is a new noise more likely than a long "sss" */
+    follow_floor(vad, db, voiced && tonal, n);
+
+    if (!vad->active) {
+        vad->run = voiced ? vad->run + n : 0;
+        if (voiced && (vad->run >= vad->onset)) {
+            vad->active = 1;
+            vad->quiet = 0;
+            vad->length = vad->run;
+            vad->voiced = vad->run;
+            event = RABBIT_VAD_START;
+        }
+    } else {
+        vad->quiet = voiced ? 0 : vad->quiet + n;
+        if ((vad->quiet >= vad->hangover) ||
+            ((vad->max > 0) && (vad->length + n > vad->max))) {
+            vad->active = 0;
+            vad->run = 0;
+            event = RABBIT_VAD_END;
+        } else {
+            vad->length += n;
+            if (voiced) {
+                vad->voiced = vad->length;
+            }
+            event = RABBIT_VAD_SPEECH;
+        }
+    }
+
+    push_preroll(vad, pcm, n);
+    vad->last = n;
+
+    return event;
+}
+
+unsigned int rabbit_vad_preroll(const struct rabbit_vad *vad,
+                                int16_t *pcm, unsigned int max)
+{
+    unsigned int n, end, start, chunk, copied = 0;
+
+    /* What came before the last block, which the caller already has */
+    if ((vad->prerollSize == 0) || (vad->prerollFill <= vad->last)) {
+        return 0;
+    }
+
+    n = vad->prerollFill - vad->last;
+    n = n < vad->prerollWant ? n : vad->prerollWant;
+    n = n < max ? n : max;
+
+    end = (vad->prerollHead + vad->prerollSize - vad->last) %
+        vad->prerollSize;
+    start = (end + vad->prerollSize - n) % vad->prerollSize;
+    while (copied < n) {
+        chunk = vad->prerollSize - start;
+        chunk = chunk < n - copied ? chunk : n - copied;
+        memcpy(&pcm[copied], &vad->preroll[start], chunk * sizeof(int16_t));
+        start = (start + chunk) % vad->prerollSize;
+        copied += chunk;
+    }
+
+    return n;
+}
+
+unsigned int rabbit_vad_utterance_ms(const struct rabbit_vad *vad)
+{
+    return (unsigned int) (((uint64_t) vad->voiced * 1000) /
+                           vad->config.rate);
+}
+
+float rabbit_vad_noise_db(const struct rabbit_vad *vad)
+{
+    return vad->floor;
+}
+
+float rabbit_vad_energy_db(const struct rabbit_vad *vad)
+{
+    return vad->energy;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,88 @@
+/*
+ * rabbit_vad.h
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#ifndef RABBIT_VAD_H
+#define RABBIT_VAD_H
+
+#include <stdint.h>
+
+/*
+ * Voice activity detection and endpointing of S16 mono blocks, shared by
+ * the speech recognizers.
+ *
+ * A block is taken as voiced when its energy stands snr_db over a noise
+ * floor that follows the quiet between words, and its zero-crossing rate
+ * is not that of hiss. An utterance starts after onset_ms of voiced
+ * blocks and ends after hangover_ms without any. The last preroll_ms
+ * before the start are kept so that the first syllable is not cut.
+ */
+struct rabbit_vad_config {
+    unsigned int rate;            // Samples per second
+    float snr_db;                 // Over the noise floor
+    float min_db;                 // dBFS, never speech below this
+    float zcr_max;                // Crossings per sample, higher is noise
+    unsigned int onset_ms;
+    unsigned int hangover_ms;
+    unsigned int preroll_ms;
+    unsigned int max_ms;          // Longest utterance, 0 for no limit
+};
+
+enum rabbit_vad_event {
+    RABBIT_VAD_SILENCE = 0,
+    RABBIT_VAD_START,             // This block starts an utterance
+    RABBIT_VAD_SPEECH,            // This block continues it
+    RABBIT_VAD_END,               // The utterance ended before this block
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct rabbit_vad;
+
+extern void rabbit_vad_defaults(struct rabbit_vad_config *config);
+extern struct rabbit_vad *rabbit_vad_new(
+    const struct rabbit_vad_config *config);
+extern void rabbit_vad_free(struct rabbit_vad *vad);
+extern void rabbit_vad_reset(struct rabbit_vad *vad);
+
+/*
+ * The microphone array's own detector, if there is one: 1 voice, 0 none,
+ * -1 unknown. A voice lowers the energy needed by half of snr_db and
+ * holds the noise floor; none raises it by as much.
+ */
+extern void rabbit_vad_hint(struct rabbit_vad *vad, int voice);
+
+extern enum rabbit_vad_event rabbit_vad_process(struct rabbit_vad *vad,
+                                                const int16_t *pcm,
+                                                unsigned int n);
+
+/*
+ * On RABBIT_VAD_START, copies out the samples that came before the
+ * block, oldest first, and returns how many.
+ */
+extern unsigned int rabbit_vad_preroll(const struct rabbit_vad *vad,
+                                       int16_t *pcm, unsigned int max);
+
+extern unsigned int rabbit_vad_utterance_ms(const struct rabbit_vad *vad);
+extern float rabbit_vad_noise_db(const struct rabbit_vad *vad);
+extern float rabbit_vad_energy_db(const struct rabbit_vad *vad);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,269 @@
+/*
+ * safety.cxx
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#include <math.h>
+#include <time.h>
+#include "rabbit.hxx"
+
+/*
+ * Stop below SAFETY_STOP_MM of clearance, ramp the speed limit up to
+ * SAFETY_SLOW_MMPS at SAFETY_SLOW_MM, and leave the wheels alone beyond.
+ */
+#define SAFETY_STOP_MM        150.0
+#define SAFETY_SLOW_MM        500.0
+#define SAFETY_SLOW_MMPS      300.0
+#define SAFETY_NO_LIMIT_MMPS  10000.0
+#define SAFETY_STALE_US       500000
+
+static const char *source_names[SAFETY_SOURCES] = {
+    "proximity",
+    "lidar",
+    "depth",
+};
+
+static unsigned int instance = 0;
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t) ts.tv_sec * 1000000ULL) + (ts.tv_nsec / 1000);
+}
+
+Safety::Safety()
+    : _enabled(true),
+      _proximitySubscription(0),
+      _fwdLimit(SAFETY_NO_LIMIT_MMPS),
+      _bwdLimit(SAFETY_NO_LIMIT_MMPS),
+      _interventions(0),
+      _maxReactionUs(0)
+{
+    unsigned int i;
+
+    if (instance != 0) {
+        fprintf(stderr, "Safety can be instantiated only once!\n");
+        exit(EXIT_FAILURE);
+    } else {
+        instance++;
+    }
+
+    for (i = 0; i < SAFETY_SOURCES; i++) {
+        _reports[i].front_mm = NAN;
+        _reports[i].rear_mm = NAN;
+        _reports[i].us = 0;
+    }
+
+    pthread_mutex_init(&_mutex, NULL);
+
+    if (proximity) {
+        _proximitySubscription =
+            proximity->subscribe(Safety::proximity_updated, this);
+    }
+
+    printf("Safety is online\n");
+}
+
+Safety::~Safety()
+{
+    if (proximity) {
+        proximity->unsubscribe(_proximitySubscription);
+    }
+
+    if (wheels) {
+        wheels->limitSpeed(SAFETY_NO_LIMIT_MMPS, SAFETY_NO_LIMIT_MMPS);
+    }
+
+    pthread_mutex_destroy(&_mutex);
+
+    instance--;
+    printf("Safety is offline\n");
+}
+
+void Safety::enable(bool en)
+{
+    en = en ? true : false;
+
+    if (en == _enabled) {
+        return;
+    }
+
+    pthread_mutex_lock(&_mutex);
+    _enabled = en;
+    _fwdLimit = SAFETY_NO_LIMIT_MMPS;
+    _bwdLimit = SAFETY_NO_LIMIT_MMPS;
+    if (wheels) {
+        wheels->limitSpeed(SAFETY_NO_LIMIT_MMPS, SAFETY_NO_LIMIT_MMPS);
+    }
+    pthread_mutex_unlock(&_mutex);
+
+    if (en) {
+        speech->speak("Obstacle stop enabled");
+        LOG("Obstacle stop enabled\n");
+    } else {
+        speech->speak("Obstacle stop disabled");
+        LOG("Obstacle stop disabled\n");
+    }
+}
+
+void Safety::proximity_updated(unsigned int mcu, void *arg)
+{
+    Safety *safety = (Safety *) arg;
+    float front, rear;
+    uint64_t us;
+
+    (void)(mcu);
+
+    proximity->clearance(&front, &rear, &us);
+    safety->report(SAFETY_PROXIMITY, front, rear, us);
+}
+
+float Safety::limitFor(float clearance_mm) const
+{
+    if (isnan(clearance_mm) || clearance_mm >= SAFETY_SLOW_MM) {
+        return SAFETY_NO_LIMIT_MMPS;
+    }
+
+    if (clearance_mm <= SAFETY_STOP_MM) {
+        return 0.0;
+    }
+
+    return SAFETY_SLOW_MMPS * (clearance_mm - SAFETY_STOP_MM) /
+        (SAFETY_SLOW_MM - SAFETY_STOP_MM);
+}
+
+float Safety::fwdLimit(void) const
+{
+    float limit;
+
+    pthread_mutex_lock(&_mutex);
+    limit = _fwdLimit;
+    pthread_mutex_unlock(&_mutex);
+
+    return limit;
+}
+
+float Safety::bwdLimit(void) const
+{
+    float limit;
+
+    pthread_mutex_lock(&_mutex);
+    limit = _bwdLimit;
+    pthread_mutex_unlock(&_mutex);
+
+    return limit;
+}
+
+unsigned int Safety::interventions(void) const
+{
+    unsigned int n;
+
+    pthread_mutex_lock(&_mutex);
+    n = _interventions;
+    pthread_mutex_unlock(&_mutex);
+
+    return n;
+}
+
+unsigned int Safety::maxReactionUs(void) const
+{
+    unsigned int us;
+
+    pthread_mutex_lock(&_mutex);
+    us = _maxReactionUs;
+    pthread_mutex_unlock(&_mutex);
+
+    return us;
+}
+
+/*
+ * Latest clearances seen by a source, us is when the readings arrived
+ * (CLOCK_MONOTONIC, 0 for now). The closest fresh reading of all sources
+ * sets the limits. They are applied to the wheels under _mutex, so that
+ * concurrent reports reach the motors in the order they were decided.
+ * The reaction time runs from the arrival of the readings to the cut.
+ */
+void Safety::report(enum safety_source source, float front_mm, float rear_mm,
+                    uint64_t us)
+{
+    uint64_t now, reaction = 0;
+    float front = NAN, rear = NAN;
+    float fwd, bwd;
+    bool cut = false;
+    unsigned int i;
+    char buf[128];
+
+    if (source >= SAFETY_SOURCES) {
+        return;
+    }
+
+    now = now_us();
+    if (us == 0 || us > now) {
+        us = now;
+    }
+
+    pthread_mutex_lock(&_mutex);
+
+    _reports[source].front_mm = front_mm;
+    _reports[source].rear_mm = rear_mm;
+    _reports[source].us = us;
+
+    if (!_enabled) {
+        pthread_mutex_unlock(&_mutex);
+        return;
+    }
+
+    for (i = 0; i < SAFETY_SOURCES; i++) {
+        if (_reports[i].us == 0 || now - _reports[i].us > SAFETY_STALE_US) {
+            continue;
+        }
+
+        front = fminf(front, _reports[i].front_mm);
+        rear = fminf(rear, _reports[i].rear_mm);
+    }
+
+    fwd = limitFor(front);
+    bwd = limitFor(rear);
+
+    if ((fwd != _fwdLimit) || (bwd != _bwdLimit)) {
+        _fwdLimit = fwd;
+        _bwdLimit = bwd;
+
+        if (wheels && wheels->limitSpeed(fwd, bwd)) {
+            cut = true;
+            reaction = now_us() - us;
+            _interventions++;
+            if (reaction > _maxReactionUs) {
+                _maxReactionUs = (unsigned int) reaction;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&_mutex);
+
+    if (cut) {
+        snprintf(buf, sizeof(buf) - 1,
+                 "Safety %s: front %.0fmm rear %.0fmm, "
+                 "limit fwd %.0f bwd %.0f mm/s in %uus\n",
+                 source_names[source],
+                 isnan(front) ? -1.0 : front, isnan(rear) ? -1.0 : rear,
+                 fwd < SAFETY_NO_LIMIT_MMPS ? fwd : -1.0,
+                 bwd < SAFETY_NO_LIMIT_MMPS ? bwd : -1.0,
+                 (unsigned int) reaction);
+        LOG(buf);
+    }
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,81 @@
+/*
+ * safety.hxx
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#ifndef SAFETY_HXX
+#define SAFETY_HXX
+
+#include <stdint.h>
+
+enum safety_source {
+    SAFETY_PROXIMITY = 0,
+    SAFETY_LIDAR = 1,
+    SAFETY_DEPTH = 2,
+    SAFETY_SOURCES = 3,
+};
+
+struct safety_report {
+    float front_mm;    // Clearance ahead, NAN if unknown
+    float rear_mm;     // Clearance behind, NAN if unknown
+    uint64_t us;       // When the readings arrived, CLOCK_MONOTONIC
+};
+
+/*
+ * Obstacle-stop layer between the range sensors and Wheels. Sensors report
+ * clearances on their own threads; the wheel speed limits are updated and
+ * applied to the motors synchronously, so the reaction time is bounded by
+ * the reporting thread and not by the wheel control loop.
+ */
+class Safety {
+
+public:
+
+    Safety();
+    ~Safety();
+
+    void enable(bool en);
+    bool isEnabled(void) const;
+
+    void report(enum safety_source source, float front_mm, float rear_mm,
+                uint64_t us = 0);
+
+    float fwdLimit(void) const;
+    float bwdLimit(void) const;
+    unsigned int interventions(void) const;
+    unsigned int maxReactionUs(void) const;
+
+private:
+
+    float limitFor(float clearance_mm) const;
+    static void proximity_updated(unsigned int mcu, void *arg);
+
+    bool _enabled;
+    unsigned int _proximitySubscription;
+    struct safety_report _reports[SAFETY_SOURCES];
+    float _fwdLimit;
+    float _bwdLimit;
+    unsigned int _interventions;
+    unsigned int _maxReactionUs;
+
+    mutable pthread_mutex_t _mutex;
+
+};
+
+inline bool Safety::isEnabled(void) const
+{
+    return _enabled;
+}
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
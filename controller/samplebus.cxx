@@ -0,0 +1,426 @@
+/*
+ * samplebus.cxx
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/time.h>
+#include <bsd/sys/time.h>
+#include <pthread.h>
+#include "rabbit.hxx"
+
+#define SAMPLE_RECORD_INTERVAL_MS  200
+#define SAMPLE_LOG_VERSION           1
+
+static unsigned int instance = 0;
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t) ts.tv_sec * 1000000ULL) + (ts.tv_nsec / 1000);
+}
+
+SampleChannel::SampleChannel(const char *name, unsigned int size,
+                             unsigned int depth)
+    : _size(size),
+      _depth(1),
+      _claimed(0),
+      _head(0),
+      _waiters(0)
+{
+    strncpy(_name, name, sizeof(_name) - 1);
+    _name[sizeof(_name) - 1] = '\0';
+
+    while (_depth < depth) {
+        _depth <<= 1;
+    }
+
+    _data = new uint8_t[_size * _depth];
+    _us = new uint64_t[_depth];
+
+    pthread_mutex_init(&_mutex, NULL);
+    pthread_cond_init(&_cond, NULL);
+
+    if (samplebus) {
+        samplebus->attach(this);
+    }
+}
+
+SampleChannel::~SampleChannel()
+{
+    if (samplebus) {
+        samplebus->detach(this);
+    }
+
+    pthread_mutex_lock(&_mutex);
+    pthread_cond_broadcast(&_cond);
+    pthread_mutex_unlock(&_mutex);
+    pthread_mutex_destroy(&_mutex);
+    pthread_cond_destroy(&_cond);
+
+    delete [] _data;
+    delete [] _us;
+}
+
+/*
+ * Called by the producer only. The claim is made visible before the slot
+ * is touched, so that a reader can tell whether what it copied might
+ * have been overwritten under it.
+ */
+void SampleChannel::publish(const void *v, uint64_t us)
+{
+    uint64_t seq;
+    unsigned int slot;
+
+    seq = _head.load(std::memory_order_relaxed);
+    slot = seq & (_depth - 1);
+
+    _claimed.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    memcpy(&_data[slot * _size], v, _size);
+    _us[slot] = us ? us : now_us();
+
+    /*
+     * Sequentially consistent, as is the check in wait(): either a waiter
+     * is counted here or it sees this sample before it sleeps.
+     */
+    _head.store(seq + 1, std::memory_order_seq_cst);
+
+    if (_waiters.load(std::memory_order_seq_cst) > 0) {
+        pthread_mutex_lock(&_mutex);
+        pthread_cond_broadcast(&_cond);
+        pthread_mutex_unlock(&_mutex);
+    }
+}
+
+/*
+ * Copy up to max samples from sequence number *seq on, oldest first, and
+ * advance *seq past them. Samples no longer held are skipped.
+ */
+unsigned int SampleChannel::read(uint64_t *seq, void *v, uint64_t *us,
+                                 unsigned int max) const
+{
+    uint8_t *dst = (uint8_t *) v;
+    uint64_t head, first, last, s;
+    unsigned int slot, n, lapped = 0;
+
+    head = _head.load(std::memory_order_acquire);
+    first = *seq;
+    if (first + _depth <= head) {
+        /* The slot of head - depth may be getting overwritten */
+        first = head - _depth + 1;
+    }
+
+    last = head;
+    if (last > first + max) {
+        last = first + max;
+    }
+
+    if (first >= last) {
+        return 0;
+    }
+
+    for (s = first; s < last; s++) {
+        slot = s & (_depth - 1);
+        memcpy(&dst[(s - first) * _size], &_data[slot * _size], _size);
+        if (us) {
+            us[s - first] = _us[slot];
+        }
+    }
+
+    /* Drop what the producer started overwriting while we copied */
+    std::atomic_thread_fence(std::memory_order_acquire);
+    head = _claimed.load(std::memory_order_relaxed);
+    if (first + _depth < head) {
+        lapped = head - _depth - first;
+        if (lapped > last - first) {
+            lapped = last - first;
+        }
+    }
+
+    n = last - first - lapped;
+    if ((lapped > 0) && (n > 0)) {
+        memmove(dst, &dst[lapped * _size], n * _size);
+        if (us) {
+            memmove(us, &us[lapped], n * sizeof(uint64_t));
+        }
+    }
+
+    *seq = last;
+
+    return n;
+}
+
+/*
+ * Wait until sample seq is published.
+ */
+bool SampleChannel::wait(uint64_t seq, unsigned int timeout_ms)
+{
+    struct timespec ts, tw;
+    int ret = 0;
+
+    if (published() > seq) {
+        return true;
+    }
+
+    tw.tv_sec = timeout_ms / 1000;
+    tw.tv_nsec = (timeout_ms % 1000) * 1000000;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    timespecadd(&ts, &tw, &ts);
+
+    _waiters++;
+    pthread_mutex_lock(&_mutex);
+    while ((_head.load(std::memory_order_seq_cst) <= seq) && (ret == 0)) {
+        ret = pthread_cond_timedwait(&_cond, &_mutex, &ts);
+    }
+    pthread_mutex_unlock(&_mutex);
+    _waiters--;
+
+    return published() > seq;
+}
+
+SampleBus::SampleBus()
+    : _log(NULL),
+      _dropped(0),
+      _running(false)
+{
+    if (instance != 0) {
+        fprintf(stderr, "SampleBus can be instantiated only once!\n");
+        exit(EXIT_FAILURE);
+    } else {
+        instance++;
+    }
+
+    bzero(_slots, sizeof(_slots));
+
+    _running = true;
+    pthread_mutex_init(&_mutex, NULL);
+    pthread_cond_init(&_cond, NULL);
+    pthread_create(&_thread, NULL, SampleBus::thread_func, this);
+    pthread_setname_np(_thread, "R'SampleBus");
+
+    printf("SampleBus is online\n");
+}
+
+SampleBus::~SampleBus()
+{
+    stopRecording();
+
+    _running = false;
+    pthread_cond_broadcast(&_cond);
+    pthread_join(_thread, NULL);
+    pthread_mutex_destroy(&_mutex);
+    pthread_cond_destroy(&_cond);
+
+    instance--;
+    printf("SampleBus is offline\n");
+}
+
+void SampleBus::attach(SampleChannel *channel)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&_mutex);
+    for (i = 0; i < SAMPLE_BUS_CHANNELS; i++) {
+        if (_slots[i].channel == NULL) {
+            _slots[i].channel = channel;
+            _slots[i].seq = 0;
+            _slots[i].declared = false;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&_mutex);
+
+    if (i == SAMPLE_BUS_CHANNELS) {
+        fprintf(stderr, "SampleBus is full, %s is not recorded\n",
+                channel->name());
+    }
+}
+
+void SampleBus::detach(SampleChannel *channel)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&_mutex);
+    for (i = 0; i < SAMPLE_BUS_CHANNELS; i++) {
+        if (_slots[i].channel == channel) {
+            record(i);
+            _slots[i].channel = NULL;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&_mutex);
+}
+
+bool SampleBus::startRecording(const char *path)
+{
+    uint32_t version = SAMPLE_LOG_VERSION;
+    unsigned int i;
+    FILE *log;
+
+    log = fopen(path, "wb");
+    if (log == NULL) {
+        perror(path);
+        return false;
+    }
+
+    if ((fwrite("RBUS", 4, 1, log) != 1) ||
+        (fwrite(&version, sizeof(version), 1, log) != 1)) {
+        perror(path);
+        fclose(log);
+        return false;
+    }
+
+    stopRecording();
+
+    pthread_mutex_lock(&_mutex);
+    for (i = 0; i < SAMPLE_BUS_CHANNELS; i++) {
+        if (_slots[i].channel) {
+            _slots[i].seq = _slots[i].channel->published();
+        }
+        _slots[i].declared = false;
+    }
+    _dropped = 0;
+    _log = log;
+    pthread_mutex_unlock(&_mutex);
+
+    printf("SampleBus recording to %s\n", path);
+
+    return true;
+}
+
+void SampleBus::stopRecording(void)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&_mutex);
+    for (i = 0; (i < SAMPLE_BUS_CHANNELS) && _log; i++) {
+        if (_slots[i].channel) {
+            record(i);
+        }
+    }
+
+    if (_log) {
+        fclose(_log);
+        _log = NULL;
+    }
+
+    if (_dropped > 0) {
+        fprintf(stderr, "SampleBus dropped %llu samples\n",
+                (unsigned long long) _dropped);
+    }
+    pthread_mutex_unlock(&_mutex);
+}
+
+void *SampleBus::thread_func(void *args)
+{
+    SampleBus *samplebus = (SampleBus *) args;
+
+    samplebus->run();
+
+    return NULL;
+}
+
+void SampleBus::run(void)
+{
+    struct timespec ts, tloop;
+    unsigned int i;
+
+    tloop.tv_sec = SAMPLE_RECORD_INTERVAL_MS / 1000;
+    tloop.tv_nsec = (SAMPLE_RECORD_INTERVAL_MS % 1000) * 1000000;
+
+    while (_running) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        timespecadd(&ts, &tloop, &ts);
+
+        pthread_mutex_lock(&_mutex);
+        for (i = 0; (i < SAMPLE_BUS_CHANNELS) && _log; i++) {
+            if (_slots[i].channel) {
+                record(i);
+            }
+        }
+        if (_log) {
+            fflush(_log);
+        }
+        pthread_cond_timedwait(&_cond, &_mutex, &ts);
+        pthread_mutex_unlock(&_mutex);
+    }
+}
+
+/*
+ * Called with the mutex held.
+ */
+void SampleBus::declare(unsigned int id, uint64_t base_us)
+{
+    SampleChannel *channel = _slots[id].channel;
+    uint8_t tag = 'C', u8 = id, len;
+    uint16_t size = channel->size();
+
+    len = strlen(channel->name());
+    fwrite(&tag, 1, 1, _log);
+    fwrite(&u8, 1, 1, _log);
+    fwrite(&size, sizeof(size), 1, _log);
+    fwrite(&base_us, sizeof(base_us), 1, _log);
+    fwrite(&len, 1, 1, _log);
+    fwrite(channel->name(), len, 1, _log);
+
+    _slots[id].lastUs = base_us;
+    _slots[id].declared = true;
+}
+
+/*
+ * Write out what channel id published since the last call. Called with
+ * the mutex held.
+ */
+void SampleBus::record(unsigned int id)
+{
+    struct slot *slot = &_slots[id];
+    uint8_t data[SAMPLE_MAX_SIZE];
+    uint8_t tag = 'S', u8 = id;
+    uint64_t seq, us;
+    uint32_t delta;
+
+    while (_log != NULL) {
+        seq = slot->seq;
+        if (slot->channel->read(&slot->seq, data, &us, 1) == 0) {
+            _dropped += slot->seq - seq;
+            break;
+        }
+        _dropped += slot->seq - seq - 1;
+
+        if (!slot->declared || (us < slot->lastUs) ||
+            (us - slot->lastUs > UINT32_MAX)) {
+            declare(id, us);
+        }
+
+        delta = us - slot->lastUs;
+        slot->lastUs = us;
+        fwrite(&tag, 1, 1, _log);
+        fwrite(&u8, 1, 1, _log);
+        fwrite(&delta, sizeof(delta), 1, _log);
+        if (fwrite(data, slot->channel->size(), 1, _log) != 1) {
+            perror("SampleBus");
+            fclose(_log);
+            _log = NULL;
+            break;
+        }
+    }
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
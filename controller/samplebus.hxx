@@ -0,0 +1,243 @@
+/*
+ * samplebus.hxx
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#ifndef SAMPLEBUS_HXX
+#define SAMPLEBUS_HXX
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+#include <type_traits>
+
+#define SAMPLE_BUS_CHANNELS  32
+#define SAMPLE_RING_DEPTH   256    // Power of two
+#define SAMPLE_NAME_SIZE     32
+#define SAMPLE_MAX_SIZE     256
+
+/*
+ * A ring of timestamped samples with one producer and any number of
+ * readers. The producer never blocks or takes a lock: it claims the next
+ * slot, fills it in and publishes it. Readers copy what they want and
+ * then check that the producer did not lap them while they were copying,
+ * dropping whatever it did overwrite. Timestamps are microseconds of
+ * CLOCK_MONOTONIC.
+ */
+class SampleChannel {
+
+public:
+
+    SampleChannel(const char *name, unsigned int size,
+                  unsigned int depth = SAMPLE_RING_DEPTH);
+    ~SampleChannel();
+
+    const char *name(void) const;
+    unsigned int size(void) const;
+    uint64_t published(void) const;
+
+    void publish(const void *v, uint64_t us = 0);
+    unsigned int read(uint64_t *seq, void *v, uint64_t *us,
+                      unsigned int max) const;
+    bool wait(uint64_t seq, unsigned int timeout_ms);
+
+private:
+
+    char _name[SAMPLE_NAME_SIZE];
+    unsigned int _size;
+    unsigned int _depth;
+    uint8_t *_data;
+    uint64_t *_us;
+    std::atomic<uint64_t> _claimed;   // Being written
+    std::atomic<uint64_t> _head;      // Published
+    std::atomic<unsigned int> _waiters;
+
+    pthread_mutex_t _mutex;
+    pthread_cond_t _cond;
+
+};
+
+inline const char *SampleChannel::name(void) const
+{
+    return _name;
+}
+
+inline unsigned int SampleChannel::size(void) const
+{
+    return _size;
+}
+
+inline uint64_t SampleChannel::published(void) const
+{
+    return _head.load(std::memory_order_acquire);
+}
+
+/*
+ * The typed face of a channel, owned by its producer.
+ */
+template <typename T>
+class SampleTopic {
+
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "samples are copied as bytes");
+    static_assert(sizeof(T) <= SAMPLE_MAX_SIZE, "sample too large");
+
+public:
+
+    SampleTopic(const char *name, unsigned int depth = SAMPLE_RING_DEPTH);
+    ~SampleTopic();
+
+    void publish(const T &v, uint64_t us = 0);
+    bool latest(T *v, uint64_t *us = NULL) const;
+    unsigned int history(T *v, uint64_t *us, unsigned int max) const;
+    bool wait(uint64_t *seq, T *v, uint64_t *us, unsigned int timeout_ms);
+    uint64_t published(void) const;
+
+private:
+
+    SampleChannel _channel;
+
+};
+
+template <typename T>
+SampleTopic<T>::SampleTopic(const char *name, unsigned int depth)
+    : _channel(name, sizeof(T), depth)
+{
+
+}
+
+template <typename T>
+SampleTopic<T>::~SampleTopic()
+{
+
+}
+
+template <typename T>
+void SampleTopic<T>::publish(const T &v, uint64_t us)
+{
+    _channel.publish(&v, us);
+}
+
+template <typename T>
+bool SampleTopic<T>::latest(T *v, uint64_t *us) const
+{
+    uint64_t seq = _channel.published();
+
+    if (seq == 0) {
+        return false;
+    }
+
+    seq--;
+
+    return _channel.read(&seq, v, us, 1) == 1;
+}
+
+/*
+ * Up to the last max samples, oldest first.
+ */
+template <typename T>
+unsigned int SampleTopic<T>::history(T *v, uint64_t *us,
+                                     unsigned int max) const
+{
+    uint64_t seq = _channel.published();
+
+    seq = seq > max ? seq - max : 0;
+
+    return _channel.read(&seq, v, us, max);
+}
+
+/*
+ * The sample at *seq, waiting up to timeout_ms for it to be published.
+ * A reader that fell behind skips ahead to the oldest sample still held.
+ */
+template <typename T>
+bool SampleTopic<T>::wait(uint64_t *seq, T *v, uint64_t *us,
+                          unsigned int timeout_ms)
+{
+    if (!_channel.wait(*seq, timeout_ms)) {
+        return false;
+    }
+
+    return _channel.read(seq, v, us, 1) == 1;
+}
+
+template <typename T>
+uint64_t SampleTopic<T>::published(void) const
+{
+    return _channel.published();
+}
+
+/*
+ * The registry of all channels, and the recorder that logs them to disk.
+ *
+ * The log starts with "RBUS" and a 32-bit version, followed by records:
+ *
+ *   'C' id:u8 size:u16 base_us:u64 len:u8 name[len]   declares a channel
+ *   'S' id:u8 delta_us:u32 data[size]                  one sample
+ *
+ * in host byte order. Sample timestamps are relative to the previous one
+ * of the channel, or to base_us for its first; a channel is declared
+ * again when a delta does not fit.
+ */
+class SampleBus {
+
+public:
+
+    SampleBus();
+    ~SampleBus();
+
+    void attach(SampleChannel *channel);
+    void detach(SampleChannel *channel);
+
+    bool startRecording(const char *path);
+    void stopRecording(void);
+    bool isRecording(void) const;
+    uint64_t dropped(void) const;
+
+private:
+
+    static void *thread_func(void *args);
+    void run(void);
+    void record(unsigned int id);
+    void declare(unsigned int id, uint64_t base_us);
+
+    struct slot {
+        SampleChannel *channel;
+        uint64_t seq;          // Next to record
+        uint64_t lastUs;
+        bool declared;
+    } _slots[SAMPLE_BUS_CHANNELS];
+
+    FILE *_log;
+    uint64_t _dropped;
+
+    bool _running;
+    pthread_t _thread;
+    pthread_mutex_t _mutex;    // Guards the slots and the log
+    pthread_cond_t _cond;
+
+};
+
+inline bool SampleBus::isRecording(void) const
+{
+    return _log != NULL;
+}
+
+inline uint64_t SampleBus::dropped(void) const
+{
+    return _dropped;
+}
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
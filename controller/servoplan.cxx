@@ -0,0 +1,100 @@
+/*
+ * servoplan.cxx
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#include <math.h>
+#include <sys/time.h>
+#include "servoplan.hxx"
+
+using namespace std;
+
+void servoplan_append(vector<struct servo_motion_exec> &plan,
+                      unsigned int pulse,
+                      const struct servo_motion *motion)
+{
+    struct servo_motion_exec e;
+
+    if (!plan.empty()) {
+        pulse = plan.back().motion.pulse;
+    }
+
+    e.motion = *motion;
+    gettimeofday(&e.t_start, NULL);
+    e.intervals = (e.motion.ms / SERVO_SCHEDULE_INTERVAL_MS) + 1;
+    e.elapsed_intervals = 0;
+    e.f_steps_per_interval =
+        (float) ((int) e.motion.pulse - (int) pulse) /
+        (float) e.intervals;
+    e.f_current_pulse = (float) pulse;
+    plan.push_back(e);
+}
+
+unsigned int servoplan_ms(const vector<struct servo_motion_exec> &plan)
+{
+    unsigned int intervals = 0;
+    vector<struct servo_motion_exec>::const_iterator it;
+
+    for (it = plan.begin(); it != plan.end(); it++) {
+        intervals += it->intervals - it->elapsed_intervals;
+    }
+
+    return intervals * SERVO_SCHEDULE_INTERVAL_MS;
+}
+
+unsigned int servoplan_pulse_at(const vector<struct servo_motion_exec> &plan,
+                                unsigned int pulse, unsigned int ms)
+{
+    unsigned int intervals;
+    unsigned int remaining;
+    vector<struct servo_motion_exec>::const_iterator it;
+
+    intervals = ms / SERVO_SCHEDULE_INTERVAL_MS;
+    for (it = plan.begin(); it != plan.end(); it++) {
+        remaining = it->intervals - it->elapsed_intervals;
+        if (intervals < remaining) {
+            return (unsigned int) ceil(it->f_current_pulse +
+                                       (it->f_steps_per_interval *
+                                        (float) intervals));
+        }
+
+        intervals -= remaining;
+    }
+
+    if (!plan.empty()) {
+        pulse = plan.back().motion.pulse;
+    }
+
+    return pulse;
+}
+
+bool servoplan_step(vector<struct servo_motion_exec> &plan,
+                    unsigned int *pulse)
+{
+    if (plan.empty()) {
+        return false;
+    }
+
+    struct servo_motion_exec &e = plan.at(0);
+    e.elapsed_intervals++;
+    e.f_current_pulse += e.f_steps_per_interval;
+    *pulse = (unsigned int) ceil(e.f_current_pulse);
+
+    if ((e.elapsed_intervals >= e.intervals)) {
+        *pulse = e.motion.pulse;
+        plan.erase(plan.begin());
+    }
+
+    return true;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,66 @@
+/*
+ * servoplan.hxx
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#ifndef SERVOPLAN_HXX
+#define SERVOPLAN_HXX
+
+#include <sys/time.h>
+#include <vector>
+
+#define SERVO_SCHEDULE_INTERVAL_MS  50
+
+struct servo_motion {
+    unsigned int pulse;
+    unsigned int ms;
+};
+
+struct servo_motion_exec {
+    struct servo_motion motion;
+    struct timeval t_start;
+    unsigned int intervals;
+    unsigned int elapsed_intervals;
+    float f_steps_per_interval;
+    float f_current_pulse;
+};
+
+/*
+ * The motion schedule of one servo channel, as Servos carries it out one
+ * SERVO_SCHEDULE_INTERVAL_MS at a time. Kept apart from the hardware so
+ * that plans can be played offline. 'pulse' is where the servo is.
+ */
+
+/* Append a motion, from where the plan ends */
+extern void servoplan_append(std::vector<struct servo_motion_exec> &plan,
+                             unsigned int pulse,
+                             const struct servo_motion *motion);
+
+/* How long until the plan has been carried out */
+extern unsigned int servoplan_ms(
+    const std::vector<struct servo_motion_exec> &plan);
+
+/* The pulse the plan will have the servo at, ms from now */
+extern unsigned int servoplan_pulse_at(
+    const std::vector<struct servo_motion_exec> &plan,
+    unsigned int pulse, unsigned int ms);
+
+/*
+ * Carry out one interval of the plan, *pulse is where the servo is to be
+ * after it. False if there is nothing planned.
+ */
+extern bool servoplan_step(std::vector<struct servo_motion_exec> &plan,
+                           unsigned int *pulse);
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -281,15 +281,10 @@ void Servos::run(void)
                 continue;  // Servo controller is offline
             }
 
-            if (_motions[chan].empty()) {
+            if (!servoplan_step(_motions[chan], &pulse)) {
                 continue;  // Empty schedule for channel
             }
 
-            struct servo_motion_exec &e = _motions[chan].at(0);
-            e.elapsed_intervals++;
-            e.f_current_pulse += e.f_steps_per_interval;
-            pulse = (unsigned int) ceil(e.f_current_pulse);
-
             if (pulse < _lo[chan]) {
                 pulse = _lo[chan];
             }
@@ -298,14 +293,6 @@ void Servos::run(void)
                 pulse = _hi[chan];
             }
 
-            if ((e.elapsed_intervals >= e.intervals)) {
-                pulse = e.motion.pulse;
-                _motions[chan].erase(_motions[chan].begin());
-            }
-
-            //printf("chan=%u interval=%u target=%u current=%u\n",
-            //       chan, e.elapsed_intervals, e.motion.pulse, pulse);
-
             on = 0;
             off = pulse * 4096 / (1000000 / _freq);
 
@@ -366,7 +353,6 @@ void Servos::scheduleMotions(unsigned int chan,
                              bool append)
 {
     unsigned int i;
-    unsigned int cur_pulse;
 
     if (chan >= SERVO_CHANNELS) {
         return;
@@ -382,37 +368,18 @@ void Servos::scheduleMotions(unsigned int chan,
         _motions[chan].clear();
     }
 
-    if (_motions[chan].empty()) {
-        cur_pulse = _pulse[chan];
-    } else {
-        cur_pulse = _motions[chan].back().motion.pulse;
-    }
-
     for (i = 0; i < motions.size(); i++) {
-        const struct servo_motion &m = motions.at(i);
-        struct servo_motion_exec e;
+        struct servo_motion m = motions.at(i);
 
-        e.motion.ms = m.ms;
-        e.motion.pulse = m.pulse;
-        if (e.motion.pulse < _lo[chan]) {
-            e.motion.pulse = _lo[chan];
+        if (m.pulse < _lo[chan]) {
+            m.pulse = _lo[chan];
         }
 
-        if (e.motion.pulse > _hi[chan]) {
-            e.motion.pulse = _hi[chan];
+        if (m.pulse > _hi[chan]) {
+            m.pulse = _hi[chan];
         }
 
-        gettimeofday(&e.t_start, NULL);
-        e.intervals = (e.motion.ms / SERVO_SCHEDULE_INTERVAL_MS) + 1;
-        e.elapsed_intervals = 0;
-        e.f_steps_per_interval =
-            (float) ((int) e.motion.pulse - (int) cur_pulse) /
-            (float) e.intervals;
-        e.f_current_pulse = (float) cur_pulse;
-        cur_pulse = e.motion.pulse;
-        //printf("scheduled chan %u: intervals=%u spi=%.2f\n",
-        //       chan, e.intervals, e.f_steps_per_interval);
-        _motions[chan].push_back(e);
+        servoplan_append(_motions[chan], _pulse[chan], &m);
     }
 
 
@@ -421,7 +388,9 @@ void Servos::scheduleMotions(unsigned int chan,
 
 void Servos::clearMotionSchedule(unsigned int chan)
 {
+    pthread_mutex_lock(&_mutex);
     _motions[chan].clear();
+    pthread_mutex_unlock(&_mutex);
 }
 
 void Servos::syncMotionSchedule(uint32_t chan_mask)
@@ -467,6 +436,7 @@ bool Servos::lastMotionPulseInPlan(unsigned int chan, unsigned int *pulse) const
 {
     bool hasLastPulse = false;
 
+    pthread_mutex_lock(&_mutex);
     if (!_motions[chan].empty()) {
         hasLastPulse = true;
 
@@ -475,10 +445,41 @@ bool Servos::lastMotionPulseInPlan(unsigned int chan, unsigned int *pulse) const
             *pulse = exec.motion.pulse;
         }
     }
+    pthread_mutex_unlock(&_mutex);
 
     return hasLastPulse;
 }
 
+unsigned int Servos::plannedMs(unsigned int chan) const
+{
+    unsigned int ms;
+
+    if (chan >= SERVO_CHANNELS) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&_mutex);
+    ms = servoplan_ms(_motions[chan]);
+    pthread_mutex_unlock(&_mutex);
+
+    return ms;
+}
+
+unsigned int Servos::plannedPulseAt(unsigned int chan, unsigned int ms) const
+{
+    unsigned int pulse;
+
+    if (chan >= SERVO_CHANNELS) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&_mutex);
+    pulse = servoplan_pulse_at(_motions[chan], _pulse[chan], ms);
+    pthread_mutex_unlock(&_mutex);
+
+    return pulse;
+}
+
 /*
  * Local variables:
  * mode: C++
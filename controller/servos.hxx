@@ -8,24 +8,10 @@
 #define SERVOS_HXX
 
 #include <vector>
+#include "servoplan.hxx"
 
 #define SERVO_CONTROLLERS            2
 #define SERVO_CHANNELS              (16 * SERVO_CONTROLLERS)
-#define SERVO_SCHEDULE_INTERVAL_MS  50
-
-struct servo_motion {
-    unsigned int pulse;
-    unsigned int ms;
-};
-
-struct servo_motion_exec {
-    struct servo_motion motion;
-    struct timeval t_start;
-    unsigned int intervals;
-    unsigned int elapsed_intervals;
-    float f_steps_per_interval;
-    float f_current_pulse;
-};
 
 struct servo_motion_sync {
     uint32_t bitmap;
@@ -57,6 +43,8 @@ public:
     bool hasMotionSchedule(unsigned int chan) const;
     void syncMotionSchedule(uint32_t chan_mask);
     bool lastMotionPulseInPlan(unsigned int chan, unsigned int *pulse) const;
+    unsigned int plannedMs(unsigned int chan) const;
+    unsigned int plannedPulseAt(unsigned int chan, unsigned int ms) const;
 
 private:
 
@@ -76,7 +64,7 @@ private:
 
     bool _running;
     pthread_t _thread;
-    pthread_mutex_t _mutex;
+    mutable pthread_mutex_t _mutex;
     pthread_cond_t _cond;
 
     std::vector<struct servo_motion_exec>
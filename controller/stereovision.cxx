@@ -19,14 +19,33 @@
 #pragma GCC diagnostic pop
 #pragma GCC diagnostic pop
 #pragma GCC diagnostic pop
+#include <math.h>
+#include <time.h>
 #include "rabbit.hxx"
 #include "osdcam.hxx"
 
+/*
+ * Band of the 640x480 depth frame, at the height of the camera, that is
+ * sampled for the closest obstacle ahead.
+ */
+#define DEPTH_BAND_Y0      200
+#define DEPTH_BAND_Y1      280
+#define DEPTH_BAND_STEP     16
+
 using namespace std;
 using namespace cv;
 
 static unsigned int instance = 0;
 
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t) ts.tv_sec * 1000000ULL) + (ts.tv_nsec / 1000);
+}
+
 StereoVision::StereoVision()
     : _rs2_pipeline(NULL),
       _vision(false),
@@ -36,7 +55,9 @@ StereoVision::StereoVision()
       _frDepth(0.0),
       _frIR(0.0),
       _gyroSPS(0.0),
-      _accelSPS(0.0)
+      _accelSPS(0.0),
+      _gyro("stereovision/gyro"),
+      _accel("stereovision/accel")
 {
     _running = true;
     pthread_mutex_init(&_mutex, NULL);
@@ -146,10 +167,13 @@ void StereoVision::run(void)
     struct timeval now, tdiff;
     struct timeval tsColor, tsDepth, tsIR, tvColor, tvDepth, tvIR;
     struct timeval tvGyro, tvAccel;
+    struct imu_sample imu;
     Mat colorScreen, depthScreen, irScreen;
     Mat colorOsd, depthOsd, irOsd;
     rs2::colorizer color_map;
     bool enableEmitter = isEmitterEnabled();
+    bool colorEn, depthEn, irEn, motionEn;
+    unsigned int streams, opened = 0;
 
     /* Setup */
     colorOsd.create(Size(300, 480), CV_8UC3);
@@ -169,19 +193,20 @@ void StereoVision::run(void)
     memcpy(&tvIR, &now, sizeof(struct timeval));
 
     while (_running) {
-        /* Close the device if there's no requestor */
-        if ((_vision == false) &&
-            (_imuEn == false) &&
-            (mjpeg_streamer->hasClient("/svcolor") == false) &&
-            (mjpeg_streamer->hasClient("/svdepth") == false) &&
-            (mjpeg_streamer->hasClient("/svir") == false)) {
-            struct timespec twait;
-
+        /* The obstacle stop needs depth whether or not anyone watches */
+        colorEn = _vision || mjpeg_streamer->hasClient("/svcolor");
+        depthEn = _vision || mjpeg_streamer->hasClient("/svdepth") ||
+            (safety != NULL);
+        irEn = _vision || mjpeg_streamer->hasClient("/svir");
+        motionEn = _vision || _imuEn;
+        streams = (colorEn ? 0x1 : 0) | (depthEn ? 0x2 : 0) |
+            (irEn ? 0x4 : 0) | (motionEn ? 0x8 : 0);
+
+        /* Close the device if there's no requestor, or to change streams */
+        if ((_rs2_pipeline != NULL) && (streams != opened)) {
             try {
-                if (_rs2_pipeline != NULL) {
-                    delete (rs2::pipeline *) _rs2_pipeline;
-                    _rs2_pipeline = NULL;
-                }
+                delete (rs2::pipeline *) _rs2_pipeline;
+                _rs2_pipeline = NULL;
             } catch (const rs2::error &e) {
                 cerr << "RealSense error calling " <<
                     e.get_failed_function() << "(" <<
@@ -191,6 +216,11 @@ void StereoVision::run(void)
                 cerr << e.what() << endl;
                 ret = -1;
             }
+            opened = 0;
+        }
+
+        if (streams == 0) {
+            struct timespec twait;
 
             clock_gettime(CLOCK_REALTIME, &twait);
             twait.tv_sec += 1;
@@ -201,11 +231,7 @@ void StereoVision::run(void)
         }
 
         /* Probe and open device */
-        probeOpenDevice(_vision | mjpeg_streamer->hasClient("/svcolor"),
-                        _vision | mjpeg_streamer->hasClient("/svdepth"),
-                        _vision | mjpeg_streamer->hasClient("/svir"),
-                        _vision | _imuEn,
-                        _vision | _imuEn);
+        probeOpenDevice(colorEn, depthEn, irEn, motionEn, motionEn);
         if (_rs2_pipeline == NULL) {
             struct timespec twait;
             clock_gettime(CLOCK_REALTIME, &twait);
@@ -215,6 +241,7 @@ void StereoVision::run(void)
             pthread_mutex_unlock(&_mutex);
             continue;
         }
+        opened = streams;
 
         /* Adjust emitter on/off */
         if (enableEmitter != _emitterEn) {
@@ -241,9 +268,10 @@ void StereoVision::run(void)
             /* Wait for frames */
             rs2::frameset frames =
                 ((rs2::pipeline *) _rs2_pipeline)->wait_for_frames();
+            uint64_t frames_us = now_us();
 
             /* Color frame */
-            if (_vision || mjpeg_streamer->hasClient("/svcolor")) {
+            if (colorEn) {
                 /* Get color frame */
                 rs2::frame color_frame = frames.get_color_frame();
                 /* Convert to OpenCV Mat */
@@ -284,52 +312,79 @@ void StereoVision::run(void)
             }
 
             /* Depth frame */
-            if (_vision || mjpeg_streamer->hasClient("/svdepth")) {
+            if (depthEn) {
                 /* Get depth frame */
                 rs2::frame depth_frame = frames.get_depth_frame();
 
-                /* Encode depth in colors */
-                rs2::frame depth_colorized =
-                    depth_frame.apply_filter(color_map);
-                /* Convert to OpenCV Mat */
-                Mat depth(Size(640, 480), CV_8UC3,
-                          (void *) depth_colorized.get_data(),
-                          Mat::AUTO_STEP);
-
-                /* Update frame rate */
-                gettimeofday(&now, NULL);
-                timersub(&now, &tvDepth, &tdiff);
-                _frDepth = 1.0 / (tdiff.tv_sec + (tdiff.tv_usec * 0.000001));
-                memcpy(&tvDepth, &now, sizeof(struct timeval));
-
-                /* Update OSD */
-                timersub(&now, &tsDepth, &tdiff);
-                if (tdiff.tv_sec > 0 || tdiff.tv_usec > 500000) {
-                    OsdCam::genOsdFrame(depthOsd, depthFrameRate());
-                    gettimeofday(&tsDepth, NULL);
+                /* Closest point straight ahead, for the obstacle stop */
+                if (safety) {
+                    rs2::depth_frame df = depth_frame.as<rs2::depth_frame>();
+                    float d, front = NAN;
+                    int x, y;
+
+                    for (y = DEPTH_BAND_Y0; y < DEPTH_BAND_Y1;
+                         y += DEPTH_BAND_STEP) {
+                        for (x = 0; x < df.get_width();
+                             x += DEPTH_BAND_STEP) {
+                            d = df.get_distance(x, y) * 1000.0;
+                            if (d > 0.0) {
+                                front = fminf(front, d);
+                            }
+                        }
+                    }
+
+                    safety->report(SAFETY_DEPTH, front, NAN, frames_us);
                 }
 
-                /* Compose screen */
-                depth.copyTo(depthScreen(Rect(0, 0, depth.cols, depth.rows)));
-                depthOsd.copyTo(depthScreen(Rect(640, 0,
-                                                 depthOsd.cols,
-                                                 depthOsd.rows)));
-
-
-                /* Publish */
-                if (mjpeg_streamer->isRunning()) {
-                    std::vector<int> params = { IMWRITE_JPEG_QUALITY, 90, };
-                    vector<uchar> buff_svdepth;
-
-                    imencode(".jpg", depthScreen, buff_svdepth, params);
-                    mjpeg_streamer->publish("/svdepth",
-                                            string(buff_svdepth.begin(),
-                                                   buff_svdepth.end()));
+                /* Only drawn for whoever watches */
+                if (_vision || mjpeg_streamer->hasClient("/svdepth")) {
+                    /* Encode depth in colors */
+                    rs2::frame depth_colorized =
+                        depth_frame.apply_filter(color_map);
+                    /* Convert to OpenCV Mat */
+                    Mat depth(Size(640, 480), CV_8UC3,
+                              (void *) depth_colorized.get_data(),
+                              Mat::AUTO_STEP);
+
+                    /* Update frame rate */
+                    gettimeofday(&now, NULL);
+                    timersub(&now, &tvDepth, &tdiff);
+                    _frDepth = 1.0 /
+                        (tdiff.tv_sec + (tdiff.tv_usec * 0.000001));
+                    memcpy(&tvDepth, &now, sizeof(struct timeval));
+
+                    /* Update OSD */
+                    timersub(&now, &tsDepth, &tdiff);
+                    if (tdiff.tv_sec > 0 || tdiff.tv_usec > 500000) {
+                        OsdCam::genOsdFrame(depthOsd, depthFrameRate());
+                        gettimeofday(&tsDepth, NULL);
+                    }
+
+                    /* Compose screen */
+                    depth.copyTo(depthScreen(Rect(0, 0,
+                                                  depth.cols, depth.rows)));
+                    depthOsd.copyTo(depthScreen(Rect(640, 0,
+                                                     depthOsd.cols,
+                                                     depthOsd.rows)));
+
+
+                    /* Publish */
+                    if (mjpeg_streamer->isRunning()) {
+                        std::vector<int> params = {
+                            IMWRITE_JPEG_QUALITY, 90,
+                        };
+                        vector<uchar> buff_svdepth;
+
+                        imencode(".jpg", depthScreen, buff_svdepth, params);
+                        mjpeg_streamer->publish("/svdepth",
+                                                string(buff_svdepth.begin(),
+                                                       buff_svdepth.end()));
+                    }
                 }
             }
 
             /* IR frame */
-            if (_vision || mjpeg_streamer->hasClient("/svir")) {
+            if (irEn) {
                 /* Get IR frame */
                 rs2::frame ir_frame = frames.first(RS2_STREAM_INFRARED);
 
@@ -389,7 +444,10 @@ void StereoVision::run(void)
                     double ts = gyro_motion.get_timestamp();
                     rs2_vector gyro_data = gyro_motion.get_motion_data();
                     (void)(ts);
-                    (void)(gyro_data);
+                    imu.x = gyro_data.x;
+                    imu.y = gyro_data.y;
+                    imu.z = gyro_data.z;
+                    _gyro.publish(imu);
                     //printf("G sps=%.1f ts=%f x=%.3f y=%.3f z=%.3f\n",
                     //       _gyroSPS, ts,
                     //       gyro_data.x, gyro_data.y, gyro_data.z);
@@ -411,7 +469,10 @@ void StereoVision::run(void)
                     double ts = accel_motion.get_timestamp();
                     rs2_vector accel_data = accel_motion.get_motion_data();
                     (void)(ts);
-                    (void)(accel_data);
+                    imu.x = accel_data.x;
+                    imu.y = accel_data.y;
+                    imu.z = accel_data.z;
+                    _accel.publish(imu);
                     //printf("A sps=%.1f ts=%f x=%.3f y=%.3f z=%.3f\n",
                     //       _accelSPS, ts,
                     //       accel_data.x, accel_data.y, accel_data.z);
@@ -7,6 +7,12 @@
 #ifndef STEREOVISION_HXX
 #define STEREOVISION_HXX
 
+#include "samplebus.hxx"
+
+struct imu_sample {
+    float x, y, z;         // rad/s for the gyro, m/s^2 for the accelerometer
+};
+
 class StereoVision {
 
 public:
@@ -28,6 +34,8 @@ public:
     float infraredFrameRate(void) const;
     float gyroSamplesPerSec(void) const;
     float accelSamplesPerSec(void) const;
+    SampleTopic<struct imu_sample> &gyroTopic(void);
+    SampleTopic<struct imu_sample> &accelTopic(void);
 
 private:
 
@@ -45,6 +53,8 @@ private:
     float _frIR;
     float _gyroSPS;
     float _accelSPS;
+    SampleTopic<struct imu_sample> _gyro;
+    SampleTopic<struct imu_sample> _accel;
 
     pthread_t _thread;
     pthread_mutex_t _mutex;
@@ -93,6 +103,16 @@ inline float StereoVision::accelSamplesPerSec(void) const
     return _accelSPS;
 }
 
+inline SampleTopic<struct imu_sample> &StereoVision::gyroTopic(void)
+{
+    return _gyro;
+}
+
+inline SampleTopic<struct imu_sample> &StereoVision::accelTopic(void)
+{
+    return _accel;
+}
+
 #endif
 
 /*
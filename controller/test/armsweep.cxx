@@ -0,0 +1,605 @@
+/*
+ * armsweep.cxx
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <dirent.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include "../armguard.hxx"
+#include "../servoplan.hxx"
+#include "../arms.hxx"
+
+/*
+ * Offline sweep of the arm gestures against the arm guard. The arm
+ * keyframes of every *.gst file are planned by armguard_plan_motion() as
+ * Arm::planMotions() plans them, onto servo schedules that servoplan.cxx
+ * carries out as Servos does, with the clock moved on in place of the
+ * Servos thread:
+ *
+ *   armsweep [gesture directory]
+ *
+ * A gesture named "<name>-right" is played together with "<name>-left",
+ * as Arm does when both arms are asked for the same gesture. Each is
+ * started from rest, and the sequences that Arm only plays after another
+ * gesture are started from where that one ends. Holds and re-timings are
+ * reported, a rejected keyframe fails the sweep.
+ */
+
+#define SWEEP_MAX_TOKENS  12
+#define SWEEP_PPD         10     // Pulses per degree of the joints
+#define SWEEP_ZERO      2000     // Pulse of 0 degree
+
+using namespace std;
+
+struct sweep_step {
+    bool arm;                     // Arm keyframe, or clear
+    unsigned int mask;            // 1 right, 2 left
+    float v[6];
+    unsigned int ms;
+    bool skip;
+    unsigned int waitMs;          // Before this step
+};
+
+struct sweep_gesture {
+    string name;
+    vector<struct sweep_step> steps;
+};
+
+struct sweep_arm {
+    unsigned int pulse[6];        // Where the servos are
+    vector<struct servo_motion_exec> plan[6];
+};
+
+/*
+ * Arm::rest(), the gripper left where it is.
+ */
+static const struct arm_pose rest_pose = {
+    0.0, -85.0, -90.0, -40.0, -90.0, 50.0,
+};
+
+/*
+ * Gestures that Arm plays only once another one has brought the arm in
+ * position.
+ */
+static const char *sequences[][2] = {
+    { "hug", "hug-inward", },
+    { "xfer-rl-ready", "xfer-rl", },
+    { "xfer-lr-ready", "xfer-lr", },
+    { NULL, NULL, },
+};
+
+static vector<struct sweep_gesture> gestures;
+static struct sweep_arm arms[2];
+static unsigned int clock_ms;
+static unsigned int holds, retimes, rejects;
+
+static unsigned int tokenize(char *line, char *tokens[], unsigned int max)
+{
+    unsigned int n = 0;
+    char *s = line;
+
+    while (*s != '\0' && n < max) {
+        while (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n') {
+            s++;
+        }
+
+        if (*s == '\0' || *s == '#') {
+            break;
+        }
+
+        if (*s == '"') {
+            /* Speech and log text are of no interest here */
+            tokens[n++] = s;
+            for (s++; *s != '\0' && *s != '"'; s++);
+            if (*s == '"') {
+                s++;
+            }
+            continue;
+        }
+
+        tokens[n++] = s;
+        while (*s != '\0' && *s != ' ' && *s != '\t' &&
+               *s != '\r' && *s != '\n') {
+            s++;
+        }
+        if (*s != '\0') {
+            *s++ = '\0';
+        }
+    }
+
+    return n;
+}
+
+static int parse_value(const char *token, float *v)
+{
+    char *endptr;
+
+    if (strcmp(token, "-") == 0) {
+        *v = NAN;
+        return 0;
+    }
+
+    *v = strtof(token, &endptr);
+    if (endptr == token || *endptr != '\0') {
+        return -1;
+    }
+
+    return 0;
+}
+
+static unsigned int parse_arms(const char *token)
+{
+    if (strcmp(token, "right") == 0) {
+        return 0x1;
+    } else if (strcmp(token, "left") == 0) {
+        return 0x2;
+    } else if (strcmp(token, "both") == 0) {
+        return 0x3;
+    }
+
+    return 0;
+}
+
+static int load_file(const char *path)
+{
+    FILE *fp;
+    char line[256];
+    char *tokens[SWEEP_MAX_TOKENS];
+    unsigned int n, i, lineno = 0, waitMs = 0;
+    struct sweep_step step;
+    struct sweep_gesture g;
+    float v;
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        lineno++;
+        n = tokenize(line, tokens, SWEEP_MAX_TOKENS);
+        if (n == 0) {
+            continue;
+        }
+
+        if (strcmp(tokens[0], "gesture") == 0 && n == 2) {
+            g.name = tokens[1];
+            gestures.push_back(g);
+            waitMs = 0;
+            continue;
+        }
+
+        if (gestures.empty()) {
+            continue;
+        }
+
+        memset(&step, 0x0, sizeof(step));
+        if ((step.mask = parse_arms(tokens[0])) != 0) {
+            if (n != 8 && !(n == 9 && strcmp(tokens[8], "skip") == 0)) {
+                goto invalid;
+            }
+
+            step.arm = true;
+            for (i = 0; i < 6; i++) {
+                if (parse_value(tokens[i + 1], &step.v[i]) != 0) {
+                    goto invalid;
+                }
+            }
+            if (parse_value(tokens[7], &v) != 0 || isnan(v) || v < 0) {
+                goto invalid;
+            }
+            step.ms = (unsigned int) v;
+            step.skip = n == 9;
+        } else if (strcmp(tokens[0], "clear") == 0) {
+            if (n != 2 || (step.mask = parse_arms(tokens[1])) == 0) {
+                goto invalid;
+            }
+        } else if (strcmp(tokens[0], "wait") == 0) {
+            if (n != 2 || parse_value(tokens[1], &v) != 0 ||
+                isnan(v) || v < 0) {
+                goto invalid;
+            }
+            waitMs += (unsigned int) v;
+            continue;
+        } else {
+            continue;
+        }
+
+        step.waitMs = waitMs;
+        waitMs = 0;
+        gestures.back().steps.push_back(step);
+        continue;
+
+invalid:
+
+        fprintf(stderr, "%s:%u: invalid '%s' step!\n", path, lineno,
+                tokens[0]);
+        fclose(fp);
+        return -1;
+    }
+
+    fclose(fp);
+
+    return 0;
+}
+
+static int load(const char *dir)
+{
+    DIR *dp;
+    struct dirent *de;
+    string path;
+    size_t len;
+    int ret = 0;
+
+    dp = opendir(dir);
+    if (dp == NULL) {
+        perror(dir);
+        return -1;
+    }
+
+    while ((de = readdir(dp)) != NULL) {
+        len = strlen(de->d_name);
+        if (len < 4 || strcmp(de->d_name + len - 4, ".gst") != 0) {
+            continue;
+        }
+
+        path = string(dir) + "/" + de->d_name;
+        if (load_file(path.c_str()) != 0) {
+            ret = -1;
+        }
+    }
+
+    closedir(dp);
+
+    return ret;
+}
+
+static const struct sweep_gesture *find(const string &name)
+{
+    unsigned int i;
+
+    for (i = 0; i < gestures.size(); i++) {
+        if (gestures[i].name == name) {
+            return &gestures[i];
+        }
+    }
+
+    return NULL;
+}
+
+static unsigned int to_pulse(float deg)
+{
+    return (unsigned int) ((int) SWEEP_ZERO + (int) roundf(deg * SWEEP_PPD));
+}
+
+static float to_degree(unsigned int pulse)
+{
+    return (float) ((int) pulse - (int) SWEEP_ZERO) / SWEEP_PPD;
+}
+
+/*
+ * Arm::plannedMs()
+ */
+static unsigned int planned_ms(const struct sweep_arm *arm)
+{
+    unsigned int i, ms, maxMs = 0;
+
+    for (i = 0; i < 6; i++) {
+        ms = servoplan_ms(arm->plan[i]);
+        if (ms > maxMs) {
+            maxMs = ms;
+        }
+    }
+
+    return maxMs;
+}
+
+/*
+ * Arm::plannedPoseAt()
+ */
+static void pose_at(const struct sweep_arm *arm, unsigned int ms,
+                    struct arm_pose *pose)
+{
+    float *p = &pose->sr;
+    unsigned int i;
+
+    for (i = 0; i < 6; i++) {
+        p[i] = to_degree(servoplan_pulse_at(arm->plan[i], arm->pulse[i], ms));
+    }
+}
+
+/*
+ * Arm::lastPlannedPulse()
+ */
+static unsigned int last_pulse(const struct sweep_arm *arm, unsigned int i)
+{
+    return arm->plan[i].empty() ? arm->pulse[i] :
+        arm->plan[i].back().motion.pulse;
+}
+
+/*
+ * Arm::setPulse(): short moves are made at once, dropping the schedule.
+ */
+static void set_pulse(struct sweep_arm *arm, unsigned int i,
+                      unsigned int pulse, unsigned int ms)
+{
+    struct servo_motion motion;
+
+    if (ms <= SERVO_SCHEDULE_INTERVAL_MS) {
+        arm->plan[i].clear();
+        arm->pulse[i] = pulse;
+    } else {
+        motion.pulse = pulse;
+        motion.ms = ms;
+        servoplan_append(arm->plan[i], arm->pulse[i], &motion);
+    }
+}
+
+/*
+ * Moves the clock on, carrying out the schedules of both arms an interval
+ * at a time as the Servos thread does.
+ */
+static void advance(unsigned int ms)
+{
+    unsigned int intervals, side, i;
+
+    intervals = (clock_ms + ms) / SERVO_SCHEDULE_INTERVAL_MS -
+        clock_ms / SERVO_SCHEDULE_INTERVAL_MS;
+    clock_ms += ms;
+
+    while (intervals-- > 0) {
+        for (side = 0; side < 2; side++) {
+            for (i = 0; i < 6; i++) {
+                servoplan_step(arms[side].plan[i], &arms[side].pulse[i]);
+            }
+        }
+    }
+}
+
+static void other_at(unsigned int ms, struct arm_pose *pose, void *arg)
+{
+    unsigned int side = *(const unsigned int *) arg;
+
+    pose_at(&arms[side == RIGHT_ARM ? LEFT_ARM : RIGHT_ARM],
+            ms, pose);
+}
+
+/*
+ * One arm keyframe, through what Arm::planMotions() does around
+ * armguard_plan_motion().
+ */
+static bool plan(const char *gesture, unsigned int side,
+                 const struct sweep_step *step)
+{
+    struct sweep_arm *arm = &arms[side];
+    struct arm_pose from, to;
+    unsigned int holdMs, ms = step->ms, i;
+    float *f = &from.sr;
+    float *t = &to.sr;
+    bool at = true;
+    char reason[80];
+
+    for (i = 0; i < 6; i++) {
+        f[i] = to_degree(last_pulse(arm, i));
+        t[i] = isnan(step->v[i]) ? f[i] : step->v[i];
+        if (to_pulse(t[i]) != arm->pulse[i]) {
+            at = false;
+        }
+    }
+
+    /* Arm::isAtPosition() */
+    if (step->skip && at) {
+        return true;
+    }
+
+    if (!armguard_plan_motion(side, &from, &to, planned_ms(arm),
+                              planned_ms(&arms[side == RIGHT_ARM ?
+                                               LEFT_ARM : RIGHT_ARM]),
+                              &ms, &holdMs, other_at, &side,
+                              reason, sizeof(reason))) {
+        printf("  %s: %s arm plan REJECTED: %s\n", gesture,
+               side == RIGHT_ARM ? "right" : "left", reason);
+        rejects++;
+        return false;
+    }
+
+    if (holdMs > 0) {
+        for (i = 0; i < 6; i++) {
+            set_pulse(arm, i, last_pulse(arm, i), holdMs);
+        }
+        printf("  %s: %s arm holds %ums: %s\n", gesture,
+               side == RIGHT_ARM ? "right" : "left", holdMs, reason);
+        holds++;
+    }
+
+    if (ms != step->ms) {
+        printf("  %s: %s arm re-timed from %ums to %ums\n", gesture,
+               side == RIGHT_ARM ? "right" : "left", step->ms, ms);
+        retimes++;
+    }
+
+    for (i = 0; i < 6; i++) {
+        set_pulse(arm, i, to_pulse(t[i]), ms);
+    }
+
+    return true;
+}
+
+/*
+ * Plays up to two gestures side by side, the way the Gestures thread
+ * interleaves its players, then lets both arms come to rest.
+ */
+static bool play(const struct sweep_gesture *a, const struct sweep_gesture *b)
+{
+    const struct sweep_gesture *g[2] = { a, b, };
+    unsigned int pc[2] = { 0, 0, };
+    unsigned int wake[2] = { 0, 0, };
+    unsigned int now = 0, next, i, j, side;
+    bool ok = true;
+
+    for (;;) {
+        for (i = 0; i < 2; i++) {
+            while (g[i] != NULL && pc[i] < g[i]->steps.size()) {
+                const struct sweep_step &step = g[i]->steps[pc[i]];
+
+                if (wake[i] + step.waitMs > now) {
+                    break;
+                }
+
+                wake[i] += step.waitMs;
+                pc[i]++;
+                for (side = 0; side < 2; side++) {
+                    if ((step.mask & (1 << side)) == 0) {
+                        continue;
+                    }
+
+                    if (!step.arm) {
+                        /* Arm::clearMotions(), the arm stops where it is */
+                        for (j = 0; j < 6; j++) {
+                            arms[side].plan[j].clear();
+                        }
+                    } else if (!plan(g[i]->name.c_str(), side, &step)) {
+                        ok = false;
+                    }
+                }
+            }
+        }
+
+        next = 0;
+        for (i = 0; i < 2; i++) {
+            if (g[i] != NULL && pc[i] < g[i]->steps.size()) {
+                if (next == 0 || wake[i] + g[i]->steps[pc[i]].waitMs < next) {
+                    next = wake[i] + g[i]->steps[pc[i]].waitMs;
+                }
+            }
+        }
+
+        if (next == 0) {
+            break;
+        }
+
+        advance(next - now);
+        now = next;
+    }
+
+    advance(planned_ms(&arms[RIGHT_ARM]) > planned_ms(&arms[LEFT_ARM]) ?
+            planned_ms(&arms[RIGHT_ARM]) : planned_ms(&arms[LEFT_ARM]));
+
+    return ok;
+}
+
+static bool play_pair(const string &name)
+{
+    const struct sweep_gesture *r = find(name + "-right");
+    const struct sweep_gesture *l = find(name + "-left");
+
+    if (r == NULL && l == NULL) {
+        r = find(name);
+    }
+
+    return play(r, l);
+}
+
+static void reset(void)
+{
+    const float *rest = &rest_pose.sr;
+    unsigned int side, i;
+
+    for (side = 0; side < 2; side++) {
+        for (i = 0; i < 6; i++) {
+            arms[side].pulse[i] = to_pulse(rest[i]);
+            arms[side].plan[i].clear();
+        }
+    }
+}
+
+static bool sweep(const vector<string> &names)
+{
+    unsigned int i;
+    bool ok = true;
+
+    for (i = 0; i < names.size(); i++) {
+        printf("%s%s", i == 0 ? "rest -> " : " -> ", names[i].c_str());
+    }
+    printf("\n");
+
+    reset();
+    for (i = 0; i < names.size(); i++) {
+        if (!play_pair(names[i])) {
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = argc > 1 ? argv[1] : "gestures";
+    vector<string> names, seq;
+    string base;
+    size_t len;
+    unsigned int i, j;
+    bool ok = true;
+
+    if (load(dir) != 0) {
+        return EXIT_FAILURE;
+    }
+
+    /* One entry per gesture, the per-arm ones under their common name */
+    for (i = 0; i < gestures.size(); i++) {
+        base = gestures[i].name;
+        len = base.length();
+        if (len > 6 && base.compare(len - 6, 6, "-right") == 0) {
+            base.erase(len - 6);
+        } else if (len > 5 && base.compare(len - 5, 5, "-left") == 0) {
+            base.erase(len - 5);
+        }
+
+        for (j = 0; j < names.size() && names[j] != base; j++);
+        if (j == names.size()) {
+            names.push_back(base);
+        }
+    }
+
+    for (i = 0; i < names.size(); i++) {
+        seq.clear();
+        seq.push_back(names[i]);
+        if (!sweep(seq)) {
+            ok = false;
+        }
+    }
+
+    for (i = 0; sequences[i][0] != NULL; i++) {
+        seq.clear();
+        seq.push_back(sequences[i][0]);
+        seq.push_back(sequences[i][1]);
+        if (!sweep(seq)) {
+            ok = false;
+        }
+    }
+
+    printf("%zu gestures, %u holds, %u re-timed, %u rejected\n",
+           gestures.size(), holds, retimes, rejects);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,192 @@
+/*
+ * doareplay.cxx
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <vector>
+#include "../doafilter.hxx"
+
+/*
+ * Replays a logged DOA trace through the SoundTracker that steers the head
+ * in Head::trackSound(), so that it can be tuned on a desk:
+ *
+ *   doareplay [-w window ms] [-o outlier deg] [-n min inliers]
+ *             [-d deadband deg] [-e expected deg] trace
+ *
+ * A trace has one reading per line, either "<ms> <DOAAngle> <speech>" or
+ * what "mosquitto_sub -t rabbit/voice/change -F '%U %p'" prints, i.e.
+ * "<s.us> DOAAngle=<deg>,SpeechDetected=<0|1>,...". The readings are held
+ * and sampled at the rate Voice polls the ReSpeaker. Every turn of the
+ * head is printed. With -e, the replay fails unless the head ends up
+ * within 10 degrees of the expected bearing.
+ */
+
+#define REPLAY_POLL_MS        100     // USB_POLL_INTERVAL_MS
+#define REPLAY_EXPECT_DEG    10.0
+
+using namespace std;
+
+struct doa_reading {
+    uint64_t ms;
+    uint32_t doa;
+    bool speech;
+};
+
+static float angle_between(float a, float b)
+{
+    float d;
+
+    d = fmodf(fabsf(a - b), 360.0);
+    if (d > 180.0) {
+        d = 360.0 - d;
+    }
+
+    return d;
+}
+
+static int load(const char *path, vector<struct doa_reading> &trace)
+{
+    FILE *fp;
+    char line[512];
+    char *s, *tok, *save, *val;
+    unsigned int lineno = 0;
+    struct doa_reading r = { 0, 0, false, };
+    double t;
+    unsigned long doa, speech;
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        lineno++;
+        s = line + strspn(line, " \t");
+        if (*s == '#' || *s == '\n' || *s == '\0') {
+            continue;
+        }
+
+        if (strchr(s, '=') != NULL) {
+            /* Changes only, the fields not in the line are held */
+            t = strtod(s, &s);
+            r.ms = (uint64_t) (t * 1000.0);
+            for (tok = strtok_r(s, " ,\r\n", &save); tok != NULL;
+                 tok = strtok_r(NULL, " ,\r\n", &save)) {
+                val = strchr(tok, '=');
+                if (val == NULL) {
+                    continue;
+                }
+                *val++ = '\0';
+                if (strcmp(tok, "DOAAngle") == 0) {
+                    r.doa = strtoul(val, NULL, 10);
+                } else if (strcmp(tok, "SpeechDetected") == 0) {
+                    r.speech = strtoul(val, NULL, 10) != 0;
+                }
+            }
+        } else if (sscanf(s, "%lf %lu %lu", &t, &doa, &speech) == 3) {
+            r.ms = (uint64_t) t;
+            r.doa = doa;
+            r.speech = speech != 0;
+        } else {
+            fprintf(stderr, "%s:%u: invalid reading!\n", path, lineno);
+            fclose(fp);
+            return -1;
+        }
+
+        trace.push_back(r);
+    }
+
+    fclose(fp);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    vector<struct doa_reading> trace;
+    unsigned int windowMs = 1000, minInliers = 3, turns = 0;
+    float outlierDeg = 30.0, deadbandDeg = 5.0, expect = NAN;
+    float deg, rotation = 0.0;
+    uint64_t ms;
+    size_t next = 0;
+    struct doa_reading now = { 0, 0, false, };
+    int opt;
+
+    while ((opt = getopt(argc, argv, "w:o:n:d:e:")) != -1) {
+        switch (opt) {
+        case 'w':
+            windowMs = atoi(optarg);
+            break;
+        case 'o':
+            outlierDeg = atof(optarg);
+            break;
+        case 'n':
+            minInliers = atoi(optarg);
+            break;
+        case 'd':
+            deadbandDeg = atof(optarg);
+            break;
+        case 'e':
+            expect = atof(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-w ms] [-o deg] [-n inliers] "
+                    "[-d deg] [-e deg] trace\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind >= argc || load(argv[optind], trace) != 0) {
+        return EXIT_FAILURE;
+    }
+
+    if (trace.empty()) {
+        fprintf(stderr, "%s: no readings\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+
+    SoundTracker tracker(windowMs, outlierDeg, minInliers, deadbandDeg);
+
+    /* As Voice::run2() polls and Head::trackSound() follows */
+    for (ms = trace[0].ms; ms <= trace.back().ms; ms += REPLAY_POLL_MS) {
+        while (next < trace.size() && trace[next].ms <= ms) {
+            now = trace[next++];
+        }
+
+        if (!tracker.track(now.doa, now.speech, ms, rotation, &deg)) {
+            continue;
+        }
+
+        printf("%8.1fs head %6.1f -> %6.1f\n",
+               (double) (ms - trace[0].ms) / 1000.0, rotation, deg);
+        rotation = deg;
+        turns++;
+    }
+
+    printf("%zu readings, %u samples, %u turns, head at %.1f\n",
+           trace.size(), tracker.samples(), turns, rotation);
+
+    if (!isnan(expect) && angle_between(rotation, expect) > REPLAY_EXPECT_DEG) {
+        fprintf(stderr, "Head at %.1f, expected %.1f\n", rotation, expect);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
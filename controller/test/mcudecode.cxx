@@ -0,0 +1,314 @@
+/*
+ * mcudecode.cxx
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pty.h>
+#include <termios.h>
+#include <pthread.h>
+#include <vector>
+#include "../mcudecoder.hxx"
+
+/*
+ * Streams MCU frames through a pty, as the serial port of a Rabbit MCU
+ * would deliver them to Proximity, with faults injected on the way:
+ *
+ *   mcudecode [-n frames] [-s seed]
+ *
+ * Frames are dropped whole, lose a byte, get a bit flipped or are preceded
+ * by garbage with stray sync bytes in it. Both ends of the pty move the
+ * bytes in chunks of random sizes. The decoder has to return exactly the
+ * frames that made it through intact, in order and unaltered, count every
+ * other one as lost, and count the damaged frames it found as corrupt.
+ * The sequence numbers wrap around on the way.
+ */
+
+#define TEST_FRAMES          20000
+#define TEST_SEQ0            (65536 - 1000)
+#define TEST_DROP_PCT            3
+#define TEST_CUT_PCT             3
+#define TEST_FLIP_PCT            3
+#define TEST_GARBAGE_PCT         2
+#define TEST_GARBAGE_MAX        50
+#define TEST_CHUNK_MAX         200
+#define TEST_TIMEOUT_MS       2000
+
+using namespace std;
+
+struct stream {
+    int fd;
+    unsigned int seed;
+    vector<uint8_t> bytes;
+};
+
+static void make_frame(uint16_t seq, struct rabbit_frame *frame)
+{
+    unsigned int i;
+
+    memset(frame, 0, sizeof(*frame));
+    frame->sync[0] = RABBIT_FRAME_SYNC0;
+    frame->sync[1] = RABBIT_FRAME_SYNC1;
+    frame->version = RABBIT_FRAME_VERSION;
+    frame->len = sizeof(*frame);
+    frame->seq = seq;
+    frame->t_us = (uint32_t) seq * 5000;
+    frame->ir = (uint8_t) (seq & 0x0f);
+    for (i = 0; i < RABBIT_FRAME_US; i++) {
+        frame->us_mm[i] = (uint16_t) (seq + i);
+        frame->us_age_us[i] = (uint16_t) (seq * i);
+    }
+    frame->temp_c10 = (int16_t) (seq % 500);
+    frame->crc = rabbit_crc16((const uint8_t *) frame +
+                              RABBIT_FRAME_CRC_OFFSET,
+                              RABBIT_FRAME_CRC_LEN);
+}
+
+static void garbage(struct stream *s)
+{
+    unsigned int n, i;
+    uint8_t b;
+
+    n = 1 + rand_r(&s->seed) % TEST_GARBAGE_MAX;
+    for (i = 0; i < n; i++) {
+        switch (rand_r(&s->seed) % 4) {
+        case 0:
+            b = RABBIT_FRAME_SYNC0;
+            break;
+        case 1:
+            b = RABBIT_FRAME_SYNC1;
+            break;
+        default:
+            b = (uint8_t) rand_r(&s->seed);
+            break;
+        }
+        s->bytes.push_back(b);
+    }
+}
+
+/*
+ * Lay out the bytes to send and work out which frames should come out of
+ * the decoder and how many damaged ones it should notice.
+ */
+static void generate(struct stream *s, unsigned int n,
+                     vector<uint16_t> &intact, unsigned int *damaged)
+{
+    struct rabbit_frame frame;
+    uint8_t *b = (uint8_t *) &frame;
+    unsigned int i, fault, at;
+    uint16_t seq;
+
+    /* Start in the middle of a frame, as on opening the port */
+    make_frame(TEST_SEQ0 - 1, &frame);
+    s->bytes.insert(s->bytes.end(), b + sizeof(frame) / 2,
+                    b + sizeof(frame));
+
+    *damaged = 0;
+    for (i = 0; i < n; i++) {
+        seq = (uint16_t) (TEST_SEQ0 + i);
+        make_frame(seq, &frame);
+
+        /* The first and last frames make it, so every gap is counted */
+        fault = (i == 0 || i == n - 1) ? 100 : rand_r(&s->seed) % 100;
+        at = rand_r(&s->seed) % sizeof(frame);
+
+        if (fault < TEST_DROP_PCT) {
+            continue;
+        }
+
+        fault -= TEST_DROP_PCT;
+        if (fault < TEST_CUT_PCT) {
+            s->bytes.insert(s->bytes.end(), b, b + at);
+            s->bytes.insert(s->bytes.end(), b + at + 1, b + sizeof(frame));
+            if (at >= sizeof(frame.sync)) {
+                (*damaged)++;
+            }
+            continue;
+        }
+
+        fault -= TEST_CUT_PCT;
+        if (fault < TEST_FLIP_PCT) {
+            b[at] ^= (uint8_t) (1 << (rand_r(&s->seed) % 8));
+            s->bytes.insert(s->bytes.end(), b, b + sizeof(frame));
+            if (at >= sizeof(frame.sync)) {
+                (*damaged)++;
+            }
+            continue;
+        }
+
+        fault -= TEST_FLIP_PCT;
+        if (fault < TEST_GARBAGE_PCT) {
+            garbage(s);
+        }
+
+        s->bytes.insert(s->bytes.end(), b, b + sizeof(frame));
+        intact.push_back(seq);
+    }
+}
+
+static void *writer_func(void *arg)
+{
+    struct stream *s = (struct stream *) arg;
+    size_t off = 0, len;
+    ssize_t ret;
+
+    while (off < s->bytes.size()) {
+        len = 1 + rand_r(&s->seed) % TEST_CHUNK_MAX;
+        if (len > s->bytes.size() - off) {
+            len = s->bytes.size() - off;
+        }
+
+        ret = write(s->fd, &s->bytes[off], len);
+        if (ret < 0) {
+            break;
+        }
+        off += ret;
+    }
+
+    return NULL;
+}
+
+static bool open_pty(int *master, int *slave)
+{
+    struct termios tio;
+
+    if (openpty(master, slave, NULL, NULL, NULL) != 0) {
+        perror("openpty");
+        return false;
+    }
+
+    /* What Proximity does to the serial port of an MCU */
+    tcgetattr(*slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(*slave, TCSANOW, &tio);
+
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    struct stream s;
+    struct rabbit_frame frame, expect;
+    struct pollfd pfd;
+    vector<uint16_t> intact;
+    unsigned int n = TEST_FRAMES, damaged, decoded = 0, seed = 1;
+    uint8_t buf[TEST_CHUNK_MAX];
+    pthread_t writer;
+    MCUDecoder decoder;
+    ssize_t len;
+    int master, slave, opt;
+    bool ok = true;
+
+    while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+        switch (opt) {
+        case 'n':
+            n = atoi(optarg);
+            break;
+        case 's':
+            seed = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n frames] [-s seed]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (n < 2) {
+        n = 2;
+    }
+
+    s.seed = seed;
+    generate(&s, n, intact, &damaged);
+
+    if (!open_pty(&master, &slave)) {
+        return EXIT_FAILURE;
+    }
+
+    s.fd = master;
+    pthread_create(&writer, NULL, writer_func, &s);
+
+    pfd.fd = slave;
+    pfd.events = POLLIN;
+    while (ok && decoded < intact.size()) {
+        if (poll(&pfd, 1, TEST_TIMEOUT_MS) <= 0) {
+            fprintf(stderr, "Stalled after %u of %zu frames!\n",
+                    decoded, intact.size());
+            ok = false;
+            break;
+        }
+
+        len = read(slave, buf, 1 + rand_r(&seed) % sizeof(buf));
+        if (len <= 0) {
+            perror("read");
+            ok = false;
+            break;
+        }
+
+        decoder.feed(buf, (size_t) len);
+        while (decoder.next(&frame)) {
+            if (decoded >= intact.size()) {
+                fprintf(stderr, "Frame %u decoded from garbage!\n",
+                        frame.seq);
+                ok = false;
+                break;
+            }
+
+            make_frame(intact[decoded], &expect);
+            if (memcmp(&frame, &expect, sizeof(frame)) != 0) {
+                fprintf(stderr, "Frame %u decoded, expected %u intact!\n",
+                        frame.seq, intact[decoded]);
+                ok = false;
+                break;
+            }
+            decoded++;
+        }
+    }
+
+    /* Let the writer finish if the reading stopped early */
+    while (poll(&pfd, 1, 100) > 0 && read(slave, buf, sizeof(buf)) > 0) {
+        continue;
+    }
+
+    pthread_join(writer, NULL);
+    close(slave);
+    close(master);
+
+    printf("%u frames in %zu bytes, %u decoded, %u lost, %u corrupt, "
+           "%u damaged\n", n, s.bytes.size(), decoder.frames(),
+           decoder.lost(), decoder.corrupt(), damaged);
+
+    if (ok && decoder.frames() != intact.size()) {
+        fprintf(stderr, "%u frames counted, %zu intact!\n",
+                decoder.frames(), intact.size());
+        ok = false;
+    }
+
+    if (ok && decoder.lost() != n - intact.size()) {
+        fprintf(stderr, "%u frames counted lost, %zu were!\n",
+                decoder.lost(), n - intact.size());
+        ok = false;
+    }
+
+    if (ok && decoder.corrupt() < damaged) {
+        fprintf(stderr, "%u frames counted corrupt, %u were damaged!\n",
+                decoder.corrupt(), damaged);
+        ok = false;
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
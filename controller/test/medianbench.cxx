@@ -0,0 +1,245 @@
+/*
+ * medianbench.cxx
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include "../medianfilter.hxx"
+
+/*
+ * Checks MedianFilter against medians and means worked out by sorting a
+ * copy of the window, then times both ways of getting a median per
+ * sample, for windows of 1, 3, 5, 10 and 50:
+ *
+ *   medianbench [-n samples]
+ *
+ * The samples are random with many repeats, as the readings of a range
+ * sensor are, and the odd NaN that has to be left out. Each way is timed
+ * a few times and the best run is kept, as the others were interrupted.
+ * Up to a window of 5 the two are about even, and the filter has to come
+ * out ahead at BENCH_ROBOT_N, the window that Ambience filters with.
+ */
+
+#define BENCH_CHECK_SAMPLES    20000
+#define BENCH_TIME_SAMPLES    200000
+#define BENCH_NAN_EVERY           97
+#define BENCH_RUNS                 5
+#define BENCH_ROBOT_N             10
+
+using namespace std;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static void generate(vector<float> &samples, unsigned int n)
+{
+    unsigned int seed = 1, i;
+
+    samples.resize(n);
+    for (i = 0; i < n; i++) {
+        if (i % BENCH_NAN_EVERY == BENCH_NAN_EVERY - 1) {
+            samples[i] = NAN;
+        } else {
+            samples[i] = (float) (rand_r(&seed) % 200) * 10.0;
+        }
+    }
+}
+
+/*
+ * Median and mean of the last N samples, by sorting a copy of them.
+ */
+template <unsigned int N>
+class SortedWindow
+{
+
+public:
+
+    SortedWindow() : _count(0), _index(0) { }
+
+    void addSample(float s)
+    {
+        if (s != s) {
+            return;
+        }
+
+        _window[_index] = s;
+        _index = (_index + 1) % N;
+        if (_count < N) {
+            _count++;
+        }
+    }
+
+    float median(void) const
+    {
+        float sorted[N], v;
+        unsigned int i, j;
+
+        if (_count == 0) {
+            return 0.0;
+        }
+
+        for (i = 0; i < _count; i++) {
+            v = _window[i];
+            for (j = i; (j > 0) && (sorted[j - 1] > v); j--) {
+                sorted[j] = sorted[j - 1];
+            }
+            sorted[j] = v;
+        }
+
+        return sorted[_count / 2];
+    }
+
+    double average(void) const
+    {
+        double sum = 0.0;
+        unsigned int i;
+
+        if (_count == 0) {
+            return 0.0;
+        }
+
+        for (i = 0; i < _count; i++) {
+            sum += _window[i];
+        }
+
+        return sum / _count;
+    }
+
+private:
+
+    float _window[N];
+    unsigned int _count;
+    unsigned int _index;
+
+};
+
+template <unsigned int N>
+static bool check(const vector<float> &samples)
+{
+    MedianFilter<float, N> filter;
+    SortedWindow<N> reference;
+    size_t i;
+
+    for (i = 0; i < samples.size(); i++) {
+        filter.addSample(samples[i]);
+        reference.addSample(samples[i]);
+
+        if (filter.median() != reference.median()) {
+            fprintf(stderr, "N=%u sample %zu: median %.1f, expected %.1f\n",
+                    N, i, filter.median(), reference.median());
+            return false;
+        }
+
+        if (fabs(filter.average() - reference.average()) > 0.01) {
+            fprintf(stderr, "N=%u sample %zu: mean %.3f, expected %.3f\n",
+                    N, i, filter.average(), reference.average());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+template <typename F>
+static double time_ns(const vector<float> &samples)
+{
+    volatile float sink;
+    uint64_t t, best = 0;
+    unsigned int run;
+    size_t i;
+
+    for (run = 0; run < BENCH_RUNS; run++) {
+        F filter;
+
+        t = now_ns();
+        for (i = 0; i < samples.size(); i++) {
+            filter.addSample(samples[i]);
+            sink = filter.median();
+        }
+        t = now_ns() - t;
+        if (run == 0 || t < best) {
+            best = t;
+        }
+    }
+    (void)(sink);
+
+    return (double) best / samples.size();
+}
+
+template <unsigned int N>
+static bool bench(const vector<float> &checked, const vector<float> &timed)
+{
+    double filter_ns, sort_ns;
+
+    if (!check<N>(checked)) {
+        return false;
+    }
+
+    filter_ns = time_ns<MedianFilter<float, N> >(timed);
+    sort_ns = time_ns<SortedWindow<N> >(timed);
+
+    printf("%4u %12.1f %12.1f %8.1fx\n", N, filter_ns, sort_ns,
+           sort_ns / filter_ns);
+
+    if (N == BENCH_ROBOT_N && filter_ns > sort_ns) {
+        fprintf(stderr, "N=%u: filter slower than sorting!\n", N);
+        return false;
+    }
+
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    vector<float> checked, timed;
+    unsigned int n = BENCH_TIME_SAMPLES;
+    bool ok;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+        case 'n':
+            n = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n samples]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    generate(checked, BENCH_CHECK_SAMPLES);
+    generate(timed, n);
+
+    printf("   N    filter ns      sort ns  speedup\n");
+
+    ok = bench<1>(checked, timed) &&
+        bench<3>(checked, timed) &&
+        bench<5>(checked, timed) &&
+        bench<10>(checked, timed) &&
+        bench<50>(checked, timed);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,244 @@
+/*
+ * safetyreact.cxx
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "../rabbit.hxx"
+
+/*
+ * Drives Safety with simulated range sensors and a stand-in for Wheels:
+ *
+ *   1. A depth camera sees an obstacle closing in. Every frame is stamped
+ *      when it arrives and scanned for SIM_SCAN_US before it is reported.
+ *      The stop has to reach the wheels within SIM_BUDGET_US of the
+ *      arrival of the first frame under SIM_STOP_MM, and Safety has to
+ *      account the scan in its reaction time.
+ *   2. The three sources report random clearances from their own threads,
+ *      SIM_ROUNDS times. After every round, the limits the wheels are left
+ *      with have to be the ones Safety decided last, and every cut has to
+ *      be counted.
+ */
+
+#define SIM_STOP_MM          150.0   // SAFETY_STOP_MM
+#define SIM_FRAME_US          5000
+#define SIM_SCAN_US           2000
+#define SIM_BUDGET_US        20000
+#define SIM_ROUNDS             200
+#define SIM_REPORTS            100
+
+Proximity *proximity = NULL;
+Wheels *wheels = NULL;
+Safety *safety = NULL;
+Speech *speech = NULL;
+
+static pthread_mutex_t wheels_mutex = PTHREAD_MUTEX_INITIALIZER;
+static float wheels_fwd = 10000.0;
+static float wheels_bwd = 10000.0;
+static unsigned int wheels_cuts = 0;
+static uint64_t wheels_stop_us = 0;
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t) ts.tv_sec * 1000000ULL) + (ts.tv_nsec / 1000);
+}
+
+Wheels::Wheels()
+{
+
+}
+
+Wheels::~Wheels()
+{
+
+}
+
+/* The robot is always on the move, so any lower limit is a cut */
+bool Wheels::limitSpeed(float fwd, float bwd)
+{
+    bool cut;
+
+    pthread_mutex_lock(&wheels_mutex);
+    cut = (fwd < wheels_fwd) || (bwd < wheels_bwd);
+    if (cut) {
+        wheels_cuts++;
+    }
+    if (fwd == 0.0 && wheels_stop_us == 0) {
+        wheels_stop_us = now_us();
+    }
+    wheels_fwd = fwd;
+    wheels_bwd = bwd;
+    pthread_mutex_unlock(&wheels_mutex);
+
+    return cut;
+}
+
+unsigned int Proximity::subscribe(proximity_callback f, void *arg)
+{
+    (void)(f);
+    (void)(arg);
+
+    return 0;
+}
+
+void Proximity::unsubscribe(unsigned int id)
+{
+    (void)(id);
+}
+
+void Proximity::clearance(float *front_mm, float *rear_mm, uint64_t *us)
+{
+    *front_mm = NAN;
+    *rear_mm = NAN;
+    if (us) {
+        *us = 0;
+    }
+}
+
+void Speech::speak(const char *message, bool immediate)
+{
+    (void)(message);
+    (void)(immediate);
+}
+
+void logging_log(const char *message)
+{
+    (void)(message);
+}
+
+static void spin_us(unsigned int us)
+{
+    uint64_t until = now_us() + us;
+
+    while (now_us() < until) {
+        /* Scanning the frame */
+    }
+}
+
+static bool approach(void)
+{
+    uint64_t arrival, first_us = 0, reaction;
+    float d;
+
+    for (d = 1000.0; d >= 50.0; d -= 25.0) {
+        arrival = now_us();
+        if (d <= SIM_STOP_MM && first_us == 0) {
+            first_us = arrival;
+        }
+        spin_us(SIM_SCAN_US);
+        safety->report(SAFETY_DEPTH, d, NAN, arrival);
+        usleep(SIM_FRAME_US - SIM_SCAN_US);
+    }
+
+    if (wheels_stop_us == 0 || first_us == 0) {
+        fprintf(stderr, "Wheels never stopped!\n");
+        return false;
+    }
+
+    reaction = wheels_stop_us - first_us;
+    printf("approach: stopped %uus after the frame, "
+           "Safety max reaction %uus, %u cuts\n",
+           (unsigned int) reaction, safety->maxReactionUs(),
+           safety->interventions());
+
+    if (reaction > SIM_BUDGET_US) {
+        fprintf(stderr, "Reaction %uus over %uus!\n",
+                (unsigned int) reaction, SIM_BUDGET_US);
+        return false;
+    }
+
+    if (safety->maxReactionUs() < SIM_SCAN_US) {
+        fprintf(stderr, "Reaction %uus misses the %uus frame scan!\n",
+                safety->maxReactionUs(), SIM_SCAN_US);
+        return false;
+    }
+
+    return true;
+}
+
+static void *sensor_func(void *arg)
+{
+    static unsigned int seeds[SAFETY_SOURCES] = { 1, 2, 3, };
+    enum safety_source source = (enum safety_source) (long) arg;
+    unsigned int i;
+    float front, rear;
+
+    for (i = 0; i < SIM_REPORTS; i++) {
+        front = 150.0 + (float) (rand_r(&seeds[source]) % 400);
+        rear = 150.0 + (float) (rand_r(&seeds[source]) % 400);
+        safety->report(source, front, rear, now_us());
+    }
+
+    return NULL;
+}
+
+static bool contend(void)
+{
+    pthread_t threads[SAFETY_SOURCES];
+    unsigned int round;
+    long i;
+
+    for (round = 0; round < SIM_ROUNDS; round++) {
+        for (i = 0; i < SAFETY_SOURCES; i++) {
+            pthread_create(&threads[i], NULL, sensor_func, (void *) i);
+        }
+
+        for (i = 0; i < SAFETY_SOURCES; i++) {
+            pthread_join(threads[i], NULL);
+        }
+
+        if (safety->fwdLimit() != wheels_fwd ||
+            safety->bwdLimit() != wheels_bwd) {
+            fprintf(stderr, "Round %u: wheels at %.1f/%.1f, "
+                    "Safety decided %.1f/%.1f!\n", round,
+                    wheels_fwd, wheels_bwd,
+                    safety->fwdLimit(), safety->bwdLimit());
+            return false;
+        }
+
+        if (safety->interventions() != wheels_cuts) {
+            fprintf(stderr, "Round %u: %u cuts, %u accounted!\n", round,
+                    wheels_cuts, safety->interventions());
+            return false;
+        }
+    }
+
+    printf("contend: %u rounds, %u cuts\n", SIM_ROUNDS, wheels_cuts);
+
+    return true;
+}
+
+int main(void)
+{
+    bool ok;
+
+    wheels = new Wheels();
+    safety = new Safety();
+
+    ok = approach() && contend();
+
+    delete safety;
+    delete wheels;
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,259 @@
+/*
+ * ussched.cxx
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+extern "C" {
+#include "rabbit_mcu.h"
+}
+
+/*
+ * Runs the ultrasound scheduler of the MCU firmware against simulated
+ * HC-SR04s in a few scenes, polled as often as main.c polls it:
+ *
+ *   ussched [-t seconds]
+ *
+ * A sensor raises its echo line ~460us after the trigger and holds it for
+ * the round trip of its ping, or for ~38ms if it hears nothing. The state
+ * machine in ultrasound.pio gives up after the range of the firmware. No
+ * sensor may be fired while its echo line is high or while a sensor facing
+ * too close to it is listening or settling.
+ *
+ * The rates are compared with the 30ms round robin that the firmware had
+ * before, which lost every other turn of a sensor that heard nothing. The
+ * scheduler has to be at least twice as fast where there is something to
+ * echo within TEST_NEAR_MM all around, and no slower anywhere else, but
+ * for sensors next to an echo from beyond TEST_FAR_MM: the round robin was
+ * faster there only by firing into the echoes of the neighbours.
+ */
+
+#define TEST_SECONDS               10
+#define TEST_POLL_US              250   // US_SAMPLING_INTERVAL_US of main.c
+#define TEST_SLOT_US             5000   // Round robin of the old firmware
+#define TEST_RISE_US              460
+#define TEST_HOLD_US            38000
+#define TEST_MAX_MM              4000   // ULTRASOUND_MAX_MM of ultrasound.c
+#define TEST_TIMEOUT_US         (500 + TEST_MAX_MM * 2 * 1000 / 343)
+#define TEST_NEAR_MM              800
+#define TEST_NEAR_GAIN              2
+#define TEST_FAR_MM              2000
+
+static const int FACING[ULTRASOUND_DEVICES] = {
+    -75, -45, -15, 15, 45, 75,
+};
+
+struct scene {
+    const char *name;
+    unsigned int d_mm[ULTRASOUND_DEVICES];  // 0 if nothing echoes
+};
+
+static const struct scene SCENES[] = {
+    { "open space", { 0, 0, 0, 0, 0, 0, }, },
+    { "all at 0.3m", { 300, 300, 300, 300, 300, 300, }, },
+    { "all at 0.8m", { 800, 800, 800, 800, 800, 800, }, },
+    { "all at 2m", { 2000, 2000, 2000, 2000, 2000, 2000, }, },
+    { "all at 3.5m", { 3500, 3500, 3500, 3500, 3500, 3500, }, },
+    { "wall ahead", { 0, 0, 500, 500, 0, 0, }, },
+    { "corridor", { 400, 700, 0, 0, 700, 400, }, },
+    { "mixed", { 300, 2500, 0, 900, 600, 0, }, },
+};
+
+struct sensor {
+    bool pending;
+    uint32_t t_rise;
+    uint32_t t_fall;
+    uint32_t t_result;
+    unsigned int readings;
+};
+
+static bool echo_high(const struct sensor *s, uint32_t now)
+{
+    return now >= s->t_rise && now < s->t_fall;
+}
+
+static void fire(struct sensor *s, unsigned int d_mm, uint32_t now)
+{
+    uint32_t round_us;
+
+    s->t_rise = now + TEST_RISE_US;
+    if (d_mm == 0) {
+        s->t_fall = s->t_rise + TEST_HOLD_US;
+        s->t_result = now + TEST_TIMEOUT_US;
+    } else {
+        round_us = d_mm * 2 * 1000 / 343;
+        s->t_fall = s->t_rise + round_us;
+        s->t_result = s->t_fall < now + TEST_TIMEOUT_US ?
+            s->t_fall : now + TEST_TIMEOUT_US;
+    }
+    s->pending = true;
+}
+
+/* What ultrasound_poll() does with the scheduler, checking every firing */
+static bool run_sched(const struct scene *scene, unsigned int seconds,
+                      unsigned int *readings)
+{
+    struct ultrasound_sched sched;
+    struct sensor sensor[ULTRASOUND_DEVICES] = {};
+    uint32_t now, t_quiet[ULTRASOUND_DEVICES] = {};
+    unsigned int i, j, idle, fired;
+    bool ok = true;
+
+    ultrasound_sched_init(&sched, FACING);
+
+    for (now = TEST_POLL_US; now < seconds * 1000000; now += TEST_POLL_US) {
+        idle = 0;
+        for (i = 0; i < ULTRASOUND_DEVICES; i++) {
+            if (sensor[i].pending && now >= sensor[i].t_result) {
+                sensor[i].pending = false;
+                sensor[i].readings++;
+                t_quiet[i] = now + ULTRASOUND_SETTLE_US;
+                ultrasound_sched_done(&sched, i, now);
+            }
+            if (!echo_high(&sensor[i], now)) {
+                idle |= (1 << i);
+            }
+        }
+
+        fired = ultrasound_sched_fire(&sched, idle, now);
+        for (i = 0; i < ULTRASOUND_DEVICES; i++) {
+            if ((fired & (1 << i)) == 0) {
+                continue;
+            }
+
+            if (sensor[i].pending || echo_high(&sensor[i], now)) {
+                fprintf(stderr, "%s: US%u fired while busy at %uus!\n",
+                        scene->name, i, now);
+                ok = false;
+            }
+
+            for (j = 0; j < ULTRASOUND_DEVICES; j++) {
+                if (j == i ||
+                    abs(FACING[i] - FACING[j]) >=
+                    ULTRASOUND_MIN_SEPARATION_DEG) {
+                    continue;
+                }
+                if (sensor[j].pending || (fired & (1 << j)) ||
+                    now < t_quiet[j]) {
+                    fprintf(stderr, "%s: US%u fired over US%u at %uus!\n",
+                            scene->name, i, j, now);
+                    ok = false;
+                }
+            }
+
+            fire(&sensor[i], scene->d_mm[i], now);
+        }
+    }
+
+    for (i = 0; i < ULTRASOUND_DEVICES; i++) {
+        readings[i] = sensor[i].readings;
+    }
+
+    return ok;
+}
+
+/* The old firmware: one trigger every slot, ignored if the line is high */
+static void run_slots(const struct scene *scene, unsigned int seconds,
+                      unsigned int *readings)
+{
+    struct sensor sensor[ULTRASOUND_DEVICES] = {};
+    uint32_t now;
+    unsigned int i = 0;
+
+    for (now = TEST_SLOT_US; now < seconds * 1000000; now += TEST_SLOT_US) {
+        if (!echo_high(&sensor[i], now)) {
+            fire(&sensor[i], scene->d_mm[i], now);
+            sensor[i].readings++;
+        }
+        i = (i + 1) % ULTRASOUND_DEVICES;
+    }
+
+    for (i = 0; i < ULTRASOUND_DEVICES; i++) {
+        readings[i] = sensor[i].readings;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int seconds = TEST_SECONDS;
+    unsigned int sched[ULTRASOUND_DEVICES], slots[ULTRASOUND_DEVICES];
+    unsigned int s, i, j, near;
+    bool far, ok = true;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:")) != -1) {
+        switch (opt) {
+        case 't':
+            seconds = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-t seconds]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (seconds == 0) {
+        seconds = 1;
+    }
+
+    for (s = 0; s < sizeof(SCENES) / sizeof(SCENES[0]); s++) {
+        ok = run_sched(&SCENES[s], seconds, sched) && ok;
+        run_slots(&SCENES[s], seconds, slots);
+
+        near = 0;
+        for (i = 0; i < ULTRASOUND_DEVICES; i++) {
+            if (SCENES[s].d_mm[i] != 0 && SCENES[s].d_mm[i] <= TEST_NEAR_MM) {
+                near++;
+            }
+        }
+
+        printf("%-12s Hz:", SCENES[s].name);
+        for (i = 0; i < ULTRASOUND_DEVICES; i++) {
+            printf(" %4u (%2u)", sched[i] / seconds, slots[i] / seconds);
+        }
+        printf("\n");
+
+        for (i = 0; i < ULTRASOUND_DEVICES; i++) {
+            far = false;
+            for (j = 0; j < ULTRASOUND_DEVICES; j++) {
+                if (abs(FACING[i] - FACING[j]) <
+                    ULTRASOUND_MIN_SEPARATION_DEG &&
+                    SCENES[s].d_mm[j] > TEST_FAR_MM) {
+                    far = true;
+                }
+            }
+
+            if (!far && sched[i] < slots[i]) {
+                fprintf(stderr, "%s: US%u at %u Hz, slower than %u Hz!\n",
+                        SCENES[s].name, i, sched[i] / seconds,
+                        slots[i] / seconds);
+                ok = false;
+            }
+            if (near == ULTRASOUND_DEVICES &&
+                sched[i] < slots[i] * TEST_NEAR_GAIN) {
+                fprintf(stderr, "%s: US%u at %u Hz, not %ux %u Hz!\n",
+                        SCENES[s].name, i, sched[i] / seconds,
+                        TEST_NEAR_GAIN, slots[i] / seconds);
+                ok = false;
+            }
+        }
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
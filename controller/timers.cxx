@@ -0,0 +1,184 @@
+/*
+ * timers.cxx
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include "timers.hxx"
+
+using namespace std;
+
+static unsigned int instance = 0;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+Timers::Timers()
+    : _nextId(1),
+      _current(0)
+{
+    pthread_condattr_t attr;
+
+    if (instance != 0) {
+        fprintf(stderr, "Timers can be instantiated only once!\n");
+        exit(EXIT_FAILURE);
+    } else {
+        instance++;
+    }
+
+    /* Deadlines are monotonic, so wall clock steps don't fire timers */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+    _running = true;
+    pthread_mutex_init(&_mutex, NULL);
+    pthread_cond_init(&_cond, &attr);
+    pthread_cond_init(&_done, NULL);
+    pthread_condattr_destroy(&attr);
+    pthread_create(&_thread, NULL, Timers::thread_func, this);
+    pthread_setname_np(_thread, "R'Timers");
+
+    printf("Timers is online\n");
+}
+
+Timers::~Timers()
+{
+    pthread_mutex_lock(&_mutex);
+    _running = false;
+    pthread_cond_broadcast(&_cond);
+    pthread_mutex_unlock(&_mutex);
+    pthread_join(_thread, NULL);
+    pthread_mutex_destroy(&_mutex);
+    pthread_cond_destroy(&_cond);
+    pthread_cond_destroy(&_done);
+
+    instance--;
+    printf("Timers is offline\n");
+}
+
+unsigned int Timers::add(unsigned int ms, timer_func f, void *arg)
+{
+    struct timer_entry entry;
+    uint64_t deadline;
+    bool earliest;
+
+    deadline = now_ns() + ((uint64_t) ms * 1000000ULL);
+
+    pthread_mutex_lock(&_mutex);
+    entry.id = _nextId++;
+    if (_nextId == 0) {
+        _nextId = 1;  // 0 is never a valid id
+    }
+    entry.f = f;
+    entry.arg = arg;
+    earliest = _timers.empty() || (deadline < _timers.begin()->first);
+    _timers.insert(pair<uint64_t, struct timer_entry>(deadline, entry));
+    if (earliest) {
+        pthread_cond_signal(&_cond);
+    }
+    pthread_mutex_unlock(&_mutex);
+
+    return entry.id;
+}
+
+void Timers::cancel(unsigned int id, bool wait)
+{
+    multimap<uint64_t, struct timer_entry>::iterator it;
+
+    if (id == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&_mutex);
+    for (it = _timers.begin(); it != _timers.end(); it++) {
+        if (it->second.id == id) {
+            _timers.erase(it);
+            break;
+        }
+    }
+
+    /* Wait for the callback in flight, unless we are the one running it */
+    if (wait && !pthread_equal(pthread_self(), _thread)) {
+        while (_current == id) {
+            pthread_cond_wait(&_done, &_mutex);
+        }
+    }
+    pthread_mutex_unlock(&_mutex);
+}
+
+unsigned int Timers::pending(void) const
+{
+    unsigned int n;
+
+    pthread_mutex_lock(&_mutex);
+    n = _timers.size();
+    pthread_mutex_unlock(&_mutex);
+
+    return n;
+}
+
+void *Timers::thread_func(void *args)
+{
+    Timers *timers = (Timers *) args;
+
+    timers->run();
+
+    return NULL;
+}
+
+void Timers::run(void)
+{
+    struct timespec ts;
+    struct timer_entry entry;
+    uint64_t deadline;
+
+    pthread_mutex_lock(&_mutex);
+
+    while (_running) {
+        if (_timers.empty()) {
+            pthread_cond_wait(&_cond, &_mutex);
+            continue;
+        }
+
+        deadline = _timers.begin()->first;
+        if (deadline > now_ns()) {
+            ts.tv_sec = deadline / 1000000000ULL;
+            ts.tv_nsec = deadline % 1000000000ULL;
+            pthread_cond_timedwait(&_cond, &_mutex, &ts);
+            continue;
+        }
+
+        entry = _timers.begin()->second;
+        _timers.erase(_timers.begin());
+        _current = entry.id;
+        pthread_mutex_unlock(&_mutex);
+
+        entry.f(entry.id, entry.arg);
+
+        pthread_mutex_lock(&_mutex);
+        _current = 0;
+        pthread_cond_broadcast(&_done);
+    }
+
+    pthread_mutex_unlock(&_mutex);
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
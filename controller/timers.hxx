@@ -0,0 +1,65 @@
+/*
+ * timers.hxx
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#ifndef TIMERS_HXX
+#define TIMERS_HXX
+
+#include <stdint.h>
+#include <pthread.h>
+#include <map>
+
+/*
+ * One-shot timers shared by all modules. Callbacks are run on the timers
+ * thread and should only hand off work (e.g. set a flag and signal their
+ * own thread).
+ */
+typedef void (*timer_func)(unsigned int id, void *arg);
+
+struct timer_entry {
+    unsigned int id;
+    timer_func f;
+    void *arg;
+};
+
+class Timers {
+
+public:
+
+    Timers();
+    ~Timers();
+
+    unsigned int add(unsigned int ms, timer_func f, void *arg);
+    void cancel(unsigned int id, bool wait = false);
+    unsigned int pending(void) const;
+
+private:
+
+    static void *thread_func(void *);
+    void run(void);
+
+    std::multimap<uint64_t, struct timer_entry> _timers;
+    unsigned int _nextId;
+    unsigned int _current;
+
+    bool _running;
+    pthread_t _thread;
+    mutable pthread_mutex_t _mutex;
+    pthread_cond_t _cond;
+    pthread_cond_t _done;
+
+};
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -6,6 +6,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
 #include <pthread.h>
 #include <sys/time.h>
 #include <bsd/sys/time.h>
@@ -26,7 +29,15 @@
 #define USB_ENDPOINT_IN	         (LIBUSB_ENDPOINT_IN  | 0x01)
 #define USB_ENDPOINT_OUT         (LIBUSB_ENDPOINT_OUT | 0x01)
 #define USB_TIMEOUT              1000
-#define USB_POLL_INTERVAL_MS     100
+#define USB_POLL_INTERVAL_MS     100     // DOA and the detectors
+#define USB_STATUS_INTERVAL_MS   1000    // What the DSP estimates
+#define USB_TUNING_INTERVAL_MS   10000   // Parameters, should someone tune
+#define USB_REG_SIZE             8       // Value, and exponent of floats
+
+#define VOICE_BLOCK_US           (RABBIT_AUDIO_BLOCK * 1000000ULL / \
+                                  RABBIT_AUDIO_RATE)
+#define VOICE_LEVEL_PUBLISH      10      // Blocks, 10 Hz
+#define VOICE_VAD_STALE_US       (USB_POLL_INTERVAL_MS * 5000ULL)
 
 using namespace std;
 
@@ -38,14 +49,29 @@ struct respeaker_ctrl {
 
 static unsigned int instance = 0;
 
-Voice::Voice()
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t) ts.tv_sec * 1000000ULL) + (ts.tv_nsec / 1000);
+}
+
+Voice::Voice(const char *wav, const char *audioTcp)
     : _handle(NULL),
+      _wavPath(wav),
+      _wav(NULL),
+      _wavData(0),
+      _wavNext(0),
       _rate(AUDIO_PCM_INPUT_RATE),
       _enable(true),
       _usbctx(NULL),
       _usbdev(NULL),
-      _volHist(),
-      _volHistCur(0)
+      _meter(AUDIO_PCM_INPUT_RATE),
+      _levelTopic("voice/level"),
+      _propTopic("voice/prop"),
+      _audio(audioTcp)
 {
     if (instance != 0) {
         fprintf(stderr, "Voice can be instantiated only once!\n");
@@ -60,7 +86,7 @@ Voice::Voice()
     pthread_create(&_thread, NULL, Voice::thread_func, this);
     pthread_setname_np(_thread, "R'Voice");
     pthread_create(&_thread2, NULL, Voice::thread_func2, this);
-    pthread_setname_np(_thread, "R'Voice2");
+    pthread_setname_np(_thread2, "R'Voice2");
 
     printf("Voice is online\n");
 }
@@ -89,6 +115,11 @@ Voice::~Voice()
         _handle = NULL;
     }
 
+    if (_wav != NULL) {
+        fclose(_wav);
+        _wav = NULL;
+    }
+
     if (_usbdev) {
         libusb_close(_usbdev);
         _usbdev = NULL;
@@ -189,6 +220,114 @@ done:
     }
 }
 
+/*
+ * Open the --wav file, which must be 16 kHz mono S16_LE, and find its
+ * samples.
+ */
+bool Voice::openWav(void)
+{
+    struct {
+        char riff[4];
+        uint32_t size;
+        char wave[4];
+    } __attribute__((packed)) riff;
+    struct {
+        char id[4];
+        uint32_t size;
+    } __attribute__((packed)) chunk;
+    struct {
+        uint16_t type;
+        uint16_t chans;
+        uint32_t rate;
+        uint32_t byteRate;
+        uint16_t align;
+        uint16_t bits;
+    } __attribute__((packed)) fmt;
+    bool haveFmt = false;
+
+    _wav = fopen(_wavPath, "rb");
+    if (_wav == NULL) {
+        perror(_wavPath);
+        return false;
+    }
+
+    if ((fread(&riff, sizeof(riff), 1, _wav) != 1) ||
+        (memcmp(riff.riff, "RIFF", 4) != 0) ||
+        (memcmp(riff.wave, "WAVE", 4) != 0)) {
+        goto bad;
+    }
+
+    while (fread(&chunk, sizeof(chunk), 1, _wav) == 1) {
+        if (memcmp(chunk.id, "fmt ", 4) == 0) {
+            if ((chunk.size < sizeof(fmt)) ||
+                (fread(&fmt, sizeof(fmt), 1, _wav) != 1)) {
+                goto bad;
+            }
+            fseek(_wav, chunk.size - sizeof(fmt) + (chunk.size & 1),
+                  SEEK_CUR);
+            haveFmt = true;
+        } else if (memcmp(chunk.id, "data", 4) == 0) {
+            if (!haveFmt ||
+                (fmt.type != 1) ||
+                (fmt.chans != AUDIO_PCM_INPUT_CHANS) ||
+                (fmt.rate != AUDIO_PCM_INPUT_RATE) ||
+                (fmt.bits != 16)) {
+                fprintf(stderr, "%s is not 16 kHz mono S16_LE\n",
+                        _wavPath);
+                fclose(_wav);
+                _wav = NULL;
+                return false;
+            }
+            _wavData = ftell(_wav);
+            _wavNext = 0;
+            return true;
+        } else {
+            fseek(_wav, chunk.size + (chunk.size & 1), SEEK_CUR);
+        }
+    }
+
+bad:
+
+    fprintf(stderr, "%s is not a WAV file\n", _wavPath);
+    fclose(_wav);
+    _wav = NULL;
+
+    return false;
+}
+
+/*
+ * Stands in for the microphone: plays the --wav file over and over, in
+ * real time.
+ */
+int Voice::readWav(int16_t *pcm, unsigned int frames)
+{
+    struct timespec ts;
+    size_t n;
+
+    if ((_wav == NULL) && !openWav()) {
+        return -1;
+    }
+
+    if (_wavNext == 0) {
+        _wavNext = now_us();
+    }
+    _wavNext += frames * 1000000ULL / AUDIO_PCM_INPUT_RATE;
+    ts.tv_sec = _wavNext / 1000000;
+    ts.tv_nsec = (_wavNext % 1000000) * 1000;
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+    n = fread(pcm, sizeof(int16_t), frames, _wav);
+    if (n < frames) {
+        fseek(_wav, _wavData, SEEK_SET);
+        n += fread(pcm + n, sizeof(int16_t), frames - n, _wav);
+    }
+    if (n < frames) {
+        memset(pcm + n, 0, (frames - n) * sizeof(int16_t));
+    }
+
+    return frames;
+}
+
 void *Voice::thread_func(void *args)
 {
     Voice *voice = (Voice *) args;
@@ -198,27 +337,66 @@ void *Voice::thread_func(void *args)
     return NULL;
 }
 
+/*
+ * What the ReSpeaker's own detector, polled by run2(), last made of the
+ * sound around us, if it is recent enough to go with these samples.
+ */
+uint32_t Voice::vadFlags(uint64_t us) const
+{
+    struct prop prop;
+    uint64_t t;
+    uint32_t flags = 0;
+
+    if ((_usbdev == NULL) || !_propTopic.latest(&prop, &t) ||
+        (t + VOICE_VAD_STALE_US < us)) {
+        return 0;
+    }
+
+    flags |= RABBIT_AUDIO_VAD_KNOWN;
+    if (prop.VoiceActivity) {
+        flags |= RABBIT_AUDIO_VAD;
+    }
+    if (prop.SpeechDetected) {
+        flags |= RABBIT_AUDIO_SPEECH;
+    }
+
+    return flags;
+}
+
 void Voice::run(void)
 {
     int ret;
     struct timespec ts;
     unsigned int frames;
-    uint8_t *buf = NULL;
-    size_t bufsize;
-    unsigned int i;
-    const int16_t *pcm_sample;
-    int16_t max, min;
+    int16_t buf[RABBIT_AUDIO_BLOCK];
+    snd_pcm_sframes_t delay;
+    uint64_t us;
+    struct audio_level level;
+    unsigned int blocks = 0;
     bool on = !_enable;
 
-    frames = AUDIO_PCM_INPUT_RATE / VOL_HIST_SIZE;
-    bufsize = frames * (snd_pcm_format_width(AUDIO_PCM_INPUT_FORMAT) / 8) *
-        AUDIO_PCM_INPUT_CHANS;
-    buf = (uint8_t *) malloc(bufsize);
+    frames = RABBIT_AUDIO_BLOCK;
 
     while (_running) {
-        /* Probe and open audio input device */
-        probeOpenAudioDevice();
-        if (_handle == NULL) {
+        delay = 0;
+        if (_wavPath != NULL) {
+            ret = readWav(buf, frames);
+        } else {
+            /* Probe and open audio input device */
+            probeOpenAudioDevice();
+            if (_handle != NULL) {
+                /* Capture PCM data */
+                ret = snd_pcm_readi((snd_pcm_t *) _handle, buf, frames);
+                if ((ret == (int) frames) &&
+                    (snd_pcm_delay((snd_pcm_t *) _handle, &delay) != 0)) {
+                    delay = 0;
+                }
+            } else {
+                ret = -1;
+            }
+        }
+
+        if ((_handle == NULL) && (_wav == NULL)) {
             clock_gettime(CLOCK_REALTIME, &ts);
             ts.tv_sec += 1;
             pthread_mutex_lock(&_mutex);
@@ -227,22 +405,23 @@ void Voice::run(void)
             continue;
         }
 
-        /* Capture PCM data */
-        ret = snd_pcm_readi((snd_pcm_t *) _handle, buf, frames);
         if (ret != (int) frames) {
             fprintf(stderr, "Voice::run %s\n", snd_strerror(ret));
             snd_pcm_close((snd_pcm_t *) _handle);
             _handle = NULL;
-            memset(_volHist, 0x0, sizeof(_volHist));
-            _volHistCur = 0;
             on = false;
+            _audio.setEnabled(false);
             mosquitto->publish("rabbit/voice/state",
                                3, "off", 1, 0);
             continue;
         }
 
+        /* When the first of these samples was taken */
+        us = now_us() - ((frames + delay) * 1000000ULL / _rate);
+
         if (on != _enable) {
             on = _enable;
+            _audio.setEnabled(on);
             if (on) {
                 mosquitto->publish("rabbit/voice/state",
                                    2, "on", 1, 0);
@@ -258,33 +437,17 @@ void Voice::run(void)
             continue;
         }
 
-        /* Publish sampled data to MQTT */
-        mosquitto->publish("rabbit/voice/pcm",
-                           bufsize, buf, 2, 0);
-
-        /* Compute the maximum */
-        for (i = 0, pcm_sample = (const int16_t *) buf,
-                 max = SHRT_MIN, min = SHRT_MAX;
-             i < frames;
-             i++, pcm_sample++) {
-            if (*pcm_sample > max) {
-                max = *pcm_sample;
-            }
-            if (*pcm_sample < min) {
-                min = *pcm_sample;
-            }
-        }
-
-        /* Update histogram */
-        _volHist[_volHistCur].min = min;
-        _volHist[_volHistCur].max = max;
-        _volHistCur++;
-        _volHistCur %= volHistSize();
-    }
+        /* Hand the samples to the recognizers */
+        _audio.publish(buf, us, vadFlags(us));
 
-    if (buf) {
-        free(buf);
-        buf = NULL;
+        /* Meter the block */
+        _meter.measure(buf, frames, &level);
+        _levelTopic.publish(level, us);
+        if ((++blocks % VOICE_LEVEL_PUBLISH) == 0) {
+            /* Readings are soon stale, no need to confirm delivery */
+            mosquitto->publish("rabbit/voice/level",
+                               sizeof(float), &level.rmsDb, 0, 0);
+        }
     }
 }
 
@@ -323,36 +486,6 @@ done:
     }
 }
 
-uint32_t Voice::readUsbIntReg(unsigned int id, unsigned int offset)
-{
-    int ret;
-    uint16_t cmd;
-    uint32_t response = 0;
-
-    if (_usbdev == NULL) {
-        return response;
-    }
-
-    cmd = 0x80 | 0x40 | (uint8_t) offset;
-    ret = libusb_control_transfer(_usbdev,
-                                  LIBUSB_REQUEST_TYPE_VENDOR |
-                                  LIBUSB_ENDPOINT_IN,
-                                  0,
-                                  cmd,
-                                  (uint16_t) id,
-                                  (unsigned char *) &response,
-                                  sizeof(response),
-                                  USB_TIMEOUT);
-    if (ret < 0) {
-        fprintf(stderr, "libusb_control_transfer: %s\n",
-                libusb_strerror(ret));
-        libusb_close(_usbdev);
-        _usbdev = NULL;
-    }
-
-    return response;
-}
-
 void Voice::writeUsbIntReg(unsigned int id, unsigned int offset,
                            uint32_t value)
 {
@@ -416,36 +549,6 @@ void Voice::writeUsbFloatReg(unsigned int id, unsigned int offset,
     }
 }
 
-float Voice::readUsbFloatReg(unsigned int id, unsigned int offset)
-{
-    int ret;
-    uint16_t cmd;
-    int32_t response[2] = { 0, 0, };
-
-    if (_usbdev == NULL) {
-        return 0.0;
-    }
-
-    cmd = 0x80 | (uint8_t) offset;
-    ret = libusb_control_transfer(_usbdev,
-                                  LIBUSB_REQUEST_TYPE_VENDOR |
-                                  LIBUSB_ENDPOINT_IN,
-                                  0,
-                                  cmd,
-                                  (uint16_t) id,
-                                  (unsigned char *) response,
-                                  sizeof(response),
-                                  USB_TIMEOUT);
-    if (ret < 0) {
-        fprintf(stderr, "libusb_control_transfer: %s\n",
-                libusb_strerror(ret));
-        libusb_close(_usbdev);
-        _usbdev = NULL;
-    }
-
-    return ((float) response[0] * powf(2.0, (float) response[1]));
-}
-
 void Voice::setPixelRingTrace(void)
 {
     int ret;
@@ -776,27 +879,241 @@ void *Voice::thread_func2(void *args)
     return NULL;
 }
 
-struct respeaker_detection {
-    uint32_t AECPathChange;
-    float    RT60;
-    uint32_t AECSilenceMode;
-    uint32_t SpeechDetected;
-    uint32_t FSBUpdated;
-    uint32_t FSBPathChange;
-    uint32_t VoiceActivity;
-    uint32_t DOAAngle;
+/*
+ * The parameters of the DSP, after tuning.py of the ReSpeaker, grouped by
+ * how soon they change. The tuning is read when the device is opened and
+ * seldom after, the detectors on every poll.
+ */
+struct respeaker_param {
+    const char *name;
+    uint16_t id;
+    uint8_t offset;
+    bool isFloat;
+    unsigned int interval;        // ms
+    size_t field;                 // In struct Voice::prop
+};
+
+#define RESPEAKER_INT(name, id, offset, interval)                       \
+    { #name, id, offset, false, interval, offsetof(Voice::prop, name) }
+#define RESPEAKER_FLOAT(name, id, offset, interval)                     \
+    { #name, id, offset, true, interval, offsetof(Voice::prop, name) }
+
+static const struct respeaker_param respeaker_params[] = {
+    RESPEAKER_INT(AECFreezeOnOff, 18, 7, USB_TUNING_INTERVAL_MS),
+    RESPEAKER_FLOAT(AECNorm, 18, 19, USB_TUNING_INTERVAL_MS),
+    RESPEAKER_INT(AECPathChange, 18, 25, USB_STATUS_INTERVAL_MS),
+    RESPEAKER_FLOAT(RT60, 18, 26, USB_STATUS_INTERVAL_MS),
+    RESPEAKER_INT(HPFOnOff, 18, 27, USB_TUNING_INTERVAL_MS),
+    RESPEAKER_FLOAT(AECSilenceLevel, 18, 30, USB_TUNING_INTERVAL_MS),
+    RESPEAKER_INT(AECSilenceMode, 18, 31, USB_STATUS_INTERVAL_MS),
+    RESPEAKER_INT(AGCOnOff, 19, 0, USB_TUNING_INTERVAL_MS),
+    RESPEAKER_FLOAT(AGCMaxGain, 19, 1, USB_TUNING_INTERVAL_MS),
+    RESPEAKER_FLOAT(AGCDesiredLevel, 19, 2, USB_TUNING_INTERVAL_MS),
+    RESPEAKER_FLOAT(AGCGain, 19, 3, USB_STATUS_INTERVAL_MS),
+    RESPEAKER_FLOAT(AGCTime, 19, 4, USB_TUNING_INTERVAL_MS),
+    RESPEAKER_INT(CNIOnOff, 19, 5, USB_TUNING_INTERVAL_MS),
+    RESPEAKER_INT(FreezeOnOff, 19, 6, USB_TUNING_INTERVAL_MS),
+    RESPEAKER_INT(StatNoiseOnOff, 19, 8, USB_TUNING_INTERVAL_MS),
+    RESPEAKER_FLOAT(GammaNS, 19, 9, USB_TUNING_INTERVAL_MS),
+    RESPEAKER_FLOAT(MinNS, 19, 10, USB_TUNING_INTERVAL_MS),
+    RESPEAKER_INT(NonStatNoiseOnOff, 19, 11, USB_TUNING_INTERVAL_MS),
+    RESPEAKER_FLOAT(GamaNN, 19, 12, USB_TUNING_INTERVAL_MS),
+    RESPEAKER_FLOAT(MinNN, 19, 13, USB_TUNING_INTERVAL_MS),
+    RESPEAKER_INT(EchoOnOff, 19, 14, USB_TUNING_INTERVAL_MS),
+    RESPEAKER_FLOAT(GammaE, 19, 15, USB_TUNING_INTERVAL_MS),
+    RESPEAKER_FLOAT(GammaETail, 19, 16, USB_TUNING_INTERVAL_MS),
+    RESPEAKER_FLOAT(GammaENL, 19, 17, USB_TUNING_INTERVAL_MS),
+    RESPEAKER_INT(NLAttenOnOff, 19, 18, USB_TUNING_INTERVAL_MS),
+    RESPEAKER_INT(NLAECMode, 19, 20, USB_TUNING_INTERVAL_MS),
+    RESPEAKER_INT(SpeechDetected, 19, 22, USB_POLL_INTERVAL_MS),
+    RESPEAKER_INT(FSBUpdated, 19, 23, USB_STATUS_INTERVAL_MS),
+    RESPEAKER_INT(FSBPathChange, 19, 24, USB_STATUS_INTERVAL_MS),
+    RESPEAKER_INT(TransientOnOff, 19, 29, USB_TUNING_INTERVAL_MS),
+    RESPEAKER_INT(VoiceActivity, 19, 32, USB_POLL_INTERVAL_MS),
+    RESPEAKER_INT(StatNoiseOnOffSR, 19, 33, USB_TUNING_INTERVAL_MS),
+    RESPEAKER_INT(NonStatNoiseOnOffSR, 19, 34, USB_TUNING_INTERVAL_MS),
+    RESPEAKER_FLOAT(GammaNSSR, 19, 35, USB_TUNING_INTERVAL_MS),
+    RESPEAKER_FLOAT(GammaNNSR, 19, 36, USB_TUNING_INTERVAL_MS),
+    RESPEAKER_FLOAT(MinNSSR, 19, 37, USB_TUNING_INTERVAL_MS),
+    RESPEAKER_FLOAT(MinNNSR, 19, 38, USB_TUNING_INTERVAL_MS),
+    RESPEAKER_FLOAT(GammaVADSR, 19, 39, USB_TUNING_INTERVAL_MS),
+    RESPEAKER_INT(DOAAngle, 21, 0, USB_POLL_INTERVAL_MS),
+};
+
+#define RESPEAKER_PARAMS \
+    (sizeof(respeaker_params) / sizeof(respeaker_params[0]))
+
+struct respeaker_poll {
+    const struct respeaker_param *param;
+    struct libusb_transfer *xfer;
+    unsigned char buf[LIBUSB_CONTROL_SETUP_SIZE + USB_REG_SIZE];
+    uint64_t due;                 // us
+    bool queued;                  // In this poll
+    bool busy;
+    bool valid;
+    int32_t raw[2];
 };
 
+static void LIBUSB_CALL respeaker_poll_done(struct libusb_transfer *xfer)
+{
+    struct respeaker_poll *poll = (struct respeaker_poll *) xfer->user_data;
+
+    poll->busy = false;
+}
+
+/*
+ * Reads all the registers that are due at once, as asynchronous control
+ * transfers queued back to back, and stores them into _prop. The names
+ * and values of those that changed since they were last read are added
+ * to changes. The device is closed on failure.
+ */
+bool Voice::pollUsbRegs(struct respeaker_poll *polls, unsigned int n,
+                        uint64_t now, string &changes)
+{
+    struct respeaker_poll *poll;
+    struct timeval tv;
+    unsigned int i, busy = 0;
+    uint32_t value;
+    int32_t raw[2];
+    float f;
+    int ret = 0;
+
+    if (_usbdev == NULL) {
+        return false;
+    }
+
+    for (i = 0; i < n; i++) {
+        poll = &polls[i];
+        if (poll->valid && (poll->due > now)) {
+            continue;
+        }
+
+        /* Bit 7 reads, bit 6 says an int */
+        libusb_fill_control_setup(poll->buf,
+                                  LIBUSB_REQUEST_TYPE_VENDOR |
+                                  LIBUSB_ENDPOINT_IN,
+                                  0,
+                                  0x80 | (poll->param->isFloat ? 0 : 0x40) |
+                                  poll->param->offset,
+                                  poll->param->id,
+                                  USB_REG_SIZE);
+        libusb_fill_control_transfer(poll->xfer, _usbdev, poll->buf,
+                                     respeaker_poll_done, poll,
+                                     USB_TIMEOUT);
+        ret = libusb_submit_transfer(poll->xfer);
+        if (ret < 0) {
+            break;
+        }
+
+        poll->queued = true;
+        poll->busy = true;
+        busy++;
+    }
+
+    if (ret < 0) {
+        for (i = 0; i < n; i++) {
+            if (polls[i].busy) {
+                libusb_cancel_transfer(polls[i].xfer);
+            }
+        }
+    }
+
+    while (busy > 0) {
+        tv.tv_sec = 0;
+        tv.tv_usec = USB_POLL_INTERVAL_MS * 1000;
+        libusb_handle_events_timeout_completed(_usbctx, &tv, NULL);
+        for (i = 0, busy = 0; i < n; i++) {
+            busy += polls[i].busy ? 1 : 0;
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        poll = &polls[i];
+        if (!poll->queued) {
+            continue;
+        }
+
+        poll->queued = false;
+        if ((poll->xfer->status != LIBUSB_TRANSFER_COMPLETED) ||
+            (poll->xfer->actual_length < USB_REG_SIZE)) {
+            if (ret == 0) {
+                ret = poll->xfer->status == LIBUSB_TRANSFER_NO_DEVICE ?
+                    LIBUSB_ERROR_NO_DEVICE : LIBUSB_ERROR_IO;
+            }
+            continue;
+        }
+
+        memcpy(raw, libusb_control_transfer_get_data(poll->xfer),
+               sizeof(raw));
+        poll->due = now + poll->param->interval * 1000ULL;
+        if (poll->valid && (poll->raw[0] == raw[0]) &&
+            (poll->raw[1] == raw[1])) {
+            continue;
+        }
+
+        poll->raw[0] = raw[0];
+        poll->raw[1] = raw[1];
+        poll->valid = true;
+
+        if (!changes.empty()) {
+            changes += ",";
+        }
+        changes += poll->param->name;
+        changes += "=";
+        if (poll->param->isFloat) {
+            f = (float) raw[0] * powf(2.0, (float) raw[1]);
+            memcpy((char *) &_prop + poll->param->field, &f, sizeof(f));
+            changes += to_string(f);
+        } else {
+            value = (uint32_t) raw[0];
+            if (poll->param->field == offsetof(Voice::prop, DOAAngle)) {
+                /* Correct/adjust DOAAngle */
+                value = 360 - (value % 360);
+                value += 90;
+                value %= 360;
+            }
+            memcpy((char *) &_prop + poll->param->field, &value,
+                   sizeof(value));
+            changes += to_string(value);
+        }
+    }
+
+    if (ret < 0) {
+        fprintf(stderr, "libusb control transfer: %s\n",
+                libusb_strerror(ret));
+        libusb_close(_usbdev);
+        _usbdev = NULL;
+        for (i = 0; i < n; i++) {
+            polls[i].valid = false;
+        }
+        return false;
+    }
+
+    return true;
+}
+
 void Voice::run2(void)
 {
     struct timespec ts, tloop;
-    struct respeaker_detection det;
+    struct respeaker_poll polls[RESPEAKER_PARAMS];
+    uint32_t speechDetected = 0, doaAngle = 0;
     bool pixelRingEnable = false;
+    bool polled;
+    unsigned int i;
+    string changes;
 
-    tloop.tv_sec = USB_POLL_INTERVAL_MS / 1000000000;
-    tloop.tv_nsec = USB_POLL_INTERVAL_MS / 1000000;
+    tloop.tv_sec = USB_POLL_INTERVAL_MS / 1000;
+    tloop.tv_nsec = (USB_POLL_INTERVAL_MS % 1000) * 1000000;
 
-    bzero(&det, sizeof(det));
+    bzero(polls, sizeof(polls));
+    for (i = 0; i < RESPEAKER_PARAMS; i++) {
+        polls[i].param = &respeaker_params[i];
+        polls[i].xfer = libusb_alloc_transfer(0);
+        if (polls[i].xfer == NULL) {
+            fprintf(stderr, "libusb_alloc_transfer failed\n");
+            goto done;
+        }
+    }
 
     while (_running) {
         /* Probe and open USB device */
@@ -821,81 +1138,29 @@ void Voice::run2(void)
             pixelRingEnable = _enable;
         }
 
-        _prop.AECFreezeOnOff = readUsbIntReg(18, 7);
-        _prop.AECNorm = readUsbFloatReg(18, 19);
-        _prop.AECPathChange = readUsbIntReg(18, 25);
-        _prop.RT60 = readUsbFloatReg(18, 26);
-        _prop.HPFOnOff = readUsbIntReg(18, 27);
-        _prop.AECSilenceLevel = readUsbFloatReg(18, 30);
-        _prop.AECSilenceMode = readUsbIntReg(18, 31);
-        _prop.AGCOnOff = readUsbIntReg(19, 0);
-        _prop.AGCMaxGain = readUsbFloatReg(19, 1);
-        _prop.AGCDesiredLevel = readUsbFloatReg(19, 2);
-        _prop.AGCGain = readUsbFloatReg(19, 3);
-        _prop.AGCTime = readUsbFloatReg(19, 4);
-        _prop.CNIOnOff = readUsbIntReg(19, 5);
-        _prop.FreezeOnOff = readUsbIntReg(19, 6);
-        _prop.StatNoiseOnOff = readUsbIntReg(19, 8);
-        _prop.GammaNS = readUsbFloatReg(19, 9);
-        _prop.MinNS = readUsbFloatReg(19, 10);
-        _prop.NonStatNoiseOnOff = readUsbIntReg(19, 11);
-        _prop.GamaNN = readUsbFloatReg(19, 12);
-        _prop.MinNN = readUsbFloatReg(19, 13);
-        _prop.EchoOnOff = readUsbIntReg(19, 14);
-        _prop.GammaE = readUsbFloatReg(19, 15);
-        _prop.GammaETail = readUsbFloatReg(19, 16);
-        _prop.GammaENL = readUsbFloatReg(19, 17);
-        _prop.NLAttenOnOff = readUsbIntReg(19, 18);
-        _prop.NLAECMode = readUsbIntReg(19, 20);
-        _prop.SpeechDetected = readUsbIntReg(19, 22);
-        _prop.FSBUpdated = readUsbIntReg(19, 23);
-        _prop.FSBPathChange = readUsbIntReg(19, 24);
-        _prop.TransientOnOff = readUsbIntReg(19, 29);
-        _prop.VoiceActivity = readUsbIntReg(19, 32);
-        _prop.StatNoiseOnOffSR = readUsbIntReg(19, 33);
-        _prop.NonStatNoiseOnOffSR = readUsbIntReg(19, 34);
-        _prop.GammaNSSR = readUsbFloatReg(19, 35);
-        _prop.GammaNNSR = readUsbFloatReg(19, 36);
-        _prop.MinNSSR = readUsbFloatReg(19, 37);
-        _prop.MinNNSR = readUsbFloatReg(19, 38);
-        _prop.GammaVADSR = readUsbFloatReg(19, 39);
-        _prop.DOAAngle = readUsbIntReg(21, 0);
-
-        /* Correct/adjust DOAAngle */
-        _prop.DOAAngle = 360 - _prop.DOAAngle;
-        _prop.DOAAngle += 90;
-        _prop.DOAAngle %= 360;
-
-        if ((det.SpeechDetected != _prop.SpeechDetected) ||
-            (det.VoiceActivity != _prop.VoiceActivity)) {
-            string s;
-            s += "AECPathChange=";
-            s += _prop.AECPathChange ? "1" : "0";
-            s += ",RT60=";
-            s += to_string(_prop.RT60);
-            s += ",AECSilenceMode=";
-            s += _prop.AECSilenceMode ? "1" : "0";
-            s += ",SpeechDetected=";
-            s += _prop.SpeechDetected ? "1" : "0";
-            s += ",FSBUpdated=";
-            s += _prop.FSBUpdated ? "1" : "0";
-            s += ",VoiceActivity=";
-            s += _prop.VoiceActivity ? "1" : "0";
-            s += ",DOAAngle=";
-            s += to_string(_prop.DOAAngle);
+        changes.clear();
+        polled = pollUsbRegs(polls, RESPEAKER_PARAMS, now_us(), changes);
+        if (polled) {
+            _propTopic.publish(_prop);
+        }
+
+        if (!changes.empty()) {
             mosquitto->publish("rabbit/voice/change",
-                               s.length(), s.c_str(),
+                               changes.length(), changes.c_str(),
                                1, 0);
         }
 
-        det.AECPathChange = _prop.AECPathChange;
-        det.RT60 = _prop.RT60;
-        det.AECSilenceMode = _prop.AECSilenceMode;
-        det.SpeechDetected = _prop.SpeechDetected;
-        det.FSBUpdated = _prop.FSBUpdated;
-        det.FSBPathChange = _prop.FSBPathChange;
-        det.VoiceActivity = _prop.VoiceActivity;
-        det.DOAAngle = _prop.DOAAngle;
+        /* Every reading while speech goes on, for the head's DOA filter */
+        if (polled &&
+            (_prop.SpeechDetected ||
+             (speechDetected != _prop.SpeechDetected) ||
+             (doaAngle != _prop.DOAAngle)) &&
+            (head != NULL)) {
+            head->notifyVoice(_prop.DOAAngle, _prop.SpeechDetected);
+        }
+
+        speechDetected = _prop.SpeechDetected;
+        doaAngle = _prop.DOAAngle;
 
         clock_gettime(CLOCK_REALTIME, &ts);
         timespecadd(&ts, &tloop, &ts);
@@ -903,6 +1168,14 @@ void Voice::run2(void)
         pthread_cond_timedwait(&_cond, &_mutex, &ts);
         pthread_mutex_unlock(&_mutex);
     }
+
+done:
+
+    for (i = 0; i < RESPEAKER_PARAMS; i++) {
+        if (polls[i].xfer != NULL) {
+            libusb_free_transfer(polls[i].xfer);
+        }
+    }
 }
 
 void Voice::enable(bool en)
@@ -914,24 +1187,52 @@ void Voice::enable(bool en)
     }
 }
 
+/*
+ * The min and max of the blocks captured in the last VOL_HIST_SIZE block
+ * times, oldest first.
+ */
 unsigned int Voice::getVolHist(struct vol_hist_point *hist,
                                unsigned int points) const
 {
-    unsigned int i;
-    unsigned int cur;
+    struct audio_level levels[VOL_HIST_SIZE];
+    uint64_t us[VOL_HIST_SIZE], now, since;
+    unsigned int i, n, first;
 
     if (hist == NULL) {
         return 0;
     }
 
-    for (i = 0, cur = _volHistCur;
-         (i < volHistSize()) && (i < points);
-         i++, cur = ((cur + 1) % volHistSize())) {
-        hist[i].min = _volHist[cur].min;
-        hist[i].max = _volHist[cur].max;
+    if (points > volHistSize()) {
+        points = volHistSize();
+    }
+
+    n = _levelTopic.history(levels, us, points);
+
+    now = now_us();
+    since = now > volHistSize() * VOICE_BLOCK_US ?
+        now - volHistSize() * VOICE_BLOCK_US : 0;
+    for (first = 0; (first < n) && (us[first] < since); first++);
+
+    for (i = first; i < n; i++) {
+        hist[i - first].min = levels[i].min;
+        hist[i - first].max = levels[i].max;
+    }
+
+    return n - first;
+}
+
+/*
+ * The levels of the block last captured, if capture is running.
+ */
+bool Voice::getLevel(struct audio_level *level) const
+{
+    uint64_t us;
+
+    if (!_levelTopic.latest(level, &us)) {
+        return false;
     }
 
-    return i;
+    return now_us() - us < 10 * VOICE_BLOCK_US;
 }
 
 /*
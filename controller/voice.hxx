@@ -7,10 +7,17 @@
 #ifndef VOICE_HXX
 #define VOICE_HXX
 
+#include <stdio.h>
+#include <string>
+#include "samplebus.hxx"
+#include "audioring.hxx"
+#include "audiometer.hxx"
+
 #define VOL_HIST_SIZE 100
 
 struct libusb_context;
 struct libusb_device_handle;
+struct respeaker_poll;
 
 struct vol_hist_point {
     int16_t min;
@@ -65,7 +72,7 @@ public:
 
 public:
 
-    Voice();
+    Voice(const char *wav = NULL, const char *audioTcp = NULL);
     ~Voice();
 
     void enable(bool en);
@@ -75,18 +82,24 @@ public:
     size_t volHistSize(void) const;
     unsigned int getVolHist(struct vol_hist_point *hist,
                             unsigned int points) const;
+    bool getLevel(struct audio_level *level) const;
+    SampleTopic<struct audio_level> &levelTopic(void);
 
     const Voice::prop &getProp(void) const;
+    SampleTopic<struct Voice::prop> &propTopic(void);
 
 private:
 
     void probeOpenAudioDevice(void);
+    bool openWav(void);
+    int readWav(int16_t *pcm, unsigned int frames);
+    uint32_t vadFlags(uint64_t us) const;
     static void *thread_func(void *args);
     void run(void);
 
     void probeOpenUSBDevice(void);
-    uint32_t readUsbIntReg(unsigned int id, unsigned int offset);
-    float readUsbFloatReg(unsigned int id, unsigned int offset);
+    bool pollUsbRegs(struct respeaker_poll *polls, unsigned int n,
+                     uint64_t now, std::string &changes);
     void writeUsbIntReg(unsigned int id, unsigned int offset,
                         uint32_t value);
     void writeUsbFloatReg(unsigned int id, unsigned int offset,
@@ -113,15 +126,21 @@ private:
     void run2(void);
 
     void *_handle;
+    const char *_wavPath;
+    FILE *_wav;
+    long _wavData;
+    uint64_t _wavNext;
     unsigned int _rate;
     bool _enable;
     libusb_context *_usbctx;
     libusb_device_handle *_usbdev;
 
-    struct vol_hist_point _volHist[VOL_HIST_SIZE];
-    unsigned int _volHistCur;
+    AudioMeter _meter;                 // Capture thread only
+    SampleTopic<struct audio_level> _levelTopic;
 
     struct prop _prop;
+    SampleTopic<struct prop> _propTopic;
+    AudioRing _audio;
 
     bool _running;
     pthread_t _thread;
@@ -138,7 +157,7 @@ inline bool Voice::isEnabled(void) const
 
 inline bool Voice::isOnline(void) const
 {
-    return _handle != NULL;
+    return (_handle != NULL) || (_wav != NULL);
 }
 
 inline size_t Voice::volHistSize(void) const
@@ -146,11 +165,21 @@ inline size_t Voice::volHistSize(void) const
     return VOL_HIST_SIZE;
 }
 
+inline SampleTopic<struct audio_level> &Voice::levelTopic(void)
+{
+    return _levelTopic;
+}
+
 inline const Voice::prop &Voice::getProp(void) const
 {
     return _prop;
 }
 
+inline SampleTopic<struct Voice::prop> &Voice::propTopic(void)
+{
+    return _propTopic;
+}
+
 #endif
 
 /*
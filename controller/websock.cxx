@@ -4,6 +4,7 @@
  * Copyright (C) 2023, Charles Chiou
  */
 
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -59,8 +60,22 @@ static void onclose(ws_cli_conn_t *client)
 static void onmessage(ws_cli_conn_t *client,
                       const unsigned char *msg, uint64_t size, int type)
 {
+    char buf[64];
+    float v, w;
+
     (void)(client);
-    (void)(type);
+
+    /* Streamed wheel command: "drive <mm/s> <deg/s>" */
+    if (type == WS_FR_OP_TXT && size < sizeof(buf) &&
+        strncmp((const char *) msg, "drive ", 6) == 0) {
+        memcpy(buf, msg, size);
+        buf[size] = '\0';
+        if (sscanf(buf, "drive %f %f", &v, &w) == 2 &&
+            !isnan(v) && !isnan(w)) {
+            wheels->command(v, w);
+        }
+        return;
+    }
 
     while (size > 0) {
         if (*msg != 'q' && *msg != 'Q') {
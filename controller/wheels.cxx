@@ -4,6 +4,7 @@
  * Copyright (C) 2023, Charles Chiou
  */
 
+#include <math.h>
 #include <sys/time.h>
 #include <bsd/sys/time.h>
 #include <iostream>
@@ -36,23 +37,97 @@
 #define L298N_IN3 17
 #define L298N_IN4 27
 
-using namespace std;
+/*
+ * Encoder SIG lines of the wheel modules.
+ */
+#define RHS_ENCODER_GPIO    5
+#define LHS_ENCODER_GPIO    6
+
+/*
+ * Drive geometry, the encoders give ENCODER_COUNTS_PER_REV rising edges per
+ * wheel revolution.
+ */
+#define WHEEL_DIAMETER_MM          72.0
+#define WHEEL_BASE_MM             235.0
+#define ENCODER_COUNTS_PER_REV    508.8
+#define WHEEL_MM_PER_TICK         (M_PI * WHEEL_DIAMETER_MM /    \
+                                   ENCODER_COUNTS_PER_REV)
+
+/*
+ * Velocity control. The feed-forward maps speed to power (75% is about
+ * cruise speed, nothing moves below the minimum), the PI terms correct
+ * for load and battery voltage.
+ */
+#define WHEEL_CONTROL_MS           20
+#define WHEEL_CRUISE_MMPS         300.0
+#define WHEEL_SPIN_MMPS           200.0
+#define WHEEL_MIN_MMPS             40.0
+#define WHEEL_TOP_MMPS            450.0
+#define WHEEL_ACCEL_MMPS2         600.0
+#define WHEEL_DECEL_MMPS2        1500.0
+#define WHEEL_ANG_ACCEL_DPS2      360.0
+#define WHEEL_ANG_DECEL_DPS2      900.0
+#define WHEEL_MIN_PCT              30.0
+#define WHEEL_FF_PCT_PER_MMPS      0.15
+#define WHEEL_KP                   0.05
+#define WHEEL_KI                   0.20
+#define WHEEL_I_LIMIT             100.0
+#define WHEEL_ENCODER_TIMEOUT_MS  500
+#define WHEEL_NO_LIMIT_MMPS     10000.0
+
+/*
+ * Streamed commands stop the wheels unless renewed within this time.
+ */
+#define WHEEL_DEADMAN_MS          300
+
+#define DEG2RAD(x)  ((x) * M_PI / 180.0)
+#define RAD2DEG(x)  ((x) * 180.0 / M_PI)
 
-static const char *state_string[10] = {
-    "halt",
-    "fwd",
-    "bwd",
-    "ror",
-    "rol",
-    "fwr",
-    "fwl",
-    "bwr",
-    "bwl",
-    "unknown",
+enum {
+    RHS = 0,
+    LHS = 1,
 };
 
+using namespace std;
+
 static unsigned int instance = 0;
 
+/*
+ * Move a reference towards a command, decelerating harder than we
+ * accelerate.
+ */
+static void ramp(float *ref, float cmd, float accel, float decel, float dt)
+{
+    float step;
+
+    if (fabsf(cmd) < fabsf(*ref) || cmd * *ref < 0.0) {
+        step = decel * dt;
+    } else {
+        step = accel * dt;
+    }
+
+    if (cmd > *ref + step) {
+        *ref += step;
+    } else if (cmd < *ref - step) {
+        *ref -= step;
+    } else {
+        *ref = cmd;
+    }
+}
+
+/*
+ * Power needed to hold a wheel speed, nothing moves below the minimum.
+ */
+static float feed_forward(float target)
+{
+    if (target == 0.0) {
+        return 0.0;
+    }
+
+    return copysignf(WHEEL_MIN_PCT + fabsf(target) * WHEEL_FF_PCT_PER_MMPS,
+                     target);
+}
+
 Wheels::Wheels()
 {
     if (instance != 0) {
@@ -77,20 +152,35 @@ Wheels::Wheels()
     servos->setRange(LHS_SPEED_SERVO, LHS_SPEED_LO_PULSE, LHS_SPEED_HI_PULSE);
     servos->setPct(LHS_SPEED_SERVO, 0);
 
-    _state = 0;
-    _rpwr = 0;
-    _rpwrTarget = 0;
-    _lpwr = 0;
-    _lpwrTarget = 0;
-
-    _fwd_ms = 0;
-    _bwd_ms = 0;
-    _ror_ms = 0;
-    _rol_ms = 0;
-    _fwr_ms = 0;
-    _fwl_ms = 0;
-    _bwr_ms = 0;
-    _bwl_ms = 0;
+    bzero(_wheel, sizeof(_wheel));
+    _wheel[RHS].dir = 1;
+    _wheel[RHS].encoderOk = true;
+    _wheel[LHS].dir = 1;
+    _wheel[LHS].encoderOk = true;
+    _cmdV = 0.0;
+    _cmdW = 0.0;
+    _refV = 0.0;
+    _refW = 0.0;
+    _moving = false;
+    _x = 0.0;
+    _y = 0.0;
+    _theta = 0.0;
+    _v = 0.0;
+    _w = 0.0;
+    _goal = GOAL_NONE;
+    _goalRemaining = 0.0;
+    _goalSign = 1.0;
+    _fwdLimit = WHEEL_NO_LIMIT_MMPS;
+    _bwdLimit = WHEEL_NO_LIMIT_MMPS;
+    _limited = false;
+    timerclear(&_expire);
+
+    gpioSetMode(RHS_ENCODER_GPIO, PI_INPUT);
+    gpioSetPullUpDown(RHS_ENCODER_GPIO, PI_PUD_UP);
+    gpioSetAlertFuncEx(RHS_ENCODER_GPIO, Wheels::encoder_alert, this);
+    gpioSetMode(LHS_ENCODER_GPIO, PI_INPUT);
+    gpioSetPullUpDown(LHS_ENCODER_GPIO, PI_PUD_UP);
+    gpioSetAlertFuncEx(LHS_ENCODER_GPIO, Wheels::encoder_alert, this);
 
     _running = true;
     pthread_mutex_init(&_mutex, NULL);
@@ -103,9 +193,7 @@ Wheels::Wheels()
 
 Wheels::~Wheels()
 {
-    if (_state != 0) {
-        halt();
-    }
+    halt();
 
     _running = false;
     pthread_cond_broadcast(&_cond);
@@ -113,6 +201,11 @@ Wheels::~Wheels()
     pthread_mutex_destroy(&_mutex);
     pthread_cond_destroy(&_cond);
 
+    gpioSetAlertFuncEx(RHS_ENCODER_GPIO, NULL, NULL);
+    gpioSetAlertFuncEx(LHS_ENCODER_GPIO, NULL, NULL);
+    output(RHS, 0.0);
+    output(LHS, 0.0);
+
     instance--;
     printf("Wheels is offline\n");
 }
@@ -126,332 +219,420 @@ void *Wheels::thread_func(void *args)
     return NULL;
 }
 
+void Wheels::encoder_alert(int gpio, int level, uint32_t tick, void *arg)
+{
+    Wheels *wheels = (Wheels *) arg;
+
+    (void)(tick);
+
+    if (level != 1) {
+        return;
+    }
+
+    if (gpio == RHS_ENCODER_GPIO) {
+        wheels->_wheel[RHS].ticks++;
+    } else if (gpio == LHS_ENCODER_GPIO) {
+        wheels->_wheel[LHS].ticks++;
+    }
+}
+
 void Wheels::run(void)
 {
     struct timespec ts, tloop;
+    float dt, v, dr, dl, ds, dtheta;
+    bool moving;
+    char buf[128];
 
     tloop.tv_sec = 0;
-    tloop.tv_nsec = 50000000;
+    tloop.tv_nsec = WHEEL_CONTROL_MS * 1000000;
+    dt = WHEEL_CONTROL_MS / 1000.0;
 
     while (_running) {
         clock_gettime(CLOCK_REALTIME, &ts);
         timespecadd(&ts, &tloop, &ts);
 
-        if (hasExpired()) {
-            halt();
-        }
-
-        if (_rpwr != _rpwrTarget) {
-            if (_rpwrTarget < _rpwr) {
-                _rpwr -= 5;
-                if (_rpwr > 100) {
-                    _rpwr = 0;
-                }
-            } else {
-                if (_rpwr < 30) {
-                    _rpwr = 30;
-                } else {
-                    _rpwr += 1;
-                }
-                if (_rpwr > _rpwrTarget) {
-                    _rpwr = _rpwrTarget;
-                }
-            }
+        pthread_mutex_lock(&_mutex);
 
-            servos->setPct(RHS_SPEED_SERVO, _rpwr);
+        if (hasExpired()) {
+            stop();
         }
 
-        if (_lpwr != _lpwrTarget) {
-            if (_lpwrTarget < _lpwr) {
-                _lpwr -= 5;
-                if (_lpwr > 100) {
-                    _lpwr = 0;
-                }
-            } else {
-                if (_lpwr < 30) {
-                    _lpwr = 30;
-                } else {
-                    _lpwr += 1;
-                }
-                if (_lpwr > _lpwrTarget) {
-                    _lpwr = _lpwrTarget;
-                }
+        /* Commands are held to the safety limits */
+        v = limitV(_cmdV);
+        if ((v != _cmdV) != _limited) {
+            _limited = (v != _cmdV);
+            if (_limited) {
+                snprintf(buf, sizeof(buf) - 1,
+                         "Wheels limited to %.0fmm/s by safety\n", v);
+                LOG(buf);
             }
-            servos->setPct(LHS_SPEED_SERVO, _lpwr);
         }
 
-        if (_rpwr == 0) {
-            gpioWrite(L298N_IN1, 0);
-            gpioWrite(L298N_IN2, 0);
+        ramp(&_refV, v, WHEEL_ACCEL_MMPS2, WHEEL_DECEL_MMPS2, dt);
+        ramp(&_refW, _cmdW, DEG2RAD(WHEEL_ANG_ACCEL_DPS2),
+             DEG2RAD(WHEEL_ANG_DECEL_DPS2), dt);
+        setpoints(_refV, _refW);
+
+        dr = control(&_wheel[RHS], dt);
+        dl = control(&_wheel[LHS], dt);
+
+        /* Differential drive odometry */
+        ds = (dr + dl) / 2.0;
+        dtheta = (dr - dl) / WHEEL_BASE_MM;
+        _x += ds * cosf(_theta + (dtheta / 2.0));
+        _y += ds * sinf(_theta + (dtheta / 2.0));
+        _theta = remainderf(_theta + dtheta, 2.0 * M_PI);
+        _v = ds / dt;
+        _w = dtheta / dt;
+
+        output(RHS, _wheel[RHS].pct);
+        output(LHS, _wheel[LHS].pct);
+
+        moving = (_refV != 0.0) || (_refW != 0.0);
+        if (moving && !_moving) {
+            gettimeofday(&_ts, NULL);
+            LOG("Wheels moving\n");
+        } else if (!moving && _moving) {
+            snprintf(buf, sizeof(buf) - 1, "Wheels halted after %ums\n",
+                     now_diff_ts_ms());
+            LOG(buf);
         }
+        _moving = moving;
 
-        if (_lpwr == 0) {
-            gpioWrite(L298N_IN3, 0);
-            gpioWrite(L298N_IN4, 0);
-        }
+        updateGoal(ds, dtheta);
 
-        pthread_mutex_lock(&_mutex);
         pthread_cond_timedwait(&_cond, &_mutex, &ts);
         pthread_mutex_unlock(&_mutex);
     }
 }
 
-void Wheels::halt(void)
+/*
+ * Linear speed within the safety limits. Spinning in place is never
+ * limited, it is how we turn away from an obstacle.
+ */
+float Wheels::limitV(float v) const
 {
-    struct itimerval tv;
-
-    if (_state == 0) {
-        return;
+    if (v > _fwdLimit) {
+        return _fwdLimit;
     }
 
-    tv.it_value.tv_sec = 0;
-    tv.it_value.tv_usec = 0;
-    tv.it_interval.tv_sec = 70;
-    tv.it_interval.tv_usec = 0;
-    setitimer(ITIMER_REAL, &tv, NULL);
-
-    change(0);
-
-    _rpwrTarget = 0;
-    _lpwrTarget = 0;
-}
-
-void Wheels::fwd(unsigned int ms)
-{
-    if (_state != 1) {
-        change(1);
-
-        _rpwrTarget = 75;
-        _lpwrTarget = 75;
-
-        gpioWrite(L298N_IN1, 1);
-        gpioWrite(L298N_IN2, 0);
-        gpioWrite(L298N_IN3, 1);
-        gpioWrite(L298N_IN4, 0);
+    if (v < -_bwdLimit) {
+        return -_bwdLimit;
     }
 
-    if (ms > 0) {
-        setExpiration(ms);
-    }
+    return v;
 }
 
-void Wheels::bwd(unsigned int ms)
+/*
+ * Wheel speeds of a (linear, angular) motion. When a wheel would exceed
+ * its top speed both are slowed down by the same factor so that the
+ * curvature is kept.
+ */
+void Wheels::setpoints(float v, float w)
 {
-    if (_state != 2) {
-        change(2);
-
-        _rpwrTarget = 75;
-        _lpwrTarget = 75;
+    float arc, top, scale = 1.0;
 
-        gpioWrite(L298N_IN1, 0);
-        gpioWrite(L298N_IN2, 1);
-        gpioWrite(L298N_IN3, 0);
-        gpioWrite(L298N_IN4, 1);
+    arc = w * WHEEL_BASE_MM / 2.0;
+    top = fmaxf(fabsf(v + arc), fabsf(v - arc));
+    if (top > WHEEL_TOP_MMPS) {
+        scale = WHEEL_TOP_MMPS / top;
     }
 
-    if (ms > 0) {
-        setExpiration(ms);
-    }
+    _wheel[RHS].target = (v + arc) * scale;
+    _wheel[LHS].target = (v - arc) * scale;
 }
 
-void Wheels::ror(unsigned int ms)
+/*
+ * Called by Safety when the clearance changes. Motion exceeding the new
+ * limits is cut right here on the caller's thread rather than on the next
+ * control loop. Returns true if the running motion was cut.
+ */
+bool Wheels::limitSpeed(float fwd, float bwd)
 {
-    if (_state != 3) {
-        change(3);
-
-        _rpwrTarget = 50;
-        _lpwrTarget = 50;
+    struct wheel_ctl *wheel;
+    float v;
+    bool cut;
+    unsigned int i;
+
+    pthread_mutex_lock(&_mutex);
+
+    _fwdLimit = fwd;
+    _bwdLimit = bwd;
+
+    v = limitV(_refV);
+    cut = (v != _refV);
+    if (cut) {
+        _refV = v;
+        setpoints(_refV, _refW);
+        for (i = 0; i < 2; i++) {
+            wheel = &_wheel[i];
+            wheel->integral = 0.0;
+            wheel->pct = feed_forward(wheel->target);
+        }
 
-        gpioWrite(L298N_IN1, 0);
-        gpioWrite(L298N_IN2, 1);
-        gpioWrite(L298N_IN3, 1);
-        gpioWrite(L298N_IN4, 0);
+        output(RHS, _wheel[RHS].pct);
+        output(LHS, _wheel[LHS].pct);
     }
 
-    if (ms > 0) {
-        setExpiration(ms);
-    }
+    pthread_mutex_unlock(&_mutex);
+
+    return cut;
 }
 
-void Wheels::rol(unsigned int ms)
+/*
+ * One velocity control step of a wheel, returns the distance it travelled.
+ */
+float Wheels::control(struct wheel_ctl *wheel, float dt)
 {
-    if (_state != 4) {
-        change(4);
-
-        _rpwrTarget = 50;
-        _lpwrTarget = 50;
-
-        gpioWrite(L298N_IN1, 1);
-        gpioWrite(L298N_IN2, 0);
-        gpioWrite(L298N_IN3, 0);
-        gpioWrite(L298N_IN4, 1);
+    uint32_t ticks, d;
+    float dist, ff, err;
+    char buf[128];
+
+    ticks = wheel->ticks;
+    d = ticks - wheel->lastTicks;
+    wheel->lastTicks = ticks;
+    dist = (float) d * WHEEL_MM_PER_TICK * wheel->dir;
+    wheel->speed = dist / dt;
+
+    if (wheel->target == 0.0) {
+        wheel->pct = 0.0;
+        wheel->integral = 0.0;
+        wheel->stallMs = 0;
+        return dist;
+    }
+
+    ff = feed_forward(wheel->target);
+
+    /* Fall back to open loop while the encoder is silent */
+    if (d > 0) {
+        if (!wheel->encoderOk) {
+            snprintf(buf, sizeof(buf) - 1, "Wheel %s encoder is back\n",
+                     wheel == &_wheel[RHS] ? "right" : "left");
+            LOG(buf);
+        }
+        wheel->stallMs = 0;
+        wheel->encoderOk = true;
+    } else if (wheel->encoderOk) {
+        wheel->stallMs += WHEEL_CONTROL_MS;
+        if (wheel->stallMs >= WHEEL_ENCODER_TIMEOUT_MS) {
+            snprintf(buf, sizeof(buf) - 1,
+                     "Wheel %s encoder is silent, running open loop\n",
+                     wheel == &_wheel[RHS] ? "right" : "left");
+            LOG(buf);
+            wheel->encoderOk = false;
+            wheel->integral = 0.0;
+        }
     }
 
-    if (ms > 0) {
-        setExpiration(ms);
+    if (wheel->encoderOk) {
+        err = wheel->target - wheel->speed;
+        wheel->integral += err * dt;
+        if (wheel->integral > WHEEL_I_LIMIT) {
+            wheel->integral = WHEEL_I_LIMIT;
+        } else if (wheel->integral < -WHEEL_I_LIMIT) {
+            wheel->integral = -WHEEL_I_LIMIT;
+        }
+        wheel->pct = ff + (WHEEL_KP * err) + (WHEEL_KI * wheel->integral);
+    } else {
+        wheel->pct = ff;
     }
-}
-
-void Wheels::fwr(unsigned int ms)
-{
-    if (_state != 5) {
-        change(5);
 
-        _rpwrTarget = 8;
-        _lpwrTarget = 75;
-
-        gpioWrite(L298N_IN1, 1);
-        gpioWrite(L298N_IN2, 0);
-        gpioWrite(L298N_IN3, 1);
-        gpioWrite(L298N_IN4, 0);
+    /* Never drive against the target direction, the motors just coast */
+    if (wheel->target > 0.0) {
+        wheel->pct = wheel->pct < 0.0 ? 0.0 : wheel->pct;
+        wheel->pct = wheel->pct > 100.0 ? 100.0 : wheel->pct;
+    } else {
+        wheel->pct = wheel->pct > 0.0 ? 0.0 : wheel->pct;
+        wheel->pct = wheel->pct < -100.0 ? -100.0 : wheel->pct;
     }
 
-    if (ms > 0) {
-        setExpiration(ms);
-    }
+    return dist;
 }
 
-void Wheels::fwl(unsigned int ms)
+void Wheels::output(unsigned int side, float pct)
 {
-    if (_state != 6) {
-        change(6);
+    unsigned int in1, in2, chan;
 
-        _rpwrTarget = 75;
-        _lpwrTarget = 8;
-
-        gpioWrite(L298N_IN1, 1);
-        gpioWrite(L298N_IN2, 0);
-        gpioWrite(L298N_IN3, 1);
-        gpioWrite(L298N_IN4, 0);
+    if (side == RHS) {
+        in1 = L298N_IN1;
+        in2 = L298N_IN2;
+        chan = RHS_SPEED_SERVO;
+    } else {
+        in1 = L298N_IN3;
+        in2 = L298N_IN4;
+        chan = LHS_SPEED_SERVO;
+    }
+
+    if (pct > 0.0) {
+        _wheel[side].dir = 1;
+        gpioWrite(in1, 1);
+        gpioWrite(in2, 0);
+    } else if (pct < 0.0) {
+        _wheel[side].dir = -1;
+        gpioWrite(in1, 0);
+        gpioWrite(in2, 1);
+    } else {
+        gpioWrite(in1, 0);
+        gpioWrite(in2, 0);
     }
 
-    if (ms > 0) {
-        setExpiration(ms);
-    }
+    servos->setPct(chan, (unsigned int) fabsf(pct));
 }
 
-void Wheels::bwr(unsigned int ms)
+/*
+ * Slow down for and stop at the end of moveDistance() and turnAngle().
+ * Called with _mutex held.
+ */
+void Wheels::updateGoal(float ds, float dtheta)
 {
-    if (_state != 7) {
-        change(7);
+    float v, w;
 
-        _rpwrTarget = 8;
-        _lpwrTarget = 75;
-
-        gpioWrite(L298N_IN1, 0);
-        gpioWrite(L298N_IN2, 1);
-        gpioWrite(L298N_IN3, 0);
-        gpioWrite(L298N_IN4, 1);
+    if (_goal == GOAL_NONE) {
+        return;
     }
 
-    if (ms > 0) {
-        setExpiration(ms);
-    }
-}
-
-void Wheels::bwl(unsigned int ms)
-{
-    if (_state != 8) {
-        change(8);
-
-        _rpwrTarget = 75;
-        _lpwrTarget = 8;
+    if (_goal == GOAL_DISTANCE) {
+        _goalRemaining -= fabsf(ds);
+        if (_goalRemaining <= 0.0) {
+            stop();
+            return;
+        }
 
-        gpioWrite(L298N_IN1, 0);
-        gpioWrite(L298N_IN2, 1);
-        gpioWrite(L298N_IN3, 0);
-        gpioWrite(L298N_IN4, 1);
-    }
+        v = sqrtf(2.0 * WHEEL_DECEL_MMPS2 * _goalRemaining);
+        v = v > WHEEL_CRUISE_MMPS ? WHEEL_CRUISE_MMPS : v;
+        v = v < WHEEL_MIN_MMPS ? WHEEL_MIN_MMPS : v;
+        _cmdV = _goalSign * v;
+        _cmdW = 0.0;
+    } else {
+        /* Remaining angle as arc length travelled by each wheel */
+        _goalRemaining -= fabsf(dtheta) * WHEEL_BASE_MM / 2.0;
+        if (_goalRemaining <= 0.0) {
+            stop();
+            return;
+        }
 
-    if (ms > 0) {
-        setExpiration(ms);
+        w = sqrtf(2.0 * WHEEL_DECEL_MMPS2 * _goalRemaining);
+        w = w > WHEEL_SPIN_MMPS ? WHEEL_SPIN_MMPS : w;
+        w = w < WHEEL_MIN_MMPS ? WHEEL_MIN_MMPS : w;
+        _cmdV = 0.0;
+        _cmdW = _goalSign * w / (WHEEL_BASE_MM / 2.0);
     }
 }
 
-unsigned int Wheels::state(void) const
+/*
+ * Called with _mutex held.
+ */
+void Wheels::stop(void)
 {
-    return _state;
+    _goal = GOAL_NONE;
+    _cmdV = 0.0;
+    _cmdW = 0.0;
+    timerclear(&_expire);
 }
 
-const char *Wheels::stateStr(void) const
+void Wheels::halt(void)
 {
-    if (_state <= 8) {
-        return state_string[_state];
-    }
-
-    return state_string[9];
+    pthread_mutex_lock(&_mutex);
+    stop();
+    pthread_mutex_unlock(&_mutex);
 }
 
-unsigned int Wheels::fwd_ms(void) const
+/*
+ * Streamed teleoperation and autonomy command: drive at v mm/s forward
+ * while turning at w deg/s counter-clockwise. The wheels stop unless the
+ * command is renewed within WHEEL_DEADMAN_MS.
+ */
+void Wheels::command(float v, float w)
 {
-    if (_state == 1) {
-        return _fwd_ms + now_diff_ts_ms();
-    }
-
-    return _fwd_ms;
+    drive(v, w, WHEEL_DEADMAN_MS);
 }
 
-unsigned int Wheels::bwd_ms(void) const
+/*
+ * Drive at v mm/s forward while turning at w deg/s counter-clockwise,
+ * for ms milliseconds or until told otherwise.
+ */
+void Wheels::drive(float v, float w, unsigned int ms)
 {
-    if (_state == 2) {
-        return _bwd_ms + now_diff_ts_ms();
+    v = v > WHEEL_MAX_MMPS ? WHEEL_MAX_MMPS : v;
+    v = v < -WHEEL_MAX_MMPS ? -WHEEL_MAX_MMPS : v;
+    w = w > WHEEL_MAX_DPS ? WHEEL_MAX_DPS : w;
+    w = w < -WHEEL_MAX_DPS ? -WHEEL_MAX_DPS : w;
+
+    pthread_mutex_lock(&_mutex);
+    _goal = GOAL_NONE;
+    _cmdV = v;
+    _cmdW = DEG2RAD(w);
+    if (ms > 0) {
+        setExpiration(ms);
+    } else {
+        timerclear(&_expire);
     }
-
-    return _bwd_ms;
+    pthread_mutex_unlock(&_mutex);
 }
 
-unsigned int Wheels::ror_ms(void) const
+void Wheels::moveDistance(float mm)
 {
-    if (_state == 3) {
-        return _ror_ms + now_diff_ts_ms();
+    if (mm == 0.0) {
+        halt();
+        return;
     }
 
-    return _ror_ms;
+    pthread_mutex_lock(&_mutex);
+    _goalSign = (mm > 0.0) ? 1.0 : -1.0;
+    _goalRemaining = fabsf(mm);
+    _goal = GOAL_DISTANCE;
+    _cmdV = _goalSign * WHEEL_CRUISE_MMPS;
+    _cmdW = 0.0;
+
+    /* Fail safe in case the wheels never get there */
+    setExpiration((unsigned int) (fabsf(mm) * 2000.0 / WHEEL_CRUISE_MMPS) +
+                  2000);
+    pthread_mutex_unlock(&_mutex);
 }
 
-unsigned int Wheels::rol_ms(void) const
+void Wheels::turnAngle(float deg)
 {
-    if (_state == 4) {
-        return _rol_ms + now_diff_ts_ms();
+    if (deg == 0.0) {
+        halt();
+        return;
     }
 
-    return _rol_ms;
+    pthread_mutex_lock(&_mutex);
+    _goalSign = (deg > 0.0) ? 1.0 : -1.0;
+    _goalRemaining = DEG2RAD(fabsf(deg)) * WHEEL_BASE_MM / 2.0;
+    _goal = GOAL_ANGLE;
+    _cmdV = 0.0;
+    _cmdW = _goalSign * WHEEL_SPIN_MMPS / (WHEEL_BASE_MM / 2.0);
+
+    setExpiration((unsigned int) (_goalRemaining * 2000.0 / WHEEL_SPIN_MMPS) +
+                  2000);
+    pthread_mutex_unlock(&_mutex);
 }
 
-unsigned int Wheels::fwr_ms(void) const
+void Wheels::odometry(float *x, float *y, float *theta) const
 {
-    if (_state == 5) {
-        return _fwr_ms + now_diff_ts_ms();
-    }
-
-    return _fwr_ms;
+    *x = _x;
+    *y = _y;
+    *theta = RAD2DEG(_theta);
 }
 
-unsigned int Wheels::fwl_ms(void) const
+void Wheels::resetOdometry(void)
 {
-    if (_state == 6) {
-        return _fwl_ms + now_diff_ts_ms();
-    }
-
-    return _fwl_ms;
+    pthread_mutex_lock(&_mutex);
+    _x = 0.0;
+    _y = 0.0;
+    _theta = 0.0;
+    pthread_mutex_unlock(&_mutex);
 }
 
-unsigned int Wheels::bwr_ms(void) const
+float Wheels::speed(void) const
 {
-    if (_state == 7) {
-        return _bwr_ms + now_diff_ts_ms();
-    }
-
-    return _bwr_ms;
+    return _v;
 }
 
-unsigned int Wheels::bwl_ms(void) const
+float Wheels::turnRate(void) const
 {
-    if (_state == 8) {
-        return _bwl_ms + now_diff_ts_ms();
-    }
-
-    return _bwl_ms;
+    return RAD2DEG(_w);
 }
 
 unsigned int Wheels::now_diff_ts_ms(void) const
@@ -466,73 +647,6 @@ unsigned int Wheels::now_diff_ts_ms(void) const
     return ms;
 }
 
-void Wheels::change(unsigned int state)
-{
-    unsigned int ms;
-
-    ms = now_diff_ts_ms();
-
-    switch (_state) {
-    case 0:                break;
-    case 1: _fwd_ms += ms; break;
-    case 2: _bwd_ms += ms; break;
-    case 3: _ror_ms += ms; break;
-    case 4: _rol_ms += ms; break;
-    case 5: _fwr_ms += ms; break;
-    case 6: _fwl_ms += ms; break;
-    case 7: _bwr_ms += ms; break;
-    case 8: _bwl_ms += ms; break;
-    default:               break;
-    }
-
-    if (_state != state) {
-        char buf[64];
-
-        if (_state == 0) {
-            snprintf(buf, sizeof(buf) - 1, "Wheel %s -> %s\n",
-                     state_string[_state], state_string[state]);
-        } else {
-            snprintf(buf, sizeof(buf) - 1, "Wheel %s %ums -> %s\n",
-                     state_string[_state], ms, state_string[state]);
-        }
-
-        switch (state) {
-        case 0:
-            if (ms > 1000) {
-                //speech->speak("Halt");
-            }
-            break;
-        case 1:
-        case 5:
-        case 6:
-            if (_state != 1 && _state != 5 && _state != 6) {
-                //speech->speak("Forward");
-            }
-            break;
-        case 2:
-        case 7:
-        case 8:
-            if (_state != 2 && _state != 7 && _state != 8) {
-                //speech->speak("Backward");
-            }
-            break;
-        case 3:
-            //speech->speak("Spin right");
-            break;
-        case 4:
-            //speech->speak("Spin left");
-            break;
-        default:
-            break;
-        }
-
-        LOG(buf);
-    }
-
-    _state = state;
-    gettimeofday(&_ts, NULL);
-}
-
 void Wheels::setExpiration(unsigned int ms)
 {
     struct timeval now;
@@ -541,7 +655,7 @@ void Wheels::setExpiration(unsigned int ms)
     gettimeofday(&now, NULL);
 
     expiry.tv_sec = ms / 1000;
-    expiry.tv_usec = (ms - (ms / 1000)) * 1000;
+    expiry.tv_usec = (ms % 1000) * 1000;
 
     timeradd(&now, &expiry, &_expire);
 }
@@ -550,6 +664,10 @@ bool Wheels::hasExpired(void) const
 {
     struct timeval now;
 
+    if (!timerisset(&_expire)) {
+        return false;
+    }
+
     gettimeofday(&now, NULL);
 
     if (timercmp(&now, &_expire, >=)) {
@@ -7,8 +7,27 @@
 #ifndef WHEELS_HXX
 #define WHEELS_HXX
 
+#include <stdint.h>
 #include <sys/time.h>
 
+struct wheel_ctl {
+    volatile uint32_t ticks;  // Encoder edges, counted on pigpio's thread
+    uint32_t lastTicks;
+    int dir;                  // Direction the wheel is driven in, +1/-1
+    float target;             // Requested speed in mm/s
+    float speed;              // Measured speed in mm/s
+    float integral;
+    float pct;                // Signed output power
+    unsigned int stallMs;     // Time powered without encoder edges
+    bool encoderOk;
+};
+
+/*
+ * Limits of a (linear, angular) drive command.
+ */
+#define WHEEL_MAX_MMPS  300.0
+#define WHEEL_MAX_DPS   120.0
+
 class Wheels {
 
 public:
@@ -18,41 +37,61 @@ public:
 
     void halt(void);
 
-    void fwd(unsigned int ms);
-    void bwd(unsigned int ms);
-    void ror(unsigned int ms);
-    void rol(unsigned int ms);
-    void fwr(unsigned int ms);
-    void fwl(unsigned int ms);
-    void bwr(unsigned int ms);
-    void bwl(unsigned int ms);
-
-    unsigned int state(void) const;
-    const char *stateStr(void) const;
-
-    unsigned int fwd_ms(void) const;
-    unsigned int bwd_ms(void) const;
-    unsigned int ror_ms(void) const;
-    unsigned int rol_ms(void) const;
-    unsigned int fwr_ms(void) const;
-    unsigned int fwl_ms(void) const;
-    unsigned int bwr_ms(void) const;
-    unsigned int bwl_ms(void) const;
+    void command(float v, float w);
+    void drive(float v, float w, unsigned int ms = 0);
+    void moveDistance(float mm);
+    void turnAngle(float deg);
+
+    void odometry(float *x, float *y, float *theta) const;
+    void resetOdometry(void);
+    float speed(void) const;
+    float turnRate(void) const;
+    bool isMoving(void) const;
+
+    bool limitSpeed(float fwd, float bwd);
 
 private:
 
+    enum Goal {
+        GOAL_NONE = 0,
+        GOAL_DISTANCE = 1,
+        GOAL_ANGLE = 2,
+    };
+
     static void *thread_func(void *);
     void run(void);
+    static void encoder_alert(int gpio, int level, uint32_t tick, void *arg);
+    float limitV(float v) const;
+    void setpoints(float v, float w);
+    float control(struct wheel_ctl *wheel, float dt);
+    void output(unsigned int side, float pct);
+    void updateGoal(float ds, float dtheta);
+    void stop(void);
     unsigned int now_diff_ts_ms(void) const;
-    void change(unsigned int state);
     void setExpiration(unsigned int ms);
     bool hasExpired(void) const;
 
-    unsigned int _state;
-    unsigned int _rpwr;
-    unsigned int _rpwrTarget;
-    unsigned int _lpwr;
-    unsigned int _lpwrTarget;
+    struct wheel_ctl _wheel[2];
+
+    float _cmdV;    // Commanded linear speed in mm/s
+    float _cmdW;    // Commanded angular speed in rad/s
+    float _refV;    // Command after acceleration limiting
+    float _refW;
+    bool _moving;
+
+    float _x;
+    float _y;
+    float _theta;
+    float _v;
+    float _w;
+
+    enum Goal _goal;
+    float _goalRemaining;
+    float _goalSign;
+
+    float _fwdLimit;
+    float _bwdLimit;
+    bool _limited;
 
     bool _running;
     pthread_t _thread;
@@ -61,17 +100,14 @@ private:
 
     struct timeval _ts;
     struct timeval _expire;
-    unsigned int _fwd_ms;
-    unsigned int _bwd_ms;
-    unsigned int _ror_ms;
-    unsigned int _rol_ms;
-    unsigned int _fwr_ms;
-    unsigned int _fwl_ms;
-    unsigned int _bwr_ms;
-    unsigned int _bwl_ms;
 
 };
 
+inline bool Wheels::isMoving(void) const
+{
+    return _moving;
+}
+
 #endif
 
 /*
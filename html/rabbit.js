@@ -112,49 +112,51 @@ function rabbit_logclear_button_event()
     rabbit_log.value = "";
 }
 
-function rabbit_wheel_fwl()
-{
-    websock.send('w7');
-}
-
-function rabbit_wheel_fwd()
-{
-    websock.send('w8');
-}
-
-function rabbit_wheel_fwr()
-{
-    websock.send('w9');
-}
-
-function rabbit_wheel_rol()
-{
-    websock.send('w4');
-}
+/*
+ * Wheel commands are streamed for as long as a wheel button is held, the
+ * rabbit'bot stops on its own when they stop coming.
+ */
+var drive_v = 0;
+var drive_w = 0;
+var drive_timer = null;
 
-function rabbit_wheel_halt()
+function rabbit_drive_send()
 {
-    websock.send('h');
+    if (websock.readyState === WebSocket.OPEN) {
+	websock.send("drive " + drive_v + " " + drive_w);
+    }
 }
 
-function rabbit_wheel_ror()
+function rabbit_drive(v, w)
 {
-    websock.send('w6');
+    drive_v = v;
+    drive_w = w;
+    rabbit_drive_send();
+    if (drive_timer === null) {
+	drive_timer = setInterval(rabbit_drive_send, 50);
+    }
 }
 
-function rabbit_wheel_bwl()
+function rabbit_drive_stop()
 {
-    websock.send('w1');
+    if (drive_timer !== null) {
+	clearInterval(drive_timer);
+	drive_timer = null;
+    }
+    drive_v = 0;
+    drive_w = 0;
+    rabbit_drive_send();
 }
 
-function rabbit_wheel_bwd()
+function rabbit_wheel_button(id, v, w)
 {
-    websock.send('w2');
-}
+    var button = document.getElementById(id);
 
-function rabbit_wheel_bwr()
-{
-    websock.send('w3');
+    button.onmousedown = function() { rabbit_drive(v, w); };
+    button.ontouchstart = function() { rabbit_drive(v, w); };
+    button.onmouseup = rabbit_drive_stop;
+    button.onmouseleave = rabbit_drive_stop;
+    button.ontouchend = rabbit_drive_stop;
 }
 
 function rabbit_keys_setup()
@@ -174,24 +176,16 @@ function rabbit_keys_setup()
     document.getElementById("view-ir").onclick =
 	set_view_ir;
 
-    document.getElementById("wheel-fwl").onclick =
-	rabbit_wheel_fwl;
-    document.getElementById("wheel-fwd").onclick =
-	rabbit_wheel_fwd;
-    document.getElementById("wheel-fwr").onclick =
-	rabbit_wheel_fwr;
-    document.getElementById("wheel-rol").onclick =
-	rabbit_wheel_rol;
+    rabbit_wheel_button("wheel-fwl", 300, 60);
+    rabbit_wheel_button("wheel-fwd", 300, 0);
+    rabbit_wheel_button("wheel-fwr", 300, -60);
+    rabbit_wheel_button("wheel-rol", 0, 90);
+    rabbit_wheel_button("wheel-ror", 0, -90);
+    rabbit_wheel_button("wheel-bwl", -300, -60);
+    rabbit_wheel_button("wheel-bwd", -300, 0);
+    rabbit_wheel_button("wheel-bwr", -300, 60);
     document.getElementById("wheel-halt").onclick =
-	rabbit_wheel_halt;
-    document.getElementById("wheel-ror").onclick =
-	rabbit_wheel_ror;
-    document.getElementById("wheel-bwl").onclick =
-	rabbit_wheel_bwl;
-    document.getElementById("wheel-bwd").onclick =
-	rabbit_wheel_bwd;
-    document.getElementById("wheel-bwr").onclick =
-	rabbit_wheel_bwr;
+	rabbit_drive_stop;
 }
 
 function rabbit_setup()
@@ -13,6 +13,14 @@ static const unsigned int IR_PINS[IR_DEVICES] = {
 
 bool ir_state[IR_DEVICES] __attribute__((section(".data.bss")));
 
+/*
+ * A sensor changes state only after ir_debounce[] consecutive samples
+ * that disagree with it.
+ */
+static unsigned int ir_debounce[IR_DEVICES];
+
+static unsigned int ir_disagree[IR_DEVICES];
+
 void ir_init(void)
 {
     unsigned int i;
@@ -21,6 +29,9 @@ void ir_init(void)
         gpio_init(IR_PINS[i]);
         gpio_set_dir(IR_PINS[i], GPIO_IN);
         gpio_disable_pulls(IR_PINS[i]);
+        ir_state[i] = gpio_get(IR_PINS[i]);
+        ir_debounce[i] = IR_DEBOUNCE_DEFAULT;
+        ir_disagree[i] = 0;
     }
 }
 
@@ -29,10 +40,31 @@ void ir_refresh(void)
     unsigned int i;
 
     for (i = 0; i < IR_DEVICES; i++) {
-        ir_state[i] = gpio_get(IR_PINS[i]);
+        if (gpio_get(IR_PINS[i]) == ir_state[i]) {
+            ir_disagree[i] = 0;
+            continue;
+        }
+
+        ir_disagree[i]++;
+        if (ir_disagree[i] >= ir_debounce[i]) {
+            ir_state[i] = !ir_state[i];
+            ir_disagree[i] = 0;
+        }
     }
 }
 
+bool ir_set_debounce(unsigned int id, unsigned int samples)
+{
+    if ((id >= IR_DEVICES) || (samples == 0) ||
+        (samples > IR_DEBOUNCE_MAX)) {
+        return false;
+    }
+
+    ir_debounce[id] = samples;
+
+    return true;
+}
+
 bool ir_triggered(void)
 {
     unsigned int i;
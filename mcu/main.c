@@ -9,16 +9,20 @@
 #include <pico/stdlib.h>
 #include <pico/unique_id.h>
 #include "rabbit_mcu.h"
+#include "rabbit_mcu_proto.h"
 
 #define IR_SAMPLING_INTERVAL_US     500
-#define US_SAMPLING_INTERVAL_US    5000
-#define USB_PUSH_DATA_INTERVAL_US  5000
+#define US_SAMPLING_INTERVAL_US     250
+#define TEMP_SAMPLING_INTERVAL_US 5000
+#define USB_PUSH_DATA_INTERVAL_US  1000
+#define USB_PUSH_ALL_INTERVAL_US   5000
 #define USB_PARSE_CMD_INTERVAL_US  1000
+#define USB_HEARTBEAT_MAX_MS      60000
 #define MAIN_LOOP_DELAY_MS          100
 
 const char *get_banner(void)
 {
-    static char banner[32];
+    static char banner[40];
     pico_unique_board_id_t board_id;
     size_t l = sizeof(banner);
     char *s = banner;
@@ -51,6 +55,10 @@ const char *get_banner(void)
         l--;
     }
 
+    ret = snprintf(s, l - 1, RABBIT_PROTO_BANNER);
+    s += ret;
+    l -= ret;
+
     *s = '\n';
     s++;
     l--;
@@ -73,15 +81,17 @@ static bool sample_ir(repeating_timer_t *timer)
 
 static bool sample_us(repeating_timer_t *timer)
 {
-    static unsigned int usid = 0;
+    static unsigned int n = 0;
 
     (void)(timer);
 
-    ultrasound_trigger(usid);
-    usid++;
-    usid %= ULTRASOUND_DEVICES;
+    ultrasound_poll();
 
-    onboard_temp_refresh();
+    n++;
+    if (n >= TEMP_SAMPLING_INTERVAL_US / US_SAMPLING_INTERVAL_US) {
+        onboard_temp_refresh();
+        n = 0;
+    }
 
     return true;
 }
@@ -135,15 +145,188 @@ static const char *encode_result(void)
     return line;
 }
 
+static const struct rabbit_frame *encode_frame(void)
+{
+    static struct rabbit_frame frame;
+    static uint16_t seq = 0;
+    uint32_t age;
+    unsigned int i;
+
+    frame.sync[0] = RABBIT_FRAME_SYNC0;
+    frame.sync[1] = RABBIT_FRAME_SYNC1;
+    frame.version = RABBIT_FRAME_VERSION;
+    frame.len = sizeof(frame);
+    frame.seq = seq++;
+    frame.t_us = time_us_32();
+
+    frame.ir = 0;
+    for (i = 0; i < IR_DEVICES; i++) {
+        if (ir_state[i]) {
+            frame.ir |= (1 << i);
+        }
+    }
+    frame.reserved = 0;
+
+    for (i = 0; i < ULTRASOUND_DEVICES; i++) {
+        if (ultrasound_d_mm[i] > 0xffff) {
+            frame.us_mm[i] = 0xffff;
+        } else {
+            frame.us_mm[i] = (uint16_t) ultrasound_d_mm[i];
+        }
+
+        age = frame.t_us - ultrasound_t_us[i];
+        if (ultrasound_t_us[i] == 0 || age > 0xffff) {
+            frame.us_age_us[i] = 0xffff;
+        } else {
+            frame.us_age_us[i] = (uint16_t) age;
+        }
+    }
+
+    frame.temp_c10 = (int16_t) (temperature_c * 10.0);
+    frame.crc = rabbit_crc16((const uint8_t *) &frame +
+                             RABBIT_FRAME_CRC_OFFSET,
+                             RABBIT_FRAME_CRC_LEN);
+
+    return &frame;
+}
+
+/*
+ * Raw write to USB CDC, no CR/LF translation.
+ */
+static void usb_write(const void *data, unsigned int len)
+{
+    const uint8_t *p = (const uint8_t *) data;
+
+    while (len > 0) {
+        putchar_raw(*p);
+        p++;
+        len--;
+    }
+}
+
 static bool usb_push_enabled = false;
+static bool usb_push_binary = false;
+
+/*
+ * By default every state is pushed every USB_PUSH_ALL_INTERVAL_US. In
+ * change-only mode ("report change"), a state is pushed as soon as an IR
+ * sensor flips, an ultrasound reading moves by usb_report_deadband_mm or
+ * more or gains or loses its echo, and otherwise every
+ * usb_report_heartbeat_us so that the host can tell the MCU is alive.
+ */
+static bool usb_report_changes = false;
+static bool usb_report_force = false;
+static unsigned int usb_report_deadband_mm = 0;
+static uint32_t usb_report_heartbeat_us = 0;
+
+static bool usb_report_due(void)
+{
+    static bool last_ir[IR_DEVICES];
+    static unsigned int last_us[ULTRASOUND_DEVICES];
+    static uint32_t t_last = 0;
+    uint32_t now;
+    unsigned int i, d, last;
+    bool due;
+
+    now = time_us_32();
+
+    if (usb_report_force) {
+        due = true;
+    } else if (usb_report_changes) {
+        due = (now - t_last) >= usb_report_heartbeat_us;
+        for (i = 0; (i < IR_DEVICES) && !due; i++) {
+            due = ir_state[i] != last_ir[i];
+        }
+        for (i = 0; (i < ULTRASOUND_DEVICES) && !due; i++) {
+            d = ultrasound_d_mm[i];
+            last = last_us[i];
+            if ((d == RABBIT_US_NO_ECHO) || (last == RABBIT_US_NO_ECHO)) {
+                due = d != last;
+            } else {
+                due = (d > last ? d - last : last - d) >=
+                    usb_report_deadband_mm;
+            }
+        }
+    } else {
+        due = (now - t_last) >= USB_PUSH_ALL_INTERVAL_US;
+    }
+
+    if (due) {
+        for (i = 0; i < IR_DEVICES; i++) {
+            last_ir[i] = ir_state[i];
+        }
+        for (i = 0; i < ULTRASOUND_DEVICES; i++) {
+            last_us[i] = ultrasound_d_mm[i];
+        }
+        t_last = now;
+        usb_report_force = false;
+    }
+
+    return due;
+}
+
+/*
+ * Filter and report commands, false if malformed:
+ *   ir debounce [<id>] <samples>
+ *   us median [<id>] <window>
+ *   report all
+ *   report change <deadband_mm> <heartbeat_ms>
+ * An id names one sensor and has to exist. The heartbeat is held to
+ * USB_HEARTBEAT_MAX_MS so that it fits in microseconds.
+ */
+static bool usb_config_cmd(const char *cmd)
+{
+    unsigned int a, b, i;
+    bool ok = true;
+    int n;
+
+    if ((n = sscanf(cmd, "ir debounce %u %u", &a, &b)) > 0) {
+        if ((n == 2) && (a >= IR_DEVICES)) {
+            return false;
+        }
+        for (i = 0; i < IR_DEVICES; i++) {
+            if ((n == 1) || (i == a)) {
+                ok = ir_set_debounce(i, n == 1 ? a : b) && ok;
+            }
+        }
+    } else if ((n = sscanf(cmd, "us median %u %u", &a, &b)) > 0) {
+        if ((n == 2) && (a >= ULTRASOUND_DEVICES)) {
+            return false;
+        }
+        for (i = 0; i < ULTRASOUND_DEVICES; i++) {
+            if ((n == 1) || (i == a)) {
+                ok = ultrasound_set_median(i, n == 1 ? a : b) && ok;
+            }
+        }
+    } else if (strcmp(cmd, "report all") == 0) {
+        usb_report_changes = false;
+    } else if ((sscanf(cmd, "report change %u %u", &a, &b) == 2) &&
+               (b > 0)) {
+        usb_report_deadband_mm = a;
+        if (b > USB_HEARTBEAT_MAX_MS) {
+            b = USB_HEARTBEAT_MAX_MS;
+        }
+        usb_report_heartbeat_us = b * 1000;
+        usb_report_changes = true;
+        usb_report_force = true;
+    } else {
+        ok = false;
+    }
+
+    return ok;
+}
 
 static bool usb_push_data(repeating_timer_t *timer)
 {
     (void)(timer);
 
     /* Send official result via USB CDC */
-    if (usb_push_enabled) {
-        usb_printf(encode_result());
+    if (usb_push_enabled && usb_report_due()) {
+        if (usb_push_binary) {
+            usb_write(encode_frame(), sizeof(struct rabbit_frame));
+        } else {
+            usb_printf(encode_result());
+        }
     }
 
     return true;
@@ -168,9 +351,17 @@ static bool usb_parse_cmd(repeating_timer_t *timer)
             if (strcmp(cmd, "id") == 0) {
                 usb_printf(get_banner());
             } else if (strcmp(cmd, "stream") == 0) {
+                usb_push_binary = false;
+                usb_push_enabled = true;
+                usb_report_force = true;
+            } else if (strcmp(cmd, "stream bin") == 0) {
+                usb_push_binary = true;
                 usb_push_enabled = true;
+                usb_report_force = true;
             } else if (strcmp(cmd, "stop") == 0) {
                 usb_push_enabled = false;
+            } else if (usb_config_cmd(cmd) == false) {
+                rs232_printf("Bad command '%s'\n", cmd);
             }
 
             l = 0;
@@ -245,8 +436,15 @@ int main(void)
                 rs232_printf("IR%u: %s\n", i, ir_state[i] ? "on" : "off");
             }
             for (i = 0; i < ULTRASOUND_DEVICES; i++) {
-                rs232_printf("US%u: %u mm\n", i, ultrasound_d_mm[i]);
+                if (ultrasound_d_mm[i] == RABBIT_US_NO_ECHO) {
+                    rs232_printf("US%u: no echo (%u Hz)\n", i,
+                                 ultrasound_hz[i]);
+                } else {
+                    rs232_printf("US%u: %u mm (%u Hz)\n", i,
+                                 ultrasound_d_mm[i], ultrasound_hz[i]);
+                }
             }
+            rs232_printf("US timeouts: %u\n", ultrasound_timeouts);
             rs232_printf("Temperature: %.1f\n", temperature_c);
         }
 
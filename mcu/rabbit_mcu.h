@@ -11,16 +11,40 @@ extern void rs232_init(void);
 extern int rs232_printf(const char *fmt, ...);
 
 #define IR_DEVICES  4
+#define IR_DEBOUNCE_DEFAULT  4     // Samples, 2ms at the IR sampling rate
+#define IR_DEBOUNCE_MAX     64
 extern bool ir_state[IR_DEVICES];
 extern void ir_init(void);
 extern void ir_refresh(void);
 extern bool ir_triggered(void);
+extern bool ir_set_debounce(unsigned int id, unsigned int samples);
 
 #define ULTRASOUND_DEVICES 6
+#define ULTRASOUND_MEDIAN_DEFAULT  3
+#define ULTRASOUND_MEDIAN_MAX      7
 extern unsigned int ultrasound_d_mm[ULTRASOUND_DEVICES];
+extern uint32_t ultrasound_t_us[ULTRASOUND_DEVICES];
+extern unsigned int ultrasound_timeouts;
+extern unsigned int ultrasound_hz[ULTRASOUND_DEVICES];
 extern void ultrasound_init(void);
-extern void ultrasound_trigger(unsigned int id);
-extern void ultrasound_clear(unsigned int id);
+extern void ultrasound_poll(void);
+extern bool ultrasound_set_median(unsigned int id, unsigned int window);
+
+#define ULTRASOUND_SETTLE_US         1000
+#define ULTRASOUND_MIN_SEPARATION_DEG  60
+struct ultrasound_sched {
+    unsigned int conflicts[ULTRASOUND_DEVICES];  // Sensors facing too close
+    unsigned int pending;                        // Fired, not back yet
+    unsigned int settling;                       // Back, not settled yet
+    uint32_t t_fire[ULTRASOUND_DEVICES];
+    uint32_t t_done[ULTRASOUND_DEVICES];
+};
+extern void ultrasound_sched_init(struct ultrasound_sched *sched,
+                                  const int *facing);
+extern unsigned int ultrasound_sched_fire(struct ultrasound_sched *sched,
+                                          unsigned int idle, uint32_t now);
+extern void ultrasound_sched_done(struct ultrasound_sched *sched,
+                                  unsigned int id, uint32_t now);
 
 extern void led_init(void);
 extern void led_set(bool on);
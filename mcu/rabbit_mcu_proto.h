@@ -0,0 +1,79 @@
+/*
+ * rabbit_mcu_proto.h
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#ifndef RABBIT_MCU_PROTO_H
+#define RABBIT_MCU_PROTO_H
+
+#include <stdint.h>
+
+/*
+ * Binary frames streamed by a Rabbit MCU after "stream bin". MCUs that
+ * speak the protocol end their "id" banner with RABBIT_PROTO_BANNER,
+ * those that don't only know the text lines of "stream".
+ *
+ * Fields are little-endian, as are both the RP2040 and the Raspberry Pi.
+ * The CRC covers everything between the sync bytes and the CRC itself.
+ */
+#define RABBIT_PROTO_BANNER    " bin2"
+#define RABBIT_FRAME_SYNC0     0xa5
+#define RABBIT_FRAME_SYNC1     0x5a
+#define RABBIT_FRAME_VERSION   2
+#define RABBIT_FRAME_IR        4
+#define RABBIT_FRAME_US        6
+#define RABBIT_US_NO_ECHO      0xffff     // Nothing within range
+
+struct rabbit_frame {
+    uint8_t sync[2];
+    uint8_t version;
+    uint8_t len;                          // sizeof(struct rabbit_frame)
+    uint16_t seq;
+    uint32_t t_us;                        // MCU time of the samples
+    uint8_t ir;                           // Bit n is IR sensor n
+    uint8_t reserved;
+    uint16_t us_mm[RABBIT_FRAME_US];
+    uint16_t us_age_us[RABBIT_FRAME_US];  // Age of us_mm at t_us, saturated
+    int16_t temp_c10;                     // In 0.1 degree C
+    uint16_t crc;
+} __attribute__((packed));
+
+#define RABBIT_FRAME_CRC_OFFSET  2
+#define RABBIT_FRAME_CRC_LEN     (sizeof(struct rabbit_frame) - 4)
+
+/*
+ * CRC-16/CCITT-FALSE
+ */
+static inline uint16_t rabbit_crc16(const uint8_t *data, unsigned int len)
+{
+    uint16_t crc = 0xffff;
+    unsigned int i;
+
+    while (len > 0) {
+        crc ^= (uint16_t) (*data << 8);
+        for (i = 0; i < 8; i++) {
+            if (crc & 0x8000) {
+                crc = (uint16_t) ((crc << 1) ^ 0x1021);
+            } else {
+                crc = (uint16_t) (crc << 1);
+            }
+        }
+        data++;
+        len--;
+    }
+
+    return crc;
+}
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -5,111 +5,255 @@
  */
 
 #include <pico/stdlib.h>
+#include <hardware/clocks.h>
+#include <hardware/pio.h>
 #include "rabbit_mcu.h"
+#include "rabbit_mcu_proto.h"
+#include "ultrasound.pio.h"
+
+/*
+ * Echoes are timed by ultrasound.pio in loops of 2us. Sensors that don't
+ * hear anything within ULTRASOUND_MAX_MM report RABBIT_US_NO_ECHO. When
+ * to fire each sensor is up to ultrasound_sched.c.
+ *
+ * A sensor is read as fast as its own echo and those of the sensors next
+ * to it allow. Against the old 5ms round robin, which read each sensor
+ * every 30ms, that is more than 2x where everything is within ~0.8m and
+ * 3x or more within ~0.5m, as controller/test/ussched.cxx measures. Far
+ * from anything it is no better: an HC-SR04 that hears nothing holds its
+ * echo line high for ~38ms, and a sensor next to one listening out to 4m
+ * waits ~24ms for it, so in open space each sensor is read ~20 times a
+ * second. Between ~2.3m and 4m the round robin was faster, by firing into
+ * the echoes of the neighbours. The rates seen are measured in
+ * ultrasound_hz.
+ */
+#define ULTRASOUND_US_PER_LOOP          2
+#ifndef ULTRASOUND_MAX_MM
+#define ULTRASOUND_MAX_MM            4000
+#endif
+#define ULTRASOUND_BURST_US           500
+#define ULTRASOUND_TIMEOUT_LOOPS      \
+    ((ULTRASOUND_BURST_US + ULTRASOUND_MAX_MM * 2 * 1000 / 343) /       \
+     ULTRASOUND_US_PER_LOOP)
+#define ULTRASOUND_RATE_US        1000000
 
 struct ultrasound_pin {
     unsigned int trigger;
     unsigned int echo;
+    int facing;                 // Degrees from the MCU's forward axis
 };
 
 struct ultrasound_state {
-    bool active;
-    uint64_t t_trigger;
-    uint64_t t_rise;
-    uint64_t t_fall;
+    PIO pio;
+    unsigned int sm;
+    unsigned int raw[ULTRASOUND_MEDIAN_MAX];  // Latest readings, ring
+    unsigned int head;
+    unsigned int count;
+    unsigned int median;                      // Window of the filter
 };
 
 struct ultrasound_pin ULTRASOUND_PINS[ULTRASOUND_DEVICES] = {
-    {  2,  3, },
-    {  4,  5, },
-    {  6,  7, },
-    {  8,  9, },
-    { 10, 11, },
-    { 12, 13, },
+    {  2,  3, -75, },
+    {  4,  5, -45, },
+    {  6,  7, -15, },
+    {  8,  9,  15, },
+    { 10, 11,  45, },
+    { 12, 13,  75, },
 };
 
 struct ultrasound_state ultrasound_state[ULTRASOUND_DEVICES]
 __attribute__((section(".data.bss")));
 
+static struct ultrasound_sched ultrasound_sched;
+
 unsigned int ultrasound_d_mm[ULTRASOUND_DEVICES]
 __attribute__((section(".data.bss")));
 
-static void ultrasound_gpio_interrupt(uint gpio, uint32_t mask)
+uint32_t ultrasound_t_us[ULTRASOUND_DEVICES]
+__attribute__((section(".data.bss")));
+
+unsigned int ultrasound_timeouts = 0;
+
+unsigned int ultrasound_readings[ULTRASOUND_DEVICES]
+__attribute__((section(".data.bss")));
+
+unsigned int ultrasound_hz[ULTRASOUND_DEVICES]
+__attribute__((section(".data.bss")));
+
+void ultrasound_init(void)
 {
+    int facing[ULTRASOUND_DEVICES];
+    unsigned int offset[2];
     unsigned int i;
-    unsigned int tdiff;
+    int sm;
+
+    offset[0] = pio_add_program(pio0, &ultrasound_program);
+    offset[1] = pio_add_program(pio1, &ultrasound_program);
 
     for (i = 0; i < ULTRASOUND_DEVICES; i++) {
-        if (gpio != ULTRASOUND_PINS[i].echo) {
-            continue;
-        }
+        gpio_init(ULTRASOUND_PINS[i].echo);
+        gpio_set_dir(ULTRASOUND_PINS[i].echo, GPIO_IN);
+        gpio_disable_pulls(ULTRASOUND_PINS[i].echo);
 
-        if (ultrasound_state[i].active == false) {
-            continue;
+        ultrasound_state[i].pio = pio0;
+        sm = pio_claim_unused_sm(pio0, false);
+        if (sm < 0) {
+            ultrasound_state[i].pio = pio1;
+            sm = pio_claim_unused_sm(pio1, true);
         }
+        ultrasound_state[i].sm = (unsigned int) sm;
+
+        ultrasound_program_init(ultrasound_state[i].pio,
+                                ultrasound_state[i].sm,
+                                offset[ultrasound_state[i].pio == pio0 ? 0 : 1],
+                                ULTRASOUND_PINS[i].trigger,
+                                ULTRASOUND_PINS[i].echo);
+        ultrasound_state[i].head = 0;
+        ultrasound_state[i].count = 0;
+        ultrasound_state[i].median = ULTRASOUND_MEDIAN_DEFAULT;
+        ultrasound_d_mm[i] = 0;
+        ultrasound_t_us[i] = 0;
+        ultrasound_readings[i] = 0;
+        ultrasound_hz[i] = 0;
+        facing[i] = ULTRASOUND_PINS[i].facing;
+    }
+
+    ultrasound_sched_init(&ultrasound_sched, facing);
+}
+
+/*
+ * Median of the last readings of a sensor. No echo sorts above any
+ * distance, so it wins only if most of the window heard nothing.
+ */
+static unsigned int ultrasound_filter(unsigned int id, unsigned int d_mm)
+{
+    struct ultrasound_state *state = &ultrasound_state[id];
+    unsigned int sorted[ULTRASOUND_MEDIAN_MAX];
+    unsigned int i, j, n, v;
+
+    state->raw[state->head] = d_mm;
+    state->head = (state->head + 1) % state->median;
+    if (state->count < state->median) {
+        state->count++;
+    }
 
-        if (mask & GPIO_IRQ_EDGE_RISE) {
-            ultrasound_state[i].t_rise = time_us_64();
-        } else if (mask & GPIO_IRQ_EDGE_FALL) {
-            ultrasound_state[i].t_fall = time_us_64();
-            if ((ultrasound_state[i].t_fall > ultrasound_state[i].t_rise) &&
-                (ultrasound_state[i].t_rise != 0)) {
-                tdiff =
-                    ultrasound_state[i].t_fall -
-                    ultrasound_state[i].t_rise;
-                ultrasound_d_mm[i] =
-                    (tdiff * (331 + 0.6 * temperature_c) / 1000) / 2;
-            }
-            ultrasound_state[i].active = false;
+    n = state->count;
+    for (i = 0; i < n; i++) {
+        v = state->raw[i];
+        for (j = i; (j > 0) && (sorted[j - 1] > v); j--) {
+            sorted[j] = sorted[j - 1];
         }
+        sorted[j] = v;
     }
+
+    return sorted[n / 2];
 }
 
-void ultrasound_init(void)
+bool ultrasound_set_median(unsigned int id, unsigned int window)
 {
-    unsigned int i;
+    if ((id >= ULTRASOUND_DEVICES) || (window == 0) ||
+        (window > ULTRASOUND_MEDIAN_MAX)) {
+        return false;
+    }
 
-    for (i = 0; i < ULTRASOUND_DEVICES; i++) {
-        gpio_init(ULTRASOUND_PINS[i].trigger);
-        gpio_set_dir(ULTRASOUND_PINS[i].trigger, GPIO_OUT);
-        gpio_put(ULTRASOUND_PINS[i].trigger, false);
-        gpio_init(ULTRASOUND_PINS[i].echo);
-        gpio_set_dir(ULTRASOUND_PINS[i].echo, GPIO_IN);
-        gpio_disable_pulls(ULTRASOUND_PINS[i].echo);
-        gpio_set_irq_enabled_with_callback(
-            ULTRASOUND_PINS[i].echo,
-            GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL,
-            true,
-            ultrasound_gpio_interrupt);
+    ultrasound_state[id].median = window;
+    ultrasound_state[id].head = 0;
+    ultrasound_state[id].count = 0;
+
+    return true;
+}
+
+/*
+ * Collect the result of a state machine, false if it is still timing.
+ * The reading is stamped with when the ping hit the obstacle.
+ */
+static bool ultrasound_collect(unsigned int id, uint32_t t_fire)
+{
+    PIO pio = ultrasound_state[id].pio;
+    unsigned int sm = ultrasound_state[id].sm;
+    uint32_t rise, fall, echo_us;
+    unsigned int d_mm;
+
+    if (pio_sm_get_rx_fifo_level(pio, sm) < 2) {
+        return false;
+    }
+
+    rise = pio_sm_get(pio, sm);
+    fall = pio_sm_get(pio, sm);
+
+    if (rise == 0) {
+        d_mm = RABBIT_US_NO_ECHO;
+        ultrasound_t_us[id] = t_fire;
+        ultrasound_timeouts++;
+    } else {
+        echo_us = (rise - fall) * ULTRASOUND_US_PER_LOOP;
+        d_mm = (echo_us * (331 + 0.6 * temperature_c) / 1000) / 2;
+        ultrasound_t_us[id] = t_fire +
+            (ULTRASOUND_TIMEOUT_LOOPS - rise) * ULTRASOUND_US_PER_LOOP +
+            echo_us / 2;
     }
+
+    ultrasound_d_mm[id] = ultrasound_filter(id, d_mm);
+    ultrasound_readings[id]++;
+
+    return true;
 }
 
-void ultrasound_trigger(unsigned int id)
+/* Readings of each sensor over the last ULTRASOUND_RATE_US */
+static void ultrasound_rate(uint32_t now)
 {
-    if (id >= ULTRASOUND_DEVICES) {
+    static uint32_t t_last = 0;
+    static unsigned int last_readings[ULTRASOUND_DEVICES];
+    uint32_t dt;
+    unsigned int i;
+
+    dt = now - t_last;
+    if (dt < ULTRASOUND_RATE_US) {
         return;
     }
 
-    gpio_put(ULTRASOUND_PINS[id].trigger, true);
-    ultrasound_state[id].active = 1;
-    ultrasound_state[id].t_trigger = time_us_64();
-    ultrasound_state[id].t_rise = 0;
-    ultrasound_state[id].t_fall = 0;
-    sleep_us(5);
-    gpio_put(ULTRASOUND_PINS[id].trigger, false);
+    for (i = 0; i < ULTRASOUND_DEVICES; i++) {
+        ultrasound_hz[i] = (unsigned int)
+            ((uint64_t) (ultrasound_readings[i] - last_readings[i]) *
+             1000000 / dt);
+        last_readings[i] = ultrasound_readings[i];
+    }
+
+    t_last = now;
 }
 
-void ultrasound_clear(unsigned int id)
+/*
+ * Called periodically: collects the echoes in flight and fires the sensors
+ * the scheduler lets go.
+ */
+void ultrasound_poll(void)
 {
-    if (id >= ULTRASOUND_DEVICES) {
-        return;
+    uint32_t now;
+    unsigned int i, idle = 0, fire;
+
+    now = time_us_32();
+
+    ultrasound_rate(now);
+
+    for (i = 0; i < ULTRASOUND_DEVICES; i++) {
+        if ((ultrasound_sched.pending & (1 << i)) &&
+            ultrasound_collect(i, ultrasound_sched.t_fire[i])) {
+            ultrasound_sched_done(&ultrasound_sched, i, now);
+        }
+
+        /* Still holding the echo line after a missed echo, can't fire */
+        if (gpio_get(ULTRASOUND_PINS[i].echo) == 0) {
+            idle |= (1 << i);
+        }
     }
 
-    ultrasound_state[id].active = 1;
-    ultrasound_state[id].t_trigger = time_us_64();
-    ultrasound_state[id].t_rise = 0;
-    ultrasound_state[id].t_fall = 0;
-    ultrasound_d_mm[id] = 0;
+    fire = ultrasound_sched_fire(&ultrasound_sched, idle, time_us_32());
+    for (i = 0; i < ULTRASOUND_DEVICES; i++) {
+        if (fire & (1 << i)) {
+            pio_sm_put(ultrasound_state[i].pio, ultrasound_state[i].sm,
+                       ULTRASOUND_TIMEOUT_LOOPS);
+        }
+    }
 }
 
 /*
@@ -0,0 +1,106 @@
+/*
+ * ultrasound_sched.c
+ *
+ * Copyright (C) 2023, Charles Chiou
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "rabbit_mcu.h"
+
+/*
+ * Decides which sensors to fire. It knows nothing of pins or PIO so that
+ * it can be driven off target, see controller/test/ussched.cxx.
+ *
+ * Sensors facing within ULTRASOUND_MIN_SEPARATION_DEG of each other would
+ * hear each other's pings, so none is fired while another of them is in
+ * flight or has come back less than ULTRASOUND_SETTLE_US ago. Any other
+ * sensor is fired as soon as its own echo line lets go: one that sees a
+ * close obstacle doesn't wait for sensors across the robot that hear
+ * nothing. Among sensors that clash, the one read longest ago goes first,
+ * so none of them starves.
+ */
+
+void ultrasound_sched_init(struct ultrasound_sched *sched, const int *facing)
+{
+    unsigned int i, j;
+
+    for (i = 0; i < ULTRASOUND_DEVICES; i++) {
+        sched->conflicts[i] = 0;
+        for (j = 0; j < ULTRASOUND_DEVICES; j++) {
+            if (abs(facing[i] - facing[j]) < ULTRASOUND_MIN_SEPARATION_DEG) {
+                sched->conflicts[i] |= (1 << j);
+            }
+        }
+        sched->t_fire[i] = 0;
+        sched->t_done[i] = 0;
+    }
+
+    sched->pending = 0;
+    sched->settling = 0;
+}
+
+/*
+ * Sensors to fire now out of those whose echo lines are low, in idle.
+ * They are marked pending until ultrasound_sched_done().
+ */
+unsigned int ultrasound_sched_fire(struct ultrasound_sched *sched,
+                                   unsigned int idle, uint32_t now)
+{
+    unsigned int fire = 0, busy, ready, i, best;
+
+    for (i = 0; i < ULTRASOUND_DEVICES; i++) {
+        if ((sched->settling & (1 << i)) &&
+            (now - sched->t_done[i] >= ULTRASOUND_SETTLE_US)) {
+            sched->settling &= ~(1 << i);
+        }
+    }
+
+    busy = sched->pending | sched->settling;
+    ready = idle & ~sched->pending;
+
+    for (;;) {
+        best = ULTRASOUND_DEVICES;
+        for (i = 0; i < ULTRASOUND_DEVICES; i++) {
+            if ((ready & (1 << i)) == 0 ||
+                (sched->conflicts[i] & (busy | fire)) != 0) {
+                continue;
+            }
+
+            if (best == ULTRASOUND_DEVICES ||
+                now - sched->t_fire[i] > now - sched->t_fire[best]) {
+                best = i;
+            }
+        }
+
+        if (best == ULTRASOUND_DEVICES) {
+            break;
+        }
+
+        fire |= (1 << best);
+        sched->t_fire[best] = now;
+    }
+
+    sched->pending |= fire;
+
+    return fire;
+}
+
+void ultrasound_sched_done(struct ultrasound_sched *sched, unsigned int id,
+                           uint32_t now)
+{
+    sched->pending &= ~(1 << id);
+    sched->settling |= (1 << id);
+    sched->t_done[id] = now;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -5,79 +5,87 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
 #include <assert.h>
-#include <limits.h>
+#include <rabbit_audio.h>
+#include <rabbit_vad.h>
 #include "voicerec.h"
 
-#define VOLUME_THRESHOLD  1000
-#define SILENT_THRESHOLD   200
-#define ACTIVE_THRESHOLD     1
-#define PUBLISH_THRESHOLD  500   // ms
+#define HANGOVER_MS        300
+#define PREROLL_MS         300
+#define PUBLISH_THRESHOLD  500   // ms of speech
 
-static unsigned int silent_count = 0;
-static unsigned int active_count = 0;
+static struct rabbit_vad *vad = NULL;
 
-static void get_frame_vol_minmax(const void *pcm, size_t size,
-                                 int16_t *min, int16_t *max)
+static void filter_init(void)
 {
-    unsigned int count;
-    const int16_t *sample;
-    int16_t lmin = SHRT_MAX, lmax = SHRT_MIN;
+    struct rabbit_vad_config config;
 
-    assert(pcm != NULL);
-    assert((size > 0) && (size % 2) == 0);
-    assert(min != NULL);
-    assert(max != NULL);
-
-    for (count = size / sizeof(int16_t), sample = (const int16_t *) pcm;
-         count > 0;
-         count--, sample++) {
-        if (*sample < lmin) {
-            lmin = *sample;
-        }
-        if (*sample > lmax) {
-            lmax = *sample;
-        }
+    rabbit_vad_defaults(&config);
+    config.rate = RABBIT_AUDIO_RATE;
+    config.hangover_ms = HANGOVER_MS;
+    config.preroll_ms = PREROLL_MS;
+    vad = rabbit_vad_new(&config);
+    if (vad == NULL) {
+        fprintf(stderr, "rabbit_vad_new failed!\n");
+        exit(EXIT_FAILURE);
     }
-
-    *min = lmin;
-    *max = lmax;
 }
 
-void filter_pcm_in(const void *pcm, size_t size)
+/*
+ * The flags are those of the block, see rabbit_audio_flags().
+ */
+void filter_pcm_in(const void *pcm, size_t size, uint32_t flags)
 {
-    static unsigned int capture = 0;
-    int16_t min, max;
-    unsigned int silent = 0;
+    int16_t preroll[RABBIT_AUDIO_RATE * PREROLL_MS / 1000];
+    unsigned int n;
+
+    assert(pcm != NULL);
+    assert((size > 0) && (size % 2) == 0);
 
-    get_frame_vol_minmax(pcm, size, &min, &max);
-    if ((max - min) < VOLUME_THRESHOLD) {
-        silent = 1;
+    if (vad == NULL) {
+        filter_init();
     }
 
-    if (silent) {
-        silent_count++;
-        active_count = 0;
+    if (flags & RABBIT_AUDIO_VAD_KNOWN) {
+        rabbit_vad_hint(vad, (flags & RABBIT_AUDIO_VAD) ? 1 : 0);
     } else {
-        active_count++;
-        silent_count = 0;
+        rabbit_vad_hint(vad, -1);
     }
 
-    if ((capture == 1) &&
-        (silent_count >= SILENT_THRESHOLD)) {
+    switch (rabbit_vad_process(vad, (const int16_t *) pcm,
+                               size / sizeof(int16_t))) {
+    case RABBIT_VAD_START:
+        n = rabbit_vad_preroll(vad, preroll,
+                               sizeof(preroll) / sizeof(int16_t));
+        if (n > 0) {
+            wav_pcm_in(preroll, n * sizeof(int16_t));
+        }
+        wav_pcm_in(pcm, size);
+        break;
+    case RABBIT_VAD_SPEECH:
+        wav_pcm_in(pcm, size);
+        break;
+    case RABBIT_VAD_END:
         wav_stop();
-        if (wav_time_elapsed_ms() > PUBLISH_THRESHOLD) {
+        if (rabbit_vad_utterance_ms(vad) > PUBLISH_THRESHOLD) {
             voicerec_wav_publish(wav_filename());
         }
-        capture = 0;
-    } else if (capture == 0) {
-        if (active_count >= ACTIVE_THRESHOLD) {
-            wav_pcm_in(pcm, size);
-            capture = 1;
-        }
-    } else if (capture == 1) {
-        wav_pcm_in(pcm, size);
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ * Capture was turned off or went away, finish what was heard.
+ */
+void filter_stop(void)
+{
+    wav_stop();
+    if (vad != NULL) {
+        rabbit_vad_reset(vad);
     }
 }
 
@@ -4,39 +4,26 @@
  * Copyright (C) 2023, Charles Chiou
  */
 
+#include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <signal.h>
 #include <mosquitto.h>
+#include <rabbit_audio.h>
 #include "voicerec.h"
 
 struct mosquitto *mosq = NULL;
 
 static void on_connect(struct mosquitto *mosq, void *obj, int reason_code)
 {
-    int ret = 0;
-
     (void)(obj);
 
     if (reason_code != 0) {
         printf("%s: %s\n", __func__, mosquitto_connack_string(reason_code));
         mosquitto_disconnect(mosq);
     }
-
-    ret = mosquitto_subscribe(mosq, NULL, "rabbit/voice/pcm", 0);
-    if (ret != MOSQ_ERR_SUCCESS) {
-        fprintf(stderr, "mosquitto_subscribe failed: %s\n",
-                mosquitto_strerror(ret));
-        mosquitto_disconnect(mosq);
-    }
-
-    ret = mosquitto_subscribe(mosq, NULL, "rabbit/voice/state", 0);
-    if (ret != MOSQ_ERR_SUCCESS) {
-        fprintf(stderr, "mosquitto_subscribe failed: %s\n",
-                mosquitto_strerror(ret));
-        mosquitto_disconnect(mosq);
-    }
 }
 
 static void on_publush(struct mosquitto *mosq, void *obj, int mid)
@@ -48,53 +35,6 @@ static void on_publush(struct mosquitto *mosq, void *obj, int mid)
     //printf("Mosquitto::onPublish: %d\n", mid);
 }
 
-static void on_subscribe(struct mosquitto *mosq, void *obj,
-                         int mid, int qos_count, const int *granted_qos)
-{
-	int i;
-	bool have_subscription = false;
-
-    (void)(mosq);
-    (void)(obj);
-    (void)(mid);
-
-	for (i = 0; i < qos_count; i++) {
-		printf("%s: %d: qos=%d\n", __func__, i, granted_qos[i]);
-		if (granted_qos[i] <= 2){
-			have_subscription = true;
-		}
-	}
-
-	if (have_subscription == false) {
-		fprintf(stderr, "%s: all rejected!\n", __func__);
-		mosquitto_disconnect(mosq);
-	}
-}
-
-static void on_message(struct mosquitto *mosq, void *obj,
-                       const struct mosquitto_message *msg)
-{
-    (void)(mosq);
-    (void)(obj);
-
-    if (strcmp(msg->topic, "rabbit/voice/pcm") == 0) {
-        filter_pcm_in(msg->payload, msg->payloadlen);
-    } else if (strcmp(msg->topic, "rabbit/voice/state") == 0) {
-        const char *str = (const char *) msg->payload;
-        if (str != NULL) {
-            if ((msg->payloadlen == 2) &&
-                (str[0] == 'o') && (str[1] == 'n')) {
-                /* No need to do anything */
-            } else if ((msg->payloadlen == 3) &&
-                       (str[0] == 'o') && (str[1] == 'f') && (str[2] == 'f')) {
-                wav_stop();
-            }
-        }
-    } else {
-        fprintf(stderr, "%s: off-topic: %s\n", __func__, msg->topic);
-    }
-}
-
 static void cleanup(void)
 {
     int ret;
@@ -136,9 +76,14 @@ static void sig_handler(int signal)
 int main(int argc, char **argv)
 {
     int ret;
+    struct rabbit_audio *audio;
+    const char *source = NULL;
+    int16_t pcm[RABBIT_AUDIO_BLOCK];
+    int enabled;
 
-    (void)(argc);
-    (void)(argv);
+    if (argc > 1) {
+        source = argv[1];    // Unix socket path or host[:port]
+    }
 
     atexit(cleanup);
     signal(SIGINT, sig_handler);
@@ -158,8 +103,6 @@ int main(int argc, char **argv)
 
     mosquitto_connect_callback_set(mosq, on_connect);
     mosquitto_publish_callback_set(mosq, on_publush);
-    mosquitto_subscribe_callback_set(mosq, on_subscribe);
-    mosquitto_message_callback_set(mosq, on_message);
 
     ret = mosquitto_connect(mosq, "rabbit", 1883, 60);
     if (ret != MOSQ_ERR_SUCCESS) {
@@ -168,10 +111,36 @@ int main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
-    for (;;) {
-        ret = mosquitto_loop_forever(mosq, -1, 1);
-        fprintf(stderr, "mosquitto_loop_forever: %s\n",
+    ret = mosquitto_loop_start(mosq);
+    if (ret != MOSQ_ERR_SUCCESS) {
+        fprintf(stderr, "mosquitto_loop_start failed: %s\n",
                 mosquitto_strerror(ret));
+        exit(EXIT_FAILURE);
+    }
+
+    /* The PCM comes through the controller's audio ring, not MQTT */
+    for (;;) {
+        audio = rabbit_audio_open(source);
+        if (audio == NULL) {
+            sleep(1);
+            continue;
+        }
+
+        enabled = 0;
+        while ((ret = rabbit_audio_read(audio, pcm, NULL, 100)) >= 0) {
+            if (ret > 0) {
+                filter_pcm_in(pcm, ret * sizeof(int16_t),
+                              rabbit_audio_flags(audio));
+            }
+
+            if (enabled && !rabbit_audio_enabled(audio)) {
+                filter_stop();
+            }
+            enabled = rabbit_audio_enabled(audio);
+        }
+
+        rabbit_audio_close(audio);
+        filter_stop();
     }
 
     return 0;
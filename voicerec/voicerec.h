@@ -15,7 +15,8 @@ extern void wav_pcm_in(const void *pcm, size_t size);
 extern void wav_stop(void);
 extern const char *wav_filename(void);
 extern unsigned int wav_time_elapsed_ms(void);
-extern void filter_pcm_in(const void *pcm, size_t size);
+extern void filter_pcm_in(const void *pcm, size_t size, uint32_t flags);
+extern void filter_stop(void);
 
 #endif
 
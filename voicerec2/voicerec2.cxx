@@ -8,150 +8,290 @@
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
-#include <limits.h>
-#include <assert.h>
+#include <time.h>
+#include <pthread.h>
+#include <string>
 #include <vector>
 #include <filesystem>
+#include <unistd.h>
 #include <whisper.h>
 #include <mosquitto.h>
+#include <rabbit_audio.h>
+#include <rabbit_vad.h>
 
 using namespace std;
 
 #define WHISPER_SAMPLE_RATE 16000
 #define MAIN_SAMPLE_SECONDS 30
 
+#define VAD_HANGOVER_MS  300
+#define VAD_PREROLL_MS   300
+
+/*
+ * While someone talks, the utterance so far is decoded again every
+ * STREAM_STEP_MS for a partial transcript. A window that grows past
+ * STREAM_WINDOW_MS is decoded one last time and its text committed; the
+ * next window starts STREAM_KEEP_MS before its end, with the committed
+ * tokens as the prompt. On the end of speech only the open window is
+ * left to decode.
+ */
+#define STREAM_STEP_MS        500
+#define STREAM_WINDOW_MS     8000
+#define STREAM_KEEP_MS        200
+#define STREAM_MIN_MS        1100    // whisper_full() ignores under 1 s
+#define STREAM_PROMPT_TOKENS   64
+
+#define ms_to_samples(ms) ((ms) * (WHISPER_SAMPLE_RATE / 1000))
+
+/*
+ * Filled in by the main thread, taken by the worker.
+ */
 struct audio_sample_main {
     float data[WHISPER_SAMPLE_RATE * MAIN_SAMPLE_SECONDS];
     unsigned int samples;
+    unsigned int base;                // Start of the open window
+    unsigned int decoded;             // Samples at the last partial
+    bool final;                       // The utterance ended
+    unsigned int end;                 // At this sample
+    uint64_t end_us;                  // When it did
 };
 
 static struct whisper_context *whisper = NULL;
+static struct whisper_state *wstate = NULL;
 static struct mosquitto *mosq = NULL;
 
 static struct audio_sample_main audio_sample_main = {
     .data = { 0, },
     .samples = 0,
+    .base = 0,
+    .decoded = 0,
+    .final = false,
+    .end = 0,
+    .end_us = 0,
 };
 
-#define VOLUME_THRESHOLD  1500
-#define SILENT_THRESHOLD   200
+static struct rabbit_vad *vad = NULL;
 
-static void get_frame_vol_minmax(const void *pcm, size_t size,
-                                 int16_t *min, int16_t *max)
-{
-    unsigned int count;
-    const int16_t *sample;
-    int16_t lmin = SHRT_MAX, lmax = SHRT_MIN;
-
-    assert(pcm != NULL);
-    assert((size > 0) && (size % 2) == 0);
-    assert(min != NULL);
-    assert(max != NULL);
-
-    for (count = size / sizeof(int16_t), sample = (const int16_t *) pcm;
-         count > 0;
-         count--, sample++) {
-        if (*sample < lmin) {
-            lmin = *sample;
-        }
-        if (*sample > lmax) {
-            lmax = *sample;
-        }
-    }
+/*
+ * What the worker made of the final transcripts, for --bench.
+ */
+struct bench_stats {
+    unsigned int utterances;
+    uint64_t heard_ms;                // Speech decoded
+    uint64_t spent_us;                // Decoding it, partials included
+    uint64_t latency_ms;              // Sum, from the end of speech
+    uint64_t max_latency_ms;
+};
 
-    *min = lmin;
-    *max = lmax;
-}
+static struct bench_stats bench_stats;
 
-static bool pcm_vad(const void *pcm, size_t size)
-{
-    bool vad = false;
-    static unsigned int silent_count = 0;
-    static unsigned int active_count = 0;
-    int16_t min, max;
-    bool silent = false;
+static bool running = false;
+static bool decoding = false;
+static pthread_t worker;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done = PTHREAD_COND_INITIALIZER;
 
-    get_frame_vol_minmax(pcm, size, &min, &max);
-    if ((max - min) < VOLUME_THRESHOLD) {
-        silent = true;
-    }
+static uint64_t now_us(void)
+{
+    struct timespec ts;
 
-    if (silent) {
-        silent_count++;
-        active_count = 0;
-    } else {
-        active_count++;
-        silent_count = 0;
-    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
 
-    if (silent_count >= SILENT_THRESHOLD) {
-        vad = false;
-    } else {
-        vad = true;
-    }
-
-    return vad;
+    return ((uint64_t) ts.tv_sec * 1000000ULL) + (ts.tv_nsec / 1000);
 }
 
-static void make_inference(void)
+/*
+ * Runs on the worker only, with its own whisper_state kept from call to
+ * call. The encoder is only given as much context as the audio needs,
+ * which is what makes short windows cheaper than a padded 30 s.
+ */
+static string make_inference(vector<float> &pcm, bool partial,
+                             vector<whisper_token> *prompt)
 {
-    int ret;
+    int ret, ctx;
+    string text;
     whisper_full_params wparams =
         whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
 
+    if (pcm.size() < ms_to_samples(STREAM_MIN_MS)) {
+        pcm.resize(ms_to_samples(STREAM_MIN_MS), 0.0);
+    }
+
+    /* 1500 encoder frames for 30 s, with a second to spare */
+    ctx = (int) (((pcm.size() + WHISPER_SAMPLE_RATE) * 1500) /
+                 (WHISPER_SAMPLE_RATE * 30));
+    ctx = ((ctx + 63) / 64) * 64;
+    ctx = ctx > 1500 ? 1500 : ctx;
+
     wparams.print_progress   = false;
     wparams.print_special    = false;
     wparams.print_realtime   = false;
     wparams.print_timestamps = false;
     wparams.translate        = false;
-    wparams.single_segment   = false;
-    wparams.max_tokens       = 32;
+    wparams.no_context       = true;
+    wparams.single_segment   = partial;
+    wparams.max_tokens       = partial ? 32 : 0;
     wparams.language         = "en";
     wparams.n_threads        = 4;
-    wparams.audio_ctx        = 0;
+    wparams.audio_ctx        = ctx;
     wparams.speed_up         = false;
+    if (prompt && !prompt->empty()) {
+        wparams.prompt_tokens = prompt->data();
+        wparams.prompt_n_tokens = (int) prompt->size();
+    }
 
-    printf("make inference with %u samples\n", audio_sample_main.samples);
-
-    ret = whisper_full(whisper, wparams,
-                       audio_sample_main.data,
-                       audio_sample_main.samples);
+    ret = whisper_full_with_state(whisper, wstate, wparams,
+                                  pcm.data(), (int) pcm.size());
     if (ret != 0) {
         fprintf(stderr, "failed to process audio (%d)!\n", ret);
+        return text;
     }
 
-    const int n_segments = whisper_full_n_segments(whisper);
+    const int n_segments = whisper_full_n_segments_from_state(wstate);
     for (int i = 0; i < n_segments; ++i) {
-        const char *text = whisper_full_get_segment_text(whisper, i);
-
-        printf("%s", text);
-        fflush(stdout);
+        text += whisper_full_get_segment_text_from_state(wstate, i);
     }
-    printf("\n");
+
+    return text;
 }
 
-static void on_connect(struct mosquitto *mosq, void *obj, int reason_code)
+/*
+ * The tokens of what was committed, to carry on from in the next window.
+ */
+static void keep_prompt(vector<whisper_token> &prompt)
 {
-    int ret = 0;
+    whisper_token id;
 
-    (void)(obj);
+    const int n_segments = whisper_full_n_segments_from_state(wstate);
+    for (int i = 0; i < n_segments; ++i) {
+        const int n_tokens = whisper_full_n_tokens_from_state(wstate, i);
+        for (int j = 0; j < n_tokens; j++) {
+            id = whisper_full_get_token_id_from_state(wstate, i, j);
+            if (id < whisper_token_eot(whisper)) {
+                prompt.push_back(id);
+            }
+        }
+    }
 
-    if (reason_code != 0) {
-        printf("%s: %s\n", __func__, mosquitto_connack_string(reason_code));
-        mosquitto_disconnect(mosq);
+    if (prompt.size() > STREAM_PROMPT_TOKENS) {
+        prompt.erase(prompt.begin(), prompt.end() - STREAM_PROMPT_TOKENS);
     }
+}
 
-    ret = mosquitto_subscribe(mosq, NULL, "rabbit/voice/pcm", 0);
-    if (ret != MOSQ_ERR_SUCCESS) {
-        fprintf(stderr, "mosquitto_subscribe failed: %s\n",
-                mosquitto_strerror(ret));
-        mosquitto_disconnect(mosq);
+static void publish_text(const char *topic, const string &text, int qos)
+{
+    size_t skip = text.find_first_not_of(' ');
+    int ret;
+
+    if ((mosq == NULL) || (skip == string::npos)) {
+        return;
     }
 
-    ret = mosquitto_subscribe(mosq, NULL, "rabbit/voice/state", 0);
+    ret = mosquitto_publish(mosq, NULL, topic, (int) (text.length() - skip),
+                            text.c_str() + skip, qos, false);
     if (ret != MOSQ_ERR_SUCCESS) {
-        fprintf(stderr, "mosquitto_subscribe failed: %s\n",
+        fprintf(stderr, "mosquitto_publish failed: %s\n",
                 mosquitto_strerror(ret));
+    }
+}
+
+static void *worker_func(void *args)
+{
+    vector<float> pcm;
+    vector<whisper_token> prompt;
+    string committed, text;
+    bool final, commit;
+    unsigned int first, last;
+    uint64_t end_us = 0, t, spent = 0, heard = 0, latency;
+
+    (void)(args);
+
+    pthread_mutex_lock(&mutex);
+    while (running) {
+        if (!audio_sample_main.final &&
+            (audio_sample_main.samples <
+             audio_sample_main.decoded + ms_to_samples(STREAM_STEP_MS))) {
+            pthread_cond_wait(&cond, &mutex);
+            continue;
+        }
+
+        /* Take the newest window, older partials are of no use */
+        final = audio_sample_main.final;
+        first = audio_sample_main.base;
+        last = final ? audio_sample_main.end : audio_sample_main.samples;
+        commit = !final && (last - first > ms_to_samples(STREAM_WINDOW_MS));
+        if (commit) {
+            last = first + ms_to_samples(STREAM_WINDOW_MS);
+            audio_sample_main.base = last - ms_to_samples(STREAM_KEEP_MS);
+        }
+        pcm.assign(&audio_sample_main.data[first],
+                   &audio_sample_main.data[last]);
+        audio_sample_main.decoded = audio_sample_main.samples;
+        if (final) {
+            /* Whatever came after is the next utterance */
+            heard = (uint64_t) last * 1000 / WHISPER_SAMPLE_RATE;
+            end_us = audio_sample_main.end_us;
+            memmove(audio_sample_main.data, &audio_sample_main.data[last],
+                    (audio_sample_main.samples - last) * sizeof(float));
+            audio_sample_main.samples -= last;
+            audio_sample_main.base = 0;
+            audio_sample_main.decoded = 0;
+            audio_sample_main.final = false;
+        }
+        decoding = true;
+        pthread_mutex_unlock(&mutex);
+
+        t = now_us();
+        text = make_inference(pcm, !final && !commit, &prompt);
+        t = now_us() - t;
+        spent += t;
+
+        if (commit) {
+            committed += text;
+            keep_prompt(prompt);
+            publish_text("rabbit/voice/partial", committed, 0);
+        } else if (!final) {
+            publish_text("rabbit/voice/partial", committed + text, 0);
+        } else {
+            text = committed + text;
+            publish_text("rabbit/voice/transcribed", text, 1);
+            latency = VAD_HANGOVER_MS + (now_us() - end_us) / 1000;
+            printf("%s\n", text.c_str());
+            printf("%llu ms heard, %llu ms decoding (RTF %.2f), "
+                   "%llu ms after the end of speech\n",
+                   (unsigned long long) heard,
+                   (unsigned long long) spent / 1000,
+                   heard ? (double) spent / 1000.0 / heard : 0.0,
+                   (unsigned long long) latency);
+            fflush(stdout);
+            bench_stats.utterances++;
+            bench_stats.heard_ms += heard;
+            bench_stats.spent_us += spent;
+            bench_stats.latency_ms += latency;
+            if (latency > bench_stats.max_latency_ms) {
+                bench_stats.max_latency_ms = latency;
+            }
+            committed.clear();
+            prompt.clear();
+            spent = 0;
+        }
+
+        pthread_mutex_lock(&mutex);
+        decoding = false;
+        pthread_cond_broadcast(&done);
+    }
+    pthread_mutex_unlock(&mutex);
+
+    return NULL;
+}
+
+static void on_connect(struct mosquitto *mosq, void *obj, int reason_code)
+{
+    (void)(obj);
+
+    if (reason_code != 0) {
+        printf("%s: %s\n", __func__, mosquitto_connack_string(reason_code));
         mosquitto_disconnect(mosq);
     }
 }
@@ -165,94 +305,274 @@ static void on_publush(struct mosquitto *mosq, void *obj, int mid)
     //printf("Mosquitto::onPublish: %d\n", mid);
 }
 
-static void on_subscribe(struct mosquitto *mosq, void *obj,
-                         int mid, int qos_count, const int *granted_qos)
+static void pcm_append(const int16_t *pcm, unsigned int new_samples)
 {
-	int i;
-	bool have_subscription = false;
+    unsigned int i;
 
-    (void)(mosq);
-    (void)(obj);
-    (void)(mid);
+    pthread_mutex_lock(&mutex);
+
+    /* Make room by dropping what the worker has committed */
+    if ((audio_sample_main.samples + new_samples) >
+        (WHISPER_SAMPLE_RATE * MAIN_SAMPLE_SECONDS)) {
+        memmove(audio_sample_main.data,
+                &audio_sample_main.data[audio_sample_main.base],
+                (audio_sample_main.samples - audio_sample_main.base) *
+                sizeof(float));
+        audio_sample_main.samples -= audio_sample_main.base;
+        audio_sample_main.decoded -= audio_sample_main.decoded >
+            audio_sample_main.base ? audio_sample_main.base :
+            audio_sample_main.decoded;
+        if (audio_sample_main.final) {
+            audio_sample_main.end -= audio_sample_main.base;
+        }
+        audio_sample_main.base = 0;
+    }
+
+    if ((audio_sample_main.samples + new_samples) <=
+        (WHISPER_SAMPLE_RATE * MAIN_SAMPLE_SECONDS)) {
+        /* Convert from S16_LE to F32 */
+        for (i = 0; i < new_samples; i++) {
+            audio_sample_main.data[audio_sample_main.samples] =
+                ((float) pcm[i]) / 32768.0;
+            audio_sample_main.samples++;
+        }
+        pthread_cond_signal(&cond);
+    }
 
-	for (i = 0; i < qos_count; i++) {
-		printf("%s: %d: qos=%d\n", __func__, i, granted_qos[i]);
-		if (granted_qos[i] <= 2){
-			have_subscription = true;
-		}
-	}
-
-	if (have_subscription == false) {
-		fprintf(stderr, "%s: all rejected!\n", __func__);
-		mosquitto_disconnect(mosq);
-	}
+    pthread_mutex_unlock(&mutex);
 }
 
-static void on_message(struct mosquitto *mosq, void *obj,
-                       const struct mosquitto_message *msg)
+/*
+ * Hand what was heard over to the worker for the final transcript. If the
+ * worker has yet to take the last one, the two go out as one.
+ */
+static void pcm_end(void)
 {
-    (void)(mosq);
-    (void)(obj);
+    pthread_mutex_lock(&mutex);
+    if (audio_sample_main.samples > 0) {
+        audio_sample_main.final = true;
+        audio_sample_main.end = audio_sample_main.samples;
+        audio_sample_main.end_us = now_us();
+        pthread_cond_signal(&cond);
+    }
+    pthread_mutex_unlock(&mutex);
+}
 
-    if (strcmp(msg->topic, "rabbit/voice/pcm") == 0) {
-        unsigned int new_samples;
-        bool vad;
-
-        vad = pcm_vad(msg->payload, msg->payloadlen);
-        if (vad) {
-            new_samples = msg->payloadlen / sizeof(int16_t);
-            if ((audio_sample_main.samples + new_samples) <=
-                (WHISPER_SAMPLE_RATE * MAIN_SAMPLE_SECONDS)) {
-                unsigned int i;
-                const int16_t *pcm_s16_le = (const int16_t *) msg->payload;
-                float v;
-
-                /* Convert from S16_LE to F32 */
-                for (i = 0; i < new_samples; i++) {
-                    v = ((float) *pcm_s16_le) / 32768.0;
-                    audio_sample_main.data[audio_sample_main.samples] = v;
-                    audio_sample_main.samples++;
-                    pcm_s16_le++;
-                }
-            }
+static void pcm_in(const int16_t *pcm, unsigned int new_samples,
+                   uint32_t flags)
+{
+    int16_t preroll[WHISPER_SAMPLE_RATE * VAD_PREROLL_MS / 1000];
+    unsigned int n;
+
+    if (flags & RABBIT_AUDIO_VAD_KNOWN) {
+        rabbit_vad_hint(vad, (flags & RABBIT_AUDIO_VAD) ? 1 : 0);
+    } else {
+        rabbit_vad_hint(vad, -1);
+    }
+
+    switch (rabbit_vad_process(vad, pcm, new_samples)) {
+    case RABBIT_VAD_START:
+        n = rabbit_vad_preroll(vad, preroll,
+                               sizeof(preroll) / sizeof(int16_t));
+        pcm_append(preroll, n);
+        pcm_append(pcm, new_samples);
+        break;
+    case RABBIT_VAD_SPEECH:
+        pcm_append(pcm, new_samples);
+        break;
+    case RABBIT_VAD_END:
+        pcm_end();
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ * Capture was turned off or went away, finish what was heard.
+ */
+static void pcm_stop(void)
+{
+    pcm_end();
+    rabbit_vad_reset(vad);
+}
 
-            if (audio_sample_main.samples >=
-                (WHISPER_SAMPLE_RATE * MAIN_SAMPLE_SECONDS)) {
-                make_inference();
-                audio_sample_main.samples = 0;
+/*
+ * Open a WAV file, which must be 16 kHz mono S16_LE, at its samples.
+ */
+static FILE *wav_open(const char *path, uint32_t *bytes)
+{
+    FILE *fp;
+    struct {
+        char riff[4];
+        uint32_t size;
+        char wave[4];
+    } __attribute__((packed)) riff;
+    struct {
+        char id[4];
+        uint32_t size;
+    } __attribute__((packed)) chunk;
+    struct {
+        uint16_t type;
+        uint16_t chans;
+        uint32_t rate;
+        uint32_t byteRate;
+        uint16_t align;
+        uint16_t bits;
+    } __attribute__((packed)) fmt;
+    bool haveFmt = false;
+
+    fp = fopen(path, "rb");
+    if (fp == NULL) {
+        perror(path);
+        return NULL;
+    }
+
+    if ((fread(&riff, sizeof(riff), 1, fp) != 1) ||
+        (memcmp(riff.riff, "RIFF", 4) != 0) ||
+        (memcmp(riff.wave, "WAVE", 4) != 0)) {
+        goto bad;
+    }
+
+    while (fread(&chunk, sizeof(chunk), 1, fp) == 1) {
+        if (memcmp(chunk.id, "fmt ", 4) == 0) {
+            if ((chunk.size < sizeof(fmt)) ||
+                (fread(&fmt, sizeof(fmt), 1, fp) != 1)) {
+                goto bad;
             }
-        } else {
-            if (audio_sample_main.samples > 0) {
-                make_inference();
-                audio_sample_main.samples = 0;
+            fseek(fp, chunk.size - sizeof(fmt) + (chunk.size & 1),
+                  SEEK_CUR);
+            haveFmt = true;
+        } else if (memcmp(chunk.id, "data", 4) == 0) {
+            if (!haveFmt ||
+                (fmt.type != 1) ||
+                (fmt.chans != 1) ||
+                (fmt.rate != WHISPER_SAMPLE_RATE) ||
+                (fmt.bits != 16)) {
+                fprintf(stderr, "%s is not 16 kHz mono S16_LE\n", path);
+                fclose(fp);
+                return NULL;
             }
+            *bytes = chunk.size;
+            return fp;
+        } else {
+            fseek(fp, chunk.size + (chunk.size & 1), SEEK_CUR);
         }
-    } else if (strcmp(msg->topic, "rabbit/voice/state") == 0) {
-        const char *str = (const char *) msg->payload;
-        if (str != NULL) {
-            if ((msg->payloadlen == 2) &&
-                (str[0] == 'o') && (str[1] == 'n')) {
-                /* No need to do anything */
-            } else if ((msg->payloadlen == 3) &&
-                       (str[0] == 'o') && (str[1] == 'f') && (str[2] == 'f')) {
-                make_inference();
-                audio_sample_main.samples = 0;
+    }
+
+bad:
+
+    fprintf(stderr, "%s is not a WAV file\n", path);
+    fclose(fp);
+
+    return NULL;
+}
+
+/*
+ * Play a WAV file in real time as if it came from the audio ring, then
+ * wait for the worker to be done with it. Returns false if it could not
+ * be read.
+ */
+static bool bench_file(const char *path)
+{
+    int16_t pcm[RABBIT_AUDIO_BLOCK];
+    struct timespec ts;
+    struct bench_stats stats;
+    uint32_t bytes;
+    uint64_t next;
+    unsigned int blocks;
+    size_t n;
+    FILE *fp;
+
+    fp = wav_open(path, &bytes);
+    if (fp == NULL) {
+        return false;
+    }
+
+    pthread_mutex_lock(&mutex);
+    memset(&bench_stats, 0, sizeof(bench_stats));
+    pthread_mutex_unlock(&mutex);
+
+    /* The file, then enough silence for the VAD to hear it end */
+    blocks = (bytes / sizeof(int16_t) + RABBIT_AUDIO_BLOCK - 1) /
+        RABBIT_AUDIO_BLOCK +
+        ms_to_samples(VAD_HANGOVER_MS * 2) / RABBIT_AUDIO_BLOCK;
+    next = now_us();
+    while (blocks-- > 0) {
+        n = 0;
+        if (bytes >= sizeof(int16_t)) {
+            n = fread(pcm, sizeof(int16_t),
+                      bytes / sizeof(int16_t) < RABBIT_AUDIO_BLOCK ?
+                      bytes / sizeof(int16_t) : RABBIT_AUDIO_BLOCK, fp);
+            bytes -= n * sizeof(int16_t);
+            if (n == 0) {
+                bytes = 0;
             }
         }
+        memset(pcm + n, 0, (RABBIT_AUDIO_BLOCK - n) * sizeof(int16_t));
+
+        next += RABBIT_AUDIO_BLOCK * 1000000ULL / WHISPER_SAMPLE_RATE;
+        ts.tv_sec = next / 1000000;
+        ts.tv_nsec = (next % 1000000) * 1000;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+        pcm_in(pcm, RABBIT_AUDIO_BLOCK, 0);
+    }
+    fclose(fp);
+
+    pcm_stop();
+
+    pthread_mutex_lock(&mutex);
+    while (audio_sample_main.final || decoding) {
+        pthread_cond_wait(&done, &mutex);
+    }
+    stats = bench_stats;
+    pthread_mutex_unlock(&mutex);
+
+    if (stats.utterances == 0) {
+        printf("%s: no speech heard\n", path);
     } else {
-        fprintf(stderr, "%s: off-topic: %s\n", __func__, msg->topic);
+        printf("%s: %u utterances, %llu ms heard, %llu ms decoding "
+               "(RTF %.2f), end of speech latency %llu ms avg, "
+               "%llu ms max\n",
+               path, stats.utterances,
+               (unsigned long long) stats.heard_ms,
+               (unsigned long long) stats.spent_us / 1000,
+               stats.heard_ms ?
+               (double) stats.spent_us / 1000.0 / stats.heard_ms : 0.0,
+               (unsigned long long) stats.latency_ms / stats.utterances,
+               (unsigned long long) stats.max_latency_ms);
     }
+    fflush(stdout);
+
+    return true;
 }
 
 static void cleanup(void)
 {
     int ret;
 
+    if (running) {
+        pthread_mutex_lock(&mutex);
+        running = false;
+        pthread_cond_signal(&cond);
+        pthread_mutex_unlock(&mutex);
+        pthread_join(worker, NULL);
+    }
+
+    if (wstate) {
+        whisper_free_state(wstate);
+        wstate = NULL;
+    }
+
     if (whisper) {
         whisper_free(whisper);
         whisper = NULL;
     }
 
+    rabbit_vad_free(vad);
+    vad = NULL;
+
     if (mosq) {
         ret = mosquitto_disconnect(mosq);
         if (ret != MOSQ_ERR_SUCCESS) {
@@ -297,9 +617,21 @@ int main(int argc, char **argv)
 {
     int ret;
     unsigned int i;
-
-    (void)(argc);
-    (void)(argv);
+    struct rabbit_audio *audio;
+    const char *source = NULL;
+    int16_t pcm[RABBIT_AUDIO_BLOCK];
+    bool enabled, bench = false;
+    struct rabbit_vad_config config;
+
+    if ((argc > 1) && (strcmp(argv[1], "--bench") == 0)) {
+        if (argc < 3) {
+            fprintf(stderr, "Usage: %s --bench FILE...\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        bench = true;        // WAV files in place of the audio ring
+    } else if (argc > 1) {
+        source = argv[1];    // Unix socket path or host[:port]
+    }
 
     atexit(cleanup);
     signal(SIGINT, sig_handler);
@@ -316,6 +648,41 @@ int main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
+    wstate = whisper_init_state(whisper);
+    if (wstate == NULL) {
+        fprintf(stderr, "whisper_init_state failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    rabbit_vad_defaults(&config);
+    config.rate = WHISPER_SAMPLE_RATE;
+    config.hangover_ms = VAD_HANGOVER_MS;
+    config.preroll_ms = VAD_PREROLL_MS;
+    vad = rabbit_vad_new(&config);
+    if (vad == NULL) {
+        fprintf(stderr, "rabbit_vad_new failed!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    running = true;
+    ret = pthread_create(&worker, NULL, worker_func, NULL);
+    if (ret != 0) {
+        running = false;
+        fprintf(stderr, "pthread_create failed (%d)!\n", ret);
+        exit(EXIT_FAILURE);
+    }
+    pthread_setname_np(worker, "R'Whisper");
+
+    if (bench) {
+        ret = EXIT_SUCCESS;
+        for (i = 2; i < (unsigned int) argc; i++) {
+            if (!bench_file(argv[i])) {
+                ret = EXIT_FAILURE;
+            }
+        }
+        exit(ret);
+    }
+
     ret = mosquitto_lib_init();
     if (ret != MOSQ_ERR_SUCCESS) {
         fprintf(stderr, "mosquitto_lib_init failed (%d)!\n", ret);
@@ -331,8 +698,6 @@ int main(int argc, char **argv)
 
     mosquitto_connect_callback_set(mosq, on_connect);
     mosquitto_publish_callback_set(mosq, on_publush);
-    mosquitto_subscribe_callback_set(mosq, on_subscribe);
-    mosquitto_message_callback_set(mosq, on_message);
 
     ret = mosquitto_connect(mosq, "rabbit", 1883, 60);
     if (ret != MOSQ_ERR_SUCCESS) {
@@ -341,10 +706,35 @@ int main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
-    for (;;) {
-        ret = mosquitto_loop_forever(mosq, -1, 1);
-        fprintf(stderr, "mosquitto_loop_forever: %s\n",
+    ret = mosquitto_loop_start(mosq);
+    if (ret != MOSQ_ERR_SUCCESS) {
+        fprintf(stderr, "mosquitto_loop_start failed: %s\n",
                 mosquitto_strerror(ret));
+        exit(EXIT_FAILURE);
+    }
+
+    /* The PCM comes through the controller's audio ring, not MQTT */
+    for (;;) {
+        audio = rabbit_audio_open(source);
+        if (audio == NULL) {
+            sleep(1);
+            continue;
+        }
+
+        enabled = false;
+        while ((ret = rabbit_audio_read(audio, pcm, NULL, 100)) >= 0) {
+            if (ret > 0) {
+                pcm_in(pcm, ret, rabbit_audio_flags(audio));
+            }
+
+            if (enabled && !rabbit_audio_enabled(audio)) {
+                pcm_stop();
+            }
+            enabled = rabbit_audio_enabled(audio);
+        }
+
+        rabbit_audio_close(audio);
+        pcm_stop();
     }
 
     return 0;